@@ -0,0 +1,419 @@
+/**
+ * @brief
+ * @file Convolver.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 10, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef CONVOLVER_H_
+#define CONVOLVER_H_
+
+// General files
+#include <cmath>
+
+#include <ThreadPool.h>
+
+/**
+ * Separable convolution with the kernel sizes known at compile time. The loops over the
+ * kernel are unrolled by the Unroll templates below, and the border is handled by copying
+ * every input row into a padded row with replicated edge pixels (and by replicating row
+ * pointers at the top and bottom), so there is only one loop shape per pass.
+ *
+ * The coefficients are compile-time constants as well, so they are folded into the unrolled
+ * code. A kernel type has a "size" and a constexpr function "at", such as the filters used
+ * by the Harris detector below. The image is processed in bands of rows, which can be spread
+ * over the threads of a ThreadPool.
+ *
+ * Convention, as in convolve.h: out[j] = sum_k kernel[k] * in[j + size/2 - k].
+ */
+
+// Number of rows in a band processed by one task
+#define CONVOLVER_BAND_ROWS		64
+
+/* **************************************************************************************
+ * Kernels with compile-time coefficients
+ * **************************************************************************************/
+
+//! Gaussian window with sigma = 1.5
+struct GaussianKernel7 {
+	static const int size = 7;
+	static constexpr float at(int k) {
+		return (k == 3) ? 0.270682f : (k == 2 || k == 4) ? 0.216745f :
+				(k == 1 || k == 5) ? 0.111281f : 0.036633f;
+	}
+};
+
+//! Binomial kernel [1 4 6 4 1]/16
+struct BinomialKernel5 {
+	static const int size = 5;
+	static constexpr float at(int k) {
+		return (k == 2) ? 0.375f : (k == 1 || k == 3) ? 0.25f : 0.0625f;
+	}
+};
+
+//! 7-tap smoothing kernel that goes with the derivative kernels, see derivative7.m by Peter Kovesi
+struct SmoothKernel7 {
+	static const int size = 7;
+	static constexpr float at(int k) {
+		return (k == 3) ? 0.361117f : (k == 2 || k == 4) ? 0.245410f :
+				(k == 1 || k == 5) ? 0.069321f : 0.004711f;
+	}
+};
+
+//! 7-tap first derivative kernel
+struct DerivativeKernel7 {
+	static const int size = 7;
+	static constexpr float at(int k) {
+		return (k == 3) ? 0.0f : half(k < 3 ? k : 6 - k) * (k < 3 ? 1.0f : -1.0f);
+	}
+	static constexpr float half(int k) {
+		return (k == 2) ? 0.193091f : (k == 1) ? 0.125376f : 0.018708f;
+	}
+};
+
+//! 5-tap smoothing kernel, see derivative5.m by Peter Kovesi
+struct SmoothKernel5 {
+	static const int size = 5;
+	static constexpr float at(int k) {
+		return (k == 2) ? 0.439911f : (k == 1 || k == 3) ? 0.249724f : 0.030320f;
+	}
+};
+
+//! 5-tap first derivative kernel
+struct DerivativeKernel5 {
+	static const int size = 5;
+	static constexpr float at(int k) {
+		return (k == 2) ? 0.0f : half(k < 2 ? k : 4 - k) * (k < 2 ? 1.0f : -1.0f);
+	}
+	static constexpr float half(int k) {
+		return (k == 1) ? 0.292315f : 0.104550f;
+	}
+};
+
+/* **************************************************************************************
+ * Unrolled inner loops
+ * **************************************************************************************/
+
+/**
+ * Unroll<N>::dot(in, kernel) returns sum_{k<N} kernel.at(k) * in[N-1-k], the recursion
+ * is resolved by the compiler so no loop remains.
+ */
+template<int N>
+struct Unroll {
+	template<typename K>
+	static inline float dot(const float *in, const K &kernel, int size) {
+		return Unroll<N-1>::dot(in, kernel, size) + kernel.at(N-1) * in[size-N];
+	}
+	template<typename K>
+	static inline float column(const float * const *rows, int j, const K &kernel) {
+		return Unroll<N-1>::column(rows, j, kernel) + kernel.at(N-1) * rows[N-1][j];
+	}
+};
+
+template<>
+struct Unroll<0> {
+	template<typename K>
+	static inline float dot(const float *, const K &, int) { return 0; }
+	template<typename K>
+	static inline float column(const float * const *, int, const K &) { return 0; }
+};
+
+//! Store as float, or as unsigned char like convolve2DSeparable (absolute value, clipped)
+inline void storePixel(float value, float &out) {
+	out = value;
+}
+
+inline void storePixel(float value, unsigned char &out) {
+	value = (float)fabs(value) + 0.5f;
+	out = (value > 255.0f) ? 255 : (unsigned char)value;
+}
+
+/**
+ * Copy a row into "padded" with "border" replicated pixels at both sides.
+ */
+template<typename TIn>
+inline void padRow(const TIn *in, float *padded, int width, int border) {
+	for (int j = 0; j < border; ++j) {
+		padded[j] = in[0];
+		padded[border + width + j] = in[width-1];
+	}
+	for (int j = 0; j < width; ++j) {
+		padded[border + j] = in[j];
+	}
+}
+
+template<typename K>
+inline void filterRow(const float *padded, float *out, int width, const K &kernel) {
+	for (int j = 0; j < width; ++j) {
+		out[j] = Unroll<K::size>::dot(padded + j, kernel, K::size);
+	}
+}
+
+template<typename K, typename TOut>
+inline void filterColumns(const float * const *rows, TOut *out, int width, const K &kernel) {
+	for (int j = 0; j < width; ++j) {
+		storePixel(Unroll<K::size>::column(rows, j, kernel), out[j]);
+	}
+}
+
+/**
+ * Collect the rows of the ring buffer for output row i, replicating the first and last
+ * row, and filter the input rows that are needed for that first.
+ */
+template<int KY>
+struct RowRing {
+	float *ring;
+	int width, height, next;
+	const float *rows[KY];
+
+	RowRing(float *ring, int width, int height, int y0): ring(ring), width(width),
+			height(height) {
+		next = y0 - KY/2;
+		if (next < 0) next = 0;
+	}
+
+	//! Next input row that has to be filtered into the returned slot, or -1
+	inline int advance(int i, float *&slot) {
+		int last = i + KY/2;
+		if (last >= height) last = height - 1;
+		if (next > last) return -1;
+		slot = ring + (next % KY) * width;
+		return next++;
+	}
+
+	inline void collect(int i) {
+		for (int k = 0; k < KY; ++k) {
+			int r = i + KY/2 - k;
+			if (r < 0) r = 0;
+			if (r >= height) r = height - 1;
+			rows[k] = ring + (r % KY) * width;
+		}
+	}
+};
+
+/**
+ * Scratch memory of the bands, kept by a convolver between calls and only allocated again
+ * when an image or the number of threads needs more. A convolver can therefore not be used
+ * from two threads at the same time.
+ */
+class BandScratch {
+public:
+	BandScratch(): data(NULL), size(0) {}
+
+	~BandScratch() { delete [] data; }
+
+	inline float *Reserve(int size) {
+		if (size > this->size) {
+			delete [] data;
+			data = new float[size];
+			this->size = size;
+		}
+		return data;
+	}
+private:
+	BandScratch(const BandScratch &);
+
+	BandScratch & operator=(const BandScratch &);
+
+	float *data;
+
+	int size;
+};
+
+/**
+ * Run band(task, thread, job) for every band of CONVOLVER_BAND_ROWS rows, on the threads of
+ * the pool if there is one. Every thread gets scratchSize floats at job.scratch.
+ */
+template<typename J>
+inline void runBands(J &job, int height, int scratchSize, BandScratch &scratch, ThreadPool *pool,
+		ThreadPoolJob band) {
+	int threads = pool ? pool->GetThreadCount() : 1;
+	job.scratchSize = scratchSize;
+	job.scratch = scratch.Reserve(threads * scratchSize);
+	int bands = (height + CONVOLVER_BAND_ROWS - 1) / CONVOLVER_BAND_ROWS;
+	if (pool) {
+		pool->ParallelFor(bands, band, &job);
+	} else {
+		for (int b = 0; b < bands; ++b) band(b, 0, &job);
+	}
+}
+
+/* **************************************************************************************
+ * Interface of ConvolverBase
+ * **************************************************************************************/
+
+/**
+ * The convolution itself, parameterized by the kernel types. Use FixedConvolver instead.
+ */
+template<typename KX, typename KY, typename T>
+class ConvolverBase {
+public:
+	ConvolverBase(const KX &kernelX, const KY &kernelY): kernelX(kernelX), kernelY(kernelY) {}
+
+	/**
+	 * Convolve "in" into "out", both width x height. The output can not be the same as the
+	 * input. With a thread pool the bands of rows are processed in parallel.
+	 */
+	template<typename TIn>
+	bool Convolve(const TIn *in, T *out, int width, int height, ThreadPool *pool = NULL) {
+		if (!in || !out || width <= 0 || height <= 0) return false;
+		if ((const void*)in == (const void*)out) return false;
+		Job<TIn> job;
+		job.self = this;
+		job.in = in;
+		job.out = out;
+		job.width = width;
+		job.height = height;
+		runBands(job, height, (width + KX::size) + KY::size * width, scratch, pool,
+				&ConvolverBase::band<TIn>);
+		return true;
+	}
+protected:
+	template<typename TIn>
+	struct Job {
+		ConvolverBase *self;
+		const TIn *in;
+		T *out;
+		int width, height;
+		float *scratch;
+		int scratchSize;
+	};
+
+	template<typename TIn>
+	static void band(int task, int thread, void *arg) {
+		const Job<TIn> &job = *(const Job<TIn>*)arg;
+		const KX &kernelX = job.self->kernelX;
+		const KY &kernelY = job.self->kernelY;
+		int width = job.width;
+		int y0 = task * CONVOLVER_BAND_ROWS;
+		int y1 = y0 + CONVOLVER_BAND_ROWS;
+		if (y1 > job.height) y1 = job.height;
+
+		float *padded = job.scratch + thread * job.scratchSize;
+		RowRing<KY::size> ring(padded + width + KX::size, width, job.height, y0);
+		const int border = KX::size / 2;
+		for (int i = y0; i < y1; ++i) {
+			float *slot = NULL;
+			int r;
+			while ((r = ring.advance(i, slot)) >= 0) {
+				padRow(job.in + r * width, padded, width, border);
+				filterRow(padded, slot, width, kernelX);
+			}
+			ring.collect(i);
+			filterColumns(ring.rows, job.out + i * width, width, kernelY);
+		}
+	}
+
+	KX kernelX;
+	KY kernelY;
+
+	BandScratch scratch;
+};
+
+/* **************************************************************************************
+ * Interface of FixedConvolver
+ * **************************************************************************************/
+
+/**
+ * Kernel sizes and coefficients at compile time, e.g. FixedConvolver<GaussianKernel7,
+ * GaussianKernel7> for Gaussian smoothing.
+ */
+template<typename KX, typename KY, typename T = float>
+class FixedConvolver: public ConvolverBase<KX, KY, T> {
+public:
+	FixedConvolver(): ConvolverBase<KX, KY, T>(KX(), KY()) {}
+};
+
+/* **************************************************************************************
+ * Interface of FixedGradients
+ * **************************************************************************************/
+
+/**
+ * The first derivatives gx = S (vertical) * D (horizontal) and gy = D (vertical) * S
+ * (horizontal) in one pass, with the smoothing kernel S and derivative kernel D known at
+ * compile time. Every input row is filtered horizontally once with both kernels.
+ */
+template<typename S, typename D>
+class FixedGradients {
+public:
+	template<typename TIn>
+	bool Gradients(const TIn *in, float *gx, float *gy, int width, int height,
+			ThreadPool *pool = NULL) {
+		if (!in || !gx || !gy || width <= 0 || height <= 0) return false;
+		Job<TIn> job;
+		job.in = in;
+		job.gx = gx;
+		job.gy = gy;
+		job.width = width;
+		job.height = height;
+		runBands(job, height, (width + S::size) + 2 * S::size * width, scratch, pool,
+				&FixedGradients::band<TIn>);
+		return true;
+	}
+protected:
+	template<typename TIn>
+	struct Job {
+		const TIn *in;
+		float *gx, *gy;
+		int width, height;
+		float *scratch;
+		int scratchSize;
+	};
+
+	template<typename TIn>
+	static void band(int task, int thread, void *arg) {
+		// both kernels need the same number of rows
+		typedef char sizes_must_match[(S::size == D::size) ? 1 : -1];
+		(void)sizeof(sizes_must_match);
+
+		const Job<TIn> &job = *(const Job<TIn>*)arg;
+		S smooth;
+		D derivative;
+		int width = job.width;
+		int y0 = task * CONVOLVER_BAND_ROWS;
+		int y1 = y0 + CONVOLVER_BAND_ROWS;
+		if (y1 > job.height) y1 = job.height;
+
+		float *padded = job.scratch + thread * job.scratchSize;
+		float *ringS = padded + width + S::size;
+		float *ringD = ringS + S::size * width;
+		RowRing<S::size> rs(ringS, width, job.height, y0);
+		RowRing<D::size> rd(ringD, width, job.height, y0);
+		const int border = S::size / 2;
+		for (int i = y0; i < y1; ++i) {
+			float *slotS = NULL, *slotD = NULL;
+			int r;
+			while ((r = rs.advance(i, slotS)) >= 0) {
+				rd.advance(i, slotD);
+				padRow(job.in + r * width, padded, width, border);
+				filterRow(padded, slotS, width, smooth);
+				filterRow(padded, slotD, width, derivative);
+			}
+			rs.collect(i);
+			rd.collect(i);
+			filterColumns(rd.rows, job.gx + i * width, width, smooth);
+			filterColumns(rs.rows, job.gy + i * width, width, derivative);
+		}
+	}
+
+	BandScratch scratch;
+};
+
+#endif /* CONVOLVER_H_ */
@@ -45,7 +45,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 // unsigned char (8-bit) version
 ///////////////////////////////////////////////////////////////////////////////
-bool convolve2DSeparable(unsigned char* in, unsigned char* out, int dataSizeX, int dataSizeY,
+inline bool convolve2DSeparable(unsigned char* in, unsigned char* out, int dataSizeX, int dataSizeY,
                          float* kernelX, int kSizeX, float* kernelY, int kSizeY)
 {
     int i, j, k, m, n;
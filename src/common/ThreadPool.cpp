@@ -0,0 +1,146 @@
+/**
+ * @brief 
+ * @file ThreadPool.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common 
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from 
+ * thread pools and TCP/IP components to control architectures and learning algorithms. 
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory 
+ * farming, for animal experimentation, or anything that violates the Universal 
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 8, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <unistd.h>
+#include <cassert>
+
+// Plugin files
+#include <ThreadPool.h>
+
+/* **************************************************************************************
+ * Implementation of ThreadPool
+ * **************************************************************************************/
+
+struct WorkerArg {
+	ThreadPool *pool;
+	int thread;
+};
+
+ThreadPool::ThreadPool(int threads): threads(threads), workers(NULL), job(NULL), arg(NULL),
+		count(0), next(0), finished(0), generation(0), quit(false) {
+	if (this->threads <= 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		this->threads = (cores > 0) ? (int)cores : 1;
+	}
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&start, NULL);
+	pthread_cond_init(&done, NULL);
+
+	// the calling thread is thread 0
+	workers = new pthread_t[this->threads];
+	for (int t = 1; t < this->threads; ++t) {
+		WorkerArg *warg = new WorkerArg;
+		warg->pool = this;
+		warg->thread = t;
+		int result = pthread_create(&workers[t], NULL, &ThreadPool::run, warg);
+		assert (result == 0);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	pthread_mutex_lock(&mutex);
+	quit = true;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&mutex);
+	for (int t = 1; t < threads; ++t) {
+		pthread_join(workers[t], NULL);
+	}
+	delete [] workers;
+	pthread_cond_destroy(&done);
+	pthread_cond_destroy(&start);
+	pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * Tasks are handed out one by one, so tasks that take longer than others do not leave
+ * threads idle. This means the order in which tasks are executed is not defined.
+ */
+void ThreadPool::ParallelFor(int count, ThreadPoolJob job, void *arg) {
+	if (count <= 0) return;
+	if (threads == 1 || count == 1) {
+		for (int i = 0; i < count; ++i) job(i, 0, arg);
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	this->job = job;
+	this->arg = arg;
+	this->count = count;
+	next = 0;
+	finished = 0;
+	++generation;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&mutex);
+
+	work(0);
+
+	pthread_mutex_lock(&mutex);
+	while (finished < count) {
+		pthread_cond_wait(&done, &mutex);
+	}
+	this->job = NULL;
+	pthread_mutex_unlock(&mutex);
+}
+
+void ThreadPool::work(int thread) {
+	pthread_mutex_lock(&mutex);
+	while (next < count) {
+		int task = next++;
+		ThreadPoolJob job = this->job;
+		void *arg = this->arg;
+		pthread_mutex_unlock(&mutex);
+
+		job(task, thread, arg);
+
+		pthread_mutex_lock(&mutex);
+		if (++finished == count) {
+			pthread_cond_signal(&done);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void *ThreadPool::run(void *self) {
+	WorkerArg *warg = (WorkerArg*)self;
+	ThreadPool *pool = warg->pool;
+	int thread = warg->thread;
+	delete warg;
+
+	int seen = 0;
+	while (true) {
+		pthread_mutex_lock(&pool->mutex);
+		while (!pool->quit && pool->generation == seen) {
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		}
+		if (pool->quit) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		pool->work(thread);
+	}
+	return NULL;
+}
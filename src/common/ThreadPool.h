@@ -0,0 +1,93 @@
+/**
+ * @brief 
+ * @file ThreadPool.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common 
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from 
+ * thread pools and TCP/IP components to control architectures and learning algorithms. 
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory 
+ * farming, for animal experimentation, or anything that violates the Universal 
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 8, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+// General files
+#include <pthread.h>
+
+//! A job is called with the index of the task and the index of the thread executing it
+typedef void (*ThreadPoolJob)(int task, int thread, void *arg);
+
+/* **************************************************************************************
+ * Interface of ThreadPool
+ * **************************************************************************************/
+
+/**
+ * A fixed set of worker threads that execute a number of independent tasks, such as the
+ * bands of rows of an image. The calling thread takes part in the work as well, so a pool
+ * with one thread does not start any worker at all. The thread index handed to a job is
+ * smaller than GetThreadCount(), so it can be used to pick the scratch memory of a thread.
+ */
+class ThreadPool {
+public:
+	//! Constructor ThreadPool, with 0 threads it uses the number of online processors
+	ThreadPool(int threads = 0);
+
+	//! Destructor ~ThreadPool
+	virtual ~ThreadPool();
+
+	//! Run job for tasks 0 to count-1 and return when all of them are done
+	void ParallelFor(int count, ThreadPoolJob job, void *arg);
+
+	//! Number of threads that execute tasks, including the calling thread
+	inline int GetThreadCount() { return threads; }
+protected:
+	//! Worker loop
+	static void *run(void *self);
+
+	//! Take tasks from the current job until there are none left
+	void work(int thread);
+private:
+	int threads;
+
+	pthread_t *workers;
+
+	pthread_mutex_t mutex;
+
+	pthread_cond_t start;
+
+	pthread_cond_t done;
+
+	//! Current job
+	ThreadPoolJob job;
+
+	void *arg;
+
+	int count;
+
+	//! Next task to be taken
+	int next;
+
+	//! Number of tasks that are finished
+	int finished;
+
+	//! Incremented for every job, so workers know there is something new
+	int generation;
+
+	bool quit;
+};
+
+#endif /* THREADPOOL_H_ */
@@ -0,0 +1,307 @@
+/**
+ * @brief
+ * @file BinaryDescriptor.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 16, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// Plugin files
+#include <BinaryDescriptor.h>
+#include <Convolver.h>
+
+/* **************************************************************************************
+ * Implementation of DescriptorSet
+ * **************************************************************************************/
+
+DescriptorSet::DescriptorSet(): count(0), capacity(0), data(NULL) {
+
+}
+
+DescriptorSet::~DescriptorSet() {
+	free(data);
+}
+
+void DescriptorSet::Resize(int count) {
+	this->count = count;
+	angles.resize(count);
+	valid.resize(count);
+	if (count <= capacity) return;
+	free(data);
+	void *mem = NULL;
+	int result = posix_memalign(&mem, 32, count * DESCRIPTOR_WORDS * sizeof(uint64_t));
+	assert (result == 0);
+	data = (uint64_t*)mem;
+	capacity = count;
+}
+
+/* **************************************************************************************
+ * Implementation of BriefExtractor
+ * **************************************************************************************/
+
+BriefExtractor::BriefExtractor(bool oriented): oriented(oriented), stride(0), smoothed(NULL),
+		smoothedSize(0) {
+	pattern();
+
+	// half width of the rows of the disk, symmetric so it is the same for every orientation
+	const int r = DESCRIPTOR_ORIENTATION_RADIUS;
+	for (int v = 0; v <= r; ++v) {
+		umax[v] = (int)floor(sqrt((double)(r * r - v * v)) + 0.5);
+	}
+}
+
+BriefExtractor::~BriefExtractor() {
+	delete [] smoothed;
+}
+
+/**
+ * The rotated pattern reaches DESCRIPTOR_PATTERN_RADIUS * sqrt(2) pixels from the corner.
+ */
+int BriefExtractor::GetMargin() {
+	int pattern = (int)ceil(DESCRIPTOR_PATTERN_RADIUS * sqrt(2.0));
+	return std::max(pattern, DESCRIPTOR_ORIENTATION_RADIUS) + 1;
+}
+
+/**
+ * Point pairs are drawn from a Gaussian with a standard deviation of a fifth of the patch
+ * width, which works best according to the BRIEF paper, clipped to the patch. A linear
+ * congruential generator with a fixed seed is used, so the pattern does not depend on the
+ * platform.
+ */
+void BriefExtractor::pattern() {
+	const int r = DESCRIPTOR_PATTERN_RADIUS;
+	const double sigma = (2 * r + 5) / 5.0;
+	unsigned int seed = 0x2012;
+	float base[DESCRIPTOR_BITS * 4];
+	for (int i = 0; i < DESCRIPTOR_BITS * 4; ) {
+		// Box-Muller, with uniform numbers in (0,1]
+		seed = seed * 1103515245 + 12345;
+		double u1 = ((seed >> 8) + 1) / 16777216.0;
+		seed = seed * 1103515245 + 12345;
+		double u2 = ((seed >> 8) + 1) / 16777216.0;
+		double g = sigma * sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2);
+		if (g < -r || g > r) continue;
+		base[i] = (float)g;
+		// the two points of a pair should be different pixels
+		if ((i % 4) == 3 && (int)floor(base[i-3] + 0.5) == (int)floor(base[i-1] + 0.5) &&
+				(int)floor(base[i-2] + 0.5) == (int)floor(base[i] + 0.5)) {
+			i -= 3;
+			continue;
+		}
+		++i;
+	}
+
+	points.resize(DESCRIPTOR_ANGLE_BINS * DESCRIPTOR_BITS * 4);
+	for (int b = 0; b < DESCRIPTOR_ANGLE_BINS; ++b) {
+		double angle = 2 * M_PI * b / DESCRIPTOR_ANGLE_BINS;
+		double c = cos(angle), s = sin(angle);
+		signed char *p = &points[b * DESCRIPTOR_BITS * 4];
+		for (int i = 0; i < DESCRIPTOR_BITS * 2; ++i) {
+			float x = base[2*i], y = base[2*i+1];
+			p[2*i] = (signed char)floor(c * x - s * y + 0.5);
+			p[2*i+1] = (signed char)floor(s * x + c * y + 0.5);
+		}
+	}
+}
+
+void BriefExtractor::offsets(int stride) {
+	if (this->stride == stride) return;
+	this->stride = stride;
+	pairs.resize(points.size() / 2);
+	for (unsigned int i = 0; i < pairs.size(); ++i) {
+		pairs[i] = points[2*i+1] * stride + points[2*i];
+	}
+}
+
+/**
+ * The moments m10 and m01 are accumulated over the disk row pair by row pair: row +v and
+ * row -v contribute with opposite sign to m01.
+ */
+float BriefExtractor::orientation(const ImageView &img, int x, int y) const {
+	const int r = DESCRIPTOR_ORIENTATION_RADIUS;
+	const unsigned char *center = img.row(y) + x;
+	int m10 = 0, m01 = 0;
+	for (int u = -r; u <= r; ++u) {
+		m10 += u * center[u];
+	}
+	for (int v = 1; v <= r; ++v) {
+		const unsigned char *below = center + v * img.stride;
+		const unsigned char *above = center - v * img.stride;
+		int sum = 0;
+		for (int u = -umax[v]; u <= umax[v]; ++u) {
+			int b = below[u], a = above[u];
+			sum += b - a;
+			m10 += u * (b + a);
+		}
+		m01 += v * sum;
+	}
+	return atan2f((float)m01, (float)m10);
+}
+
+void BriefExtractor::describe(const unsigned char *p, int bin, uint64_t *descriptor) const {
+	const int *pair = &pairs[bin * DESCRIPTOR_BITS * 2];
+	for (int w = 0; w < DESCRIPTOR_WORDS; ++w) {
+		uint64_t word = 0;
+		for (int i = 0; i < 64; ++i, pair += 2) {
+			word |= (uint64_t)(p[pair[0]] < p[pair[1]]) << i;
+		}
+		descriptor[w] = word;
+	}
+}
+
+void BriefExtractor::Extract(CRawImage *img, const std::vector<Corner*> & corners,
+		DescriptorSet & set, ThreadPool *pool) {
+	assert (img->isMonochrome());
+	int width = img->getwidth(), height = img->getheight();
+	if (width * height > smoothedSize) {
+		delete [] smoothed;
+		smoothedSize = width * height;
+		smoothed = new unsigned char[smoothedSize];
+	}
+	gaussian.Convolve(img->data, smoothed, width, height, pool);
+
+	ImageView view;
+	view.data = smoothed;
+	view.width = width;
+	view.height = height;
+	view.stride = width;
+	Extract(view, corners, set);
+}
+
+void BriefExtractor::Extract(const ImageView &img, const std::vector<Corner*> & corners,
+		DescriptorSet & set) {
+	offsets(img.stride);
+	const int margin = GetMargin();
+	const float step = DESCRIPTOR_ANGLE_BINS / (2 * M_PI);
+	set.Resize(corners.size());
+	for (unsigned int i = 0; i < corners.size(); ++i) {
+		int x = corners[i]->x, y = corners[i]->y;
+		uint64_t *descriptor = set.GetDescriptor(i);
+		if (x < margin || y < margin || x >= img.width - margin || y >= img.height - margin) {
+			memset(descriptor, 0, DESCRIPTOR_WORDS * sizeof(uint64_t));
+			set.angles[i] = 0;
+			set.valid[i] = 0;
+			continue;
+		}
+		int bin = 0;
+		float angle = 0;
+		if (oriented) {
+			angle = orientation(img, x, y);
+			bin = (int)floor(angle * step + 0.5);
+			bin = (bin + DESCRIPTOR_ANGLE_BINS) % DESCRIPTOR_ANGLE_BINS;
+		}
+		describe(img.row(y) + x, bin, descriptor);
+		set.angles[i] = angle;
+		set.valid[i] = 1;
+	}
+}
+
+/* **************************************************************************************
+ * Implementation of BinaryMatcher
+ * **************************************************************************************/
+
+BinaryMatcher::BinaryMatcher(): ratio(0.8), crossCheck(true), maxDistance(DESCRIPTOR_BITS / 4) {
+
+}
+
+BinaryMatcher::~BinaryMatcher() {
+
+}
+
+void BinaryMatcher::reset(int count0, int count1) {
+	best0.assign(count0, -1);
+	dist0.assign(count0, DESCRIPTOR_BITS + 1);
+	second0.assign(count0, DESCRIPTOR_BITS + 1);
+	best1.assign(count1, -1);
+	dist1.assign(count1, DESCRIPTOR_BITS + 1);
+}
+
+/**
+ * The nearest query of every descriptor in set1 is tracked along. This is only the true
+ * nearest if every query that has the descriptor in its window is compared with it, which
+ * holds for the brute force search and for square windows of equal size.
+ */
+void BinaryMatcher::compare(const DescriptorSet &set0, int i, const DescriptorSet &set1,
+		const int *candidates, int n) {
+	if (!set0.IsValid(i)) return;
+	const uint64_t *a = set0.GetDescriptor(i);
+	int best = -1, first = DESCRIPTOR_BITS + 1, second = DESCRIPTOR_BITS + 1;
+	for (int k = 0; k < n; ++k) {
+		int j = candidates[k];
+		if (!set1.IsValid(j)) continue;
+		int d = Distance(a, set1.GetDescriptor(j));
+		if (d < first) {
+			second = first;
+			first = d;
+			best = j;
+		} else if (d < second) {
+			second = d;
+		}
+		if (d < dist1[j]) {
+			dist1[j] = d;
+			best1[j] = i;
+		}
+	}
+	best0[i] = best;
+	dist0[i] = first;
+	second0[i] = second;
+}
+
+void BinaryMatcher::collect(std::vector<DescriptorMatch> & matches) {
+	matches.clear();
+	for (unsigned int i = 0; i < best0.size(); ++i) {
+		int j = best0[i];
+		if (j < 0 || dist0[i] > maxDistance) continue;
+		if (second0[i] <= DESCRIPTOR_BITS && dist0[i] >= ratio * second0[i]) continue;
+		if (crossCheck && best1[j] != (int)i) continue;
+		matches.push_back(DescriptorMatch(i, j, dist0[i]));
+	}
+}
+
+void BinaryMatcher::Match(const DescriptorSet &set0, const DescriptorSet &set1,
+		std::vector<DescriptorMatch> & matches) {
+	reset(set0.GetCount(), set1.GetCount());
+	candidates.resize(set1.GetCount());
+	for (int j = 0; j < set1.GetCount(); ++j) candidates[j] = j;
+	for (int i = 0; i < set0.GetCount(); ++i) {
+		if (candidates.empty()) break;
+		compare(set0, i, set1, &candidates[0], candidates.size());
+	}
+	collect(matches);
+}
+
+void BinaryMatcher::Match(const DescriptorSet &set0, const std::vector<Corner*> & corners0,
+		const DescriptorSet &set1, const SpatialGrid &grid1, int radius,
+		std::vector<DescriptorMatch> & matches) {
+	assert ((int)corners0.size() == set0.GetCount());
+	reset(set0.GetCount(), set1.GetCount());
+	for (int i = 0; i < set0.GetCount(); ++i) {
+		grid1.QueryBox(corners0[i]->x, corners0[i]->y, radius, candidates);
+		if (candidates.empty()) continue;
+		compare(set0, i, set1, &candidates[0], candidates.size());
+	}
+	collect(matches);
+}
@@ -0,0 +1,251 @@
+/**
+ * @brief
+ * @file BinaryDescriptor.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 16, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef BINARYDESCRIPTOR_H_
+#define BINARYDESCRIPTOR_H_
+
+// General files
+#include <vector>
+#include <stdint.h>
+
+#include <Convolver.h>
+#include <CornerDetector.h>
+#include <SpatialGrid.h>
+#include <Pyramid.h>
+
+class ThreadPool;
+
+//! Number of bits in a descriptor, one comparison of two pixels per bit
+#define DESCRIPTOR_BITS			256
+
+//! Number of 64-bit words in a descriptor
+#define DESCRIPTOR_WORDS		(DESCRIPTOR_BITS / 64)
+
+//! Radius of the disk over which the orientation of a corner is calculated
+#define DESCRIPTOR_ORIENTATION_RADIUS	15
+
+//! The test points are within [-13,13] in both directions around a corner
+#define DESCRIPTOR_PATTERN_RADIUS	13
+
+//! The orientation is discretized in this number of steps, the pattern is precomputed for each
+#define DESCRIPTOR_ANGLE_BINS		32
+
+/* **************************************************************************************
+ * Interface of DescriptorSet
+ * **************************************************************************************/
+
+/**
+ * The binary descriptors of a set of corners, stored one after the other as DESCRIPTOR_WORDS
+ * 64-bit words, in the same order as the corners. Corners too close to the border of the
+ * image do not get a descriptor, they are marked invalid and are never matched.
+ */
+class DescriptorSet {
+public:
+	//! Constructor DescriptorSet
+	DescriptorSet();
+
+	//! Destructor ~DescriptorSet
+	virtual ~DescriptorSet();
+
+	//! Set the number of descriptors, memory is only allocated if it grows
+	void Resize(int count);
+
+	inline int GetCount() const { return count; }
+
+	inline const uint64_t *GetDescriptor(int i) const { return data + i * DESCRIPTOR_WORDS; }
+
+	inline uint64_t *GetDescriptor(int i) { return data + i * DESCRIPTOR_WORDS; }
+
+	//! Orientation of corner i in radians, 0 if the descriptors are not oriented
+	inline float GetAngle(int i) const { return angles[i]; }
+
+	inline bool IsValid(int i) const { return valid[i] != 0; }
+private:
+	friend class BriefExtractor;
+
+	int count;
+
+	int capacity;
+
+	uint64_t *data;
+
+	std::vector<float> angles;
+
+	std::vector<unsigned char> valid;
+};
+
+/* **************************************************************************************
+ * Interface of BriefExtractor
+ * **************************************************************************************/
+
+/**
+ * BRIEF-style binary descriptor: every bit is the comparison of the intensities at two points
+ * around a corner, on a smoothed image, so it is cheap to compute and to compare. The 256
+ * point pairs are drawn once from an isotropic Gaussian (with a fixed seed, so descriptors
+ * from different runs can be compared). Like ORB the descriptor can be made rotation
+ * invariant: the orientation of a corner is the direction from the corner to the intensity
+ * centroid of the disk around it, and the pattern is rotated accordingly. The rotated
+ * patterns are precomputed for DESCRIPTOR_ANGLE_BINS orientations as offsets in the image.
+ */
+class BriefExtractor {
+public:
+	//! Constructor BriefExtractor
+	BriefExtractor(bool oriented = true);
+
+	//! Destructor ~BriefExtractor
+	virtual ~BriefExtractor();
+
+	inline void SetOriented(bool oriented) { this->oriented = oriented; }
+
+	inline bool GetOriented() const { return oriented; }
+
+	//! Smooth the grayscale image and compute the descriptors of the corners on it
+	void Extract(CRawImage *img, const std::vector<Corner*> & corners, DescriptorSet & set,
+			ThreadPool *pool = NULL);
+
+	//! Compute the descriptors on an image that is smoothed already
+	void Extract(const ImageView &smoothed, const std::vector<Corner*> & corners,
+			DescriptorSet & set);
+
+	//! Distance to the border below which corners do not get a descriptor
+	static int GetMargin();
+protected:
+	//! Draw the point pairs and rotate them for every orientation
+	void pattern();
+
+	//! Convert the rotated patterns to offsets for an image with rows of stride bytes
+	void offsets(int stride);
+
+	//! Orientation of the corner at p, in radians
+	float orientation(const ImageView &img, int x, int y) const;
+
+	void describe(const unsigned char *p, int bin, uint64_t *descriptor) const;
+private:
+	bool oriented;
+
+	//! Point pairs as (x0,y0,x1,y1) for every orientation bin
+	std::vector<signed char> points;
+
+	//! Pairs of offsets relative to a corner, for every orientation bin
+	std::vector<int> pairs;
+
+	//! Stride the offsets are computed for
+	int stride;
+
+	//! Half width of every row of the orientation disk
+	int umax[DESCRIPTOR_ORIENTATION_RADIUS + 1];
+
+	//! Smoothed image, reused
+	unsigned char *smoothed;
+
+	int smoothedSize;
+
+	FixedConvolver<GaussianKernel7, GaussianKernel7, unsigned char> gaussian;
+};
+
+/* **************************************************************************************
+ * Interface of BinaryMatcher
+ * **************************************************************************************/
+
+struct DescriptorMatch {
+	DescriptorMatch(int query, int train, int distance): query(query), train(train),
+			distance(distance) {}
+	//! Index in the first set
+	int query;
+	//! Index in the second set
+	int train;
+	//! Hamming distance
+	int distance;
+};
+
+/**
+ * Matches binary descriptors by Hamming distance, which is the population count of the xor
+ * of the 64-bit words (a single popcnt instruction per word when compiled for a processor
+ * that has it, e.g. with -mpopcnt). A match is the nearest descriptor in the second set. It
+ * is only accepted if the nearest is clearly better than the second nearest (ratio test) and
+ * if the query is in turn the nearest for the descriptor it matches to (cross-check). The
+ * search can be restricted to the corners in a window, using a SpatialGrid.
+ */
+class BinaryMatcher {
+public:
+	//! Constructor BinaryMatcher
+	BinaryMatcher();
+
+	//! Destructor ~BinaryMatcher
+	virtual ~BinaryMatcher();
+
+	//! Nearest must be smaller than ratio times the second nearest, 1 disables the test
+	inline void SetRatio(float ratio) { this->ratio = ratio; }
+
+	inline void SetCrossCheck(bool crossCheck) { this->crossCheck = crossCheck; }
+
+	//! Matches with a larger Hamming distance are rejected
+	inline void SetMaxDistance(int maxDistance) { this->maxDistance = maxDistance; }
+
+	//! Compare all descriptors of set0 with all of set1, the result is cleared first
+	void Match(const DescriptorSet &set0, const DescriptorSet &set1,
+			std::vector<DescriptorMatch> & matches);
+
+	/**
+	 * Compare the descriptors of set0 only with those of set1 whose corners are within a square
+	 * of radius pixels around the corner in the first image. The grid is built on the corners
+	 * of set1.
+	 */
+	void Match(const DescriptorSet &set0, const std::vector<Corner*> & corners0,
+			const DescriptorSet &set1, const SpatialGrid &grid1, int radius,
+			std::vector<DescriptorMatch> & matches);
+
+	//! Hamming distance between two descriptors
+	static inline int Distance(const uint64_t *a, const uint64_t *b) {
+		int d = 0;
+		for (int w = 0; w < DESCRIPTOR_WORDS; ++w) {
+			d += __builtin_popcountll(a[w] ^ b[w]);
+		}
+		return d;
+	}
+protected:
+	void reset(int count0, int count1);
+
+	//! Compare query i with the given candidates, keep track of the nearest in both directions
+	void compare(const DescriptorSet &set0, int i, const DescriptorSet &set1,
+			const int *candidates, int n);
+
+	void collect(std::vector<DescriptorMatch> & matches);
+private:
+	float ratio;
+
+	bool crossCheck;
+
+	int maxDistance;
+
+	//! Nearest and second nearest for every query
+	std::vector<int> best0, dist0, second0;
+
+	//! Nearest query for every descriptor in set1
+	std::vector<int> best1, dist1;
+
+	std::vector<int> candidates;
+};
+
+#endif /* BINARYDESCRIPTOR_H_ */
@@ -0,0 +1,491 @@
+/**
+ * @brief 
+ * @file BundleAdjustment.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common 
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from 
+ * thread pools and TCP/IP components to control architectures and learning algorithms. 
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory 
+ * farming, for animal experimentation, or anything that violates the Universal 
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 19, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+// Plugin files
+#include <BundleAdjustment.h>
+
+//! Default Huber threshold in pixels
+#define BA_HUBER				2.0f
+
+/* **************************************************************************************
+ * Implementation of BundleAdjustment
+ * **************************************************************************************/
+
+BundleAdjustment::BundleAdjustment(int maxLandmarks, int maxObservations):
+		maxLandmarks(maxLandmarks), maxObservations(maxObservations), focal(1), baseline(1),
+		cx(0), cy(0), huber(BA_HUBER), keyframes(0), landmarks(0), observations(0),
+		initialCost(0), finalCost(0) {
+	assert (maxLandmarks > 0 && maxObservations > 0);
+	points.resize(maxLandmarks);
+	trialPoints.resize(maxLandmarks);
+	keyframe.resize(maxObservations);
+	landmark.resize(maxObservations);
+	u.resize(maxObservations);
+	v.resize(maxObservations);
+	ur.resize(maxObservations);
+	stereo.resize(maxObservations);
+	first.resize(maxLandmarks + 1);
+	constrained.resize(maxLandmarks);
+	order.resize(maxObservations);
+	C.resize(maxLandmarks);
+	gp.resize(maxLandmarks);
+	E.resize(maxObservations);
+}
+
+BundleAdjustment::~BundleAdjustment() {
+
+}
+
+void BundleAdjustment::SetCamera(float focal, float baseline, float cx, float cy) {
+	assert (focal > 0);
+	this->focal = focal;
+	this->baseline = baseline;
+	this->cx = cx;
+	this->cy = cy;
+}
+
+void BundleAdjustment::Clear() {
+	keyframes = landmarks = observations = 0;
+}
+
+int BundleAdjustment::AddKeyframe(const RelativePose &pose, bool fixed) {
+	if (keyframes == BA_MAX_KEYFRAMES) return -1;
+	R[keyframes] = Mat3d::From(pose.R);
+	t[keyframes] = Vec3d::From(pose.t);
+	this->fixed[keyframes] = fixed;
+	return keyframes++;
+}
+
+int BundleAdjustment::AddLandmark(float X, float Y, float Z) {
+	if (landmarks == maxLandmarks) return -1;
+	points[landmarks] = MakeVec<double>(X, Y, Z);
+	return landmarks++;
+}
+
+bool BundleAdjustment::AddObservation(int keyframe, int landmark, float u, float v, float d) {
+	assert (keyframe >= 0 && keyframe < keyframes && landmark >= 0 && landmark < landmarks);
+	if (observations == maxObservations) return false;
+	int i = observations++;
+	this->keyframe[i] = keyframe;
+	this->landmark[i] = landmark;
+	this->u[i] = (u - cx) / focal;
+	this->v[i] = (v - cy) / focal;
+	this->ur[i] = (u - d - cx) / focal;
+	stereo[i] = d > 0;
+	return true;
+}
+
+/**
+ * Levenberg-Marquardt: a step that lowers the cost is taken and the damping is divided by
+ * ten, otherwise the damping is multiplied by ten. The normal equations are only formed
+ * again after a step is taken.
+ */
+int BundleAdjustment::Solve(int iterations) {
+	initialCost = finalCost = 0;
+	if (keyframes == 0 || observations == 0) return 0;
+
+	// the observations of every landmark together, by counting sort
+	for (int p = 0; p <= landmarks; ++p) first[p] = 0;
+	for (int i = 0; i < observations; ++i) first[landmark[i] + 1]++;
+	for (int p = 0; p < landmarks; ++p) first[p + 1] += first[p];
+	for (int i = 0; i < observations; ++i) order[first[landmark[i]]++] = i;
+	for (int p = landmarks; p > 0; --p) first[p] = first[p - 1];
+	first[0] = 0;
+
+	// one observation without disparity leaves the depth of a landmark free
+	for (int p = 0; p < landmarks; ++p) {
+		int n = first[p + 1] - first[p];
+		constrained[p] = n > 1 || (n == 1 && stereo[order[first[p]]]);
+	}
+
+	bool anchored = false;
+	for (int k = 0; k < keyframes; ++k) anchored = anchored || fixed[k];
+	if (!anchored) fixed[0] = true;
+
+	double cost = linearize(false, true);
+	initialCost = cost;
+	double lambda = 1e-4;
+	int it = 0;
+	while (it < iterations && lambda < 1e8) {
+		it++;
+		if (!step(lambda)) {
+			lambda *= 10;
+			continue;
+		}
+		double next = linearize(true, false);
+		if (next >= cost) {
+			lambda *= 10;
+			continue;
+		}
+		for (int k = 0; k < keyframes; ++k) {
+			R[k] = trialR[k];
+			t[k] = trialT[k];
+		}
+		for (int p = 0; p < landmarks; ++p) points[p] = trialPoints[p];
+		bool converged = cost - next < 1e-8 * cost;
+		cost = linearize(false, true);
+		lambda = std::max(lambda / 10, 1e-10);
+		if (converged) break;
+	}
+	finalCost = cost;
+	return it;
+}
+
+/**
+ * A point at C = R X + t in the camera is seen at (C0, C1) / C2 in the left image and at
+ * (C0 - baseline) / C2 in the right image. The derivative of C is -[R X]x to the rotation
+ * vector w of R' = exp(w) R, the identity to the step of t and R to the step of X. An
+ * observation with a residual r of norm s above the Huber threshold k costs 2 k s - k^2
+ * instead of s^2, and gets weight k / s in the normal equations.
+ */
+double BundleAdjustment::linearize(bool trial, bool equations) {
+	const Mat3d *Rs = trial ? trialR : R;
+	const Vec3d *ts = trial ? trialT : t;
+	const Vec3d *Xs = trial ? &trialPoints[0] : &points[0];
+	const double k = huber / focal, b = baseline;
+	if (equations) {
+		B = CameraSystem::Zero();
+		gc = CameraVector::Zero();
+		for (int p = 0; p < landmarks; ++p) {
+			C[p] = Mat3d::Zero();
+			gp[p] = Vec3d::Zero();
+		}
+	}
+	double cost = 0;
+	for (int i = 0; i < observations; ++i) {
+		int c = keyframe[i], p = landmark[i];
+		if (!constrained[p]) {
+			if (equations) E[i] = Mat<6, 3, double>::Zero();
+			continue;
+		}
+		Vec3d RX = Rs[c] * Xs[p];
+		Vec3d P = RX + ts[c];
+		if (P[2] <= 1e-6) {
+			if (equations) E[i] = Mat<6, 3, double>::Zero();
+			continue;
+		}
+		double iz = 1 / P[2];
+		double x = P[0] * iz, y = P[1] * iz;
+		Vec3d r = {{ x - u[i], y - v[i], stereo[i] ? (P[0] - b) * iz - ur[i] : 0 }};
+		double s = r.Norm(), weight = 1;
+		if (s <= k) {
+			cost += s * s;
+		} else {
+			cost += 2 * k * s - k * k;
+			weight = k / s;
+		}
+		if (!equations) continue;
+		double xr = stereo[i] ? (P[0] - b) * iz : 0;
+		Mat3d projection = {{ iz, 0, -x * iz, 0, iz, -y * iz, 0, 0, 0 }};
+		if (stereo[i]) {
+			projection(2, 0) = iz;
+			projection(2, 2) = -xr * iz;
+		}
+		Mat3d Jp = projection * Rs[c];
+		Mat3d JpW = Jp.Transpose() * weight;
+		C[p] += JpW * Jp;
+		gp[p] += JpW * r;
+		if (fixed[c]) {
+			E[i] = Mat<6, 3, double>::Zero();
+			continue;
+		}
+		Mat<3, 6, double> Jc;
+		Jc.SetBlock(0, 0, projection * -Skew(RX));
+		Jc.SetBlock(0, 3, projection);
+		Mat<6, 3, double> JcW = Jc.Transpose() * weight;
+		B.SetBlock(6 * c, 6 * c, B.Block<6, 6>(6 * c, 6 * c) + JcW * Jc);
+		gc.SetBlock(6 * c, 0, gc.Block<6, 1>(6 * c, 0) + JcW * r);
+		E[i] = JcW * Jp;
+	}
+	return cost;
+}
+
+/**
+ * With the damped landmark blocks C the reduced camera system is
+ * (B - E C^-1 E^T) dc = -(gc - E C^-1 gp), summed over the pairs of observations of every
+ * landmark. Then dp = C^-1 (-gp - E^T dc) for every landmark. Rows of fixed and unused
+ * keyframes are the identity, so their step is zero.
+ */
+bool BundleAdjustment::step(double lambda) {
+	CameraSystem S = B;
+	CameraVector rhs = -gc;
+	for (int c = 0; c < BA_MAX_KEYFRAMES; ++c) {
+		for (int j = 6 * c; j < 6 * c + 6; ++j) {
+			if (c >= keyframes || fixed[c]) S(j, j) = 1;
+			else S(j, j) *= 1 + lambda;
+		}
+	}
+	for (int p = 0; p < landmarks; ++p) {
+		Mat3d inverse;
+		if (!constrained[p]) continue;
+		if (!dampedInverse(p, lambda, inverse)) return false;
+		for (int a = first[p]; a < first[p + 1]; ++a) {
+			int i = order[a], ci = keyframe[i];
+			if (fixed[ci]) continue;
+			Mat<6, 3, double> EC = E[i] * inverse;
+			rhs.SetBlock(6 * ci, 0, rhs.Block<6, 1>(6 * ci, 0) + EC * gp[p]);
+			for (int b = first[p]; b < first[p + 1]; ++b) {
+				int j = order[b], cj = keyframe[j];
+				if (fixed[cj]) continue;
+				S.SetBlock(6 * ci, 6 * cj, S.Block<6, 6>(6 * ci, 6 * cj) - EC * E[j].Transpose());
+			}
+		}
+	}
+	dc = rhs;
+	if (!SolveCholesky(S, dc)) return false;
+	for (int c = 0; c < keyframes; ++c) {
+		trialR[c] = Exp(dc.Block<3, 1>(6 * c, 0)) * R[c];
+		trialT[c] = t[c] + dc.Block<3, 1>(6 * c + 3, 0);
+	}
+	for (int p = 0; p < landmarks; ++p) {
+		Mat3d inverse;
+		if (!constrained[p]) {
+			trialPoints[p] = points[p];
+			continue;
+		}
+		dampedInverse(p, lambda, inverse);
+		Vec3d g = -gp[p];
+		for (int a = first[p]; a < first[p + 1]; ++a) {
+			int i = order[a], ci = keyframe[i];
+			if (fixed[ci]) continue;
+			g -= E[i].Transpose() * dc.Block<6, 1>(6 * ci, 0);
+		}
+		trialPoints[p] = points[p] + inverse * g;
+	}
+	return true;
+}
+
+//! The tiny constant keeps a landmark that is seen only once from making C singular
+bool BundleAdjustment::dampedInverse(int p, double lambda, Mat3d &inverse) const {
+	Mat3d damped = C[p];
+	for (int j = 0; j < 3; ++j) damped(j, j) = damped(j, j) * (1 + lambda) + 1e-12;
+	return Inverse(damped, inverse);
+}
+
+/* **************************************************************************************
+ * Implementation of SlidingWindow
+ * **************************************************************************************/
+
+SlidingWindow::SlidingWindow(int size, int maxLandmarks, int maxObservations): size(size),
+		maxLandmarks(maxLandmarks), maxObservations(maxObservations), nextKeyframe(0),
+		nextLandmark(0), adjustment(maxLandmarks, maxObservations), busy(false), ready(false),
+		quit(false) {
+	assert (size > 1 && size <= BA_MAX_KEYFRAMES);
+	keyframeIds.resize(size, -1);
+	poses.resize(size);
+	landmarkIds.resize(maxLandmarks, -1);
+	positions.resize(maxLandmarks);
+	seen.resize(maxLandmarks, 0);
+	landmarkIndex.resize(maxLandmarks, -1);
+	observed.reserve(maxObservations);
+	adjustedKeyframes.resize(size);
+	adjustedLandmarks.resize(maxLandmarks);
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&start, NULL);
+	pthread_cond_init(&done, NULL);
+	int result = pthread_create(&worker, NULL, &SlidingWindow::run, this);
+	assert (result == 0);
+}
+
+SlidingWindow::~SlidingWindow() {
+	pthread_mutex_lock(&mutex);
+	quit = true;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&mutex);
+	pthread_join(worker, NULL);
+	pthread_cond_destroy(&done);
+	pthread_cond_destroy(&start);
+	pthread_mutex_destroy(&mutex);
+}
+
+void SlidingWindow::SetCamera(float focal, float baseline, float cx, float cy) {
+	Wait();
+	adjustment.SetCamera(focal, baseline, cx, cy);
+}
+
+int SlidingWindow::AddKeyframe(const RelativePose &pose) {
+	int slot = nextKeyframe % size;
+	if (keyframeIds[slot] >= 0) retire(slot);
+	keyframeIds[slot] = nextKeyframe;
+	poses[slot] = pose;
+	return nextKeyframe++;
+}
+
+/**
+ * The ID of a landmark is the first number from nextLandmark on for which the slot ID
+ * modulo maxLandmarks is free, so IDs are never used twice and finding the slot of an ID
+ * takes no search.
+ */
+int SlidingWindow::AddLandmark(float X, float Y, float Z) {
+	for (int attempt = 0; attempt < maxLandmarks; ++attempt) {
+		int id = nextLandmark++;
+		int slot = id % maxLandmarks;
+		if (landmarkIds[slot] >= 0) continue;
+		landmarkIds[slot] = id;
+		positions[slot] = MakeVec<float>(X, Y, Z);
+		seen[slot] = 0;
+		return id;
+	}
+	return -1;
+}
+
+bool SlidingWindow::AddObservation(int keyframe, int landmark, float u, float v, float d) {
+	if (!HasKeyframe(keyframe) || !HasLandmark(landmark)) return false;
+	if ((int)observed.size() == maxObservations) return false;
+	Observation observation = { keyframe, landmark, u, v, d };
+	observed.push_back(observation);
+	seen[landmark % maxLandmarks]++;
+	return true;
+}
+
+void SlidingWindow::retire(int slot) {
+	int id = keyframeIds[slot];
+	int n = 0;
+	for (size_t i = 0; i < observed.size(); ++i) {
+		if (observed[i].keyframe != id) {
+			observed[n++] = observed[i];
+			continue;
+		}
+		int l = observed[i].landmark % maxLandmarks;
+		if (--seen[l] == 0) landmarkIds[l] = -1;
+	}
+	observed.resize(n);
+	keyframeIds[slot] = -1;
+}
+
+/**
+ * The oldest keyframe in the window is fixed. Landmarks get an index in the order in
+ * which they are first observed.
+ */
+void SlidingWindow::fill() {
+	adjustment.Clear();
+	int oldest = std::max(0, nextKeyframe - size);
+	int keyframes = 0;
+	for (int id = oldest; id < nextKeyframe; ++id) {
+		if (!HasKeyframe(id)) continue;
+		adjustment.AddKeyframe(poses[id % size], keyframes == 0);
+		adjustedKeyframes[keyframes++] = id;
+	}
+	for (size_t i = 0; i < observed.size(); ++i) {
+		landmarkIndex[observed[i].landmark % maxLandmarks] = -1;
+	}
+	for (size_t i = 0; i < observed.size(); ++i) {
+		const Observation &o = observed[i];
+		int slot = o.landmark % maxLandmarks;
+		if (landmarkIndex[slot] < 0) {
+			const Vec3f &X = positions[slot];
+			landmarkIndex[slot] = adjustment.AddLandmark(X[0], X[1], X[2]);
+			adjustedLandmarks[landmarkIndex[slot]] = o.landmark;
+		}
+		adjustment.AddObservation(o.keyframe - adjustedKeyframes[0], landmarkIndex[slot], o.u, o.v,
+				o.d);
+	}
+}
+
+//! Keyframes and landmarks that left the window in the meantime are skipped
+void SlidingWindow::apply() {
+	for (int k = 0; k < adjustment.GetKeyframeCount(); ++k) {
+		int id = adjustedKeyframes[k];
+		if (HasKeyframe(id)) adjustment.GetPose(k, poses[id % size]);
+	}
+	for (int p = 0; p < adjustment.GetLandmarkCount(); ++p) {
+		int id = adjustedLandmarks[p];
+		if (!HasLandmark(id)) continue;
+		Vec3f &X = positions[id % maxLandmarks];
+		adjustment.GetLandmark(p, X[0], X[1], X[2]);
+	}
+}
+
+bool SlidingWindow::Start() {
+	pthread_mutex_lock(&mutex);
+	if (busy) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	if (ready) {
+		apply();
+		ready = false;
+	}
+	fill();
+	busy = true;
+	pthread_cond_signal(&start);
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+bool SlidingWindow::Poll() {
+	pthread_mutex_lock(&mutex);
+	bool result = !busy && ready;
+	if (result) {
+		apply();
+		ready = false;
+	}
+	pthread_mutex_unlock(&mutex);
+	return result;
+}
+
+void SlidingWindow::Wait() {
+	pthread_mutex_lock(&mutex);
+	while (busy) {
+		pthread_cond_wait(&done, &mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void SlidingWindow::Optimize() {
+	Wait();
+	Poll();
+	fill();
+	adjustment.Solve();
+	apply();
+}
+
+void *SlidingWindow::run(void *self) {
+	SlidingWindow *window = (SlidingWindow*)self;
+	while (true) {
+		pthread_mutex_lock(&window->mutex);
+		while (!window->quit && !window->busy) {
+			pthread_cond_wait(&window->start, &window->mutex);
+		}
+		if (window->quit) {
+			pthread_mutex_unlock(&window->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&window->mutex);
+
+		window->adjustment.Solve();
+
+		pthread_mutex_lock(&window->mutex);
+		window->busy = false;
+		window->ready = true;
+		pthread_cond_broadcast(&window->done);
+		pthread_mutex_unlock(&window->mutex);
+	}
+	return NULL;
+}
@@ -0,0 +1,284 @@
+/**
+ * @brief
+ * @file BundleAdjustment.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 19, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef BUNDLEADJUSTMENT_H_
+#define BUNDLEADJUSTMENT_H_
+
+// General files
+#include <vector>
+#include <pthread.h>
+
+#include <Essential.h>
+#include <Matrix.h>
+
+//! Maximum number of keyframes in a bundle adjustment, it fixes the size of the camera system
+#define BA_MAX_KEYFRAMES		10
+
+/* **************************************************************************************
+ * Interface of BundleAdjustment
+ * **************************************************************************************/
+
+/**
+ * Joint refinement of the poses of a few keyframes and of the landmarks they see, by
+ * minimizing the reprojection errors with Levenberg-Marquardt. A pose is world to camera,
+ * X_c = R X + t as RelativePose. Observations in the left image give two residuals, with
+ * a disparity they give a third in the right image, which fixes the scale.
+ *
+ * Every landmark only depends on the cameras that see it, so the normal equations have a
+ * block-diagonal landmark part. It is eliminated by the Schur complement, which leaves a
+ * dense system of six unknowns per keyframe, solved by Cholesky. The landmarks follow by
+ * back-substitution. The Huber loss keeps the remaining outliers from pulling the
+ * solution away. The first keyframe is fixed, for the gauge, and landmarks with a single
+ * observation without disparity are left out. All buffers have the capacity
+ * given at construction, nothing is allocated in Solve.
+ */
+class BundleAdjustment {
+public:
+	//! Constructor BundleAdjustment
+	BundleAdjustment(int maxLandmarks = 1024, int maxObservations = 8192);
+
+	//! Destructor ~BundleAdjustment
+	virtual ~BundleAdjustment();
+
+	//! Focal length and principal point of the rectified stereo pair in pixels, the baseline in
+	//! metric units as in stereo.cfg, which is the unit of the landmarks and translations
+	void SetCamera(float focal, float baseline, float cx, float cy);
+
+	//! Reprojection errors above this number of pixels count linearly (Huber)
+	inline void SetHuber(float huber) { this->huber = huber; }
+
+	//! Remove all keyframes, landmarks and observations
+	void Clear();
+
+	//! Add a keyframe with its pose, returns its index or -1 if full
+	int AddKeyframe(const RelativePose &pose, bool fixed = false);
+
+	//! Add a landmark at (X,Y,Z) in world coordinates, returns its index or -1 if full
+	int AddLandmark(float X, float Y, float Z);
+
+	//! Observation of a landmark at pixel (u,v) with disparity d, or without if d <= 0
+	bool AddObservation(int keyframe, int landmark, float u, float v, float d = -1);
+
+	//! Optimize, returns the number of iterations
+	int Solve(int iterations = 10);
+
+	inline void GetPose(int keyframe, RelativePose &pose) const {
+		R[keyframe].CopyTo(pose.R);
+		t[keyframe].CopyTo(pose.t);
+	}
+
+	inline void GetLandmark(int landmark, float &X, float &Y, float &Z) const {
+		X = points[landmark][0];
+		Y = points[landmark][1];
+		Z = points[landmark][2];
+	}
+
+	//! Robust cost before and after the last Solve, in squared normalized coordinates
+	inline double GetInitialCost() const { return initialCost; }
+
+	inline double GetFinalCost() const { return finalCost; }
+
+	inline int GetKeyframeCount() const { return keyframes; }
+
+	inline int GetLandmarkCount() const { return landmarks; }
+
+	inline int GetObservationCount() const { return observations; }
+protected:
+	//! Robust cost of the current or of the trial state, with the normal equations if asked
+	double linearize(bool trial, bool equations);
+
+	//! Solve the damped normal equations into the steps, false if they are not definite
+	bool step(double lambda);
+
+	//! Inverse of the damped block of landmark p
+	bool dampedInverse(int p, double lambda, Mat3d &inverse) const;
+private:
+	typedef Mat<6 * BA_MAX_KEYFRAMES, 6 * BA_MAX_KEYFRAMES, double> CameraSystem;
+	typedef Vec<6 * BA_MAX_KEYFRAMES, double> CameraVector;
+
+	int maxLandmarks, maxObservations;
+
+	float focal, baseline, cx, cy;
+
+	float huber;
+
+	int keyframes, landmarks, observations;
+
+	double initialCost, finalCost;
+
+	//! State and trial state
+	Mat3d R[BA_MAX_KEYFRAMES], trialR[BA_MAX_KEYFRAMES];
+
+	Vec3d t[BA_MAX_KEYFRAMES], trialT[BA_MAX_KEYFRAMES];
+
+	bool fixed[BA_MAX_KEYFRAMES];
+
+	std::vector<Vec3d> points, trialPoints;
+
+	//! Observations in normalized coordinates, ur in the right image if stereo
+	std::vector<int> keyframe, landmark;
+
+	std::vector<double> u, v, ur;
+
+	std::vector<unsigned char> stereo;
+
+	//! Observations sorted by landmark
+	std::vector<int> first, order;
+
+	//! Landmarks with enough observations to fix their position, the others are left alone
+	std::vector<unsigned char> constrained;
+
+	//! Normal equations: cameras, landmarks and the blocks that couple them
+	CameraSystem B;
+
+	CameraVector gc, dc;
+
+	std::vector<Mat3d> C;
+
+	std::vector<Vec3d> gp;
+
+	std::vector<Mat<6, 3, double> > E;
+};
+
+/* **************************************************************************************
+ * Interface of SlidingWindow
+ * **************************************************************************************/
+
+/**
+ * The last keyframes with the landmarks they observe, refined by bundle adjustment in a
+ * thread of its own, so the front-end is never blocked. Keyframes and landmarks are
+ * known by IDs that stay valid as long as they are in the window: the oldest keyframe
+ * leaves when the window is full, and a landmark leaves with the last keyframe that sees
+ * it. Start copies the window into the adjustment if it is not busy, Poll copies the
+ * result back into the keyframes and landmarks that are still there.
+ */
+class SlidingWindow {
+public:
+	//! Constructor SlidingWindow
+	SlidingWindow(int size = 5, int maxLandmarks = 1024, int maxObservations = 8192);
+
+	//! Destructor ~SlidingWindow
+	virtual ~SlidingWindow();
+
+	void SetCamera(float focal, float baseline, float cx, float cy);
+
+	//! Add a keyframe, the oldest one leaves if the window is full, returns its ID
+	int AddKeyframe(const RelativePose &pose);
+
+	//! Add a landmark at (X,Y,Z) in world coordinates, returns its ID or -1 if full
+	int AddLandmark(float X, float Y, float Z);
+
+	//! Observation of a landmark in a keyframe, with disparity d or without if d <= 0
+	bool AddObservation(int keyframe, int landmark, float u, float v, float d = -1);
+
+	inline bool HasKeyframe(int id) const {
+		return id >= 0 && keyframeIds[id % size] == id;
+	}
+
+	inline bool HasLandmark(int id) const {
+		return id >= 0 && landmarkIds[id % maxLandmarks] == id;
+	}
+
+	inline const RelativePose & GetPose(int keyframe) const { return poses[keyframe % size]; }
+
+	inline const Vec3f & GetLandmark(int landmark) const {
+		return positions[landmark % maxLandmarks];
+	}
+
+	//! ID of the newest keyframe, -1 if there is none
+	inline int GetLastKeyframe() const { return nextKeyframe - 1; }
+
+	//! Start the adjustment of the window, false if the previous one is still running
+	bool Start();
+
+	//! Take over the result of an adjustment that has finished, false if there is none
+	bool Poll();
+
+	//! Wait for the running adjustment
+	void Wait();
+
+	//! Adjust the window in the calling thread
+	void Optimize();
+
+	//! The adjustment, only to be used when it is not running
+	inline BundleAdjustment & GetAdjustment() { return adjustment; }
+protected:
+	//! Adjustment thread
+	static void *run(void *self);
+
+	//! Copy the window into the adjustment
+	void fill();
+
+	//! Copy the result of the adjustment into the window
+	void apply();
+
+	//! Remove the oldest keyframe with its observations and the landmarks they leave unseen
+	void retire(int slot);
+private:
+	int size, maxLandmarks, maxObservations;
+
+	int nextKeyframe, nextLandmark;
+
+	//! IDs per slot, -1 if a slot is free
+	std::vector<int> keyframeIds, landmarkIds;
+
+	std::vector<RelativePose> poses;
+
+	std::vector<Vec3f> positions;
+
+	//! Number of observations of a landmark
+	std::vector<int> seen;
+
+	//! Observations: keyframe ID, landmark ID, pixel and disparity
+	struct Observation {
+		int keyframe, landmark;
+		float u, v, d;
+	};
+
+	std::vector<Observation> observed;
+
+	//! IDs of the keyframes and landmarks that are in the adjustment, by index
+	std::vector<int> adjustedKeyframes, adjustedLandmarks;
+
+	//! Index in the adjustment by slot, -1 if not in the adjustment
+	std::vector<int> landmarkIndex;
+
+	BundleAdjustment adjustment;
+
+	pthread_t worker;
+
+	pthread_mutex_t mutex;
+
+	pthread_cond_t start;
+
+	pthread_cond_t done;
+
+	bool busy;
+
+	bool ready;
+
+	bool quit;
+};
+
+#endif /* BUNDLEADJUSTMENT_H_ */
@@ -0,0 +1,344 @@
+/**
+ * @brief
+ * @file CameraModel.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 22, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <CameraModel.h>
+
+using namespace std;
+
+//! Number of iterations to remove the distortion of a point
+#define UNDISTORT_ITERATIONS		8
+
+/* **************************************************************************************
+ * Rotations, 3x3 row-major
+ * **************************************************************************************/
+
+//! Rotation matrix of a rotation vector (axis times angle), Rodrigues' formula
+static void rodrigues(const float *r, float *R) {
+	double theta = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+	if (theta < 1e-12) {
+		for (int i = 0; i < 9; ++i) R[i] = (i % 4 == 0) ? 1 : 0;
+		return;
+	}
+	double x = r[0] / theta, y = r[1] / theta, z = r[2] / theta;
+	double c = cos(theta), s = sin(theta), t = 1 - c;
+	R[0] = t*x*x + c;   R[1] = t*x*y - s*z; R[2] = t*x*z + s*y;
+	R[3] = t*x*y + s*z; R[4] = t*y*y + c;   R[5] = t*y*z - s*x;
+	R[6] = t*x*z - s*y; R[7] = t*y*z + s*x; R[8] = t*z*z + c;
+}
+
+//! C = A B, or A^T B if transpose is set
+static void multiply(const float *A, const float *B, float *C, bool transpose = false) {
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			float sum = 0;
+			for (int k = 0; k < 3; ++k) {
+				sum += (transpose ? A[k*3+i] : A[i*3+k]) * B[k*3+j];
+			}
+			C[i*3+j] = sum;
+		}
+	}
+}
+
+/* **************************************************************************************
+ * Implementation of CameraIntrinsics
+ * **************************************************************************************/
+
+CameraIntrinsics::CameraIntrinsics(): fx(1), fy(1), cx(0), cy(0), k1(0), k2(0), k3(0), p1(0),
+		p2(0) {
+
+}
+
+void CameraIntrinsics::Distort(float x, float y, float &xd, float &yd) const {
+	float r2 = x * x + y * y;
+	float radial = 1 + r2 * (k1 + r2 * (k2 + r2 * k3));
+	xd = x * radial + 2 * p1 * x * y + p2 * (r2 + 2 * x * x);
+	yd = y * radial + p1 * (r2 + 2 * y * y) + 2 * p2 * x * y;
+}
+
+/**
+ * Fixed-point iteration x = (xd - tangential(x)) / radial(x), which converges quickly for the
+ * moderate distortion of normal lenses.
+ */
+void CameraIntrinsics::Undistort(float xd, float yd, float &x, float &y) const {
+	x = xd;
+	y = yd;
+	for (int i = 0; i < UNDISTORT_ITERATIONS; ++i) {
+		float r2 = x * x + y * y;
+		float radial = 1 + r2 * (k1 + r2 * (k2 + r2 * k3));
+		float dx = 2 * p1 * x * y + p2 * (r2 + 2 * x * x);
+		float dy = p1 * (r2 + 2 * y * y) + 2 * p2 * x * y;
+		x = (xd - dx) / radial;
+		y = (yd - dy) / radial;
+	}
+}
+
+/* **************************************************************************************
+ * Implementation of RemapTable
+ * **************************************************************************************/
+
+RemapTable::RemapTable(): width(0), height(0) {
+
+}
+
+RemapTable::~RemapTable() {
+
+}
+
+/**
+ * For every output pixel the ray of the target camera is rotated back into the frame of the
+ * camera, distorted and projected. This is only done once, so it can be in floating point.
+ */
+void RemapTable::Build(const CameraIntrinsics &camera, const float *R,
+		const CameraIntrinsics &target, int width, int height) {
+	this->width = width;
+	this->height = height;
+	offsets.resize(width * height);
+	weightsTop.resize(2 * width * height);
+	weightsBottom.resize(2 * width * height);
+	const int one = 1 << REMAP_BITS;
+	for (int v = 0; v < height; ++v) {
+		for (int u = 0; u < width; ++u) {
+			float rx = (u - target.cx) / target.fx, ry = (v - target.cy) / target.fy;
+			// R^T (rx, ry, 1)
+			float X = R[0] * rx + R[3] * ry + R[6];
+			float Y = R[1] * rx + R[4] * ry + R[7];
+			float Z = R[2] * rx + R[5] * ry + R[8];
+			int i = v * width + u;
+			offsets[i] = 0;
+			weightsTop[2*i] = weightsTop[2*i+1] = weightsBottom[2*i] = weightsBottom[2*i+1] = 0;
+			if (Z <= 0) continue;
+			float xd, yd;
+			camera.Distort(X / Z, Y / Z, xd, yd);
+			float sx = camera.fx * xd + camera.cx, sy = camera.fy * yd + camera.cy;
+			int fx = (int)floorf(sx * one + 0.5f), fy = (int)floorf(sy * one + 0.5f);
+			int ix = fx >> REMAP_BITS, iy = fy >> REMAP_BITS;
+			if (ix < 0 || iy < 0 || ix >= width - 1 || iy >= height - 1) continue;
+			int ax = fx & (one - 1), ay = fy & (one - 1);
+			offsets[i] = iy * width + ix;
+			weightsTop[2*i] = (one - ax) * (one - ay);
+			weightsTop[2*i+1] = ax * (one - ay);
+			weightsBottom[2*i] = (one - ax) * ay;
+			weightsBottom[2*i+1] = ax * ay;
+		}
+	}
+}
+
+/**
+ * The four source pixels of eight output pixels are gathered into pairs (left, right) of
+ * 16-bit values, which pmaddwd multiplies with the pairs of weights and adds.
+ */
+void RemapTable::Apply(const ImageView &src, const ImageView &dst) const {
+	assert (IsBuilt());
+	assert (src.width == width && src.height == height && src.stride == width);
+	assert (dst.width == width && dst.height == height);
+	const int shift = 2 * REMAP_BITS;
+	for (int y = 0; y < height; ++y) {
+		const int *ofs = &offsets[y * width];
+		const short *wt = &weightsTop[2 * y * width], *wb = &weightsBottom[2 * y * width];
+		unsigned char *out = dst.row(y);
+		int x = 0;
+#ifdef __SSE2__
+		const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+		short top[16], bottom[16];
+		for (; x + 8 <= width; x += 8) {
+			for (int k = 0; k < 8; ++k) {
+				const unsigned char *p = src.data + ofs[x + k];
+				top[2*k] = p[0];
+				top[2*k+1] = p[1];
+				bottom[2*k] = p[width];
+				bottom[2*k+1] = p[width + 1];
+			}
+			__m128i lo = _mm_add_epi32(
+					_mm_madd_epi16(_mm_loadu_si128((const __m128i*)top), _mm_loadu_si128((const __m128i*)(wt + 2*x))),
+					_mm_madd_epi16(_mm_loadu_si128((const __m128i*)bottom), _mm_loadu_si128((const __m128i*)(wb + 2*x))));
+			__m128i hi = _mm_add_epi32(
+					_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(top + 8)), _mm_loadu_si128((const __m128i*)(wt + 2*x + 8))),
+					_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(bottom + 8)), _mm_loadu_si128((const __m128i*)(wb + 2*x + 8))));
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, round), shift);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, round), shift);
+			__m128i packed = _mm_packs_epi32(lo, hi);
+			_mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(packed, packed));
+		}
+#endif
+		for (; x < width; ++x) {
+			const unsigned char *p = src.data + ofs[x];
+			int sum = p[0] * wt[2*x] + p[1] * wt[2*x+1] + p[width] * wb[2*x] + p[width+1] * wb[2*x+1];
+			out[x] = (unsigned char)((sum + (1 << (shift - 1))) >> shift);
+		}
+	}
+}
+
+/* **************************************************************************************
+ * Implementation of StereoCamera
+ * **************************************************************************************/
+
+StereoCamera::StereoCamera(): baseline(0) {
+	float zero[3] = { 0, 0, 0 };
+	SetExtrinsics(zero, zero);
+}
+
+StereoCamera::~StereoCamera() {
+
+}
+
+/**
+ * Unknown keys are ignored, so the file can hold other settings as well.
+ */
+bool StereoCamera::Load(const char *filename) {
+	ifstream file(filename);
+	if (!file.is_open()) {
+		cerr << __func__ << ": cannot open \"" << filename << '"' << endl;
+		return false;
+	}
+	float values[6][5];
+	const char *keys[6] = { "left.intrinsics", "left.distortion", "right.intrinsics",
+			"right.distortion", "rotation", "translation" };
+	const int counts[6] = { 4, 5, 4, 5, 3, 3 };
+	bool found[6] = { false, false, false, false, false, false };
+	string line;
+	while (getline(file, line)) {
+		size_t comment = line.find('#');
+		if (comment != string::npos) line.erase(comment);
+		istringstream words(line);
+		string key;
+		if (!(words >> key)) continue;
+		for (int k = 0; k < 6; ++k) {
+			if (key != keys[k]) continue;
+			for (int v = 0; v < counts[k]; ++v) {
+				if (!(words >> values[k][v])) {
+					cerr << __func__ << ": expected " << counts[k] << " values for " << key << endl;
+					return false;
+				}
+			}
+			found[k] = true;
+		}
+	}
+	for (int k = 0; k < 6; ++k) {
+		if (!found[k]) {
+			cerr << __func__ << ": missing " << keys[k] << " in \"" << filename << '"' << endl;
+			return false;
+		}
+	}
+	for (int s = 0; s < 2; ++s) {
+		const float *in = values[2*s], *dist = values[2*s+1];
+		CameraIntrinsics &c = cameras[s];
+		c.fx = in[0]; c.fy = in[1]; c.cx = in[2]; c.cy = in[3];
+		c.k1 = dist[0]; c.k2 = dist[1]; c.p1 = dist[2]; c.p2 = dist[3]; c.k3 = dist[4];
+	}
+	SetExtrinsics(values[4], values[5]);
+	return true;
+}
+
+void StereoCamera::SetIntrinsics(CameraSide side, const CameraIntrinsics &intrinsics) {
+	cameras[side] = intrinsics;
+	rectification();
+}
+
+void StereoCamera::SetExtrinsics(const float *rotation, const float *translation) {
+	memcpy(this->rotation, rotation, 3 * sizeof(float));
+	memcpy(this->translation, translation, 3 * sizeof(float));
+	rectification();
+}
+
+/**
+ * With Rh the rotation over half the angle of R, inverted: R_left = W Rh^T and R_right = W Rh,
+ * then R_right R = R_left, so the rectified frames only differ by the translation R_right T.
+ * W rotates Rh T onto the x-axis. The rectified cameras get the mean focal length and
+ * principal point of the two cameras.
+ */
+void StereoCamera::rectification() {
+	float half[3] = { -rotation[0] / 2, -rotation[1] / 2, -rotation[2] / 2 };
+	float Rh[9];
+	rodrigues(half, Rh);
+	float t[3];
+	for (int i = 0; i < 3; ++i) {
+		t[i] = Rh[i*3] * translation[0] + Rh[i*3+1] * translation[1] + Rh[i*3+2] * translation[2];
+	}
+	float norm = sqrtf(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+	baseline = norm;
+
+	// axis and angle of the rotation of t onto (+-1, 0, 0)
+	float W[9];
+	float u = t[0] > 0 ? 1 : -1;
+	float w[3] = { 0, t[2] * u, -t[1] * u };
+	float wn = sqrtf(w[1] * w[1] + w[2] * w[2]);
+	if (wn > 1e-12 && norm > 0) {
+		float angle = acosf(fabsf(t[0]) / norm);
+		for (int i = 0; i < 3; ++i) w[i] *= angle / wn;
+	} else {
+		w[1] = w[2] = 0;
+	}
+	rodrigues(w, W);
+
+	float RhT[9];
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j) RhT[i*3+j] = Rh[j*3+i];
+	}
+	multiply(W, RhT, R[CS_LEFT]);
+	multiply(W, Rh, R[CS_RIGHT]);
+
+	rectified = CameraIntrinsics();
+	float f = (cameras[0].fx + cameras[0].fy + cameras[1].fx + cameras[1].fy) / 4;
+	rectified.fx = rectified.fy = f;
+	rectified.cx = (cameras[0].cx + cameras[1].cx) / 2;
+	rectified.cy = (cameras[0].cy + cameras[1].cy) / 2;
+}
+
+void StereoCamera::BuildMaps(int width, int height) {
+	for (int s = 0; s < 2; ++s) {
+		maps[s].Build(cameras[s], R[s], rectified, width, height);
+	}
+}
+
+void StereoCamera::Rectify(CameraSide side, CRawImage *img, CRawImage *result) const {
+	assert (img->isMonochrome() && result->isMonochrome());
+	assert (img != result);
+	maps[side].Apply(ImageView(img), ImageView(result));
+}
+
+void StereoCamera::RectifyPoint(CameraSide side, float x, float y, float &rx, float &ry) const {
+	const CameraIntrinsics &c = cameras[side];
+	float xn, yn;
+	c.Undistort((x - c.cx) / c.fx, (y - c.cy) / c.fy, xn, yn);
+	const float *Rs = R[side];
+	float X = Rs[0] * xn + Rs[1] * yn + Rs[2];
+	float Y = Rs[3] * xn + Rs[4] * yn + Rs[5];
+	float Z = Rs[6] * xn + Rs[7] * yn + Rs[8];
+	rx = rectified.fx * X / Z + rectified.cx;
+	ry = rectified.fy * Y / Z + rectified.cy;
+}
@@ -0,0 +1,181 @@
+/**
+ * @brief
+ * @file CameraModel.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 22, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef CAMERAMODEL_H_
+#define CAMERAMODEL_H_
+
+// General files
+#include <vector>
+
+#include <CRawImage.h>
+#include <Pyramid.h>
+
+//! Number of fractional bits of the source coordinates in a remap table
+#define REMAP_BITS			5
+
+/**
+ * Pinhole camera with lens distortion. Normalized coordinates (x,y) are (X/Z, Y/Z) of a point
+ * in the camera frame, pixel coordinates are (fx x + cx, fy y + cy) after distortion. The
+ * distortion model is the common one of Brown: radial with k1, k2, k3 and tangential with p1
+ * and p2.
+ */
+struct CameraIntrinsics {
+	CameraIntrinsics();
+
+	float fx, fy, cx, cy;
+
+	float k1, k2, k3, p1, p2;
+
+	//! Apply the distortion to normalized coordinates
+	void Distort(float x, float y, float &xd, float &yd) const;
+
+	//! Remove the distortion from normalized coordinates, iteratively
+	void Undistort(float xd, float yd, float &x, float &y) const;
+};
+
+/* **************************************************************************************
+ * Interface of RemapTable
+ * **************************************************************************************/
+
+/**
+ * Lookup table that maps every pixel of an output image to a position in a source image,
+ * for undistortion and rectification. The position is stored in fixed point: the offset of
+ * the top-left source pixel and the four bilinear weights, which sum to 1 << (2*REMAP_BITS).
+ * Applying the table interpolates eight pixels at a time with SSE2, only fetching the source
+ * pixels is scalar. Output pixels that map outside the source image are black.
+ */
+class RemapTable {
+public:
+	//! Constructor RemapTable
+	RemapTable();
+
+	//! Destructor ~RemapTable
+	virtual ~RemapTable();
+
+	/**
+	 * Build the table for a camera that is rotated by R (row-major) and then has the
+	 * intrinsics of "target" without distortion, for images of width x height pixels.
+	 */
+	void Build(const CameraIntrinsics &camera, const float *R, const CameraIntrinsics &target,
+			int width, int height);
+
+	inline bool IsBuilt() const { return !offsets.empty(); }
+
+	//! Remap src to dst, both of the size the table is built for, src rows are width apart
+	void Apply(const ImageView &src, const ImageView &dst) const;
+private:
+	int width;
+
+	int height;
+
+	std::vector<int> offsets;
+
+	//! Weights of the top and bottom pixel pairs, interleaved as (left, right)
+	std::vector<short> weightsTop;
+
+	std::vector<short> weightsBottom;
+};
+
+/* **************************************************************************************
+ * Interface of StereoCamera
+ * **************************************************************************************/
+
+enum CameraSide {
+	CS_LEFT,
+	CS_RIGHT
+};
+
+/**
+ * Calibration of a stereo pair and its rectification. The extrinsics map a point from the left
+ * to the right camera frame: X_right = R X_left + T, with R given as a rotation vector (axis
+ * times angle). Rectification rotates both cameras by half of R towards each other and then
+ * such that the baseline is along the x-axis (the method of Bouguet), and gives them the same
+ * intrinsics. Then a point is on the same row in both rectified images. Full frames are
+ * rectified with remap tables that are built once; a few corners can be rectified on their
+ * own with RectifyPoint, which is much cheaper than remapping the frame.
+ *
+ * The configuration file has a key followed by its values on every line, # starts a comment:
+ *   left.intrinsics fx fy cx cy
+ *   left.distortion k1 k2 p1 p2 k3
+ *   right.intrinsics fx fy cx cy
+ *   right.distortion k1 k2 p1 p2 k3
+ *   rotation rx ry rz
+ *   translation tx ty tz
+ */
+class StereoCamera {
+public:
+	//! Constructor StereoCamera
+	StereoCamera();
+
+	//! Destructor ~StereoCamera
+	virtual ~StereoCamera();
+
+	//! Read the calibration from a configuration file, false if it is missing or incomplete
+	bool Load(const char *filename);
+
+	void SetIntrinsics(CameraSide side, const CameraIntrinsics &intrinsics);
+
+	//! Rotation vector and translation from the left to the right camera
+	void SetExtrinsics(const float *rotation, const float *translation);
+
+	inline const CameraIntrinsics & GetIntrinsics(CameraSide side) const { return cameras[side]; }
+
+	//! Intrinsics of both rectified cameras, without distortion
+	inline const CameraIntrinsics & GetRectified() const { return rectified; }
+
+	//! Focal length of the rectified cameras in pixels
+	inline float GetFocal() const { return rectified.fx; }
+
+	//! Distance between the cameras, in the unit of the translation
+	inline float GetBaseline() const { return baseline; }
+
+	//! Build the remap tables for frames of width x height pixels
+	void BuildMaps(int width, int height);
+
+	//! Rectify a grayscale frame of one of the cameras, BuildMaps has to be called before
+	void Rectify(CameraSide side, CRawImage *img, CRawImage *result) const;
+
+	//! Rectify a single point in pixel coordinates
+	void RectifyPoint(CameraSide side, float x, float y, float &rx, float &ry) const;
+protected:
+	//! Calculate the rotations of the cameras and the rectified intrinsics
+	void rectification();
+private:
+	CameraIntrinsics cameras[2];
+
+	float rotation[3];
+
+	float translation[3];
+
+	//! Rotation of every camera frame to the rectified frame, row-major
+	float R[2][9];
+
+	CameraIntrinsics rectified;
+
+	float baseline;
+
+	RemapTable maps[2];
+};
+
+#endif /* CAMERAMODEL_H_ */
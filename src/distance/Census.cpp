@@ -0,0 +1,156 @@
+/**
+ * @brief
+ * @file Census.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 24, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <Census.h>
+
+/* **************************************************************************************
+ * Implementation of Census
+ * **************************************************************************************/
+
+/**
+ * Codes of one row for a window with the given radius. The bytes of the code are built in
+ * bytes[0..bits/8-1], sixteen pixels each, and then written as words of T.
+ */
+template<typename T, int R>
+static void transformRow(const ImageView &img, int y, T *out) {
+	const int width = img.width;
+	const int bytes = ((2*R+1) * (2*R+1) - 1) / 8;
+	const unsigned char *center = img.row(y);
+	int x = 0;
+	for (; x < R; ++x) out[x] = 0;
+#ifdef __SSE2__
+	const __m128i sign = _mm_set1_epi8((char)0x80);
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 16 + R <= width; x += 16) {
+		__m128i c = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(center + x)), sign);
+		__m128i code[8];
+		int bit = 0;
+		__m128i current = zero;
+		for (int dy = -R; dy <= R; ++dy) {
+			const unsigned char *row = img.row(y + dy) + x;
+			for (int dx = -R; dx <= R; ++dx) {
+				if (dy == 0 && dx == 0) continue;
+				__m128i n = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(row + dx)), sign);
+				// neighbour darker than the center, as a mask of 0x00 or 0xFF per pixel
+				__m128i darker = _mm_cmplt_epi8(n, c);
+				current = _mm_or_si128(current, _mm_and_si128(darker, _mm_set1_epi8((char)(1 << (bit & 7)))));
+				if ((++bit & 7) == 0) {
+					code[(bit >> 3) - 1] = current;
+					current = zero;
+				}
+			}
+		}
+		for (int b = bytes; b < 8; ++b) code[b] = zero;
+		if (sizeof(T) == 4) {
+			// bytes 0,1,2,3 of every pixel into 32-bit words
+			__m128i lo01 = _mm_unpacklo_epi8(code[0], code[1]), hi01 = _mm_unpackhi_epi8(code[0], code[1]);
+			__m128i lo23 = _mm_unpacklo_epi8(code[2], code[3]), hi23 = _mm_unpackhi_epi8(code[2], code[3]);
+			_mm_storeu_si128((__m128i*)(out + x), _mm_unpacklo_epi16(lo01, lo23));
+			_mm_storeu_si128((__m128i*)(out + x + 4), _mm_unpackhi_epi16(lo01, lo23));
+			_mm_storeu_si128((__m128i*)(out + x + 8), _mm_unpacklo_epi16(hi01, hi23));
+			_mm_storeu_si128((__m128i*)(out + x + 12), _mm_unpackhi_epi16(hi01, hi23));
+		} else {
+			// bytes 0 to 7 of every pixel into 64-bit words
+			__m128i w16[4][2], w32[2][2];
+			for (int k = 0; k < 4; ++k) {
+				w16[k][0] = _mm_unpacklo_epi8(code[2*k], code[2*k+1]);
+				w16[k][1] = _mm_unpackhi_epi8(code[2*k], code[2*k+1]);
+			}
+			for (int h = 0; h < 2; ++h) {
+				// pixels 8h to 8h+7
+				w32[0][0] = _mm_unpacklo_epi16(w16[0][h], w16[1][h]);
+				w32[0][1] = _mm_unpackhi_epi16(w16[0][h], w16[1][h]);
+				w32[1][0] = _mm_unpacklo_epi16(w16[2][h], w16[3][h]);
+				w32[1][1] = _mm_unpackhi_epi16(w16[2][h], w16[3][h]);
+				T *o = out + x + 8 * h;
+				_mm_storeu_si128((__m128i*)(o), _mm_unpacklo_epi32(w32[0][0], w32[1][0]));
+				_mm_storeu_si128((__m128i*)(o + 2), _mm_unpackhi_epi32(w32[0][0], w32[1][0]));
+				_mm_storeu_si128((__m128i*)(o + 4), _mm_unpacklo_epi32(w32[0][1], w32[1][1]));
+				_mm_storeu_si128((__m128i*)(o + 6), _mm_unpackhi_epi32(w32[0][1], w32[1][1]));
+			}
+		}
+	}
+#endif
+	for (; x < width - R; ++x) {
+		T code = 0;
+		int bit = 0;
+		for (int dy = -R; dy <= R; ++dy) {
+			const unsigned char *row = img.row(y + dy) + x;
+			for (int dx = -R; dx <= R; ++dx) {
+				if (dy == 0 && dx == 0) continue;
+				if (row[dx] < center[x]) code |= (T)1 << bit;
+				++bit;
+			}
+		}
+		out[x] = code;
+	}
+	for (; x < width; ++x) out[x] = 0;
+}
+
+template<typename T, int R>
+static void transform(const ImageView &img, T *out) {
+	const int width = img.width;
+	for (int y = 0; y < img.height; ++y) {
+		if (y < R || y >= img.height - R) {
+			memset(out + y * width, 0, width * sizeof(T));
+			continue;
+		}
+		transformRow<T, R>(img, y, out + y * width);
+	}
+}
+
+void Census::Transform5x5(const ImageView &img, uint32_t *out) {
+	transform<uint32_t, 2>(img, out);
+}
+
+void Census::Transform7x7(const ImageView &img, uint64_t *out) {
+	transform<uint64_t, 3>(img, out);
+}
+
+void Census::Transform5x5(CRawImage *img, uint32_t *out) {
+	assert (img->isMonochrome());
+	Transform5x5(ImageView(img), out);
+}
+
+void Census::Transform7x7(CRawImage *img, uint64_t *out) {
+	assert (img->isMonochrome());
+	Transform7x7(ImageView(img), out);
+}
+
+void Census::Rank(const uint32_t *codes, int count, unsigned char *ranks) {
+	for (int i = 0; i < count; ++i) ranks[i] = (unsigned char)__builtin_popcount(codes[i]);
+}
+
+void Census::Rank(const uint64_t *codes, int count, unsigned char *ranks) {
+	for (int i = 0; i < count; ++i) ranks[i] = (unsigned char)__builtin_popcountll(codes[i]);
+}
@@ -0,0 +1,92 @@
+/**
+ * @brief
+ * @file Census.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 24, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef CENSUS_H_
+#define CENSUS_H_
+
+// General files
+#include <stdint.h>
+
+#include <CRawImage.h>
+#include <Pyramid.h>
+
+/* **************************************************************************************
+ * Interface of Census
+ * **************************************************************************************/
+
+/**
+ * Census transform: every pixel gets a bit string that tells for each pixel in the window
+ * around it whether it is darker than the center. It only depends on the order of the
+ * intensities, so a difference in gain or offset between two cameras does not change it. Two
+ * codes are compared by their Hamming distance, an xor and a population count. The 5x5
+ * window gives 24 bits in a 32-bit word, the 7x7 window 48 bits in a 64-bit word, neighbours
+ * in row-major order with the first in the least significant bit. The rank transform, the
+ * number of darker neighbours, is the population count of the code.
+ *
+ * The transform does sixteen pixels at a time with SSE2: the comparison with one neighbour
+ * gives a byte mask, eight of them are combined into a byte per pixel, and the bytes are
+ * interleaved into the words. Pixels closer to the border than the radius of the window get
+ * code 0.
+ */
+class Census {
+public:
+	//! 5x5 census codes of a grayscale image, out has rows of img.width words
+	static void Transform5x5(const ImageView &img, uint32_t *out);
+
+	//! 7x7 census codes
+	static void Transform7x7(const ImageView &img, uint64_t *out);
+
+	static void Transform5x5(CRawImage *img, uint32_t *out);
+
+	static void Transform7x7(CRawImage *img, uint64_t *out);
+
+	//! Rank transform from the census codes
+	static void Rank(const uint32_t *codes, int count, unsigned char *ranks);
+
+	static void Rank(const uint64_t *codes, int count, unsigned char *ranks);
+
+	static inline int Hamming(uint32_t a, uint32_t b) { return __builtin_popcount(a ^ b); }
+
+	static inline int Hamming(uint64_t a, uint64_t b) { return __builtin_popcountll(a ^ b); }
+
+	/**
+	 * Sum of the Hamming distances over a square window of codes around (x0,y0) in the first
+	 * and (x1,y1) in the second code image, both with rows of stride words. This is the
+	 * matching cost for sparse points, the window has to be inside both images.
+	 */
+	template<typename T>
+	static int WindowCost(const T *codes0, const T *codes1, int stride, int x0, int y0, int x1,
+			int y1, int window) {
+		const int half = window / 2;
+		int cost = 0;
+		for (int r = -half; r <= half; ++r) {
+			const T *a = codes0 + (y0 + r) * stride + x0 - half;
+			const T *b = codes1 + (y1 + r) * stride + x1 - half;
+			for (int c = 0; c < window; ++c) cost += Hamming(a[c], b[c]);
+		}
+		return cost;
+	}
+};
+
+#endif /* CENSUS_H_ */
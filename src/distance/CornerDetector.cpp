@@ -28,9 +28,22 @@
 // Turn on/off saving images to disk
 #define STORE_IMAGES		1
 
-// Use "fast" corner detection (or Harris)
+// Use "fast" corner detection by default (or Harris), see SetMethod
 #define USE_FAST			1
 
+// Sensitivity parameter k of Harris-Stephens, 0.04 to 0.15 according to wikipedia
+#define HARRIS_K			0.04f
+
+// Keep corners with a response of at least this fraction of the maximum response
+#define HARRIS_QUALITY		0.01f
+
+// Half size of the window for subpixel refinement, the window is 2*SUBPIX_WINDOW+1 wide
+#define SUBPIX_WINDOW		4
+
+// Subpixel refinement stops after this number of iterations or if it moves less than epsilon
+#define SUBPIX_ITERATIONS	10
+#define SUBPIX_EPSILON		0.01f
+
 /* **************************************************************************************
  * Includes and typedefs
  * **************************************************************************************/
@@ -40,10 +53,17 @@
 #include <sstream>
 #include <CRawImage.h>
 #include <cassert>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
 
-#include <convolve.h>
+#include <Convolver.h>
 #include <fast/fast.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #if STORE_IMAGES == 0
 #undef STORE_IMAGES
 #endif
@@ -61,13 +81,21 @@ using namespace std;
  * Implementation of CornerDetector
  * **************************************************************************************/
 
-CornerDetector::CornerDetector(): img(NULL), dx(NULL), dy(NULL), ddx(NULL), ddy(NULL),
-		dxy(NULL), dH(NULL), dDisp(NULL), index(0) {
-
+CornerDetector::CornerDetector(): img(NULL), sxx(NULL), syy(NULL), sxy(NULL),
+		response(NULL), dDisp(NULL), index(0), pool(NULL) {
+#ifdef USE_FAST
+	method = CM_FAST;
+#else
+	method = CM_HARRIS;
+#endif
 }
 
 CornerDetector::~CornerDetector() {
-
+	delete [] sxx;
+	delete [] syy;
+	delete [] sxy;
+	delete [] response;
+	delete dDisp;
 }
 
 /**
@@ -85,26 +113,24 @@ void CornerDetector::SetImage(CRawImage *img) {
 	// we do not need to deallocate if new image is same size as old one
 	if (img->getsize() == this->img->getsize()) {
 		cout << "Images are same size as old ones: won't reallocate memory" << endl;
+		this->img = img;
 		return;
 	}
+	this->img = img;
 
 	// delete all temporary images and create anew
 	cout << "Delete old temporary images" << endl;
-	delete [] dx;
-	delete [] dy;
-	delete [] ddx;
-	delete [] ddy;
-	delete [] dxy;
-	delete [] dH;
-	delete [] dDisp;
+	delete [] sxx;
+	delete [] syy;
+	delete [] sxy;
+	delete [] response;
+	delete dDisp;
 create_temps:
 	cout << "Create new temporary images" << endl;
-	dx = new CRawImage(img->getwidth(), img->getheight(), 1);
-	dy = new CRawImage(img->getwidth(), img->getheight(), 1);
-	ddx = new CRawImage(img->getwidth(), img->getheight(), 1);
-	ddy = new CRawImage(img->getwidth(), img->getheight(), 1);
-	dxy = new CRawImage(img->getwidth(), img->getheight(), 1);
-	dH = new CRawImage(img->getwidth(), img->getheight(), 1);
+	sxx = new float[img->getsize()];
+	syy = new float[img->getsize()];
+	sxy = new float[img->getsize()];
+	response = new float[img->getsize()];
 	dDisp = new CRawImage(img->getwidth(), img->getheight(), 1);
 }
 
@@ -140,21 +166,28 @@ void CornerDetector::GetCorners(std::vector<Corner*> & corners) {
 	assert (img->isMonochrome());
 
 	stringstream f;
-	string method;
+	string name;
 	cout << "Detection" << endl;
-#ifdef USE_FAST
-	fast(corners);
-	method = "fast";
-#else
-	harris(corners);
-	method = "harris";
-#endif
+	switch (method) {
+	case CM_FAST:
+		fast(corners);
+		name = "fast";
+		break;
+	case CM_HARRIS:
+		harris(corners);
+		name = "harris";
+		break;
+	case CM_SHI_TOMASI:
+		harris(corners);
+		name = "shi_tomasi";
+		break;
+	}
 
 	DrawCorners(corners, dDisp);
 
 #ifdef STORE_IMAGES
 	f.clear(); f.str("");
-	f << "corners_" << method << '_' << ++index << ".bmp";
+	f << "corners_" << name << '_' << ++index << ".bmp";
 	cout << __func__ << ": save " << f.str() << endl;
 	dDisp->saveBmp(f.str().c_str());
 #endif
@@ -163,82 +196,163 @@ void CornerDetector::GetCorners(std::vector<Corner*> & corners) {
 }
 
 /**
- * Harris corner detector, or Shi-Tomaso, etc.
+ * FAST is only run on the patches. Harris and Shi-Tomasi need the maximum response over the
+ * whole image for their threshold, so there the corners of the whole image are filtered.
  */
-void CornerDetector::harris(std::vector<Corner*> &corners) {
+void CornerDetector::GetCorners(const std::vector<Patch> & patches, std::vector<Corner*> & corners) {
+	if (!img) {
+		cerr << __func__ << "First set image" << endl;
+		assert(false);
+	}
+	assert (img->isMonochrome());
 
-#ifdef LOWER_HARRIS_ACCURACY
-	//5-tap derivative coefficients for 2 derivatives
-	unsigned char ntap = 5;
-	float p[]  = {0.030320,  0.249724,  0.439911,  0.249724,  0.030320};
-	float d1[] = {0.104550,  0.292315,  0.000000, -0.292315, -0.104550};
-	float d2[] = {0.232905,  0.002668, -0.471147,  0.002668,  0.232905};
-#else
-	unsigned char ntap = 7;
-    float p[]  = { 0.004711,  0.069321,  0.245410,  0.361117,  0.245410,  0.069321,  0.004711 };
-    float d1[] = { 0.018708,  0.125376,  0.193091,  0.000000, -0.193091, -0.125376, -0.018708 };
-    float d2[] = { 0.055336,  0.137778, -0.056554, -0.273118, -0.056554,  0.137778,  0.055336 };
+	if (method == CM_FAST) {
+		for (unsigned int p = 0; p < patches.size(); ++p) {
+			fast(corners, patches[p]);
+		}
+		return;
+	}
+
+	std::vector<Corner*> all;
+	harris(all);
+	for (unsigned int c = 0; c < all.size(); ++c) {
+		bool inside = false;
+		for (unsigned int p = 0; p < patches.size() && !inside; ++p) {
+			const Patch &patch = patches[p];
+			inside = (all[c]->x >= patch.x && all[c]->x < patch.x + patch.width &&
+					all[c]->y >= patch.y && all[c]->y < patch.y + patch.height);
+		}
+		if (inside) corners.push_back(all[c]);
+		else delete all[c];
+	}
+}
+
+/**
+ * Turn the gradients in sxx (gx) and syy (gy) into the products of the structure tensor,
+ * in place: sxx = gx*gx, syy = gy*gy, sxy = gx*gy.
+ */
+static void gradientProducts(float *sxx, float *syy, float *sxy, int size) {
+	int i = 0;
+#ifdef __SSE2__
+	for (; i + 4 <= size; i += 4) {
+		__m128 gx = _mm_loadu_ps(sxx + i);
+		__m128 gy = _mm_loadu_ps(syy + i);
+		_mm_storeu_ps(sxy + i, _mm_mul_ps(gx, gy));
+		_mm_storeu_ps(sxx + i, _mm_mul_ps(gx, gx));
+		_mm_storeu_ps(syy + i, _mm_mul_ps(gy, gy));
+	}
 #endif
+	for (; i < size; ++i) {
+		float gx = sxx[i], gy = syy[i];
+		sxy[i] = gx * gy;
+		sxx[i] = gx * gx;
+		syy[i] = gy * gy;
+	}
+}
+
+/**
+ * Corner response from the windowed structure tensor A = [sxx sxy; sxy syy]. Harris-Stephens
+ * uses the determinant and the trace, det(A) - k trace(A)^2. Shi-Tomasi uses the smallest
+ * eigenvalue, trace/2 - sqrt((sxx-syy)^2/4 + sxy^2). Returns the maximum response.
+ */
+static float cornerResponse(const float *sxx, const float *syy, const float *sxy, float *response,
+		int size, bool shi_tomasi) {
+	const float k = HARRIS_K;
+	float max = 0;
+	int i = 0;
+#ifdef __SSE2__
+	__m128 vmax = _mm_setzero_ps();
+	const __m128 vk = _mm_set1_ps(k);
+	const __m128 half = _mm_set1_ps(0.5f);
+	for (; i + 4 <= size; i += 4) {
+		__m128 a = _mm_loadu_ps(sxx + i);
+		__m128 c = _mm_loadu_ps(syy + i);
+		__m128 b = _mm_loadu_ps(sxy + i);
+		__m128 r;
+		if (shi_tomasi) {
+			__m128 mean = _mm_mul_ps(_mm_add_ps(a, c), half);
+			__m128 diff = _mm_mul_ps(_mm_sub_ps(a, c), half);
+			r = _mm_sub_ps(mean, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(diff, diff), _mm_mul_ps(b, b))));
+		} else {
+			__m128 trace = _mm_add_ps(a, c);
+			__m128 det = _mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, b));
+			r = _mm_sub_ps(det, _mm_mul_ps(vk, _mm_mul_ps(trace, trace)));
+		}
+		_mm_storeu_ps(response + i, r);
+		vmax = _mm_max_ps(vmax, r);
+	}
+	float m[4];
+	_mm_storeu_ps(m, vmax);
+	for (int j = 0; j < 4; ++j) if (m[j] > max) max = m[j];
+#endif
+	for (; i < size; ++i) {
+		float a = sxx[i], b = sxy[i], c = syy[i];
+		float r;
+		if (shi_tomasi) {
+			float diff = (a - c) * 0.5f;
+			r = (a + c) * 0.5f - sqrt(diff * diff + b * b);
+		} else {
+			r = (a * c - b * b) - k * (a + c) * (a + c);
+		}
+		response[i] = r;
+		if (r > max) max = r;
+	}
+	return max;
+}
+
+/**
+ * Harris corner detector, or Shi-Tomasi.
+ *
+ * The gradients are obtained with the 5 or 7 tap derivative filters, see
+ * http://www.csse.uwa.edu.au/~pk/research/matlabfns/Spatial/derivative5.m
+ * The products of the gradients are windowed with a Gaussian, which gives the "structure
+ * tensor" http://en.wikipedia.org/wiki/Corner_detection or the "Harris matrix" A.
+ */
+void CornerDetector::harris(std::vector<Corner*> &corners) {
+	int width = img->getwidth();
+	int height = img->getheight();
+	int size = img->getsize();
+
+	// only first derivatives are needed, both in one pass
 	cout << __func__ << ": convolve" << endl;
 	bool success;
-	success = convolve2DSeparable(img->data, dx->data, img->getwidth(), img->getheight(), p, ntap, d1, ntap);
+	success = gradients.Gradients(img->data, sxx, syy, width, height, pool);
 	assert (success);
-	// we don't need dy but it would be d1,ntap,p,ntap
-	cout << __func__ << ": convolve" << endl;
-	success = convolve2DSeparable(img->data, dy->data, img->getwidth(), img->getheight(), d1, ntap, p, ntap);
-	cout << __func__ << ": convolve" << endl;
-	convolve2DSeparable(img->data, ddx->data, img->getwidth(), img->getheight(), p, ntap, d2, ntap);
-	cout << __func__ << ": convolve" << endl;
-	convolve2DSeparable(img->data, ddy->data, img->getwidth(), img->getheight(), d2, ntap, p, ntap);
-	cout << __func__ << ": convolve" << endl;
-	convolve2DSeparable(dx->data, dxy->data, img->getwidth(), img->getheight(), d1, ntap, p, ntap);
-
-	// We now have the "structure tensor" http://en.wikipedia.org/wiki/Corner_detection
-	// or in other wards the "Harris matrix"
-
-	// I don't know why there is first a convolution according to the Shi and Tomasi
-	// operator and afterwards a convolution with a Gaussian filter.
-	// A 2D Gaussian filter http://www.librow.com/articles/article-9 is also separable
-	// and it would be better to incorporate that at once in the Hessian itself
-	// for now I just skip it
-//#define HARRIS_STEPHEN
-
-	// now we have to calculate \gamma_1 * \gamma_2 - k ( \gamma_1 + gamma_2 )^2
-	// this does not need to calculate the eigenvalue decomposition of A, but only the determinant and the trace
-	// it is also possible to avoid to have a parameter k, by using a harmonic mean of the eigenvalues
-
-#ifdef HARRIS_STEPHEN
-	// this one fails because we are working with chars
-	float k = 0.04; // 0.04 to 0.15 according to wikipedia
-	cout << __func__ << ": write dH" << endl;
-	for (int i = 0; i < img->getsize(); ++i) {
-		dH->data[i] = (ddx->data[i]*ddy->data[i] - dxy->data[i]*dxy->data[i]) \
-				- k * (ddx->data[i]+ddy->data[i])*(ddx->data[i]+ddy->data[i]);
-		if (ddx->data[i]*ddy->data[i] - dxy->data[i]*dxy->data[i] > 255) {
-			cerr << "Error, reached limit: " << ddx->data[i]*ddy->data[i] - dxy->data[i]*dxy->data[i] << endl;
-			cerr << " but minus " << k * (ddx->data[i]+ddy->data[i])*(ddx->data[i]+ddy->data[i]) << endl;
-			cerr << " makes finally " << (int)dH->data[i] << endl;
-		}
-	}
-#else
-	unsigned char eps = 5;
-	for (int i = 0; i < img->getsize(); ++i) {
-		dH->data[i] = (ddx->data[i] * ddy->data[i] - dxy->data[i] * dxy->data[i]) \
-				/ (ddx->data[i] + ddy->data[i] + eps);
+
+	gradientProducts(sxx, syy, sxy, size);
+
+	// a 2D Gaussian filter is separable as well, http://www.librow.com/articles/article-9
+	// this can not work in place, so the response plane is used as output and the planes are
+	// swapped afterwards
+	float **planes[] = { &sxx, &syy, &sxy };
+	for (int i = 0; i < 3; ++i) {
+		float *plane = *planes[i];
+		success = window.Convolve(plane, response, width, height, pool);
+		assert (success);
+		*planes[i] = response;
+		response = plane;
 	}
-#endif
-	// http://www.csse.uwa.edu.au/~pk/research/matlabfns/Spatial/nonmaxsuppts.m
 
-	// Shi and Tomasi computes min(\gamma_1,\gamma_2) (the minimum of the eigenvalues)
-	// which seems to be better, but is computationally more expensive than determining the determinant and trace
+	// Harris-Stephens only needs the determinant and the trace, not the eigenvalues, Shi-Tomasi
+	// computes min(\gamma_1,\gamma_2) which is a bit more expensive but seems to be better
+	float max = cornerResponse(sxx, syy, sxy, response, size, method == CM_SHI_TOMASI);
+	if (max <= 0) return;
+	float threshold = HARRIS_QUALITY * max;
 
-	int threshold = 80;
-	for (int i = 1; i < img->getwidth()-1; ++i) {
-		for (int j = 1; j < img->getheight()-1; ++j) {
-			int total = dH->data[i+j*img->getwidth()];
-			if (total > threshold) {
-				AddCorner(corners,i,j);
-			}
+	// non-maximum suppression in a 3x3 neighbourhood, row by row
+	// http://www.csse.uwa.edu.au/~pk/research/matlabfns/Spatial/nonmaxsuppts.m
+	for (int j = 1; j < height-1; ++j) {
+		const float *above = response + (j-1)*width;
+		const float *row = response + j*width;
+		const float *below = response + (j+1)*width;
+		for (int i = 1; i < width-1; ++i) {
+			float r = row[i];
+			if (r <= threshold) continue;
+			// strict on one side, so plateaus give a single corner
+			if (r < row[i+1] || r <= row[i-1]) continue;
+			if (r < below[i-1] || r < below[i] || r < below[i+1]) continue;
+			if (r <= above[i-1] || r <= above[i] || r <= above[i+1]) continue;
+			AddCorner(corners,i,j);
 		}
 	}
 }
@@ -248,15 +362,151 @@ void CornerDetector::harris(std::vector<Corner*> &corners) {
  * Either with respect to default versus _nonmax versions. Or with respect to fast9, fast... versions.
  */
 void CornerDetector::fast(std::vector<Corner*> &corners) {
+	Patch all;
+	all.x = all.y = 0;
+	all.width = img->getwidth();
+	all.height = img->getheight();
+	fast(corners, all);
+}
+
+/**
+ * The segment test needs a circle with a radius of 3 pixels, so the library skips 3 pixels at
+ * the border. The patch is extended by that, as far as the image allows, so corners at the
+ * edge of the patch are found as well.
+ */
+void CornerDetector::fast(std::vector<Corner*> &corners, const Patch &patch) {
+	const int border = 3;
+	const int width = img->getwidth();
+	int x0 = std::max(patch.x - border, 0);
+	int y0 = std::max(patch.y - border, 0);
+	int x1 = std::min(patch.x + patch.width + border, width);
+	int y1 = std::min(patch.y + patch.height + border, img->getheight());
+	if (x1 - x0 <= 2 * border || y1 - y0 <= 2 * border) return;
+
 	int numcorners;
 	xy* xycorn;
 	//xycorn = fast11_detect_nonmax(img->data, img->getwidth(), img->getheight(), img->getwidth(), 100, &numcorners);
-	xycorn = fast11_detect(img->data, img->getwidth(), img->getheight(), img->getwidth(), 20, &numcorners);
+	xycorn = fast11_detect(img->data + y0 * width + x0, x1 - x0, y1 - y0, width, 20, &numcorners);
 	for (int p = 0; p < numcorners; ++p) {
-		int i = xycorn[p].x;
-		int j = xycorn[p].y;
+		int i = x0 + xycorn[p].x;
+		int j = y0 + xycorn[p].y;
+		if (i < patch.x || i >= patch.x + patch.width) continue;
+		if (j < patch.y || j >= patch.y + patch.height) continue;
 		AddCorner(corners, i, j);
 	}
+	free(xycorn);
+}
+
+void CornerDetector::RefineCorners(std::vector<Corner*> & corners) {
+	assert (img != NULL);
+	for (unsigned int i = 0; i < corners.size(); ++i) {
+		if (!refine(corners[i])) {
+			corners[i]->sx = corners[i]->x;
+			corners[i]->sy = corners[i]->y;
+		}
+	}
+}
+
+/**
+ * At a corner every gradient g in the window is orthogonal to the vector from the corner q to
+ * its pixel p: g^T (p - q) = 0. In the least squares sense q solves (sum g g^T) q = sum
+ * g g^T p, with a Gaussian weight on the pixels. The window is interpolated bilinearly around
+ * the current estimate and the system is solved again until q stops moving. The sums are
+ * accumulated four pixels at a time, the rows are padded with zero weights to a multiple of
+ * four.
+ */
+bool CornerDetector::refine(Corner *corner) {
+	const int win = SUBPIX_WINDOW, size = 2 * win + 1;
+	const int padded = (size + 3) & ~3;
+	const int width = img->getwidth(), height = img->getheight();
+	// patch has a border of one pixel for the central differences
+	float patch[(size + 2) * (padded + 2)];
+	float weights[size * padded];
+	float offsets[padded];
+	for (int c = 0; c < padded; ++c) offsets[c] = c - win;
+	for (int r = 0; r < size; ++r) {
+		for (int c = 0; c < padded; ++c) {
+			float dx = c - win, dy = r - win;
+			weights[r * padded + c] = (c < size) ? expf(-(dx * dx + dy * dy) / (win * win)) : 0;
+		}
+	}
+
+	const int stride = padded + 2;
+	float qx = corner->x, qy = corner->y;
+	for (int it = 0; it < SUBPIX_ITERATIONS; ++it) {
+		int ix = (int)floorf(qx), iy = (int)floorf(qy);
+		if (ix - win - 1 < 0 || iy - win - 1 < 0) return false;
+		if (ix + win + padded - size + 2 >= width || iy + win + 2 >= height) return false;
+		float ax = qx - ix, ay = qy - iy;
+		float w00 = (1 - ax) * (1 - ay), w01 = ax * (1 - ay), w10 = (1 - ax) * ay, w11 = ax * ay;
+		for (int r = 0; r < size + 2; ++r) {
+			const unsigned char *s0 = img->data + (iy - win - 1 + r) * width + ix - win - 1;
+			const unsigned char *s1 = s0 + width;
+			float *p = patch + r * stride;
+			for (int c = 0; c < stride; ++c) {
+				p[c] = w00 * s0[c] + w01 * s0[c+1] + w10 * s1[c] + w11 * s1[c+1];
+			}
+		}
+
+		// window coordinates of the pixels relative to the current estimate
+		float a = 0, b = 0, c = 0, bb1 = 0, bb2 = 0;
+#ifdef __SSE2__
+		__m128 sa = _mm_setzero_ps(), sb = _mm_setzero_ps(), sc = _mm_setzero_ps();
+		__m128 sb1 = _mm_setzero_ps(), sb2 = _mm_setzero_ps();
+		const __m128 half = _mm_set1_ps(0.5f);
+		for (int r = 0; r < size; ++r) {
+			const float *above = patch + r * stride + 1, *row = above + stride, *below = row + stride;
+			const __m128 py = _mm_set1_ps((float)(r - win));
+			for (int k = 0; k < padded; k += 4) {
+				__m128 gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + k + 1), _mm_loadu_ps(row + k - 1)), half);
+				__m128 gy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(below + k), _mm_loadu_ps(above + k)), half);
+				__m128 w = _mm_loadu_ps(weights + r * padded + k);
+				__m128 px = _mm_loadu_ps(offsets + k);
+				__m128 gxx = _mm_mul_ps(_mm_mul_ps(gx, gx), w);
+				__m128 gxy = _mm_mul_ps(_mm_mul_ps(gx, gy), w);
+				__m128 gyy = _mm_mul_ps(_mm_mul_ps(gy, gy), w);
+				sa = _mm_add_ps(sa, gxx);
+				sb = _mm_add_ps(sb, gxy);
+				sc = _mm_add_ps(sc, gyy);
+				sb1 = _mm_add_ps(sb1, _mm_add_ps(_mm_mul_ps(gxx, px), _mm_mul_ps(gxy, py)));
+				sb2 = _mm_add_ps(sb2, _mm_add_ps(_mm_mul_ps(gxy, px), _mm_mul_ps(gyy, py)));
+			}
+		}
+		float sum[4];
+		_mm_storeu_ps(sum, sa); a = sum[0] + sum[1] + sum[2] + sum[3];
+		_mm_storeu_ps(sum, sb); b = sum[0] + sum[1] + sum[2] + sum[3];
+		_mm_storeu_ps(sum, sc); c = sum[0] + sum[1] + sum[2] + sum[3];
+		_mm_storeu_ps(sum, sb1); bb1 = sum[0] + sum[1] + sum[2] + sum[3];
+		_mm_storeu_ps(sum, sb2); bb2 = sum[0] + sum[1] + sum[2] + sum[3];
+#else
+		for (int r = 0; r < size; ++r) {
+			const float *above = patch + r * stride + 1, *row = above + stride, *below = row + stride;
+			float py = r - win;
+			for (int k = 0; k < size; ++k) {
+				float gx = (row[k+1] - row[k-1]) * 0.5f, gy = (below[k] - above[k]) * 0.5f;
+				float w = weights[r * padded + k], px = offsets[k];
+				float gxx = gx * gx * w, gxy = gx * gy * w, gyy = gy * gy * w;
+				a += gxx;
+				b += gxy;
+				c += gyy;
+				bb1 += gxx * px + gxy * py;
+				bb2 += gxy * px + gyy * py;
+			}
+		}
+#endif
+		float det = a * c - b * b;
+		if (fabsf(det) <= 1e-6f * (a * c + 1e-12f)) return false;
+		float dx = (c * bb1 - b * bb2) / det;
+		float dy = (a * bb2 - b * bb1) / det;
+		qx += dx;
+		qy += dy;
+		if (dx * dx + dy * dy < SUBPIX_EPSILON * SUBPIX_EPSILON) break;
+	}
+	// a corner that moved more than the window is not the same corner
+	if (fabsf(qx - corner->x) > win || fabsf(qy - corner->y) > win) return false;
+	corner->sx = qx;
+	corner->sy = qy;
+	return true;
 }
 
 void CornerDetector::DrawCorners(std::vector<Corner*> & corners, CRawImage *result) {
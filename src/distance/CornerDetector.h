@@ -30,11 +30,16 @@
 
 //#include <common/CRawImage.h>
 #include <CRawImage.h>
+#include <Convolver.h>
+#include <ThreadPool.h>
 
 struct Corner {
-	Corner(int x, int y): x(x), y(y) {}
+	Corner(int x, int y): x(x), y(y), sx(x), sy(y) {}
 	int x;
 	int y;
+	//! Position with subpixel precision, the same as (x,y) until it is refined
+	float sx;
+	float sy;
 };
 
 struct Patch {
@@ -44,6 +49,13 @@ struct Patch {
 	int height;
 };
 
+//! The available corner detectors
+enum CornerMethod {
+	CM_FAST,                   //! FAST segment test (fast11)
+	CM_HARRIS,                 //! Harris-Stephens, det(A) - k trace(A)^2
+	CM_SHI_TOMASI,             //! Shi-Tomasi, minimum eigenvalue of A
+};
+
 /* **************************************************************************************
  * Interface of CornerDetector
  * **************************************************************************************/
@@ -59,12 +71,24 @@ public:
 	//! Set image for corner detection
 	void SetImage(CRawImage *img);
 
+	//! Select the corner detector to be used by GetCorners
+	inline void SetMethod(CornerMethod method) { this->method = method; }
+
+	//! Get the selected corner detector
+	inline CornerMethod GetMethod() { return method; }
+
+	//! Use the threads of the given pool for the convolutions (not deallocated by the detector)
+	inline void SetThreadPool(ThreadPool *pool) { this->pool = pool; }
+
 	//! Get all the corners
 	void GetCorners(std::vector<Corner*> & corners);
 
 	//! Get only the corners in the corresponding patches (rectangular regions)
 	void GetCorners(const std::vector<Patch> & patches, std::vector<Corner*> & corners);
 
+	//! Refine the position of the corners to subpixel precision, in sx and sy
+	void RefineCorners(std::vector<Corner*> & corners);
+
 	//! Draw the corners to a canvas
 	void DrawCorners(std::vector<Corner*> & corners, CRawImage *result);
 protected:
@@ -75,17 +99,40 @@ protected:
 
 	void fast(std::vector<Corner*> &corners);
 
+	//! Refine a single corner, false if it does not converge
+	bool refine(Corner *corner);
+
+	//! Run FAST on a part of the image only
+	void fast(std::vector<Corner*> &corners, const Patch &patch);
+
 private:
 	//! Original image
 	CRawImage *img;
 
-	//! Temporary image structures to store gradients etc.
-	CRawImage *dx, *dy, *ddx, *ddy, *dxy, *dH;
+	//! Structure tensor, sxx and syy are first used to store the gradients gx and gy
+	float *sxx, *syy, *sxy;
+
+	//! Corner response
+	float *response;
+
+	//! 5 or 7-tap derivative filters, with the coefficients known at compile time
+#ifdef LOWER_HARRIS_ACCURACY
+	FixedGradients<SmoothKernel5, DerivativeKernel5> gradients;
+#else
+	FixedGradients<SmoothKernel7, DerivativeKernel7> gradients;
+#endif
+
+	//! Gaussian window with sigma = 1.5
+	FixedConvolver<GaussianKernel7, GaussianKernel7> window;
 
 	//! Display results
 	CRawImage *dDisp;
 
 	int index;
+
+	CornerMethod method;
+
+	ThreadPool *pool;
 };
 
 
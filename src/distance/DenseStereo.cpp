@@ -0,0 +1,405 @@
+/**
+ * @brief
+ * @file DenseStereo.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 23, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <DenseStereo.h>
+#include <Census.h>
+#include <ThreadPool.h>
+
+//! Bands get at least this number of rows
+#define DENSE_MIN_BAND_ROWS		16
+
+/* **************************************************************************************
+ * Implementation of DenseStereo
+ * **************************************************************************************/
+
+DenseStereo::DenseStereo(int disparities, int window): maxDifference(1), bandRows(0),
+		cost(DC_SAD), pool(NULL) {
+	SetDisparities(disparities);
+	SetWindow(window);
+}
+
+DenseStereo::~DenseStereo() {
+
+}
+
+void DenseStereo::SetDisparities(int disparities) {
+	assert (disparities > 0);
+	this->disparities = (disparities + 15) & ~15;
+}
+
+void DenseStereo::SetWindow(int window) {
+	assert (window > 0 && window <= DENSE_MAX_WINDOW && (window % 2) == 1);
+	this->window = window;
+}
+
+void DenseStereo::Compute(const ImageView &left, const ImageView &right,
+		std::vector<short> & disparity) {
+	disparity.resize(left.width * left.height);
+	Compute(left, right, &disparity[0]);
+}
+
+void DenseStereo::Compute(const ImageView &left, const ImageView &right, short *disparity) {
+	assert (left.width == right.width && left.height == right.height);
+	const int width = left.width, D = disparities;
+	int threads = pool ? pool->GetThreadCount() : 1;
+	workspaces.resize(threads);
+	for (int t = 0; t < threads; ++t) {
+		Workspace &ws = workspaces[t];
+		ws.columns.resize(width * D);
+		ws.sums.resize(D);
+		ws.reversed.resize(width + D);
+		ws.reversedOld.resize(width + D);
+		ws.rightCost.resize(width + D);
+		ws.rightDisparity.resize(width + D);
+	}
+
+	const int size = width * left.height;
+	if (cost == DC_CENSUS5) {
+		codes5[0].resize(size);
+		codes5[1].resize(size);
+		Census::Transform5x5(left, &codes5[0][0]);
+		Census::Transform5x5(right, &codes5[1][0]);
+	} else if (cost == DC_CENSUS7) {
+		codes7[0].resize(size);
+		codes7[1].resize(size);
+		Census::Transform7x7(left, &codes7[0][0]);
+		Census::Transform7x7(right, &codes7[1][0]);
+	}
+
+	Job job;
+	job.self = this;
+	job.left = &left;
+	job.right = &right;
+	job.disparity = disparity;
+	job.bandRows = bandRows;
+	if (job.bandRows <= 0) {
+		job.bandRows = std::max((left.height + 2 * threads - 1) / (2 * threads), DENSE_MIN_BAND_ROWS);
+	}
+	int bands = (left.height + job.bandRows - 1) / job.bandRows;
+	if (pool) {
+		pool->ParallelFor(bands, &DenseStereo::band, &job);
+	} else {
+		for (int b = 0; b < bands; ++b) band(b, 0, &job);
+	}
+}
+
+void DenseStereo::band(int task, int thread, void *arg) {
+	const Job &job = *(const Job*)arg;
+	int y0 = task * job.bandRows;
+	int y1 = std::min(y0 + job.bandRows, job.left->height);
+	job.self->band(*job.left, *job.right, job.disparity, y0, y1, job.self->workspaces[thread]);
+}
+
+/**
+ * The column sums of the first row of the band are built from scratch, after that every row
+ * costs one row of additions and one of subtractions. Rows above and below the image are
+ * replicated.
+ */
+void DenseStereo::band(const ImageView &left, const ImageView &right, short *disparity,
+		int y0, int y1, Workspace &ws) {
+	const int half = window / 2, last = left.height - 1;
+	std::fill(ws.columns.begin(), ws.columns.end(), 0);
+	for (int r = -half; r <= half; ++r) {
+		accumulate(left, right, std::min(std::max(y0 + r, 0), last), -1, ws);
+	}
+	for (int y = y0; y < y1; ++y) {
+		if (y > y0) {
+			accumulate(left, right, std::min(y + half, last), std::max(y - half - 1, 0), ws);
+		}
+		select(left, disparity + y * left.width, ws);
+	}
+}
+
+void DenseStereo::accumulate(const ImageView &left, const ImageView &right, int in, int out,
+		Workspace &ws) {
+	switch (cost) {
+	case DC_SAD:
+		accumulateSAD(left, right, in, out, ws);
+		break;
+	case DC_CENSUS5:
+		accumulateCensus(&codes5[0][0], &codes5[1][0], left.width, in, out, ws);
+		break;
+	case DC_CENSUS7:
+		accumulateCensus(&codes7[0][0], &codes7[1][0], left.width, in, out, ws);
+		break;
+	}
+}
+
+/**
+ * With the right row reversed, reversed[width-1-x+d] is right[x-d], so the costs of sixteen
+ * consecutive disparities of a pixel are the absolute differences of one byte with sixteen
+ * contiguous bytes. Pixels left of the image are replicated from the first column. The 16-bit
+ * sums wrap around when a row is subtracted before it is added, that is harmless because the
+ * end result is in range.
+ */
+void DenseStereo::accumulateSAD(const ImageView &left, const ImageView &right, int in, int out,
+		Workspace &ws) {
+	const int width = left.width, D = disparities;
+	unsigned char *reversed = (unsigned char*)&ws.reversed[0];
+	unsigned char *reversedOld = (unsigned char*)&ws.reversedOld[0];
+	const unsigned char *rowIn = right.row(in);
+	for (int j = 0; j < width + D; ++j) {
+		reversed[j] = rowIn[std::max(width - 1 - j, 0)];
+	}
+	const unsigned char *lIn = left.row(in), *lOut = NULL;
+	if (out >= 0) {
+		const unsigned char *rowOut = right.row(out);
+		for (int j = 0; j < width + D; ++j) {
+			reversedOld[j] = rowOut[std::max(width - 1 - j, 0)];
+		}
+		lOut = left.row(out);
+	}
+	unsigned short *columns = &ws.columns[0];
+	for (int x = 0; x < width; ++x) {
+		unsigned short *c = columns + x * D;
+		const unsigned char *rIn = reversed + width - 1 - x;
+		const unsigned char *rOut = reversedOld + width - 1 - x;
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i a = _mm_set1_epi8((char)lIn[x]);
+		const __m128i b = _mm_set1_epi8((char)(lOut ? lOut[x] : 0));
+		for (int d = 0; d < D; d += 16) {
+			__m128i r = _mm_loadu_si128((const __m128i*)(rIn + d));
+			__m128i cost = _mm_or_si128(_mm_subs_epu8(a, r), _mm_subs_epu8(r, a));
+			__m128i lo = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(c + d)), _mm_unpacklo_epi8(cost, zero));
+			__m128i hi = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(c + d + 8)), _mm_unpackhi_epi8(cost, zero));
+			if (lOut) {
+				r = _mm_loadu_si128((const __m128i*)(rOut + d));
+				cost = _mm_or_si128(_mm_subs_epu8(b, r), _mm_subs_epu8(r, b));
+				lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(cost, zero));
+				hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(cost, zero));
+			}
+			_mm_storeu_si128((__m128i*)(c + d), lo);
+			_mm_storeu_si128((__m128i*)(c + d + 8), hi);
+		}
+#else
+		for (int d = 0; d < D; ++d) {
+			int sum = c[d] + abs(lIn[x] - rIn[d]);
+			if (lOut) sum -= abs(lOut[x] - rOut[d]);
+			c[d] = (unsigned short)sum;
+		}
+#endif
+	}
+}
+
+#ifdef __SSE2__
+//! Number of set bits in every byte
+static inline __m128i popcountBytes(__m128i v) {
+	const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0F);
+	v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), m1));
+	v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi16(v, 2), m2));
+	return _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi16(v, 4)), m4);
+}
+
+//! Hamming distances of a code with eight codes, as 16-bit values
+static inline __m128i hamming8(uint32_t a, const uint32_t *b) {
+	const __m128i code = _mm_set1_epi32((int)a), low = _mm_set1_epi32(0xFF);
+	__m128i h[2];
+	for (int k = 0; k < 2; ++k) {
+		__m128i v = popcountBytes(_mm_xor_si128(code, _mm_loadu_si128((const __m128i*)(b + 4*k))));
+		v = _mm_add_epi8(v, _mm_srli_epi32(v, 8));
+		v = _mm_add_epi8(v, _mm_srli_epi32(v, 16));
+		h[k] = _mm_and_si128(v, low);
+	}
+	return _mm_packs_epi32(h[0], h[1]);
+}
+
+static inline __m128i hamming8(uint64_t a, const uint64_t *b) {
+	const __m128i code = _mm_set1_epi64x((long long)a), zero = _mm_setzero_si128();
+	__m128i h[4];
+	for (int k = 0; k < 4; ++k) {
+		__m128i v = popcountBytes(_mm_xor_si128(code, _mm_loadu_si128((const __m128i*)(b + 2*k))));
+		// sums of the bytes in both 64-bit halves, in 32-bit lanes 0 and 2
+		h[k] = _mm_shuffle_epi32(_mm_sad_epu8(v, zero), _MM_SHUFFLE(3, 1, 2, 0));
+	}
+	return _mm_packs_epi32(_mm_unpacklo_epi64(h[0], h[1]), _mm_unpacklo_epi64(h[2], h[3]));
+}
+#endif
+
+/**
+ * The same as the absolute differences, with the right row of codes reversed. SSE2 has no
+ * population count, so the bits are counted per byte with shifts and masks, and the bytes
+ * are summed per code.
+ */
+template<typename T>
+void DenseStereo::accumulateCensus(const T *left, const T *right, int width, int in, int out,
+		Workspace &ws) {
+	const int D = disparities;
+	T *reversed = (T*)&ws.reversed[0];
+	T *reversedOld = (T*)&ws.reversedOld[0];
+	const T *rowIn = right + in * width;
+	for (int j = 0; j < width + D; ++j) {
+		reversed[j] = rowIn[std::max(width - 1 - j, 0)];
+	}
+	const T *lIn = left + in * width, *lOut = NULL;
+	if (out >= 0) {
+		const T *rowOut = right + out * width;
+		for (int j = 0; j < width + D; ++j) {
+			reversedOld[j] = rowOut[std::max(width - 1 - j, 0)];
+		}
+		lOut = left + out * width;
+	}
+	unsigned short *columns = &ws.columns[0];
+	for (int x = 0; x < width; ++x) {
+		unsigned short *c = columns + x * D;
+		const T *rIn = reversed + width - 1 - x;
+		const T *rOut = reversedOld + width - 1 - x;
+#ifdef __SSE2__
+		for (int d = 0; d < D; d += 8) {
+			__m128i sum = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(c + d)), hamming8(lIn[x], rIn + d));
+			if (lOut) sum = _mm_sub_epi16(sum, hamming8(lOut[x], rOut + d));
+			_mm_storeu_si128((__m128i*)(c + d), sum);
+		}
+#else
+		for (int d = 0; d < D; ++d) {
+			int sum = c[d] + Census::Hamming(lIn[x], rIn[d]);
+			if (lOut) sum -= Census::Hamming(lOut[x], rOut[d]);
+			c[d] = (unsigned short)sum;
+		}
+#endif
+	}
+}
+
+/**
+ * The window sum along the row is updated incrementally from the column sums, columns left
+ * and right of the image are replicated. Pixel x can have a disparity up to x. The best
+ * disparity of every pixel of the right row is collected along the way: the cost of right
+ * pixel x-d at disparity d is the cost of left pixel x at d.
+ */
+void DenseStereo::select(const ImageView &left, short *disparity, Workspace &ws) {
+	const int width = left.width, D = disparities, half = window / 2;
+	const unsigned short *columns = &ws.columns[0];
+	unsigned short *sums = &ws.sums[0];
+	std::fill(ws.rightCost.begin(), ws.rightCost.end(), 0xFFFF);
+	std::fill(ws.rightDisparity.begin(), ws.rightDisparity.end(), -1);
+
+	std::fill(ws.sums.begin(), ws.sums.end(), 0);
+	for (int k = -half; k <= half; ++k) {
+		const unsigned short *c = columns + std::min(std::max(k, 0), width - 1) * D;
+		for (int d = 0; d < D; ++d) sums[d] += c[d];
+	}
+
+	for (int x = 0; x < width; ++x) {
+		if (x > 0) {
+			const unsigned short *cIn = columns + std::min(x + half, width - 1) * D;
+			const unsigned short *cOut = columns + std::max(x - half - 1, 0) * D;
+#ifdef __SSE2__
+			for (int d = 0; d < D; d += 8) {
+				__m128i s = _mm_loadu_si128((const __m128i*)(sums + d));
+				s = _mm_add_epi16(s, _mm_loadu_si128((const __m128i*)(cIn + d)));
+				s = _mm_sub_epi16(s, _mm_loadu_si128((const __m128i*)(cOut + d)));
+				_mm_storeu_si128((__m128i*)(sums + d), s);
+			}
+#else
+			for (int d = 0; d < D; ++d) sums[d] += cIn[d] - cOut[d];
+#endif
+		}
+
+		const int dMax = std::min(D - 1, x);
+		int best = 0;
+#ifdef __SSE2__
+		if (dMax == D - 1) {
+			// unsigned minimum with the signed instruction, by flipping the sign bits
+			const __m128i sign = _mm_set1_epi16((short)0x8000);
+			__m128i m = _mm_xor_si128(_mm_loadu_si128((const __m128i*)sums), sign);
+			for (int d = 8; d < D; d += 8) {
+				m = _mm_min_epi16(m, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(sums + d)), sign));
+			}
+			m = _mm_min_epi16(m, _mm_srli_si128(m, 8));
+			m = _mm_min_epi16(m, _mm_srli_si128(m, 4));
+			m = _mm_min_epi16(m, _mm_srli_si128(m, 2));
+			m = _mm_xor_si128(_mm_set1_epi16((short)_mm_extract_epi16(m, 0)), sign);
+			for (int d = 0; d < D; d += 8) {
+				int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(sums + d)), m));
+				if (mask) {
+					best = d + __builtin_ctz(mask) / 2;
+					break;
+				}
+			}
+		} else
+#endif
+		{
+			for (int d = 1; d <= dMax; ++d) {
+				if (sums[d] < sums[best]) best = d;
+			}
+		}
+
+		int value = best << DISPARITY_SHIFT;
+		if (best > 0 && best < dMax) {
+			int c0 = sums[best-1], c1 = sums[best], c2 = sums[best+1];
+			int denominator = c0 - 2 * c1 + c2;
+			if (denominator > 0) {
+				value += (int)floorf((c0 - c2) * (float)(1 << DISPARITY_SHIFT) / (2 * denominator) + 0.5f);
+			}
+		}
+		disparity[x] = (short)value;
+
+		if (maxDifference >= 0) {
+			// reversed, so right pixels x-d for increasing d are contiguous
+			unsigned short *rightCost = &ws.rightCost[width - 1 - x];
+			short *rightDisparity = &ws.rightDisparity[width - 1 - x];
+#ifdef __SSE2__
+			if (dMax == D - 1) {
+				const __m128i sign = _mm_set1_epi16((short)0x8000);
+				const __m128i step = _mm_set1_epi16(8);
+				__m128i index = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+				for (int d = 0; d < D; d += 8, index = _mm_add_epi16(index, step)) {
+					__m128i c = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(sums + d)), sign);
+					__m128i r = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(rightCost + d)), sign);
+					__m128i better = _mm_cmplt_epi16(c, r);
+					__m128i rd = _mm_loadu_si128((const __m128i*)(rightDisparity + d));
+					rd = _mm_or_si128(_mm_and_si128(better, index), _mm_andnot_si128(better, rd));
+					_mm_storeu_si128((__m128i*)(rightCost + d), _mm_xor_si128(_mm_min_epi16(c, r), sign));
+					_mm_storeu_si128((__m128i*)(rightDisparity + d), rd);
+				}
+				continue;
+			}
+#endif
+			for (int d = 0; d <= dMax; ++d) {
+				if (sums[d] < rightCost[d]) {
+					rightCost[d] = sums[d];
+					rightDisparity[d] = d;
+				}
+			}
+		}
+	}
+
+	if (maxDifference < 0) return;
+	for (int x = 0; x < width; ++x) {
+		int d = (disparity[x] + (1 << (DISPARITY_SHIFT - 1))) >> DISPARITY_SHIFT;
+		int r = ws.rightDisparity[width - 1 - std::max(x - d, 0)];
+		if (abs(r - d) > maxDifference) disparity[x] = DISPARITY_INVALID;
+	}
+}
@@ -0,0 +1,169 @@
+/**
+ * @brief
+ * @file DenseStereo.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 23, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef DENSESTEREO_H_
+#define DENSESTEREO_H_
+
+// General files
+#include <vector>
+#include <stdint.h>
+
+#include <Pyramid.h>
+
+class ThreadPool;
+
+//! Number of fractional bits of the disparities in the map
+#define DISPARITY_SHIFT			4
+
+//! Disparity of pixels without a reliable match
+#define DISPARITY_INVALID		(-1)
+
+//! Largest window, so the sum of absolute differences over it fits 16 bits
+#define DENSE_MAX_WINDOW		15
+
+enum DenseCost {
+	DC_SAD,                    //! Absolute difference of the intensities
+	DC_CENSUS5,                //! Hamming distance of 5x5 census codes
+	DC_CENSUS7,                //! Hamming distance of 7x7 census codes
+};
+
+/* **************************************************************************************
+ * Interface of DenseStereo
+ * **************************************************************************************/
+
+/**
+ * Disparity for every pixel of a rectified stereo pair, by block matching: the cost of a
+ * disparity is the sum of absolute differences over a square window, the disparity with the
+ * lowest cost wins, refined to subpixel precision with a parabola. A disparity is only kept if
+ * the match from the right image back to the left gives the same disparity (left-right check).
+ *
+ * There is no cost volume. The image is processed in bands of rows, in parallel over a
+ * thread pool. Within a band the window sums are aggregated incrementally: per column the sum
+ * over the rows of the window is kept for all disparities, and moving to the next row adds the
+ * costs of the row that enters and subtracts those of the row that leaves. Along the row the
+ * window sum is updated in the same way. So per thread only a row of column sums is needed
+ * (width x disparities 16-bit values), and the disparities are processed eight or sixteen at
+ * a time with SSE2.
+ *
+ * Instead of the absolute difference of the intensities the Hamming distance of census codes
+ * can be used as the cost of a pixel. That is not affected by a difference in exposure
+ * between the cameras. The codes of both images are computed once per frame.
+ */
+class DenseStereo {
+public:
+	//! Constructor DenseStereo, the number of disparities is rounded up to a multiple of 16
+	DenseStereo(int disparities = 64, int window = 9);
+
+	//! Destructor ~DenseStereo
+	virtual ~DenseStereo();
+
+	//! Disparities 0 to disparities-1 are searched
+	void SetDisparities(int disparities);
+
+	//! Width and height of the window, odd and at most DENSE_MAX_WINDOW
+	void SetWindow(int window);
+
+	inline int GetDisparities() const { return disparities; }
+
+	//! Maximum difference between the left and the right disparity, negative disables the check
+	inline void SetMaxDifference(int maxDifference) { this->maxDifference = maxDifference; }
+
+	//! Cost of a single pixel, SAD by default
+	inline void SetCost(DenseCost cost) { this->cost = cost; }
+
+	//! Rows per band, 0 chooses two bands per thread
+	inline void SetBandRows(int bandRows) { this->bandRows = bandRows; }
+
+	//! Use the threads of the given pool (not deallocated by the matcher)
+	inline void SetThreadPool(ThreadPool *pool) { this->pool = pool; }
+
+	/**
+	 * Calculate the disparity map of the left image, with DISPARITY_SHIFT fractional bits and
+	 * DISPARITY_INVALID where there is no match. The map has rows of left.width values.
+	 */
+	void Compute(const ImageView &left, const ImageView &right, short *disparity);
+
+	//! Same, the map is resized to the image
+	void Compute(const ImageView &left, const ImageView &right, std::vector<short> & disparity);
+protected:
+	//! Scratch memory of a thread
+	struct Workspace {
+		//! Sum over the rows of the window, per column and disparity
+		std::vector<unsigned short> columns;
+		//! Sum over the window, per disparity
+		std::vector<unsigned short> sums;
+		//! Right row (intensities or codes) in reverse, so increasing disparities are contiguous
+		std::vector<uint64_t> reversed;
+		std::vector<uint64_t> reversedOld;
+		//! Best cost and disparity for the pixels of the right row, in reverse
+		std::vector<unsigned short> rightCost;
+		std::vector<short> rightDisparity;
+	};
+
+	struct Job {
+		DenseStereo *self;
+		const ImageView *left;
+		const ImageView *right;
+		short *disparity;
+		int bandRows;
+	};
+
+	static void band(int task, int thread, void *arg);
+
+	//! Disparities of rows y0 to y1-1
+	void band(const ImageView &left, const ImageView &right, short *disparity, int y0, int y1,
+			Workspace &ws);
+
+	//! Add the costs of row "in" to the column sums, and subtract those of row "out" (if >= 0)
+	void accumulate(const ImageView &left, const ImageView &right, int in, int out, Workspace &ws);
+
+	void accumulateSAD(const ImageView &left, const ImageView &right, int in, int out, Workspace &ws);
+
+	//! Same with census codes, rows of width words
+	template<typename T>
+	void accumulateCensus(const T *left, const T *right, int width, int in, int out, Workspace &ws);
+
+	//! Winner-take-all over the window sums of one row, with left-right check
+	void select(const ImageView &left, short *disparity, Workspace &ws);
+private:
+	int disparities;
+
+	int window;
+
+	int maxDifference;
+
+	int bandRows;
+
+	DenseCost cost;
+
+	ThreadPool *pool;
+
+	//! Census codes of the left and the right image
+	std::vector<uint32_t> codes5[2];
+	std::vector<uint64_t> codes7[2];
+
+	std::vector<Workspace> workspaces;
+};
+
+#endif /* DENSESTEREO_H_ */
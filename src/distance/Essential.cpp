@@ -0,0 +1,785 @@
+/**
+ * @brief 
+ * @file Essential.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common 
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from 
+ * thread pools and TCP/IP components to control architectures and learning algorithms. 
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory 
+ * farming, for animal experimentation, or anything that violates the Universal 
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 7, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <Essential.h>
+#include <Matrix.h>
+
+//! Default threshold of RelativePoseEstimator in pixels
+#define ESSENTIAL_THRESHOLD		1.0f
+
+//! Step of the numerical derivatives in Essential::Refine
+#define ESSENTIAL_STEP			1e-6
+
+/* **************************************************************************************
+ * Small dense matrices, row-major, in double
+ * **************************************************************************************/
+
+/**
+ * Singular value decomposition E = U diag(S) V^T of a 3x3 matrix, from the eigenvectors of
+ * E^T E, with the singular values in decreasing order and det(U) = det(V) = 1. The third
+ * columns are completed by cross products, they are only determined up to sign when the
+ * smallest singular value is zero, as for an essential matrix.
+ */
+static void svd3(const Mat3d &E, Mat3d &U, Vec3d &S, Mat3d &V) {
+	Vec3d values;
+	SymmetricEigen(E.Transpose() * E, values, V);
+	for (int k = 0; k < 3; ++k) S[k] = sqrt(std::max(values[k], 0.0));
+	V.SetCol(2, Cross(V.Col(0), V.Col(1)));
+	for (int k = 0; k < 2; ++k) {
+		Vec3d u = E * V.Col(k);
+		double norm = u.Norm();
+		if (norm > 1e-300) u /= norm;
+		else u = Mat3d::Identity().Col(k);
+		U.SetCol(k, u);
+	}
+	U.SetCol(2, Cross(U.Col(0), U.Col(1)));
+}
+
+//! E = [t]x R, scaled to unit Frobenius norm
+static Mat3d essential(const Mat3d &R, const Vec3d &t) {
+	Mat3d E = Skew(t) * R;
+	double norm = E.Norm();
+	return norm > 0 ? E / norm : E;
+}
+
+/**
+ * Similarity transform that moves the centroid of the points to the origin and scales
+ * them to an average distance of sqrt(2).
+ */
+static bool normalization(const float *x, const float *y, const unsigned char *mask, int count,
+		Mat3d &T) {
+	double mx = 0, my = 0;
+	int n = 0;
+	for (int i = 0; i < count; ++i) {
+		if (mask && !mask[i]) continue;
+		mx += x[i];
+		my += y[i];
+		n++;
+	}
+	if (n == 0) return false;
+	mx /= n;
+	my /= n;
+	double distance = 0;
+	for (int i = 0; i < count; ++i) {
+		if (mask && !mask[i]) continue;
+		distance += sqrt((x[i] - mx) * (x[i] - mx) + (y[i] - my) * (y[i] - my));
+	}
+	distance /= n;
+	if (distance < 1e-12) return false;
+	double s = sqrt(2.0) / distance;
+	Mat3d similarity = {{ s, 0, -s * mx, 0, s, -s * my, 0, 0, 1 }};
+	T = similarity;
+	return true;
+}
+
+/* **************************************************************************************
+ * Polynomials for the five-point solver
+ * **************************************************************************************/
+
+/**
+ * Polynomials of degree three in x, y and z have twenty coefficients, in the order of the
+ * monomials of Nister: x^3, y^3, x^2y, xy^2, x^2z, x^2, y^2z, y^2, xyz, xy, | xz^2, xz, x,
+ * yz^2, yz, y, z^3, z^2, z, 1. After Gauss-Jordan elimination of the first ten, the rows
+ * of x^2z, x^2, y^2z, y^2, xyz and xy give three equations in x, y and z only.
+ */
+static const int MONOMIALS[20][3] = {
+	{ 3, 0, 0 }, { 0, 3, 0 }, { 2, 1, 0 }, { 1, 2, 0 }, { 2, 0, 1 },
+	{ 2, 0, 0 }, { 0, 2, 1 }, { 0, 2, 0 }, { 1, 1, 1 }, { 1, 1, 0 },
+	{ 1, 0, 2 }, { 1, 0, 1 }, { 1, 0, 0 }, { 0, 1, 2 }, { 0, 1, 1 },
+	{ 0, 1, 0 }, { 0, 0, 3 }, { 0, 0, 2 }, { 0, 0, 1 }, { 0, 0, 0 }
+};
+
+//! Index of the monomial x^a y^b z^c, -1 if the degree is above three
+static const int MONOMIAL_INDEX[4][4][4] = {
+	{ { 19, 18, 17, 16 }, { 15, 14, 13, -1 }, { 7, 6, -1, -1 }, { 1, -1, -1, -1 } },
+	{ { 12, 11, 10, -1 }, { 9, 8, -1, -1 }, { 3, -1, -1, -1 }, { -1, -1, -1, -1 } },
+	{ { 5, 4, -1, -1 }, { 2, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 } },
+	{ { 0, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 }, { -1, -1, -1, -1 } }
+};
+
+//! The monomials of polynomials of degree one and two
+static const int LINEAR[4] = { 12, 15, 18, 19 };
+static const int QUADRATIC[10] = { 5, 7, 17, 9, 11, 14, 12, 15, 18, 19 };
+
+//! c += scale a b, with only the monomials ta of a and tb of b used
+static void product(const double *a, const int *ta, int na, const double *b, const int *tb,
+		int nb, double scale, double *c) {
+	for (int i = 0; i < na; ++i) {
+		const int *ma = MONOMIALS[ta[i]];
+		double ai = scale * a[ta[i]];
+		for (int j = 0; j < nb; ++j) {
+			const int *mb = MONOMIALS[tb[j]];
+			c[MONOMIAL_INDEX[ma[0] + mb[0]][ma[1] + mb[1]][ma[2] + mb[2]]] += ai * b[tb[j]];
+		}
+	}
+}
+
+//! c = a b for polynomials in one variable, coefficients from low to high degree
+static void polyMultiply(const double *a, int da, const double *b, int db, double *c) {
+	for (int i = 0; i <= da + db; ++i) c[i] = 0;
+	for (int i = 0; i <= da; ++i) {
+		for (int j = 0; j <= db; ++j) c[i+j] += a[i] * b[j];
+	}
+}
+
+static inline double polyEvaluate(const double *p, int degree, double t) {
+	double result = p[degree];
+	for (int i = degree - 1; i >= 0; --i) result = result * t + p[i];
+	return result;
+}
+
+/**
+ * The distinct real roots of a polynomial by a Sturm sequence: the number of sign changes
+ * in the sequence at a point, minus that at a larger point, is the number of roots in
+ * between. Intervals are halved until they hold a single root, which is then found by
+ * bisection.
+ */
+static int realRoots(const double *p, int degree, double *roots) {
+	double largest = 0;
+	for (int i = 0; i <= degree; ++i) largest = std::max(largest, fabs(p[i]));
+	while (degree > 0 && fabs(p[degree]) <= 1e-14 * largest) degree--;
+	if (degree < 1) return 0;
+
+	// substitute z = s w, with s the geometric mean of the magnitudes of the roots, so the
+	// coefficients are balanced and the remainders below do not lose their precision
+	double s = 1;
+	if (p[0] != 0) s = pow(fabs(p[0] / p[degree]), 1.0 / degree);
+	double seq[11][11];
+	int deg[11];
+	double power = 1;
+	for (int i = 0; i <= degree; ++i) {
+		seq[0][i] = p[i] * power;
+		power *= s;
+	}
+	double lead = fabs(seq[0][degree]);
+	for (int i = 0; i <= degree; ++i) seq[0][i] /= lead;
+	deg[0] = degree;
+	for (int i = 1; i <= degree; ++i) seq[1][i-1] = i * seq[0][i] / degree;
+	deg[1] = degree - 1;
+	int n = 2;
+	while (deg[n-1] > 0) {
+		const double *a = seq[n-2], *b = seq[n-1];
+		double r[11];
+		int dr = deg[n-2], db = deg[n-1];
+		for (int i = 0; i <= dr; ++i) r[i] = a[i];
+		for (; dr >= db; --dr) {
+			double f = r[dr] / b[db];
+			for (int j = 0; j <= db; ++j) r[dr - db + j] -= f * b[j];
+		}
+		double scale = 0;
+		for (int i = 0; i <= deg[n-2]; ++i) scale = std::max(scale, fabs(a[i]));
+		while (dr >= 0 && fabs(r[dr]) <= 1e-12 * scale) dr--;
+		// a common factor, the remaining roots are multiple
+		if (dr < 0) break;
+		double lead = fabs(r[dr]);
+		for (int i = 0; i <= dr; ++i) seq[n][i] = -r[i] / lead;
+		deg[n] = dr;
+		n++;
+	}
+
+	double bound = 0;
+	for (int i = 0; i < degree; ++i) bound = std::max(bound, fabs(seq[0][i]));
+	bound += 1;
+
+	struct Interval { double lo, hi; int clo, chi; };
+	Interval stack[64];
+	int top = 0, found = 0;
+	int changes[2];
+	for (int side = 0; side < 2; ++side) {
+		double t = side ? bound : -bound;
+		int c = 0;
+		double last = 0;
+		for (int k = 0; k < n; ++k) {
+			double value = polyEvaluate(seq[k], deg[k], t);
+			if (value == 0) continue;
+			if (last != 0 && (value > 0) != (last > 0)) c++;
+			last = value;
+		}
+		changes[side] = c;
+	}
+	Interval all = { -bound, bound, changes[0], changes[1] };
+	stack[top++] = all;
+	while (top > 0) {
+		Interval iv = stack[--top];
+		int inside = iv.clo - iv.chi;
+		if (inside <= 0) continue;
+		if (inside == 1 || iv.hi - iv.lo < 1e-10 * (1 + fabs(iv.lo))) {
+			// bisection on the polynomial itself
+			double lo = iv.lo, hi = iv.hi;
+			double flo = polyEvaluate(seq[0], deg[0], lo);
+			for (int it = 0; it < 100 && hi - lo > 1e-14 * (1 + fabs(lo)); ++it) {
+				double mid = 0.5 * (lo + hi);
+				double fmid = polyEvaluate(seq[0], deg[0], mid);
+				if ((fmid > 0) == (flo > 0)) {
+					lo = mid;
+					flo = fmid;
+				} else {
+					hi = mid;
+				}
+			}
+			roots[found++] = s * 0.5 * (lo + hi);
+			continue;
+		}
+		double mid = 0.5 * (iv.lo + iv.hi);
+		int c = 0;
+		double last = 0;
+		for (int k = 0; k < n; ++k) {
+			double value = polyEvaluate(seq[k], deg[k], mid);
+			if (value == 0) continue;
+			if (last != 0 && (value > 0) != (last > 0)) c++;
+			last = value;
+		}
+		if (top + 2 > 64) continue;
+		Interval left = { iv.lo, mid, iv.clo, c }, right = { mid, iv.hi, c, iv.chi };
+		stack[top++] = left;
+		stack[top++] = right;
+	}
+	return found;
+}
+
+/* **************************************************************************************
+ * Implementation of FivePointSolver, EightPointSolver and SampsonResidual
+ * **************************************************************************************/
+
+/**
+ * The five epipolar constraints are linear in E, which leaves a four-dimensional null
+ * space E = x X + y Y + z Z + W. Then det(E) = 0 and 2 E E^T E - trace(E E^T) E = 0 give ten
+ * cubic equations in x, y and z. After elimination they reduce to three equations
+ * B(z) (x, y, 1)^T = 0, so det(B(z)) is a polynomial of degree ten in z. Every real root
+ * gives x and y from the null vector of B(z).
+ */
+int FivePointSolver::operator()(const int *sample, Essential *models) const {
+	// orthonormal null space of the 5x9 constraints: Householder QR of their transpose,
+	// the last four columns of the orthogonal factor
+	double A[9][5], v[5][9], beta[5];
+	for (int i = 0; i < 5; ++i) {
+		double x = x0[sample[i]], y = y0[sample[i]], u = x1[sample[i]], w = y1[sample[i]];
+		double row[9] = { u * x, u * y, u, w * x, w * y, w, x, y, 1 };
+		for (int j = 0; j < 9; ++j) A[j][i] = row[j];
+	}
+	for (int k = 0; k < 5; ++k) {
+		double norm = 0;
+		for (int i = k; i < 9; ++i) norm += A[i][k] * A[i][k];
+		norm = sqrt(norm);
+		if (norm < 1e-12) return 0;
+		double alpha = A[k][k] > 0 ? -norm : norm;
+		for (int i = 0; i < 9; ++i) v[k][i] = (i < k) ? 0 : A[i][k];
+		v[k][k] -= alpha;
+		double vv = 0;
+		for (int i = k; i < 9; ++i) vv += v[k][i] * v[k][i];
+		beta[k] = 2 / vv;
+		for (int j = k; j < 5; ++j) {
+			double s = 0;
+			for (int i = k; i < 9; ++i) s += v[k][i] * A[i][j];
+			s *= beta[k];
+			for (int i = k; i < 9; ++i) A[i][j] -= s * v[k][i];
+		}
+	}
+	double basis[4][9];
+	for (int b = 0; b < 4; ++b) {
+		double *e = basis[b];
+		for (int i = 0; i < 9; ++i) e[i] = (i == 5 + b) ? 1 : 0;
+		for (int k = 4; k >= 0; --k) {
+			double s = 0;
+			for (int i = k; i < 9; ++i) s += v[k][i] * e[i];
+			s *= beta[k];
+			for (int i = k; i < 9; ++i) e[i] -= s * v[k][i];
+		}
+	}
+
+	// the entries of E as polynomials x X + y Y + z Z + W
+	double E[9][20], EEt[9][20], M[10][20];
+	for (int i = 0; i < 9; ++i) {
+		for (int j = 0; j < 20; ++j) E[i][j] = EEt[i][j] = 0;
+		E[i][12] = basis[0][i];
+		E[i][15] = basis[1][i];
+		E[i][18] = basis[2][i];
+		E[i][19] = basis[3][i];
+	}
+	for (int i = 0; i < 10; ++i) {
+		for (int j = 0; j < 20; ++j) M[i][j] = 0;
+	}
+	for (int i = 0; i < 3; ++i) {
+		for (int j = i; j < 3; ++j) {
+			for (int k = 0; k < 3; ++k) {
+				product(E[i*3+k], LINEAR, 4, E[j*3+k], LINEAR, 4, 1, EEt[i*3+j]);
+			}
+			if (i != j) {
+				for (int m = 0; m < 20; ++m) EEt[j*3+i][m] = EEt[i*3+j][m];
+			}
+		}
+	}
+	double trace[20];
+	for (int m = 0; m < 20; ++m) trace[m] = EEt[0][m] + EEt[4][m] + EEt[8][m];
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			double *row = M[1 + i*3+j];
+			for (int k = 0; k < 3; ++k) {
+				product(EEt[i*3+k], QUADRATIC, 10, E[k*3+j], LINEAR, 4, 2, row);
+			}
+			product(trace, QUADRATIC, 10, E[i*3+j], LINEAR, 4, -1, row);
+		}
+	}
+	double minor[20];
+	const int cofactors[3][4] = { { 4, 8, 5, 7 }, { 3, 8, 5, 6 }, { 3, 7, 4, 6 } };
+	const double signs[3] = { 1, -1, 1 };
+	for (int c = 0; c < 3; ++c) {
+		for (int m = 0; m < 20; ++m) minor[m] = 0;
+		product(E[cofactors[c][0]], LINEAR, 4, E[cofactors[c][1]], LINEAR, 4, 1, minor);
+		product(E[cofactors[c][2]], LINEAR, 4, E[cofactors[c][3]], LINEAR, 4, -1, minor);
+		product(minor, QUADRATIC, 10, E[c], LINEAR, 4, signs[c], M[0]);
+	}
+
+	// Gauss-Jordan elimination of the first ten monomials
+	for (int k = 0; k < 10; ++k) {
+		int pivot = k;
+		for (int i = k + 1; i < 10; ++i) {
+			if (fabs(M[i][k]) > fabs(M[pivot][k])) pivot = i;
+		}
+		if (fabs(M[pivot][k]) < 1e-15) return 0;
+		for (int j = 0; j < 20; ++j) std::swap(M[k][j], M[pivot][j]);
+		double f = 1 / M[k][k];
+		for (int j = k; j < 20; ++j) M[k][j] *= f;
+		for (int i = 0; i < 10; ++i) {
+			if (i == k) continue;
+			double g = M[i][k];
+			if (g == 0) continue;
+			for (int j = k; j < 20; ++j) M[i][j] -= g * M[k][j];
+		}
+	}
+
+	// row(x^2z) - z row(x^2) etc.: x p1(z) + y p2(z) + p3(z), degrees 3, 3 and 4
+	double B[3][3][5];
+	for (int r = 0; r < 3; ++r) {
+		const double *e = M[4 + 2*r], *f = M[5 + 2*r];
+		for (int c = 0; c < 2; ++c) {
+			int o = c * 3;
+			B[r][c][0] = e[12+o];
+			B[r][c][1] = e[11+o] - f[12+o];
+			B[r][c][2] = e[10+o] - f[11+o];
+			B[r][c][3] = -f[10+o];
+		}
+		B[r][2][0] = e[19];
+		B[r][2][1] = e[18] - f[19];
+		B[r][2][2] = e[17] - f[18];
+		B[r][2][3] = e[16] - f[17];
+		B[r][2][4] = -f[16];
+	}
+	const int degrees[3] = { 3, 3, 4 };
+	double determinant[11] = { 0 };
+	for (int c = 0; c < 3; ++c) {
+		int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+		double a[8], b[8];
+		polyMultiply(B[1][c1], degrees[c1], B[2][c2], degrees[c2], a);
+		polyMultiply(B[1][c2], degrees[c2], B[2][c1], degrees[c1], b);
+		int dm = degrees[c1] + degrees[c2];
+		for (int i = 0; i <= dm; ++i) a[i] -= b[i];
+		double term[11];
+		polyMultiply(B[0][c], degrees[c], a, dm, term);
+		for (int i = 0; i <= degrees[c] + dm; ++i) determinant[i] += term[i];
+	}
+
+	double roots[10];
+	int count = realRoots(determinant, 10, roots);
+	int models_found = 0;
+	for (int k = 0; k < count; ++k) {
+		double z = roots[k];
+		Vec3d b[3];
+		for (int r = 0; r < 3; ++r) {
+			for (int c = 0; c < 3; ++c) b[r][c] = polyEvaluate(B[r][c], degrees[c], z);
+		}
+		// the null vector of B(z) from the pair of rows with the largest cross product
+		Vec3d best = Vec3d::Zero();
+		for (int r = 0; r < 3; ++r) {
+			Vec3d v = Cross(b[r], b[(r + 1) % 3]);
+			if (v.SquaredNorm() > best.SquaredNorm()) best = v;
+		}
+		if (fabs(best[2]) < 1e-12 * best.Norm() || best[2] == 0) continue;
+		double x = best[0] / best[2], y = best[1] / best[2];
+		double e[9], norm = 0;
+		for (int i = 0; i < 9; ++i) {
+			e[i] = x * basis[0][i] + y * basis[1][i] + z * basis[2][i] + basis[3][i];
+			norm += e[i] * e[i];
+		}
+		norm = sqrt(norm);
+		for (int i = 0; i < 9; ++i) models[models_found].e[i] = e[i] / norm;
+		models_found++;
+	}
+	return models_found;
+}
+
+int EightPointSolver::operator()(const int *sample, Essential *models) const {
+	float sx0[8], sy0[8], sx1[8], sy1[8];
+	for (int i = 0; i < 8; ++i) {
+		sx0[i] = x0[sample[i]];
+		sy0[i] = y0[sample[i]];
+		sx1[i] = x1[sample[i]];
+		sy1[i] = y1[sample[i]];
+	}
+	return Essential::Fit(sx0, sy0, sx1, sy1, NULL, 8, models[0]) ? 1 : 0;
+}
+
+/**
+ * With l = E x0 and l' = E^T x1 the error is (x1^T E x0)^2 / (l0^2 + l1^2 + l'0^2 + l'1^2).
+ */
+void SampsonResidual::operator()(const Essential &E, int begin, int end, float *errors) const {
+	const float *e = E.e;
+	int i = begin;
+#ifdef __SSE2__
+	const __m128 e0 = _mm_set1_ps(e[0]), e1 = _mm_set1_ps(e[1]), e2 = _mm_set1_ps(e[2]);
+	const __m128 e3 = _mm_set1_ps(e[3]), e4 = _mm_set1_ps(e[4]), e5 = _mm_set1_ps(e[5]);
+	const __m128 e6 = _mm_set1_ps(e[6]), e7 = _mm_set1_ps(e[7]), e8 = _mm_set1_ps(e[8]);
+	const __m128 tiny = _mm_set1_ps(1e-30f), huge = _mm_set1_ps(1e30f);
+	for (; i + 4 <= end; i += 4) {
+		__m128 x = _mm_loadu_ps(x0 + i), y = _mm_loadu_ps(y0 + i);
+		__m128 u = _mm_loadu_ps(x1 + i), v = _mm_loadu_ps(y1 + i);
+		__m128 l0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, x), _mm_mul_ps(e1, y)), e2);
+		__m128 l1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e3, x), _mm_mul_ps(e4, y)), e5);
+		__m128 l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e6, x), _mm_mul_ps(e7, y)), e8);
+		__m128 m0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, u), _mm_mul_ps(e3, v)), e6);
+		__m128 m1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1, u), _mm_mul_ps(e4, v)), e7);
+		__m128 num = _mm_add_ps(_mm_add_ps(_mm_mul_ps(u, l0), _mm_mul_ps(v, l1)), l2);
+		__m128 den = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, l0), _mm_mul_ps(l1, l1)),
+				_mm_add_ps(_mm_mul_ps(m0, m0), _mm_mul_ps(m1, m1)));
+		__m128 valid = _mm_cmpgt_ps(den, tiny);
+		__m128 error = _mm_div_ps(_mm_mul_ps(num, num), _mm_or_ps(_mm_and_ps(valid, den),
+				_mm_andnot_ps(valid, _mm_set1_ps(1.0f))));
+		error = _mm_or_ps(_mm_and_ps(valid, error), _mm_andnot_ps(valid, huge));
+		_mm_storeu_ps(errors + i - begin, error);
+	}
+#endif
+	for (; i < end; ++i) {
+		float x = x0[i], y = y0[i], u = x1[i], v = y1[i];
+		float l0 = e[0] * x + e[1] * y + e[2];
+		float l1 = e[3] * x + e[4] * y + e[5];
+		float l2 = e[6] * x + e[7] * y + e[8];
+		float m0 = e[0] * u + e[3] * v + e[6];
+		float m1 = e[1] * u + e[4] * v + e[7];
+		float num = u * l0 + v * l1 + l2;
+		float den = l0 * l0 + l1 * l1 + m0 * m0 + m1 * m1;
+		errors[i - begin] = den > 1e-30f ? num * num / den : 1e30f;
+	}
+}
+
+/* **************************************************************************************
+ * Implementation of Essential
+ * **************************************************************************************/
+
+void Essential::FromPose(const RelativePose &pose, Essential &E) {
+	essential(Mat3d::From(pose.R), Vec3d::From(pose.t)).CopyTo(E.e);
+}
+
+bool Essential::Fit(const float *x0, const float *y0, const float *x1, const float *y1,
+		const unsigned char *mask, int count, Essential &E) {
+	Mat3d T0, T1;
+	if (!normalization(x0, y0, mask, count, T0)) return false;
+	if (!normalization(x1, y1, mask, count, T1)) return false;
+	Mat<9, 9, double> AtA = Mat<9, 9, double>::Zero();
+	int n = 0;
+	for (int i = 0; i < count; ++i) {
+		if (mask && !mask[i]) continue;
+		double x = T0[0] * x0[i] + T0[2], y = T0[4] * y0[i] + T0[5];
+		double u = T1[0] * x1[i] + T1[2], v = T1[4] * y1[i] + T1[5];
+		double r[9] = { u * x, u * y, u, v * x, v * y, v, x, y, 1 };
+		for (int j = 0; j < 9; ++j) {
+			for (int k = j; k < 9; ++k) AtA(j, k) += r[j] * r[k];
+		}
+		n++;
+	}
+	if (n < 8) return false;
+	for (int j = 0; j < 9; ++j) {
+		for (int k = 0; k < j; ++k) AtA(j, k) = AtA(k, j);
+	}
+	Vec<9, double> values;
+	Mat<9, 9, double> V;
+	SymmetricEigen(AtA, values, V);
+
+	// E = T1^T En T0, then the singular values (1, 1, 0)
+	Mat3d En = Mat3d::From(V.Col(8).m);
+	Mat3d U, W;
+	Vec3d S;
+	svd3(T1.Transpose() * En * T0, U, S, W);
+	if (S[1] < 1e-12 * S[0]) return false;
+	Mat3d e = (U.Col(0) * W.Col(0).Transpose() + U.Col(1) * W.Col(1).Transpose()) / sqrt(2.0);
+	e.CopyTo(E.e);
+	return true;
+}
+
+/**
+ * With E = U diag(1, 1, 0) V^T the rotation is U W V^T or U W^T V^T, W a rotation over 90
+ * degrees about z, and the translation is plus or minus the third column of U. A point is
+ * triangulated from d1 x1 = d0 R x0 + t, in the least-squares sense for d0 by the cross
+ * product with x1, and it has to be in front of both cameras.
+ */
+int Essential::Decompose(const Essential &E, const float *x0, const float *y0, const float *x1,
+		const float *y1, const unsigned char *mask, int count, RelativePose &pose) {
+	Mat3d U, V;
+	Vec3d S;
+	svd3(Mat3d::From(E.e), U, S, V);
+	const Mat3d W = {{ 0, -1, 0, 1, 0, 0, 0, 0, 1 }};
+	Mat3d rotations[2] = { U * W * V.Transpose(), U * W.Transpose() * V.Transpose() };
+
+	int best = -1;
+	for (int r = 0; r < 2; ++r) {
+		const Mat3d &R = rotations[r];
+		for (int sign = -1; sign <= 1; sign += 2) {
+			Vec3d t = U.Col(2) * (double)sign;
+			int front = 0;
+			for (int i = 0; i < count; ++i) {
+				if (mask && !mask[i]) continue;
+				Vec3d p = MakeVec<double>(x0[i], y0[i], 1), q = MakeVec<double>(x1[i], y1[i], 1);
+				Vec3d Rp = R * p;
+				Vec3d a = Cross(q, Rp), b = Cross(q, t);
+				double aa = a.SquaredNorm();
+				if (aa < 1e-20) continue;
+				double d0 = -Dot(a, b) / aa;
+				double depth = d0 * Rp[2] + t[2];
+				if (d0 > 0 && depth > 0) front++;
+			}
+			if (front > best) {
+				best = front;
+				R.CopyTo(pose.R);
+				t.CopyTo(pose.t);
+			}
+		}
+	}
+	return best;
+}
+
+/**
+ * Sampson errors as residuals (x1^T E x0) / sqrt(l0^2 + l1^2 + l'0^2 + l'1^2) of E.
+ */
+static inline double sampson(const Mat3d &e, double x, double y, double u, double v) {
+	double l0 = e[0] * x + e[1] * y + e[2];
+	double l1 = e[3] * x + e[4] * y + e[5];
+	double l2 = e[6] * x + e[7] * y + e[8];
+	double m0 = e[0] * u + e[3] * v + e[6];
+	double m1 = e[1] * u + e[4] * v + e[7];
+	double den = l0 * l0 + l1 * l1 + m0 * m0 + m1 * m1;
+	return den > 1e-30 ? (u * l0 + v * l1 + l2) / sqrt(den) : 0;
+}
+
+/**
+ * The pose R, t is changed by a rotation vector w, R' = exp(w) R, and by a step (a, b) in
+ * the plane perpendicular to t, t' = (t + a b1 + b b2) / |...|.
+ */
+static void perturb(const Mat3d &R, const Vec3d &t, const Vec3d &b1, const Vec3d &b2,
+		const Vec<5, double> &delta, Mat3d &Rn, Vec3d &tn) {
+	Rn = Exp(delta.Block<3, 1>(0, 0)) * R;
+	tn = (t + b1 * delta[3] + b2 * delta[4]).Normalized();
+}
+
+//! Two unit vectors perpendicular to t and to each other
+static void tangents(const Vec3d &t, Vec3d &b1, Vec3d &b2) {
+	int smallest = 0;
+	for (int i = 1; i < 3; ++i) {
+		if (fabs(t[i]) < fabs(t[smallest])) smallest = i;
+	}
+	b1 = Cross(t, Mat3d::Identity().Col(smallest)).Normalized();
+	b2 = Cross(t, b1);
+}
+
+/**
+ * Levenberg-Marquardt over five parameters, a rotation vector and a step in the tangent
+ * plane of t. The Jacobian is taken by forward differences, which only needs the essential
+ * matrices of the five perturbed poses per iteration.
+ */
+int Essential::Refine(const float *x0, const float *y0, const float *x1, const float *y1,
+		const unsigned char *mask, int count, RelativePose &pose, int iterations) {
+	Mat3d R = Mat3d::From(pose.R);
+	Vec3d t = Vec3d::From(pose.t);
+	double lambda = 1e-3;
+	bool update = true;
+	double cost = 0;
+	Mat<5, 5, double> JtJ;
+	Vec<5, double> Jtr;
+	Vec3d b1, b2;
+	int it = 0;
+	while (it < iterations) {
+		if (update) {
+			tangents(t, b1, b2);
+			Mat3d e[6];
+			e[0] = essential(R, t);
+			for (int k = 0; k < 5; ++k) {
+				Vec<5, double> delta = Vec<5, double>::Zero();
+				delta[k] = ESSENTIAL_STEP;
+				Mat3d Rk;
+				Vec3d tk;
+				perturb(R, t, b1, b2, delta, Rk, tk);
+				e[k+1] = essential(Rk, tk);
+			}
+			JtJ = Mat<5, 5, double>::Zero();
+			Jtr = Vec<5, double>::Zero();
+			cost = 0;
+			for (int i = 0; i < count; ++i) {
+				if (mask && !mask[i]) continue;
+				double r = sampson(e[0], x0[i], y0[i], x1[i], y1[i]);
+				double J[5];
+				for (int k = 0; k < 5; ++k) {
+					J[k] = (sampson(e[k+1], x0[i], y0[i], x1[i], y1[i]) - r) / ESSENTIAL_STEP;
+				}
+				cost += r * r;
+				for (int j = 0; j < 5; ++j) {
+					Jtr[j] += J[j] * r;
+					for (int k = j; k < 5; ++k) JtJ(j, k) += J[j] * J[k];
+				}
+			}
+			for (int j = 0; j < 5; ++j) {
+				for (int k = 0; k < j; ++k) JtJ(j, k) = JtJ(k, j);
+			}
+			update = false;
+		}
+		it++;
+		Mat<5, 5, double> A = JtJ;
+		for (int j = 0; j < 5; ++j) A(j, j) *= 1 + lambda;
+		Vec<5, double> step = -Jtr;
+		if (!Solve(A, step, 1e-15)) break;
+		Mat3d Rn;
+		Vec3d tn;
+		perturb(R, t, b1, b2, step, Rn, tn);
+		Mat3d e = essential(Rn, tn);
+		double next = 0;
+		for (int i = 0; i < count; ++i) {
+			if (mask && !mask[i]) continue;
+			double r = sampson(e, x0[i], y0[i], x1[i], y1[i]);
+			next += r * r;
+		}
+		if (next >= cost) {
+			lambda *= 10;
+			continue;
+		}
+		R = Rn;
+		t = tn;
+		lambda = std::max(lambda / 10, 1e-12);
+		update = true;
+		if (cost - next < 1e-10 * cost) break;
+	}
+	R.CopyTo(pose.R);
+	t.CopyTo(pose.t);
+	return it;
+}
+
+/* **************************************************************************************
+ * Implementation of RelativePoseEstimator
+ * **************************************************************************************/
+
+RelativePoseEstimator::RelativePoseEstimator(int capacity): capacity(capacity), focal(1), cx(0),
+		cy(0), threshold(ESSENTIAL_THRESHOLD), inlierCount(0), ransac(1, 0.99f, 500),
+		fallback(1, 0.99f, 500) {
+	assert (capacity > 0);
+	nx0.resize(capacity);
+	ny0.resize(capacity);
+	nx1.resize(capacity);
+	ny1.resize(capacity);
+	inliers.resize(capacity);
+	order.reserve(capacity);
+	ranked.resize(capacity);
+	ransac.Reserve(capacity);
+	fallback.Reserve(capacity);
+	SetThreshold(threshold);
+}
+
+RelativePoseEstimator::~RelativePoseEstimator() {
+
+}
+
+void RelativePoseEstimator::SetCamera(float focal, float cx, float cy) {
+	assert (focal > 0);
+	this->focal = focal;
+	this->cx = cx;
+	this->cy = cy;
+	SetThreshold(threshold);
+}
+
+void RelativePoseEstimator::SetThreshold(float threshold) {
+	this->threshold = threshold;
+	float normalized = threshold / focal;
+	ransac.SetThreshold(normalized * normalized);
+	fallback.SetThreshold(normalized * normalized);
+}
+
+/**
+ * With PROSAC the correspondences are normalized in order of quality, everything is done in
+ * that order and only the inliers are put back in the order of the input.
+ */
+bool RelativePoseEstimator::Estimate(const float *x0, const float *y0, const float *x1,
+		const float *y1, int count, RelativePose &pose, const float *quality) {
+	assert (count <= capacity);
+	inlierCount = 0;
+	ransac.SetProsac(quality != NULL);
+	fallback.SetProsac(quality != NULL);
+	if (quality) RankByQuality(quality, count, order);
+	for (int k = 0; k < count; ++k) {
+		int i = quality ? order[k] : k;
+		nx0[k] = (x0[i] - cx) / focal;
+		ny0[k] = (y0[i] - cy) / focal;
+		nx1[k] = (x1[i] - cx) / focal;
+		ny1[k] = (y1[i] - cy) / focal;
+	}
+	SampsonResidual residual = { &nx0[0], &ny0[0], &nx1[0], &ny1[0] };
+	Essential E;
+	const unsigned char *mask = NULL;
+	FivePointSolver five = { &nx0[0], &ny0[0], &nx1[0], &ny1[0] };
+	if (ransac.Run(five, residual, count, E)) {
+		mask = ransac.GetInliers();
+	} else {
+		EightPointSolver eight = { &nx0[0], &ny0[0], &nx1[0], &ny1[0] };
+		if (!fallback.Run(eight, residual, count, E)) return false;
+		mask = fallback.GetInliers();
+	}
+	for (int i = 0; i < count; ++i) inliers[i] = mask[i];
+
+	if (Essential::Decompose(E, &nx0[0], &ny0[0], &nx1[0], &ny1[0], &inliers[0], count, pose) <= 0) {
+		return false;
+	}
+	Essential::Refine(&nx0[0], &ny0[0], &nx1[0], &ny1[0], &inliers[0], count, pose);
+
+	// the inliers of the refined pose
+	Essential::FromPose(pose, E);
+	float errors[RANSAC_BLOCK];
+	const float limit = (threshold / focal) * (threshold / focal);
+	for (int begin = 0; begin < count; begin += RANSAC_BLOCK) {
+		int end = std::min(begin + RANSAC_BLOCK, count);
+		residual(E, begin, end, errors);
+		for (int i = begin; i < end; ++i) {
+			inliers[i] = errors[i - begin] < limit;
+			inlierCount += inliers[i];
+		}
+	}
+	if (quality) {
+		std::copy(inliers.begin(), inliers.begin() + count, ranked.begin());
+		for (int k = 0; k < count; ++k) inliers[order[k]] = ranked[k];
+	}
+	return true;
+}
@@ -0,0 +1,176 @@
+/**
+ * @brief
+ * @file Essential.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 7, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef ESSENTIAL_H_
+#define ESSENTIAL_H_
+
+// General files
+#include <vector>
+
+#include <Ransac.h>
+
+/**
+ * Motion of a calibrated camera between two frames: a point X in the coordinates of the
+ * first camera is at R X + t in those of the second. R is 3x3 row-major. From two images
+ * alone the length of t is unknown, it is 1.
+ */
+struct RelativePose {
+	RelativePose() {
+		for (int i = 0; i < 9; ++i) R[i] = (i % 4 == 0) ? 1 : 0;
+		t[0] = t[1] = 0; t[2] = 1;
+	}
+	float R[9];
+	float t[3];
+};
+
+/**
+ * The essential matrix E = [t]x R, 3x3 row-major, of unit Frobenius norm. Correspondences
+ * in normalized image coordinates ((u - cx) / f, (v - cy) / f) satisfy x1^T E x0 = 0.
+ */
+struct Essential {
+	float e[9];
+
+	//! Essential matrix of a pose
+	static void FromPose(const RelativePose &pose, Essential &E);
+
+	/**
+	 * Least-squares fit to the correspondences with a nonzero mask value (all if mask is
+	 * NULL) by the normalized eight-point algorithm, after which the two nonzero singular
+	 * values are made equal. False if there are fewer than eight or they are degenerate.
+	 */
+	static bool Fit(const float *x0, const float *y0, const float *x1, const float *y1,
+			const unsigned char *mask, int count, Essential &E);
+
+	/**
+	 * The pose of E out of the four possibilities, for which most of the correspondences
+	 * (with a nonzero mask value) are in front of both cameras. Returns that number.
+	 */
+	static int Decompose(const Essential &E, const float *x0, const float *y0, const float *x1,
+			const float *y1, const unsigned char *mask, int count, RelativePose &pose);
+
+	/**
+	 * Minimize the Sampson errors with Levenberg-Marquardt over the rotation and the
+	 * direction of the translation, starting at pose. Returns the number of iterations.
+	 */
+	static int Refine(const float *x0, const float *y0, const float *x1, const float *y1,
+			const unsigned char *mask, int count, RelativePose &pose, int iterations = 10);
+};
+
+/**
+ * Minimal solver for Ransac: the (up to ten) essential matrices through five
+ * correspondences, by the method of Nister (2004).
+ */
+struct FivePointSolver {
+	typedef Essential Model;
+	static const int SAMPLE_SIZE = 5;
+	static const int MAX_MODELS = 10;
+	int operator()(const int *sample, Essential *models) const;
+	const float *x0, *y0, *x1, *y1;
+};
+
+/**
+ * Solver for Ransac from eight correspondences, by the eight-point algorithm. Slower to
+ * converge than the five-point solver, but it does not fail on degenerate polynomials.
+ */
+struct EightPointSolver {
+	typedef Essential Model;
+	static const int SAMPLE_SIZE = 8;
+	static const int MAX_MODELS = 1;
+	int operator()(const int *sample, Essential *models) const;
+	const float *x0, *y0, *x1, *y1;
+};
+
+/**
+ * Squared Sampson error, the first-order approximation of the squared distance of a
+ * correspondence to the nearest one that satisfies the epipolar constraint.
+ */
+struct SampsonResidual {
+	void operator()(const Essential &E, int begin, int end, float *errors) const;
+	const float *x0, *y0, *x1, *y1;
+};
+
+/* **************************************************************************************
+ * Interface of RelativePoseEstimator
+ * **************************************************************************************/
+
+/**
+ * The rotation and the direction of the translation of the camera between two frames from
+ * point correspondences in pixels, for when the floor is not visible and the motion is
+ * not planar. RANSAC with the five-point solver finds the inliers; if it finds no model,
+ * it is tried again with the eight-point solver. The essential matrix is refitted to all
+ * inliers, the pose in front of the cameras is chosen, and the pose is refined. All
+ * buffers have the capacity given at construction, the solvers work on the stack. Given the
+ * quality of the correspondences, samples are drawn from the best ones first (PROSAC).
+ */
+class RelativePoseEstimator {
+public:
+	//! Constructor RelativePoseEstimator
+	RelativePoseEstimator(int capacity = 1024);
+
+	//! Destructor ~RelativePoseEstimator
+	virtual ~RelativePoseEstimator();
+
+	//! Focal length and principal point in pixels of the (undistorted) camera
+	void SetCamera(float focal, float cx, float cy);
+
+	//! Maximum Sampson distance of an inlier in pixels
+	void SetThreshold(float threshold);
+
+	/**
+	 * Estimate the motion from count correspondences (x0,y0) -> (x1,y1), in pixels. With a
+	 * quality for every correspondence, higher is better, PROSAC is used.
+	 */
+	bool Estimate(const float *x0, const float *y0, const float *x1, const float *y1, int count,
+			RelativePose &pose, const float *quality = NULL);
+
+	inline const unsigned char *GetInliers() const { return &inliers[0]; }
+
+	inline int GetInlierCount() const { return inlierCount; }
+
+	inline Ransac<FivePointSolver, SampsonResidual> & GetRansac() { return ransac; }
+private:
+	int capacity;
+
+	float focal, cx, cy;
+
+	float threshold;
+
+	int inlierCount;
+
+	//! Correspondences in normalized image coordinates
+	std::vector<float> nx0, ny0, nx1, ny1;
+
+	std::vector<unsigned char> inliers;
+
+	//! The correspondences from best to worst, and the inliers in that order, for PROSAC
+	std::vector<int> order;
+
+	std::vector<unsigned char> ranked;
+
+	Ransac<FivePointSolver, SampsonResidual> ransac;
+
+	Ransac<EightPointSolver, SampsonResidual> fallback;
+};
+
+#endif /* ESSENTIAL_H_ */
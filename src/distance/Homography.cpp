@@ -0,0 +1,470 @@
+/**
+ * @brief 
+ * @file Homography.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common 
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from 
+ * thread pools and TCP/IP components to control architectures and learning algorithms. 
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory 
+ * farming, for animal experimentation, or anything that violates the Universal 
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 2, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <Homography.h>
+#include <Matrix.h>
+
+//! Default threshold of PlaneSegmentation in pixels
+#define PLANE_THRESHOLD			2.0f
+
+//! Default threshold on the floor, a fraction of the distance of the point (see Odometry)
+#define GROUND_THRESHOLD		0.05f
+
+/**
+ * Similarity transform T that moves the centroid of the points to the origin and scales
+ * them to an average distance of sqrt(2), which makes the direct linear transform well
+ * conditioned.
+ */
+static bool normalization(const float *x, const float *y, const unsigned char *mask, int count,
+		Mat3d &T) {
+	double mx = 0, my = 0;
+	int n = 0;
+	for (int i = 0; i < count; ++i) {
+		if (mask && !mask[i]) continue;
+		mx += x[i];
+		my += y[i];
+		n++;
+	}
+	if (n == 0) return false;
+	mx /= n;
+	my /= n;
+	double distance = 0;
+	for (int i = 0; i < count; ++i) {
+		if (mask && !mask[i]) continue;
+		distance += sqrt((x[i] - mx) * (x[i] - mx) + (y[i] - my) * (y[i] - my));
+	}
+	distance /= n;
+	if (distance < 1e-12) return false;
+	double s = sqrt(2.0) / distance;
+	Mat3d similarity = {{ s, 0, -s * mx, 0, s, -s * my, 0, 0, 1 }};
+	T = similarity;
+	return true;
+}
+
+//! H = T1^-1 Hn T0, scaled to h[8] = 1 if possible
+static void denormalize(const Mat3d &Hn, const Mat3d &T0, const Mat3d &T1, Homography &H) {
+	double s = 1 / T1[0];
+	Mat3d T1inv = {{ s, 0, -T1[2] * s, 0, s, -T1[5] * s, 0, 0, 1 }};
+	Mat3d result = T1inv * Hn * T0;
+	double scale = result[8];
+	if (fabs(scale) < 1e-12) scale = result.Norm();
+	(result / scale).CopyTo(H.h);
+}
+
+/* **************************************************************************************
+ * Implementation of Homography
+ * **************************************************************************************/
+
+/**
+ * Every correspondence gives two rows of A h = 0, the solution is the eigenvector of A^T A
+ * with the smallest eigenvalue.
+ */
+bool Homography::Fit(const float *x0, const float *y0, const float *x1, const float *y1,
+		const unsigned char *mask, int count, Homography &H) {
+	Mat3d T0, T1;
+	if (!normalization(x0, y0, mask, count, T0)) return false;
+	if (!normalization(x1, y1, mask, count, T1)) return false;
+	Mat<9, 9, double> AtA = Mat<9, 9, double>::Zero();
+	int n = 0;
+	for (int i = 0; i < count; ++i) {
+		if (mask && !mask[i]) continue;
+		double x = T0[0] * x0[i] + T0[2], y = T0[4] * y0[i] + T0[5];
+		double u = T1[0] * x1[i] + T1[2], v = T1[4] * y1[i] + T1[5];
+		double r1[9] = { x, y, 1, 0, 0, 0, -u * x, -u * y, -u };
+		double r2[9] = { 0, 0, 0, x, y, 1, -v * x, -v * y, -v };
+		for (int j = 0; j < 9; ++j) {
+			for (int k = j; k < 9; ++k) AtA(j, k) += r1[j] * r1[k] + r2[j] * r2[k];
+		}
+		n++;
+	}
+	if (n < 4) return false;
+	for (int j = 0; j < 9; ++j) {
+		for (int k = 0; k < j; ++k) AtA(j, k) = AtA(k, j);
+	}
+	Vec<9, double> values;
+	Mat<9, 9, double> V;
+	SymmetricEigen(AtA, values, V);
+	Mat3d Hn = Mat3d::From(V.Col(8).m);
+	denormalize(Hn, T0, T1, H);
+	return true;
+}
+
+/**
+ * Squared distances of the mapped points with h[8] fixed at 1, and if JtJ is not NULL the
+ * normal equations. The Jacobian of u = (h0 x + h1 y + h2) / w is (x, y, 1, 0, 0, 0, -u x,
+ * -u y) / w, that of v likewise.
+ */
+static double evaluate(const float *x0, const float *y0, const float *x1, const float *y1,
+		const unsigned char *mask, int count, const Vec<8, double> &p, Mat<8, 8, double> *JtJ,
+		Vec<8, double> *Jtr) {
+	double cost = 0;
+	if (JtJ) {
+		*JtJ = Mat<8, 8, double>::Zero();
+		*Jtr = Vec<8, double>::Zero();
+	}
+	for (int i = 0; i < count; ++i) {
+		if (mask && !mask[i]) continue;
+		double x = x0[i], y = y0[i];
+		double w = p[6] * x + p[7] * y + 1;
+		if (fabs(w) < 1e-12) continue;
+		double u = (p[0] * x + p[1] * y + p[2]) / w;
+		double v = (p[3] * x + p[4] * y + p[5]) / w;
+		double ru = u - x1[i], rv = v - y1[i];
+		cost += ru * ru + rv * rv;
+		if (!JtJ) continue;
+		double ju[8] = { x / w, y / w, 1 / w, 0, 0, 0, -u * x / w, -u * y / w };
+		double jv[8] = { 0, 0, 0, x / w, y / w, 1 / w, -v * x / w, -v * y / w };
+		for (int j = 0; j < 8; ++j) {
+			(*Jtr)[j] += ju[j] * ru + jv[j] * rv;
+			for (int k = j; k < 8; ++k) (*JtJ)(j, k) += ju[j] * ju[k] + jv[j] * jv[k];
+		}
+	}
+	if (JtJ) {
+		for (int j = 0; j < 8; ++j) {
+			for (int k = 0; k < j; ++k) (*JtJ)(j, k) = (*JtJ)(k, j);
+		}
+	}
+	return cost;
+}
+
+/**
+ * Levenberg-Marquardt on the eight parameters left with h[8] fixed at 1. The damping is
+ * divided by ten after a step that lowers the cost, and multiplied by ten otherwise.
+ */
+int Homography::Refine(const float *x0, const float *y0, const float *x1, const float *y1,
+		const unsigned char *mask, int count, Homography &H, int iterations) {
+	if (fabs(H.h[8]) < 1e-12) return 0;
+	Vec<8, double> p = Vec<8, double>::From(H.h) / (double)H.h[8];
+	Mat<8, 8, double> JtJ;
+	Vec<8, double> Jtr;
+	double cost = evaluate(x0, y0, x1, y1, mask, count, p, &JtJ, &Jtr);
+	double lambda = 1e-3;
+	int it = 0;
+	while (it < iterations) {
+		it++;
+		Mat<8, 8, double> A = JtJ;
+		for (int j = 0; j < 8; ++j) A(j, j) *= 1 + lambda;
+		Vec<8, double> step = -Jtr;
+		if (!Solve(A, step)) break;
+		Vec<8, double> q = p + step;
+		double next = evaluate(x0, y0, x1, y1, mask, count, q, NULL, NULL);
+		if (next >= cost) {
+			lambda *= 10;
+			continue;
+		}
+		p = q;
+		lambda = std::max(lambda / 10, 1e-12);
+		bool converged = (cost - next) < 1e-10 * cost;
+		cost = evaluate(x0, y0, x1, y1, mask, count, p, &JtJ, &Jtr);
+		if (converged) break;
+	}
+	p.CopyTo(H.h);
+	H.h[8] = 1;
+	return it;
+}
+
+/* **************************************************************************************
+ * Implementation of HomographySolver and HomographyResidual
+ * **************************************************************************************/
+
+/**
+ * In normalized coordinates, with h[8] at 1, the four correspondences give eight linear
+ * equations in the other eight entries. Three collinear points make them singular.
+ */
+int HomographySolver::operator()(const int *sample, Homography *models) const {
+	float sx0[4], sy0[4], sx1[4], sy1[4];
+	for (int i = 0; i < 4; ++i) {
+		sx0[i] = x0[sample[i]];
+		sy0[i] = y0[sample[i]];
+		sx1[i] = x1[sample[i]];
+		sy1[i] = y1[sample[i]];
+	}
+	Mat3d T0, T1;
+	if (!normalization(sx0, sy0, NULL, 4, T0)) return 0;
+	if (!normalization(sx1, sy1, NULL, 4, T1)) return 0;
+	Mat<8, 8, double> A;
+	Vec<8, double> b;
+	for (int i = 0; i < 4; ++i) {
+		double x = T0[0] * sx0[i] + T0[2], y = T0[4] * sy0[i] + T0[5];
+		double u = T1[0] * sx1[i] + T1[2], v = T1[4] * sy1[i] + T1[5];
+		double r1[8] = { x, y, 1, 0, 0, 0, -u * x, -u * y };
+		double r2[8] = { 0, 0, 0, x, y, 1, -v * x, -v * y };
+		for (int j = 0; j < 8; ++j) {
+			A(2*i, j) = r1[j];
+			A(2*i+1, j) = r2[j];
+		}
+		b[2*i] = u;
+		b[2*i+1] = v;
+	}
+	if (!Solve(A, b)) return 0;
+	Mat3d Hn = {{ b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], 1 }};
+	denormalize(Hn, T0, T1, models[0]);
+	return 1;
+}
+
+void HomographyResidual::operator()(const Homography &H, int begin, int end, float *errors) const {
+	const float *h = H.h;
+	int i = begin;
+#ifdef __SSE2__
+	const __m128 h0 = _mm_set1_ps(h[0]), h1 = _mm_set1_ps(h[1]), h2 = _mm_set1_ps(h[2]);
+	const __m128 h3 = _mm_set1_ps(h[3]), h4 = _mm_set1_ps(h[4]), h5 = _mm_set1_ps(h[5]);
+	const __m128 h6 = _mm_set1_ps(h[6]), h7 = _mm_set1_ps(h[7]), h8 = _mm_set1_ps(h[8]);
+	const __m128 tiny = _mm_set1_ps(1e-8f), huge = _mm_set1_ps(1e30f);
+	for (; i + 4 <= end; i += 4) {
+		__m128 x = _mm_loadu_ps(x0 + i), y = _mm_loadu_ps(y0 + i);
+		__m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h6, x), _mm_mul_ps(h7, y)), h8);
+		__m128 valid = _mm_cmpgt_ps(w, tiny);
+		__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), w);
+		__m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h0, x), _mm_mul_ps(h1, y)), h2);
+		__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h3, x), _mm_mul_ps(h4, y)), h5);
+		__m128 eu = _mm_sub_ps(_mm_mul_ps(u, inv), _mm_loadu_ps(x1 + i));
+		__m128 ev = _mm_sub_ps(_mm_mul_ps(v, inv), _mm_loadu_ps(y1 + i));
+		__m128 e = _mm_add_ps(_mm_mul_ps(eu, eu), _mm_mul_ps(ev, ev));
+		e = _mm_or_ps(_mm_and_ps(valid, e), _mm_andnot_ps(valid, huge));
+		_mm_storeu_ps(errors + i - begin, e);
+	}
+#endif
+	for (; i < end; ++i) {
+		float w = h[6] * x0[i] + h[7] * y0[i] + h[8];
+		if (!(w > 1e-8f)) {
+			errors[i - begin] = 1e30f;
+			continue;
+		}
+		float eu = (h[0] * x0[i] + h[1] * y0[i] + h[2]) / w - x1[i];
+		float ev = (h[3] * x0[i] + h[4] * y0[i] + h[5]) / w - y1[i];
+		errors[i - begin] = eu * eu + ev * ev;
+	}
+}
+
+/* **************************************************************************************
+ * Implementation of GroundPlane
+ * **************************************************************************************/
+
+GroundPlane::GroundPlane(): fx(1), fy(1), cx(0), cy(0), height(1), maxDistance(10) {
+	SetMounting(1, 0);
+}
+
+GroundPlane::~GroundPlane() {
+
+}
+
+void GroundPlane::SetCamera(float fx, float fy, float cx, float cy) {
+	this->fx = fx;
+	this->fy = fy;
+	this->cx = cx;
+	this->cy = cy;
+}
+
+/**
+ * The columns of R are the camera axes in robot coordinates (x right, y down, z forwards):
+ * pitching down turns the optical axis to (0, sin(pitch), cos(pitch)).
+ */
+void GroundPlane::SetMounting(float height, float pitch) {
+	assert (height > 0);
+	this->height = height;
+	float c = cos(pitch), s = sin(pitch);
+	R[0] = 1; R[1] = 0; R[2] = 0;
+	R[3] = 0; R[4] = c; R[5] = s;
+	R[6] = 0; R[7] = -s; R[8] = c;
+}
+
+bool GroundPlane::ToGround(float u, float v, float &x, float &z) const {
+	float a = (u - cx) / fx, b = (v - cy) / fy;
+	float rx = R[0] * a + R[1] * b + R[2];
+	float ry = R[3] * a + R[4] * b + R[5];
+	float rz = R[6] * a + R[7] * b + R[8];
+	if (ry < 1e-6f) return false;
+	float s = height / ry;
+	x = s * rx;
+	z = s * rz;
+	return z > 0 && x * x + z * z < maxDistance * maxDistance;
+}
+
+/**
+ * A pixel is turned into a ray in robot coordinates by R K^-1, the ray hits the floor at
+ * (x, z) = height (rx, rz) / ry, homogeneous (rx, rz, ry / height). There the motion
+ * moves it as in Odometry, after which it goes back to (x, height, z) and into the image
+ * by K R^T. All steps are linear in homogeneous coordinates, so their product is H.
+ */
+void GroundPlane::FromMotion(const PlanarMotion &motion, Homography &H) const {
+	double c = cos(motion.yaw), s = sin(motion.yaw);
+	double tx = motion.lateral, tz = motion.forward;
+	Mat3d Kinv = {{ 1 / fx, 0, -cx / fx, 0, 1 / fy, -cy / fy, 0, 0, 1 }};
+	Mat3d K = {{ fx, 0, cx, 0, fy, cy, 0, 0, 1 }};
+	Mat3d Rd = Mat3d::From(R);
+	Mat3d A = {{ 1, 0, 0, 0, 0, 1, 0, 1 / height, 0 }};
+	Mat3d M = {{ c, s, -(c * tx + s * tz), -s, c, -(c * tz - s * tx), 0, 0, 1 }};
+	Mat3d B = {{ 1, 0, 0, 0, 0, height, 0, 1, 0 }};
+	Mat3d product = K * Rd.Transpose() * B * M * A * Rd * Kinv;
+	(product / product[8]).CopyTo(H.h);
+}
+
+/* **************************************************************************************
+ * Implementation of PlaneSegmentation
+ * **************************************************************************************/
+
+PlaneSegmentation::PlaneSegmentation(int capacity, int maxPlanes): capacity(capacity),
+		maxPlanes(maxPlanes), threshold(PLANE_THRESHOLD), minInliers(15), ground(NULL), planes(0),
+		hasGround(false), ransac(PLANE_THRESHOLD * PLANE_THRESHOLD, 0.99f, 500),
+		groundRansac(GROUND_THRESHOLD * GROUND_THRESHOLD, 0.99f, 200) {
+	assert (capacity > 0 && maxPlanes > 0);
+	labels.reserve(capacity);
+	homographies.resize(maxPlanes);
+	wx0.resize(capacity);
+	wy0.resize(capacity);
+	wx1.resize(capacity);
+	wy1.resize(capacity);
+	index.resize(capacity);
+	mask.resize(capacity);
+	errors.resize(capacity);
+	gx0.resize(capacity);
+	gz0.resize(capacity);
+	gx1.resize(capacity);
+	gz1.resize(capacity);
+	gw.resize(capacity);
+	ransac.Reserve(capacity);
+	groundRansac.Reserve(capacity);
+}
+
+PlaneSegmentation::~PlaneSegmentation() {
+
+}
+
+void PlaneSegmentation::SetThreshold(float threshold) {
+	this->threshold = threshold;
+	ransac.SetThreshold(threshold * threshold);
+}
+
+int PlaneSegmentation::Segment(const float *x0, const float *y0, const float *x1,
+		const float *y1, int count) {
+	assert (count <= capacity);
+	labels.assign(count, -1);
+	planes = 0;
+	hasGround = false;
+	if (ground && segmentGround(x0, y0, x1, y1, count)) {
+		hasGround = true;
+		planes = 1;
+	}
+
+	const float limit = threshold * threshold;
+	while (planes < maxPlanes) {
+		// the correspondences that are not on a plane yet
+		int n = 0;
+		for (int i = 0; i < count; ++i) {
+			if (labels[i] >= 0) continue;
+			wx0[n] = x0[i];
+			wy0[n] = y0[i];
+			wx1[n] = x1[i];
+			wy1[n] = y1[i];
+			index[n++] = i;
+		}
+		if (n < minInliers) break;
+
+		HomographySolver solver = { &wx0[0], &wy0[0], &wx1[0], &wy1[0] };
+		HomographyResidual residual = { &wx0[0], &wy0[0], &wx1[0], &wy1[0] };
+		Homography &H = homographies[planes];
+		if (!ransac.Run(solver, residual, n, H)) break;
+		if (ransac.GetInlierCount() < minInliers) break;
+
+		// fit to all inliers and refine, then take the inliers of the refined homography
+		const unsigned char *inliers = ransac.GetInliers();
+		Homography fit = H;
+		if (Homography::Fit(&wx0[0], &wy0[0], &wx1[0], &wy1[0], inliers, n, fit)) {
+			Homography::Refine(&wx0[0], &wy0[0], &wx1[0], &wy1[0], inliers, n, fit);
+			H = fit;
+		}
+		residual(H, 0, n, &errors[0]);
+		int found = 0;
+		for (int i = 0; i < n; ++i) {
+			if (errors[i] < limit) {
+				labels[index[i]] = planes;
+				found++;
+			}
+		}
+		if (found < minInliers) {
+			for (int i = 0; i < n; ++i) labels[index[i]] = -1;
+			break;
+		}
+		planes++;
+	}
+	return planes;
+}
+
+/**
+ * The correspondences are projected onto the floor. RANSAC over samples of two of them
+ * gives the motion, which is refitted to the inliers by Odometry::Estimate. Then all
+ * correspondences, also those above the horizon, are checked in the image against the
+ * homography of that motion.
+ */
+bool PlaneSegmentation::segmentGround(const float *x0, const float *y0, const float *x1,
+		const float *y1, int count) {
+	int n = 0;
+	for (int i = 0; i < count; ++i) {
+		if (!ground->ToGround(x0[i], y0[i], gx0[n], gz0[n])) continue;
+		if (!ground->ToGround(x1[i], y1[i], gx1[n], gz1[n])) continue;
+		gw[n] = 1 / (gz0[n] * gz0[n] + gz1[n] * gz1[n]);
+		n++;
+	}
+	if (n < minInliers) return false;
+
+	PlanarSolver solver = { &gx0[0], &gz0[0], &gx1[0], &gz1[0] };
+	PlanarResidual residual = { &gx0[0], &gz0[0], &gx1[0], &gz1[0], &gw[0] };
+	PlanarMotion motion;
+	if (!groundRansac.Run(solver, residual, n, motion)) return false;
+	if (groundRansac.GetInlierCount() < minInliers) return false;
+	const unsigned char *inliers = groundRansac.GetInliers();
+	for (int i = 0; i < n; ++i) {
+		if (!inliers[i]) gw[i] = 0;
+	}
+	if (!Odometry::Estimate(&gx0[0], &gz0[0], &gx1[0], &gz1[0], &gw[0], n, motion)) return false;
+
+	Homography &H = homographies[0];
+	ground->FromMotion(motion, H);
+	HomographyResidual check = { x0, y0, x1, y1 };
+	check(H, 0, count, &errors[0]);
+	const float limit = threshold * threshold;
+	int found = 0;
+	for (int i = 0; i < count; ++i) {
+		if (errors[i] < limit) {
+			labels[i] = 0;
+			found++;
+		}
+	}
+	if (found < minInliers) {
+		labels.assign(count, -1);
+		return false;
+	}
+	groundMotion = motion;
+	return true;
+}
@@ -0,0 +1,220 @@
+/**
+ * @brief
+ * @file Homography.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 2, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef HOMOGRAPHY_H_
+#define HOMOGRAPHY_H_
+
+// General files
+#include <vector>
+
+#include <Odometry.h>
+#include <Ransac.h>
+
+/**
+ * Projective mapping of the plane, 3x3 row-major, normally scaled such that h[8] is 1. A
+ * point (x,y) maps to ((h0 x + h1 y + h2) / w, (h3 x + h4 y + h5) / w) with
+ * w = h6 x + h7 y + h8.
+ */
+struct Homography {
+	Homography() { for (int i = 0; i < 9; ++i) h[i] = (i % 4 == 0) ? 1 : 0; }
+	float h[9];
+
+	//! Map a point, false if it maps to infinity
+	inline bool Map(float x, float y, float &u, float &v) const {
+		float w = h[6] * x + h[7] * y + h[8];
+		if (w < 1e-8f && w > -1e-8f) return false;
+		u = (h[0] * x + h[1] * y + h[2]) / w;
+		v = (h[3] * x + h[4] * y + h[5]) / w;
+		return true;
+	}
+
+	/**
+	 * Least-squares fit to the correspondences (x0,y0) -> (x1,y1) with a nonzero mask value
+	 * (all if mask is NULL) by the normalized direct linear transform. False if there are
+	 * fewer than four of them or they are degenerate.
+	 */
+	static bool Fit(const float *x0, const float *y0, const float *x1, const float *y1,
+			const unsigned char *mask, int count, Homography &H);
+
+	/**
+	 * Minimize the squared distances in the second image with Levenberg-Marquardt, starting
+	 * at H. Returns the number of iterations.
+	 */
+	static int Refine(const float *x0, const float *y0, const float *x1, const float *y1,
+			const unsigned char *mask, int count, Homography &H, int iterations = 10);
+};
+
+/**
+ * Minimal solver for Ransac: the homography through four correspondences, by the
+ * normalized direct linear transform with h[8] fixed at 1.
+ */
+struct HomographySolver {
+	typedef Homography Model;
+	static const int SAMPLE_SIZE = 4;
+	static const int MAX_MODELS = 1;
+	int operator()(const int *sample, Homography *models) const;
+	const float *x0, *y0, *x1, *y1;
+};
+
+/**
+ * Squared distance between a point in the second image and the mapped point of the first
+ * image, for Ransac. Points that map to infinity or behind the camera get a huge error.
+ */
+struct HomographyResidual {
+	void operator()(const Homography &H, int begin, int end, float *errors) const;
+	const float *x0, *y0, *x1, *y1;
+};
+
+/* **************************************************************************************
+ * Interface of GroundPlane
+ * **************************************************************************************/
+
+/**
+ * The floor as seen by a camera at a known height above it, pitched down over a known
+ * angle and without roll. Image points below the horizon are projected onto the floor, in
+ * the coordinates of Odometry: x to the right and z forwards. The motion of the robot over
+ * the floor gives the homography of the floor between two frames directly.
+ */
+class GroundPlane {
+public:
+	//! Constructor GroundPlane
+	GroundPlane();
+
+	//! Destructor ~GroundPlane
+	virtual ~GroundPlane();
+
+	//! Intrinsics of the (undistorted) camera, in pixels
+	void SetCamera(float fx, float fy, float cx, float cy);
+
+	//! Height of the camera above the floor and pitch in radians, positive looking down
+	void SetMounting(float height, float pitch);
+
+	//! Points further away than this are considered to be not on the floor
+	inline void SetMaxDistance(float maxDistance) { this->maxDistance = maxDistance; }
+
+	//! Project the pixel (u,v) onto the floor, false above the horizon or too far away
+	bool ToGround(float u, float v, float &x, float &z) const;
+
+	//! The homography of the floor from the previous frame to the current one
+	void FromMotion(const PlanarMotion &motion, Homography &H) const;
+private:
+	float fx, fy, cx, cy;
+
+	float height;
+
+	//! Rotation from camera to robot coordinates, 3x3 row-major
+	float R[9];
+
+	float maxDistance;
+};
+
+/* **************************************************************************************
+ * Interface of PlaneSegmentation
+ * **************************************************************************************/
+
+/**
+ * Groups point correspondences between two frames into planes. Points on one plane are
+ * related by a homography, so the planes are found one after the other: RANSAC finds the
+ * homography with most inliers, it is refitted to them and refined, they are labelled and
+ * removed, and the search continues on the remaining points.
+ *
+ * If the ground plane is known, the floor is found first and much cheaper: the points
+ * are projected onto the floor and RANSAC on the planar motion needs samples of only two
+ * points. The homography of that motion then labels the floor points in the images. The
+ * motion is kept, it is the motion of the robot.
+ *
+ * All buffers have the capacity given at construction.
+ */
+class PlaneSegmentation {
+public:
+	//! Constructor PlaneSegmentation
+	PlaneSegmentation(int capacity = 1024, int maxPlanes = 4);
+
+	//! Destructor ~PlaneSegmentation
+	virtual ~PlaneSegmentation();
+
+	//! Maximum distance in pixels between a point and its mapped correspondence
+	void SetThreshold(float threshold);
+
+	//! A plane needs at least this number of points
+	inline void SetMinInliers(int minInliers) { this->minInliers = minInliers; }
+
+	//! Use the fast path for the floor, NULL to switch it off
+	inline void SetGroundPlane(const GroundPlane *ground) { this->ground = ground; }
+
+	//! Segment count correspondences (x0,y0) -> (x1,y1), returns the number of planes
+	int Segment(const float *x0, const float *y0, const float *x1, const float *y1, int count);
+
+	//! Plane of every correspondence, -1 for none
+	inline const int *GetLabels() const { return &labels[0]; }
+
+	inline int GetPlaneCount() const { return planes; }
+
+	inline const Homography & GetHomography(int plane) const { return homographies[plane]; }
+
+	//! True if plane 0 is the floor
+	inline bool HasGround() const { return hasGround; }
+
+	//! Motion of the robot over the floor, if HasGround
+	inline const PlanarMotion & GetGroundMotion() const { return groundMotion; }
+protected:
+	//! Find the floor by planar motion, label it as plane 0
+	bool segmentGround(const float *x0, const float *y0, const float *x1, const float *y1,
+			int count);
+private:
+	int capacity;
+
+	int maxPlanes;
+
+	float threshold;
+
+	int minInliers;
+
+	const GroundPlane *ground;
+
+	int planes;
+
+	bool hasGround;
+
+	PlanarMotion groundMotion;
+
+	std::vector<int> labels;
+
+	std::vector<Homography> homographies;
+
+	//! Remaining correspondences and their index in the input
+	std::vector<float> wx0, wy0, wx1, wy1;
+	std::vector<int> index;
+	std::vector<unsigned char> mask;
+	std::vector<float> errors;
+
+	//! Correspondences on the floor and their weights
+	std::vector<float> gx0, gz0, gx1, gz1, gw;
+
+	Ransac<HomographySolver, HomographyResidual> ransac;
+
+	Ransac<PlanarSolver, PlanarResidual> groundRansac;
+};
+
+#endif /* HOMOGRAPHY_H_ */
@@ -0,0 +1,368 @@
+/**
+ * @brief
+ * @file KLTTracker.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 17, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <KLTTracker.h>
+
+//! Number of bits of the fixed-point interpolation weights
+#define KLT_W_BITS			14
+
+/* **************************************************************************************
+ * Implementation of KLTTracker
+ * **************************************************************************************/
+
+KLTTracker::KLTTracker(int window, int maxIterations, float epsilon): maxIterations(maxIterations),
+		epsilon(epsilon), minEigenvalue(0.1), forwardBackward(true), fbThreshold(1.0) {
+	SetWindow(window);
+}
+
+KLTTracker::~KLTTracker() {
+
+}
+
+void KLTTracker::SetWindow(int window) {
+	assert (window > 1);
+	this->window = window;
+	stride = (window + 7) & ~7;
+	patch.assign(window * stride, 0);
+	patchDx.assign(window * stride, 0);
+	patchDy.assign(window * stride, 0);
+}
+
+void KLTTracker::Gradients::Swap(Gradients &other) {
+	for (int l = 0; l < MAX_PYRAMID_LEVELS; ++l) {
+		dx[l].swap(other.dx[l]);
+		dy[l].swap(other.dy[l]);
+	}
+	std::swap(levels, other.levels);
+}
+
+/**
+ * The Scharr operator [3 10 3] x [-1 0 1] is at most 16*255 in magnitude, so it fits 16
+ * bits, and it is 32 times the derivative. The border is left at zero.
+ */
+void KLTTracker::gradients(const Pyramid &pyramid, int levels, Gradients &g) {
+	levels = std::min(levels, pyramid.GetLevels());
+	for (int l = g.levels; l < levels; ++l) {
+		const ImageView &img = pyramid.GetLevel(l);
+		const int w = img.width, h = img.height;
+		g.dx[l].assign(w * h, 0);
+		g.dy[l].assign(w * h, 0);
+		for (int y = 1; y < h - 1; ++y) {
+			const unsigned char *r0 = img.row(y-1), *r1 = img.row(y), *r2 = img.row(y+1);
+			short *dx = &g.dx[l][y * w], *dy = &g.dy[l][y * w];
+			for (int x = 1; x < w - 1; ++x) {
+				dx[x] = 3 * (r0[x+1] - r0[x-1] + r2[x+1] - r2[x-1]) + 10 * (r1[x+1] - r1[x-1]);
+				dy[x] = 3 * (r2[x-1] - r0[x-1] + r2[x+1] - r0[x+1]) + 10 * (r2[x] - r0[x]);
+			}
+		}
+	}
+	g.levels = std::max(g.levels, levels);
+}
+
+inline bool KLTTracker::inside(const ImageView &img, float x, float y) const {
+	int ix = (int)floorf(x), iy = (int)floorf(y);
+	return (ix >= 0 && iy >= 0 && ix + stride < img.width && iy + window < img.height);
+}
+
+void KLTTracker::interpolateTemplate(const ImageView &img, const short *dx, const short *dy,
+		float x, float y, float &a11, float &a12, float &a22) {
+	int ix = (int)floorf(x), iy = (int)floorf(y);
+	float ax = x - ix, ay = y - iy;
+	int w00 = (int)floorf((1 - ax) * (1 - ay) * (1 << KLT_W_BITS) + 0.5);
+	int w01 = (int)floorf(ax * (1 - ay) * (1 << KLT_W_BITS) + 0.5);
+	int w10 = (int)floorf((1 - ax) * ay * (1 << KLT_W_BITS) + 0.5);
+	int w11 = (1 << KLT_W_BITS) - w00 - w01 - w10;
+
+	const int w = img.width;
+	a11 = a12 = a22 = 0;
+	for (int r = 0; r < window; ++r) {
+		const unsigned char *s0 = img.row(iy + r) + ix, *s1 = s0 + img.stride;
+		const short *dx0 = dx + (iy + r) * w + ix, *dx1 = dx0 + w;
+		const short *dy0 = dy + (iy + r) * w + ix, *dy1 = dy0 + w;
+		short *p = &patch[r * stride], *px = &patchDx[r * stride], *py = &patchDy[r * stride];
+		// a row of products fits 32 bits, the whole window does not
+		int s11 = 0, s12 = 0, s22 = 0;
+		for (int c = 0; c < window; ++c) {
+			p[c] = (short)((s0[c] * w00 + s0[c+1] * w01 + s1[c] * w10 + s1[c+1] * w11 +
+					(1 << (KLT_W_BITS - 6))) >> (KLT_W_BITS - 5));
+			int gx = (dx0[c] * w00 + dx0[c+1] * w01 + dx1[c] * w10 + dx1[c+1] * w11 +
+					(1 << (KLT_W_BITS - 1))) >> KLT_W_BITS;
+			int gy = (dy0[c] * w00 + dy0[c+1] * w01 + dy1[c] * w10 + dy1[c+1] * w11 +
+					(1 << (KLT_W_BITS - 1))) >> KLT_W_BITS;
+			px[c] = (short)gx;
+			py[c] = (short)gy;
+			s11 += gx * gx;
+			s12 += gx * gy;
+			s22 += gy * gy;
+		}
+		a11 += s11;
+		a12 += s12;
+		a22 += s22;
+		// padding does not contribute to the sums in mismatch
+		for (int c = window; c < stride; ++c) {
+			p[c] = px[c] = py[c] = 0;
+		}
+	}
+}
+
+/**
+ * The window in the next image is interpolated row by row, eight pixels at a time: the pairs
+ * of horizontal neighbours are interleaved, so pmaddwd multiplies them with the pair of
+ * weights and adds them in one go. The products with the gradients are summed with pmaddwd
+ * too, and accumulated in floats, because the sum over the window does not fit 32 bits.
+ */
+void KLTTracker::mismatch(const ImageView &img, float x, float y, float &b1, float &b2) {
+	int ix = (int)floorf(x), iy = (int)floorf(y);
+	float ax = x - ix, ay = y - iy;
+	int w00 = (int)floorf((1 - ax) * (1 - ay) * (1 << KLT_W_BITS) + 0.5);
+	int w01 = (int)floorf(ax * (1 - ay) * (1 << KLT_W_BITS) + 0.5);
+	int w10 = (int)floorf((1 - ax) * ay * (1 << KLT_W_BITS) + 0.5);
+	int w11 = (1 << KLT_W_BITS) - w00 - w01 - w10;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wTop = _mm_set1_epi32((w01 << 16) | w00);
+	const __m128i wBottom = _mm_set1_epi32((w11 << 16) | w10);
+	const __m128i round = _mm_set1_epi32(1 << (KLT_W_BITS - 6));
+	__m128 sum1 = _mm_setzero_ps(), sum2 = _mm_setzero_ps();
+	for (int r = 0; r < window; ++r) {
+		const unsigned char *s0 = img.row(iy + r) + ix, *s1 = s0 + img.stride;
+		const short *p = &patch[r * stride], *px = &patchDx[r * stride], *py = &patchDy[r * stride];
+		for (int c = 0; c < stride; c += 8) {
+			__m128i t0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(s0 + c)), zero);
+			__m128i t1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(s0 + c + 1)), zero);
+			__m128i u0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(s1 + c)), zero);
+			__m128i u1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(s1 + c + 1)), zero);
+			__m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(t0, t1), wTop),
+					_mm_madd_epi16(_mm_unpacklo_epi16(u0, u1), wBottom));
+			__m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(t0, t1), wTop),
+					_mm_madd_epi16(_mm_unpackhi_epi16(u0, u1), wBottom));
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, round), KLT_W_BITS - 5);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, round), KLT_W_BITS - 5);
+			__m128i diff = _mm_sub_epi16(_mm_packs_epi32(lo, hi),
+					_mm_loadu_si128((const __m128i*)(p + c)));
+			__m128i d1 = _mm_madd_epi16(diff, _mm_loadu_si128((const __m128i*)(px + c)));
+			__m128i d2 = _mm_madd_epi16(diff, _mm_loadu_si128((const __m128i*)(py + c)));
+			sum1 = _mm_add_ps(sum1, _mm_cvtepi32_ps(d1));
+			sum2 = _mm_add_ps(sum2, _mm_cvtepi32_ps(d2));
+		}
+	}
+	float s[4];
+	_mm_storeu_ps(s, sum1);
+	b1 = s[0] + s[1] + s[2] + s[3];
+	_mm_storeu_ps(s, sum2);
+	b2 = s[0] + s[1] + s[2] + s[3];
+#else
+	b1 = b2 = 0;
+	for (int r = 0; r < window; ++r) {
+		const unsigned char *s0 = img.row(iy + r) + ix, *s1 = s0 + img.stride;
+		const short *p = &patch[r * stride], *px = &patchDx[r * stride], *py = &patchDy[r * stride];
+		int sum1 = 0, sum2 = 0;
+		for (int c = 0; c < window; ++c) {
+			int j = (s0[c] * w00 + s0[c+1] * w01 + s1[c] * w10 + s1[c+1] * w11 +
+					(1 << (KLT_W_BITS - 6))) >> (KLT_W_BITS - 5);
+			int diff = j - p[c];
+			sum1 += diff * px[c];
+			sum2 += diff * py[c];
+		}
+		b1 += sum1;
+		b2 += sum2;
+	}
+#endif
+}
+
+float KLTTracker::residual(const ImageView &img, float x, float y) {
+	int ix = (int)floorf(x), iy = (int)floorf(y);
+	float ax = x - ix, ay = y - iy;
+	int w00 = (int)floorf((1 - ax) * (1 - ay) * (1 << KLT_W_BITS) + 0.5);
+	int w01 = (int)floorf(ax * (1 - ay) * (1 << KLT_W_BITS) + 0.5);
+	int w10 = (int)floorf((1 - ax) * ay * (1 << KLT_W_BITS) + 0.5);
+	int w11 = (1 << KLT_W_BITS) - w00 - w01 - w10;
+	int sum = 0;
+	for (int r = 0; r < window; ++r) {
+		const unsigned char *s0 = img.row(iy + r) + ix, *s1 = s0 + img.stride;
+		const short *p = &patch[r * stride];
+		for (int c = 0; c < window; ++c) {
+			int j = (s0[c] * w00 + s0[c+1] * w01 + s1[c] * w10 + s1[c+1] * w11 +
+					(1 << (KLT_W_BITS - 6))) >> (KLT_W_BITS - 5);
+			sum += abs(j - p[c]);
+		}
+	}
+	return sum / (32.0f * window * window);
+}
+
+/**
+ * At every level the displacement d solves G d = b, with G the structure tensor of the
+ * template and b the sum of the differences times the gradients. Both are 32*32 times their
+ * value in pixel units, so d comes out in pixels. If an update is about the opposite of the
+ * previous one the iteration oscillates around the solution, and half of it is taken. The
+ * window at a coarse level covers a large part of the image, so points close to the border
+ * are only tracked at the levels where the window fits.
+ */
+TrackStatus KLTTracker::track(const Pyramid &from, const Gradients &g, const Pyramid &to,
+		int levels, float x, float y, float &nx, float &ny, float *error) {
+	levels = std::min(levels, std::min(from.GetLevels(), to.GetLevels()));
+	const float half = (window - 1) / 2.0f;
+	const float scale = 1.0f / (1 << (levels - 1));
+	// position of the window, top-left, relative to the point
+	float gx = (nx - x) * scale, gy = (ny - y) * scale;
+	for (int l = levels - 1; l >= 0; --l) {
+		const float s = 1.0f / (1 << l);
+		const ImageView &I = from.GetLevel(l);
+		const ImageView &J = to.GetLevel(l);
+		float px = x * s - half, py = y * s - half;
+		if (!inside(I, px, py) || !inside(J, px + gx, py + gy)) {
+			// near the border the coarse levels are skipped, only level 0 is required
+			if (l == 0) return TS_OUTSIDE;
+			gx *= 2;
+			gy *= 2;
+			continue;
+		}
+
+		float a11, a12, a22;
+		interpolateTemplate(I, &g.dx[l][0], &g.dy[l][0], px, py, a11, a12, a22);
+		float det = a11 * a22 - a12 * a12;
+		float minEig = (a11 + a22 - sqrtf((a11 - a22) * (a11 - a22) + 4 * a12 * a12)) / 2;
+		if (minEig < minEigenvalue * 1024 * window * window || det <= 0) return TS_FLAT;
+		float invDet = 1.0f / det;
+
+		float prevDx = 0, prevDy = 0;
+		for (int i = 0; i < maxIterations; ++i) {
+			float qx = px + gx, qy = py + gy;
+			if (!inside(J, qx, qy)) return TS_OUTSIDE;
+			float b1, b2;
+			mismatch(J, qx, qy, b1, b2);
+			float dx = (a12 * b2 - a22 * b1) * invDet;
+			float dy = (a12 * b1 - a11 * b2) * invDet;
+			if (i > 0 && fabsf(dx + prevDx) < 0.01f && fabsf(dy + prevDy) < 0.01f) {
+				gx += dx * 0.5f;
+				gy += dy * 0.5f;
+				break;
+			}
+			gx += dx;
+			gy += dy;
+			if (dx * dx + dy * dy < epsilon * epsilon) break;
+			prevDx = dx;
+			prevDy = dy;
+		}
+		if (l > 0) {
+			gx *= 2;
+			gy *= 2;
+		}
+	}
+	nx = x + gx;
+	ny = y + gy;
+	if (error) {
+		const ImageView &J = to.GetLevel(0);
+		if (!inside(J, x - half + gx, y - half + gy)) return TS_OUTSIDE;
+		*error = residual(J, x - half + gx, y - half + gy);
+	}
+	return TS_OK;
+}
+
+/**
+ * At every level the iterations converge within about half a window, which counts double at
+ * the next finer level, so L levels reach half the window times 2^L - 1 pixels at level 0.
+ */
+int KLTTracker::GetLevels(float radius) const {
+	const float half = (window - 1) / 2.0f;
+	int levels = 1;
+	while (levels < MAX_PYRAMID_LEVELS && half * ((1 << levels) - 1) < radius) levels++;
+	return levels;
+}
+
+void KLTTracker::Track(const Pyramid &prev, const Pyramid &next,
+		const std::vector<Corner*> & corners, std::vector<TrackedPoint> & result) {
+	if (corners.empty()) {
+		result.clear();
+		return;
+	}
+	xs.resize(corners.size());
+	ys.resize(corners.size());
+	for (unsigned int i = 0; i < corners.size(); ++i) {
+		xs[i] = corners[i]->sx;
+		ys[i] = corners[i]->sy;
+	}
+	Track(prev, next, &xs[0], &ys[0], corners.size(), result);
+}
+
+void KLTTracker::Track(const Pyramid &prev, const Pyramid &next, const float *xs, const float *ys,
+		int count, std::vector<TrackedPoint> & result, const float *guessXs, const float *guessYs,
+		const float *radii) {
+	prevGradients.Clear();
+	nextGradients.Clear();
+	Track(prev, prevGradients, next, nextGradients, xs, ys, count, result, guessXs, guessYs,
+			radii);
+}
+
+void KLTTracker::Track(const Pyramid &prev, Gradients &gPrev, const Pyramid &next,
+		Gradients &gNext, const float *xs, const float *ys, int count,
+		std::vector<TrackedPoint> & result, const float *guessXs, const float *guessYs,
+		const float *radii) {
+	result.resize(count);
+	int levels = MAX_PYRAMID_LEVELS;
+	if (radii) {
+		float largest = 0;
+		for (int i = 0; i < count; ++i) largest = std::max(largest, radii[i]);
+		levels = GetLevels(largest);
+	}
+	gradients(prev, levels, gPrev);
+	for (int i = 0; i < count; ++i) {
+		TrackedPoint &t = result[i];
+		float gx = guessXs ? guessXs[i] : xs[i];
+		float gy = guessYs ? guessYs[i] : ys[i];
+		t.x = gx;
+		t.y = gy;
+		t.error = 0;
+		t.status = track(prev, gPrev, next, levels, xs[i], ys[i], t.x, t.y, &t.error);
+		if (t.status == TS_OK && radii) {
+			float dx = t.x - gx, dy = t.y - gy;
+			if (dx * dx + dy * dy > radii[i] * radii[i]) t.status = TS_UNEXPECTED;
+		}
+	}
+	if (!forwardBackward) return;
+
+	gradients(next, levels, gNext);
+	for (int i = 0; i < count; ++i) {
+		TrackedPoint &t = result[i];
+		if (t.status != TS_OK) continue;
+		float bx = xs[i], by = ys[i];
+		TrackStatus status = track(next, gNext, prev, levels, t.x, t.y, bx, by, NULL);
+		float dx = bx - xs[i], dy = by - ys[i];
+		if (status != TS_OK || dx * dx + dy * dy > fbThreshold * fbThreshold) {
+			t.status = TS_INCONSISTENT;
+		}
+	}
+}
@@ -0,0 +1,195 @@
+/**
+ * @brief
+ * @file KLTTracker.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 17, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef KLTTRACKER_H_
+#define KLTTRACKER_H_
+
+// General files
+#include <vector>
+
+#include <CornerDetector.h>
+#include <Pyramid.h>
+
+enum TrackStatus {
+	//! Tracked successfully
+	TS_OK,
+	//! The window left the image
+	TS_OUTSIDE,
+	//! Not enough texture in the window to track it
+	TS_FLAT,
+	//! Tracking back does not end up at the start
+	TS_INCONSISTENT,
+	//! Ended up farther from the initial guess than the search radius
+	TS_UNEXPECTED
+};
+
+struct TrackedPoint {
+	//! Position in the next image
+	float x;
+	float y;
+	TrackStatus status;
+	//! Mean absolute intensity difference of the windows at level 0
+	float error;
+};
+
+/* **************************************************************************************
+ * Interface of KLTTracker
+ * **************************************************************************************/
+
+/**
+ * Pyramidal Lucas-Kanade tracker (after Bouguet). A point is tracked from the coarsest level
+ * of the pyramids down to level 0, at every level the displacement is refined iteratively
+ * until the update is smaller than epsilon. The window around the point in the previous
+ * image (the template) and its gradients are interpolated once per level, only the window in
+ * the next image is interpolated again in every iteration. Bilinear interpolation is done in
+ * fixed point, with 14-bit weights and 5 fractional bits in the result, eight pixels at a
+ * time with SSE2. With the forward-backward check every point is tracked back from where it
+ * ended up, if it does not return to its start it is marked inconsistent. The gradients of a
+ * pyramid can be kept by the caller, so a frame that is tracked from and into only gets them
+ * computed once.
+ */
+class KLTTracker {
+public:
+	//! Scharr derivatives of the levels of a pyramid, 16 bits per pixel, computed when needed
+	struct Gradients {
+		Gradients(): levels(0) {}
+
+		//! Forget the derivatives, when the pyramid is built again
+		inline void Clear() { levels = 0; }
+
+		//! Exchange the contents with other gradients, without copying them
+		void Swap(Gradients &other);
+
+		std::vector<short> dx[MAX_PYRAMID_LEVELS];
+		std::vector<short> dy[MAX_PYRAMID_LEVELS];
+
+		//! Number of levels that are computed
+		int levels;
+	};
+
+	//! Constructor KLTTracker
+	KLTTracker(int window = 15, int maxIterations = 20, float epsilon = 0.03);
+
+	//! Destructor ~KLTTracker
+	virtual ~KLTTracker();
+
+	//! Width and height of the window around a point
+	void SetWindow(int window);
+
+	inline void SetMaxIterations(int maxIterations) { this->maxIterations = maxIterations; }
+
+	//! Iterations stop when the update is smaller than this number of pixels
+	inline void SetEpsilon(float epsilon) { this->epsilon = epsilon; }
+
+	//! Points with a smaller minimum eigenvalue of the mean structure tensor are flat
+	inline void SetMinEigenvalue(float minEigenvalue) { this->minEigenvalue = minEigenvalue; }
+
+	//! Enable the forward-backward check, threshold in pixels
+	inline void SetForwardBackward(bool enable, float threshold = 1.0) {
+		forwardBackward = enable; fbThreshold = threshold;
+	}
+
+	//! Track the corners from the previous into the next image
+	void Track(const Pyramid &prev, const Pyramid &next, const std::vector<Corner*> & corners,
+			std::vector<TrackedPoint> & result);
+
+	/**
+	 * Track count points. The initial guesses of the positions in the next image can be given,
+	 * for example from a motion model, by default they are the positions in the previous image.
+	 * With a search radius in pixels around every guess, only as many levels of the pyramids
+	 * are used as the largest radius needs, and points that end up outside their radius are
+	 * unexpected.
+	 */
+	void Track(const Pyramid &prev, const Pyramid &next, const float *xs, const float *ys,
+			int count, std::vector<TrackedPoint> & result, const float *guessXs = NULL,
+			const float *guessYs = NULL, const float *radii = NULL);
+
+	/**
+	 * Track count points with the gradients of both pyramids kept by the caller, the levels
+	 * that are missing are added to them.
+	 */
+	void Track(const Pyramid &prev, Gradients &gPrev, const Pyramid &next,
+			Gradients &gNext, const float *xs, const float *ys, int count,
+			std::vector<TrackedPoint> & result, const float *guessXs = NULL,
+			const float *guessYs = NULL, const float *radii = NULL);
+
+	//! Number of pyramid levels that are needed to find a point radius pixels from its guess
+	int GetLevels(float radius) const;
+protected:
+	//! Derivatives of the first levels of the pyramid, if they are not there yet
+	void gradients(const Pyramid &pyramid, int levels, Gradients &g);
+
+	/**
+	 * Track one point from (x,y) in from to (nx,ny) in to, which contains the initial guess,
+	 * over at most the given number of levels
+	 */
+	TrackStatus track(const Pyramid &from, const Gradients &g, const Pyramid &to, int levels,
+			float x, float y, float &nx, float &ny, float *error);
+
+	//! Check that the window at (x,y), in its padded width, is inside the image
+	inline bool inside(const ImageView &img, float x, float y) const;
+
+	/**
+	 * Interpolate the template and its gradients at (x,y), the top-left corner of the window,
+	 * and sum the structure tensor [a11 a12; a12 a22] over it.
+	 */
+	void interpolateTemplate(const ImageView &img, const short *dx, const short *dy, float x,
+			float y, float &a11, float &a12, float &a22);
+
+	//! Sum of (J - I) times the gradients, with J the window in img at (x,y)
+	void mismatch(const ImageView &img, float x, float y, float &b1, float &b2);
+
+	//! Mean absolute difference between J and the template
+	float residual(const ImageView &img, float x, float y);
+private:
+	int window;
+
+	//! Template rows are padded to a multiple of 8 pixels
+	int stride;
+
+	int maxIterations;
+
+	float epsilon;
+
+	float minEigenvalue;
+
+	bool forwardBackward;
+
+	float fbThreshold;
+
+	Gradients prevGradients;
+
+	Gradients nextGradients;
+
+	//! Template, with 5 fractional bits, and its gradients
+	std::vector<short> patch;
+	std::vector<short> patchDx;
+	std::vector<short> patchDy;
+
+	//! Positions of the corners, reused
+	std::vector<float> xs;
+	std::vector<float> ys;
+};
+
+#endif /* KLTTRACKER_H_ */
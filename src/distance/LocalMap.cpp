@@ -0,0 +1,267 @@
+/**
+ * @brief 
+ * @file LocalMap.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common 
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from 
+ * thread pools and TCP/IP components to control architectures and learning algorithms. 
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory 
+ * farming, for animal experimentation, or anything that violates the Universal 
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 21, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+// Plugin files
+#include <LocalMap.h>
+#include <Matrix.h>
+
+//! Defaults of the keyframe policy
+#define LOCALMAP_PARALLAX		20.0f
+#define LOCALMAP_SURVIVAL		0.6f
+#define LOCALMAP_INTERVAL		30
+#define LOCALMAP_TRACKED		20
+
+//! Default radius of the search for the keyframe descriptors of the tracks, in pixels
+#define LOCALMAP_SEARCH_RADIUS	64
+
+//! Size of the association table as a multiple of the number of landmarks
+#define LOCALMAP_ASSOCIATIONS	4
+
+/* **************************************************************************************
+ * Implementation of LocalMap
+ * **************************************************************************************/
+
+LocalMap::LocalMap(int window, int maxLandmarks): focal(1), baseline(1), cx(0), cy(0),
+		minParallax(LOCALMAP_PARALLAX), minSurvival(LOCALMAP_SURVIVAL),
+		maxInterval(LOCALMAP_INTERVAL), minTracked(LOCALMAP_TRACKED), observed(0), tracked(0),
+		sinceKeyframe(0), keyframes(0), relocalized(0), lastKeyframe(-1), lost(true), parallax(0),
+		searchRadius(LOCALMAP_SEARCH_RADIUS), window(window, maxLandmarks, maxLandmarks * window),
+		pnp(maxLandmarks) {
+	Association none = { -1, -1, -1, 0, 0 };
+	associations.resize(maxLandmarks * LOCALMAP_ASSOCIATIONS, none);
+	motions.resize(maxLandmarks);
+	pnp.SetProsac(true);
+	pose.t[2] = 0;
+	previous = pose;
+}
+
+LocalMap::~LocalMap() {
+	resize(keyCorners, 0);
+	resize(corners, 0);
+}
+
+void LocalMap::resize(std::vector<Corner*> &corners, int count) {
+	for (unsigned int i = count; i < corners.size(); ++i) delete corners[i];
+	for (int i = corners.size(); i < count; ++i) corners.push_back(new Corner(0, 0));
+	corners.resize(count);
+}
+
+void LocalMap::SetCamera(float focal, float baseline, float cx, float cy) {
+	this->focal = focal;
+	this->baseline = baseline;
+	this->cx = cx;
+	this->cy = cy;
+	window.SetCamera(focal, baseline, cx, cy);
+	pnp.SetCamera(focal, baseline, cx, cy);
+}
+
+/**
+ * The landmarks are taken as refined by the window so far, the pose of the frame is in the
+ * world coordinates of the map, so it does not drift between keyframes. Older tracks are
+ * more likely to follow their landmark, PROSAC samples them first.
+ */
+bool LocalMap::Track(const TrackManager &tracks, CRawImage *img) {
+	window.Poll();
+	previous = pose;
+	sinceKeyframe++;
+	tracked = 0;
+	parallax = 0;
+	pnp.Clear();
+	int n = 0;
+	for (int i = 0; i < tracks.GetCount(); ++i) {
+		const Association &a = associate(tracks.GetId(i));
+		if (a.track != tracks.GetId(i) || !window.HasLandmark(a.landmark)) continue;
+		const Vec3f &X = window.GetLandmark(a.landmark);
+		if (!pnp.Add(X[0], X[1], X[2], tracks.GetX(i), tracks.GetY(i), tracks.GetAge(i))) break;
+		if (a.keyframe == lastKeyframe) {
+			float dx = tracks.GetX(i) - a.x, dy = tracks.GetY(i) - a.y;
+			motions[n++] = sqrt(dx * dx + dy * dy);
+		}
+	}
+	if (n > 0) {
+		std::nth_element(motions.begin(), motions.begin() + n / 2, motions.begin() + n);
+		parallax = motions[n / 2];
+	}
+	RelativePose estimate;
+	lost = pnp.GetCount() < minTracked || !pnp.Estimate(estimate) ||
+			pnp.GetInlierCount() < minTracked;
+	if (lost) return img != NULL && relocalize(tracks, img);
+	pose = estimate;
+	tracked = pnp.GetInlierCount();
+	return true;
+}
+
+bool LocalMap::NeedKeyframe() const {
+	return keyframes == 0 || lost || sinceKeyframe >= maxInterval || parallax > minParallax ||
+			tracked < minSurvival * observed;
+}
+
+/**
+ * After tracking failed the map starts anew from the pose of the previous frame: the old
+ * landmarks can not be related to this frame.
+ */
+void LocalMap::AddKeyframe(const TrackManager &tracks, const float *disparities,
+		CRawImage *img) {
+	window.Poll();
+	if (lost) {
+		Association none = { -1, -1, -1, 0, 0 };
+		std::fill(associations.begin(), associations.end(), none);
+	}
+	lastKeyframe = window.AddKeyframe(pose);
+	Mat3f R = Mat3f::From(pose.R);
+	Vec3f t = Vec3f::From(pose.t);
+	observed = 0;
+	for (int i = 0; i < tracks.GetCount(); ++i) {
+		int id = tracks.GetId(i);
+		float u = tracks.GetX(i), v = tracks.GetY(i), d = disparities[i];
+		Association &a = associate(id);
+		if (a.track != id || !window.HasLandmark(a.landmark)) {
+			if (d <= 0) continue;
+			// a new landmark, from its depth focal * baseline / disparity in this keyframe
+			float z = focal * baseline / d;
+			Vec3f X = MakeVec<float>((u - cx) * z / focal, (v - cy) * z / focal, z);
+			Vec3f world = R.Transpose() * (X - t);
+			int landmark = window.AddLandmark(world[0], world[1], world[2]);
+			if (landmark < 0) continue;
+			a.track = id;
+			a.landmark = landmark;
+		}
+		if (!window.AddObservation(lastKeyframe, a.landmark, u, v, d)) continue;
+		a.keyframe = lastKeyframe;
+		a.x = u;
+		a.y = v;
+		observed++;
+	}
+
+	// the descriptors of the observations, to relocalize against
+	keyLandmarks.clear();
+	resize(keyCorners, img ? observed : 0);
+	if (img) {
+		for (int i = 0; i < tracks.GetCount(); ++i) {
+			const Association &a = associate(tracks.GetId(i));
+			if (a.track != tracks.GetId(i) || a.keyframe != lastKeyframe) continue;
+			Corner *corner = keyCorners[keyLandmarks.size()];
+			corner->sx = a.x;
+			corner->sy = a.y;
+			corner->x = (int)a.x;
+			corner->y = (int)a.y;
+			keyLandmarks.push_back(a.landmark);
+		}
+		extractor.Extract(img, keyCorners, keyDescriptors);
+		keyGrid.Build(keyCorners, img->getwidth(), img->getheight(), searchRadius);
+	}
+	tracked = observed;
+	parallax = 0;
+	sinceKeyframe = 0;
+	keyframes++;
+	lost = false;
+	window.Start();
+}
+
+/**
+ * The tracks that got lost have been replaced by new tracks, which have no landmark yet.
+ * These are matched to the keyframe by appearance, with the ratio test and the cross-check
+ * of the matcher, and PnP removes the matches that are still wrong, sampling the matches
+ * with the smallest Hamming distance first. Only the inliers are
+ * associated with the landmark they matched, also the tracks that survived: most of them
+ * did not follow their landmark, or tracking would not have failed.
+ */
+bool LocalMap::relocalize(const TrackManager &tracks, CRawImage *img) {
+	if (keyLandmarks.empty()) return false;
+	resize(corners, tracks.GetCount());
+	for (int i = 0; i < tracks.GetCount(); ++i) {
+		corners[i]->sx = tracks.GetX(i);
+		corners[i]->sy = tracks.GetY(i);
+		corners[i]->x = (int)tracks.GetX(i);
+		corners[i]->y = (int)tracks.GetY(i);
+	}
+	extractor.Extract(img, corners, descriptors);
+	matcher.Match(descriptors, corners, keyDescriptors, keyGrid, searchRadius, matches);
+
+	pnp.Clear();
+	matched.clear();
+	for (unsigned int m = 0; m < matches.size(); ++m) {
+		int landmark = keyLandmarks[matches[m].train];
+		if (!window.HasLandmark(landmark)) continue;
+		const Vec3f &X = window.GetLandmark(landmark);
+		if (!pnp.Add(X[0], X[1], X[2], corners[matches[m].query]->sx,
+				corners[matches[m].query]->sy, -matches[m].distance)) break;
+		matched.push_back(m);
+	}
+	RelativePose estimate;
+	if (pnp.GetCount() < minTracked || !pnp.Estimate(estimate) ||
+			pnp.GetInlierCount() < minTracked) return false;
+
+	for (int i = 0; i < tracks.GetCount(); ++i) {
+		Association &a = associate(tracks.GetId(i));
+		if (a.track == tracks.GetId(i)) a.track = -1;
+	}
+	const unsigned char *inliers = pnp.GetInliers();
+	int n = 0;
+	for (unsigned int k = 0; k < matched.size(); ++k) {
+		if (!inliers[k]) continue;
+		const DescriptorMatch &match = matches[matched[k]];
+		const Corner *key = keyCorners[match.train];
+		Association &a = associate(tracks.GetId(match.query));
+		a.track = tracks.GetId(match.query);
+		a.landmark = keyLandmarks[match.train];
+		a.keyframe = lastKeyframe;
+		a.x = key->sx;
+		a.y = key->sy;
+		float dx = corners[match.query]->sx - a.x, dy = corners[match.query]->sy - a.y;
+		motions[n++] = sqrt(dx * dx + dy * dy);
+	}
+	std::nth_element(motions.begin(), motions.begin() + n / 2, motions.begin() + n);
+	parallax = motions[n / 2];
+	pose = estimate;
+	tracked = pnp.GetInlierCount();
+	lost = false;
+	relocalized++;
+	return true;
+}
+
+//! The motion R, t with pose = motion * previous
+void LocalMap::GetMotion(RelativePose &motion) const {
+	Mat3f R = Mat3f::From(pose.R) * Mat3f::From(previous.R).Transpose();
+	Vec3f t = Vec3f::From(pose.t) - R * Vec3f::From(previous.t);
+	R.CopyTo(motion.R);
+	t.CopyTo(motion.t);
+}
+
+void LocalMap::GetDisparities(const TrackManager &tracks, float *disparities) const {
+	Mat3f R = Mat3f::From(pose.R);
+	Vec3f t = Vec3f::From(pose.t);
+	for (int i = 0; i < tracks.GetCount(); ++i) {
+		disparities[i] = 0;
+		const Association &a = associate(tracks.GetId(i));
+		if (a.track != tracks.GetId(i) || !window.HasLandmark(a.landmark)) continue;
+		Vec3f X = R * window.GetLandmark(a.landmark) + t;
+		if (X[2] > 0) disparities[i] = focal * baseline / X[2];
+	}
+}
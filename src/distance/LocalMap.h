@@ -0,0 +1,206 @@
+/**
+ * @brief
+ * @file LocalMap.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 21, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef LOCALMAP_H_
+#define LOCALMAP_H_
+
+// General files
+#include <vector>
+
+#include <TrackManager.h>
+#include <PnP.h>
+#include <BundleAdjustment.h>
+#include <BinaryDescriptor.h>
+
+/* **************************************************************************************
+ * Interface of LocalMap
+ * **************************************************************************************/
+
+/**
+ * The landmarks of the last keyframes, and the pose of every frame with respect to them.
+ *
+ * A frame is tracked against the map: the tracks that follow a landmark give its pose by
+ * PnP directly in world coordinates, which needs no disparity. Only a keyframe gets the
+ * expensive treatment: tracks observe their landmarks in it, and tracks without a landmark
+ * start one from their disparity. A frame becomes a keyframe when the tracks moved far
+ * enough since the last one (parallax), when too few of the landmarks of the last keyframe
+ * are still tracked, after a maximum number of frames, or when tracking fails. The
+ * keyframes and landmarks live in a SlidingWindow, which refines them in the background.
+ *
+ * Tracks are associated with landmarks through a table indexed by track ID modulo its
+ * size, so nothing is allocated per frame. A track that collides with a much older one
+ * that is still alive loses its landmark, and gets a new one at the next keyframe.
+ *
+ * When the image is given, a keyframe also keeps the binary descriptors of the tracks that
+ * observe its landmarks. If tracking fails, because the tracks that followed the landmarks
+ * got lost, the current tracks are matched to those descriptors around their position in
+ * the keyframe, and the pose is estimated from the landmarks they are matched to. The
+ * tracks that agree with that pose follow the landmarks from then on (relocalization).
+ */
+class LocalMap {
+public:
+	//! Constructor LocalMap
+	LocalMap(int window = 5, int maxLandmarks = 1024);
+
+	//! Destructor ~LocalMap
+	virtual ~LocalMap();
+
+	//! Focal length and principal point of the rectified stereo pair in pixels, the baseline in
+	//! the metric units of stereo.cfg
+	void SetCamera(float focal, float baseline, float cx, float cy);
+
+	//! A keyframe is added when the median motion of the tracks exceeds this number of pixels
+	inline void SetMinParallax(float parallax) { minParallax = parallax; }
+
+	//! A keyframe is added when fewer than this fraction of its landmarks is still tracked
+	inline void SetMinSurvival(float survival) { minSurvival = survival; }
+
+	//! A keyframe is added at least every so many frames
+	inline void SetMaxInterval(int interval) { maxInterval = interval; }
+
+	//! Tracking fails with fewer landmarks than this
+	inline void SetMinTracked(int tracked) { minTracked = tracked; }
+
+	//! Tracks are matched to the keyframe within a square of this number of pixels
+	inline void SetSearchRadius(int radius) { searchRadius = radius; }
+
+	/**
+	 * Estimate the pose of the frame the tracks were last updated with, img is the grayscale
+	 * image of that frame, to relocalize with if tracking fails. False if too few tracks
+	 * follow a landmark or no pose is found, the pose is then that of the previous frame.
+	 */
+	bool Track(const TrackManager &tracks, CRawImage *img = NULL);
+
+	//! Whether the frame of the last Track should become a keyframe
+	bool NeedKeyframe() const;
+
+	/**
+	 * Make the frame of the last Track a keyframe, disparities holds the disparity in pixels
+	 * of every track, zero or less if it has none. Without the grayscale image of the frame
+	 * the keyframe can not be relocalized against.
+	 */
+	void AddKeyframe(const TrackManager &tracks, const float *disparities, CRawImage *img = NULL);
+
+	//! The pose of the last frame, from world to camera
+	inline const RelativePose & GetPose() const { return pose; }
+
+	//! The motion from the frame before the last one to the last one
+	void GetMotion(RelativePose &motion) const;
+
+	/**
+	 * The disparity in pixels that the landmark of every track has in the last frame, zero
+	 * for tracks without a landmark.
+	 */
+	void GetDisparities(const TrackManager &tracks, float *disparities) const;
+
+	//! Number of tracks that followed a landmark in the last Track
+	inline int GetTracked() const { return tracked; }
+
+	//! Number of times tracking was recovered by matching descriptors to the keyframe
+	inline int GetRelocalized() const { return relocalized; }
+
+	//! Median motion in pixels of the tracks since the last keyframe
+	inline float GetParallax() const { return parallax; }
+
+	inline int GetKeyframeCount() const { return keyframes; }
+
+	inline SlidingWindow & GetWindow() { return window; }
+
+	inline PnPEstimator & GetPnP() { return pnp; }
+protected:
+	//! Association of a track with a landmark and its position in the keyframe it was seen in
+	struct Association {
+		int track, landmark, keyframe;
+		float x, y;
+	};
+
+	inline Association & associate(int track) { return associations[track % associations.size()]; }
+
+	inline const Association & associate(int track) const {
+		return associations[track % associations.size()];
+	}
+
+	//! Match the tracks to the descriptors of the last keyframe and estimate the pose from those
+	bool relocalize(const TrackManager &tracks, CRawImage *img);
+
+	//! Make count corners available, they are reused
+	static void resize(std::vector<Corner*> &corners, int count);
+private:
+	float focal, baseline, cx, cy;
+
+	float minParallax, minSurvival;
+
+	int maxInterval, minTracked;
+
+	//! Landmarks observed in the last keyframe, and how many of them were tracked now
+	int observed, tracked;
+
+	int sinceKeyframe;
+
+	int keyframes, relocalized;
+
+	int lastKeyframe;
+
+	bool lost;
+
+	float parallax;
+
+	int searchRadius;
+
+	RelativePose pose, previous;
+
+	std::vector<Association> associations;
+
+	//! Motion of every tracked landmark since the last keyframe, for the median
+	std::vector<float> motions;
+
+	SlidingWindow window;
+
+	PnPEstimator pnp;
+
+	BriefExtractor extractor;
+
+	BinaryMatcher matcher;
+
+	//! Positions and descriptors of the tracks with a landmark in the last keyframe
+	std::vector<Corner*> keyCorners;
+
+	std::vector<int> keyLandmarks;
+
+	DescriptorSet keyDescriptors;
+
+	SpatialGrid keyGrid;
+
+	//! Positions and descriptors of the tracks when relocalizing, and their matches
+	std::vector<Corner*> corners;
+
+	DescriptorSet descriptors;
+
+	std::vector<DescriptorMatch> matches;
+
+	//! Index in matches of every correspondence given to PnP
+	std::vector<int> matched;
+};
+
+#endif /* LOCALMAP_H_ */
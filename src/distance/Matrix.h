@@ -0,0 +1,670 @@
+/**
+ * @brief
+ * @file Matrix.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 12, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+// General files
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/* **************************************************************************************
+ * Unrolled inner products
+ * **************************************************************************************/
+
+/**
+ * Inner product of N elements, of which those of b are stride apart, unrolled at compile
+ * time like the kernels in Convolver.h.
+ */
+template<int N>
+struct MatUnroll {
+	template<typename T>
+	static constexpr T dot(const T *a, const T *b, int stride) {
+		return a[0] * b[0] + MatUnroll<N-1>::dot(a + 1, b + stride, stride);
+	}
+};
+
+template<>
+struct MatUnroll<0> {
+	template<typename T>
+	static constexpr T dot(const T *, const T *, int) { return 0; }
+};
+
+//! c = a b for an R x C and a C x K matrix, row-major
+template<int R, int C, int K, typename T>
+struct MatMultiply {
+	static inline void apply(const T *a, const T *b, T *c) {
+		for (int i = 0; i < R; ++i) {
+			for (int j = 0; j < K; ++j) c[i*K+j] = MatUnroll<C>::dot(a + i*C, b + j, K);
+		}
+	}
+};
+
+#ifdef __SSE__
+//! 4x4 times 4x4 in single precision: every row of c is a combination of the rows of b
+template<>
+struct MatMultiply<4, 4, 4, float> {
+	static inline void apply(const float *a, const float *b, float *c) {
+		__m128 b0 = _mm_loadu_ps(b), b1 = _mm_loadu_ps(b + 4);
+		__m128 b2 = _mm_loadu_ps(b + 8), b3 = _mm_loadu_ps(b + 12);
+		for (int i = 0; i < 4; ++i) {
+			__m128 r = _mm_mul_ps(_mm_set1_ps(a[i*4]), b0);
+			r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i*4+1]), b1));
+			r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i*4+2]), b2));
+			r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i*4+3]), b3));
+			_mm_storeu_ps(c + i*4, r);
+		}
+	}
+};
+
+//! 4x4 times a 4-vector in single precision, as a combination of the columns of a
+template<>
+struct MatMultiply<4, 4, 1, float> {
+	static inline void apply(const float *a, const float *b, float *c) {
+		__m128 r0 = _mm_loadu_ps(a), r1 = _mm_loadu_ps(a + 4);
+		__m128 r2 = _mm_loadu_ps(a + 8), r3 = _mm_loadu_ps(a + 12);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		__m128 r = _mm_mul_ps(r0, _mm_set1_ps(b[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(r1, _mm_set1_ps(b[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(r2, _mm_set1_ps(b[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(r3, _mm_set1_ps(b[3])));
+		_mm_storeu_ps(c, r);
+	}
+};
+#endif
+
+/* **************************************************************************************
+ * Interface of Mat
+ * **************************************************************************************/
+
+/**
+ * Matrix with its dimensions known at compile time, stored row-major in the object itself,
+ * so it lives on the stack and nothing is allocated. It is an aggregate without
+ * constructors: "Mat<3,3> A;" is not initialized, "Mat<2,2> A = {{ 1, 2, 3, 4 }};" is, also
+ * in constant expressions. The factories and accessors that C++11 allows in a constant
+ * expression, with a body of a single return, are constexpr. Vectors are matrices of one
+ * column, see Vec.
+ */
+template<int R, int C, typename T = float>
+struct Mat {
+	enum { ROWS = R, COLS = C, SIZE = R * C };
+
+	T m[R * C];
+
+	//! Value-initialized, so all elements are zero
+	static constexpr Mat Zero() { return Mat(); }
+
+	static inline Mat Identity() {
+		Mat a = Zero();
+		for (int i = 0; i < R && i < C; ++i) a.m[i*C+i] = 1;
+		return a;
+	}
+
+	//! From R*C values in row-major order, of any type
+	template<typename S>
+	static inline Mat From(const S *values) {
+		Mat a;
+		for (int i = 0; i < SIZE; ++i) a.m[i] = values[i];
+		return a;
+	}
+
+	template<typename S>
+	inline void CopyTo(S *values) const {
+		for (int i = 0; i < SIZE; ++i) values[i] = m[i];
+	}
+
+	template<typename S>
+	inline Mat<R, C, S> Cast() const {
+		Mat<R, C, S> a;
+		for (int i = 0; i < SIZE; ++i) a.m[i] = m[i];
+		return a;
+	}
+
+	inline T & operator()(int r, int c) { return m[r*C+c]; }
+	constexpr const T & operator()(int r, int c) const { return m[r*C+c]; }
+
+	//! Element i in row-major order, for vectors the i-th element
+	inline T & operator[](int i) { return m[i]; }
+	constexpr const T & operator[](int i) const { return m[i]; }
+
+	inline Mat<C, R, T> Transpose() const {
+		Mat<C, R, T> a;
+		for (int i = 0; i < R; ++i) {
+			for (int j = 0; j < C; ++j) a.m[j*R+i] = m[i*C+j];
+		}
+		return a;
+	}
+
+	//! The BR x BC block with its top left corner at (r,c)
+	template<int BR, int BC>
+	inline Mat<BR, BC, T> Block(int r, int c) const {
+		Mat<BR, BC, T> a;
+		for (int i = 0; i < BR; ++i) {
+			for (int j = 0; j < BC; ++j) a.m[i*BC+j] = m[(r+i)*C+c+j];
+		}
+		return a;
+	}
+
+	template<int BR, int BC>
+	inline void SetBlock(int r, int c, const Mat<BR, BC, T> &b) {
+		for (int i = 0; i < BR; ++i) {
+			for (int j = 0; j < BC; ++j) m[(r+i)*C+c+j] = b.m[i*BC+j];
+		}
+	}
+
+	inline Mat<1, C, T> Row(int r) const { return Block<1, C>(r, 0); }
+	inline Mat<R, 1, T> Col(int c) const { return Block<R, 1>(0, c); }
+
+	inline void SetRow(int r, const Mat<1, C, T> &row) { SetBlock(r, 0, row); }
+	inline void SetCol(int c, const Mat<R, 1, T> &col) { SetBlock(0, c, col); }
+
+	inline Mat & operator+=(const Mat &b) {
+		for (int i = 0; i < SIZE; ++i) m[i] += b.m[i];
+		return *this;
+	}
+
+	inline Mat & operator-=(const Mat &b) {
+		for (int i = 0; i < SIZE; ++i) m[i] -= b.m[i];
+		return *this;
+	}
+
+	inline Mat & operator*=(T s) {
+		for (int i = 0; i < SIZE; ++i) m[i] *= s;
+		return *this;
+	}
+
+	inline Mat & operator/=(T s) {
+		for (int i = 0; i < SIZE; ++i) m[i] /= s;
+		return *this;
+	}
+
+	inline Mat operator+(const Mat &b) const { Mat a = *this; return a += b; }
+	inline Mat operator-(const Mat &b) const { Mat a = *this; return a -= b; }
+	inline Mat operator*(T s) const { Mat a = *this; return a *= s; }
+	inline Mat operator/(T s) const { Mat a = *this; return a /= s; }
+
+	inline Mat operator-() const {
+		Mat a;
+		for (int i = 0; i < SIZE; ++i) a.m[i] = -m[i];
+		return a;
+	}
+
+	template<int K>
+	inline Mat<R, K, T> operator*(const Mat<C, K, T> &b) const {
+		Mat<R, K, T> a;
+		MatMultiply<R, C, K, T>::apply(m, b.m, a.m);
+		return a;
+	}
+
+	//! Sum of the squares of all elements, the squared Frobenius norm
+	constexpr T SquaredNorm() const {
+		return MatUnroll<SIZE>::dot(m, m, 1);
+	}
+
+	inline T Norm() const { return std::sqrt(SquaredNorm()); }
+
+	inline Mat Normalized() const { return *this / Norm(); }
+
+	inline T Trace() const {
+		T t = 0;
+		for (int i = 0; i < R && i < C; ++i) t += m[i*C+i];
+		return t;
+	}
+};
+
+template<int R, int C, typename T>
+inline Mat<R, C, T> operator*(T s, const Mat<R, C, T> &a) { return a * s; }
+
+//! Column vector
+template<int N, typename T = float>
+using Vec = Mat<N, 1, T>;
+
+typedef Mat<2, 2, float> Mat2f;
+typedef Mat<3, 3, float> Mat3f;
+typedef Mat<4, 4, float> Mat4f;
+typedef Mat<2, 2, double> Mat2d;
+typedef Mat<3, 3, double> Mat3d;
+typedef Mat<4, 4, double> Mat4d;
+typedef Vec<2, float> Vec2f;
+typedef Vec<3, float> Vec3f;
+typedef Vec<4, float> Vec4f;
+typedef Vec<2, double> Vec2d;
+typedef Vec<3, double> Vec3d;
+typedef Vec<4, double> Vec4d;
+
+/* **************************************************************************************
+ * Vectors
+ * **************************************************************************************/
+
+template<int N, typename T>
+constexpr T Dot(const Vec<N, T> &a, const Vec<N, T> &b) {
+	return MatUnroll<N>::dot(a.m, b.m, 1);
+}
+
+template<typename T>
+constexpr Vec<3, T> Cross(const Vec<3, T> &a, const Vec<3, T> &b) {
+	return Vec<3, T>{{ a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+			a[0] * b[1] - a[1] * b[0] }};
+}
+
+//! The matrix [v]x with [v]x w = v x w
+template<typename T>
+constexpr Mat<3, 3, T> Skew(const Vec<3, T> &v) {
+	return Mat<3, 3, T>{{ 0, -v[2], v[1], v[2], 0, -v[0], -v[1], v[0], 0 }};
+}
+
+template<typename T>
+constexpr Vec<3, T> MakeVec(T x, T y, T z) {
+	return Vec<3, T>{{ x, y, z }};
+}
+
+/* **************************************************************************************
+ * Determinants and inverses
+ * **************************************************************************************/
+
+template<typename T>
+constexpr T Determinant(const Mat<2, 2, T> &a) {
+	return a[0] * a[3] - a[1] * a[2];
+}
+
+template<typename T>
+constexpr T Determinant(const Mat<3, 3, T> &a) {
+	return a[0] * (a[4] * a[8] - a[5] * a[7]) - a[1] * (a[3] * a[8] - a[5] * a[6]) +
+			a[2] * (a[3] * a[7] - a[4] * a[6]);
+}
+
+//! Inverse by the adjugate, false if the matrix is singular
+template<typename T>
+inline bool Inverse(const Mat<2, 2, T> &a, Mat<2, 2, T> &inverse) {
+	T det = Determinant(a);
+	if (det == 0) return false;
+	Mat<2, 2, T> adj = {{ a[3], -a[1], -a[2], a[0] }};
+	inverse = adj / det;
+	return true;
+}
+
+//! Inverse by the adjugate, false if the matrix is singular
+template<typename T>
+inline bool Inverse(const Mat<3, 3, T> &a, Mat<3, 3, T> &inverse) {
+	Mat<3, 3, T> adj = {{
+		a[4] * a[8] - a[5] * a[7], a[2] * a[7] - a[1] * a[8], a[1] * a[5] - a[2] * a[4],
+		a[5] * a[6] - a[3] * a[8], a[0] * a[8] - a[2] * a[6], a[2] * a[3] - a[0] * a[5],
+		a[3] * a[7] - a[4] * a[6], a[1] * a[6] - a[0] * a[7], a[0] * a[4] - a[1] * a[3] }};
+	T det = a[0] * adj[0] + a[1] * adj[3] + a[2] * adj[6];
+	if (det == 0) return false;
+	inverse = adj / det;
+	return true;
+}
+
+/**
+ * Inverse of a 4x4 matrix by the adjugate, with the 2x2 minors of the top and bottom two
+ * rows shared between the cofactors. False if the matrix is singular.
+ */
+template<typename T>
+inline bool Inverse(const Mat<4, 4, T> &a, Mat<4, 4, T> &inverse) {
+	T s0 = a[0] * a[5] - a[4] * a[1], s1 = a[0] * a[6] - a[4] * a[2];
+	T s2 = a[0] * a[7] - a[4] * a[3], s3 = a[1] * a[6] - a[5] * a[2];
+	T s4 = a[1] * a[7] - a[5] * a[3], s5 = a[2] * a[7] - a[6] * a[3];
+	T c5 = a[10] * a[15] - a[14] * a[11], c4 = a[9] * a[15] - a[13] * a[11];
+	T c3 = a[9] * a[14] - a[13] * a[10], c2 = a[8] * a[15] - a[12] * a[11];
+	T c1 = a[8] * a[14] - a[12] * a[10], c0 = a[8] * a[13] - a[12] * a[9];
+	T det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	if (det == 0) return false;
+	T d = 1 / det;
+	Mat<4, 4, T> &b = inverse;
+	b[0] = ( a[5] * c5 - a[6] * c4 + a[7] * c3) * d;
+	b[1] = (-a[1] * c5 + a[2] * c4 - a[3] * c3) * d;
+	b[2] = ( a[13] * s5 - a[14] * s4 + a[15] * s3) * d;
+	b[3] = (-a[9] * s5 + a[10] * s4 - a[11] * s3) * d;
+	b[4] = (-a[4] * c5 + a[6] * c2 - a[7] * c1) * d;
+	b[5] = ( a[0] * c5 - a[2] * c2 + a[3] * c1) * d;
+	b[6] = (-a[12] * s5 + a[14] * s2 - a[15] * s1) * d;
+	b[7] = ( a[8] * s5 - a[10] * s2 + a[11] * s1) * d;
+	b[8] = ( a[4] * c4 - a[5] * c2 + a[7] * c0) * d;
+	b[9] = (-a[0] * c4 + a[1] * c2 - a[3] * c0) * d;
+	b[10] = ( a[12] * s4 - a[13] * s2 + a[15] * s0) * d;
+	b[11] = (-a[8] * s4 + a[9] * s2 - a[11] * s0) * d;
+	b[12] = (-a[4] * c3 + a[5] * c1 - a[6] * c0) * d;
+	b[13] = ( a[0] * c3 - a[1] * c1 + a[2] * c0) * d;
+	b[14] = (-a[12] * s3 + a[13] * s1 - a[14] * s0) * d;
+	b[15] = ( a[8] * s3 - a[9] * s1 + a[10] * s0) * d;
+	return true;
+}
+
+/* **************************************************************************************
+ * Linear systems
+ * **************************************************************************************/
+
+/**
+ * Solve A x = b by Gaussian elimination with partial pivoting. The solution replaces b.
+ * False if A is (nearly) singular.
+ */
+template<int N, typename T>
+inline bool Solve(Mat<N, N, T> A, Vec<N, T> &b, T epsilon = T(1e-12)) {
+	for (int k = 0; k < N; ++k) {
+		int pivot = k;
+		for (int i = k + 1; i < N; ++i) {
+			if (std::fabs(A(i, k)) > std::fabs(A(pivot, k))) pivot = i;
+		}
+		if (std::fabs(A(pivot, k)) < epsilon) return false;
+		if (pivot != k) {
+			for (int j = 0; j < N; ++j) std::swap(A(k, j), A(pivot, j));
+			std::swap(b[k], b[pivot]);
+		}
+		for (int i = k + 1; i < N; ++i) {
+			T f = A(i, k) / A(k, k);
+			for (int j = k; j < N; ++j) A(i, j) -= f * A(k, j);
+			b[i] -= f * b[k];
+		}
+	}
+	for (int k = N - 1; k >= 0; --k) {
+		for (int j = k + 1; j < N; ++j) b[k] -= A(k, j) * b[j];
+		b[k] /= A(k, k);
+	}
+	return true;
+}
+
+/**
+ * Solve A x = b for a symmetric positive definite A by the Cholesky decomposition A = L L^T,
+ * as for normal equations. The solution replaces b. False if A is not positive definite.
+ */
+template<int N, typename T>
+inline bool SolveCholesky(Mat<N, N, T> A, Vec<N, T> &b) {
+	for (int j = 0; j < N; ++j) {
+		T d = A(j, j);
+		for (int k = 0; k < j; ++k) d -= A(j, k) * A(j, k);
+		if (d <= 0) return false;
+		d = std::sqrt(d);
+		A(j, j) = d;
+		for (int i = j + 1; i < N; ++i) {
+			T s = A(i, j);
+			for (int k = 0; k < j; ++k) s -= A(i, k) * A(j, k);
+			A(i, j) = s / d;
+		}
+	}
+	for (int i = 0; i < N; ++i) {
+		for (int k = 0; k < i; ++k) b[i] -= A(i, k) * b[k];
+		b[i] /= A(i, i);
+	}
+	for (int i = N - 1; i >= 0; --i) {
+		for (int k = i + 1; k < N; ++k) b[i] -= A(k, i) * b[k];
+		b[i] /= A(i, i);
+	}
+	return true;
+}
+
+/* **************************************************************************************
+ * Eigenvalues and singular values
+ * **************************************************************************************/
+
+/**
+ * Eigen decomposition A = V diag(values) V^T of a symmetric matrix by cyclic Jacobi
+ * rotations, with the eigenvalues in decreasing order and the eigenvectors in the columns
+ * of V. Accurate also for the small eigenvalues, which are the interesting ones for
+ * least-squares problems.
+ */
+template<int N, typename T>
+inline void SymmetricEigen(Mat<N, N, T> A, Vec<N, T> &values, Mat<N, N, T> &V) {
+	V = Mat<N, N, T>::Identity();
+	for (int sweep = 0; sweep < 30; ++sweep) {
+		T off = 0, diagonal = 0;
+		for (int i = 0; i < N; ++i) {
+			diagonal += A(i, i) * A(i, i);
+			for (int j = i + 1; j < N; ++j) off += A(i, j) * A(i, j);
+		}
+		if (off <= T(1e-30) * diagonal) break;
+		for (int p = 0; p < N; ++p) {
+			for (int q = p + 1; q < N; ++q) {
+				T apq = A(p, q);
+				if (apq == 0) continue;
+				T theta = (A(q, q) - A(p, p)) / (2 * apq);
+				T t = (theta >= 0 ? 1 : -1) / (std::fabs(theta) + std::sqrt(theta * theta + 1));
+				T c = 1 / std::sqrt(t * t + 1), s = t * c;
+				for (int k = 0; k < N; ++k) {
+					T akp = A(k, p), akq = A(k, q);
+					A(k, p) = c * akp - s * akq;
+					A(k, q) = s * akp + c * akq;
+				}
+				for (int k = 0; k < N; ++k) {
+					T apk = A(p, k), aqk = A(q, k);
+					A(p, k) = c * apk - s * aqk;
+					A(q, k) = s * apk + c * aqk;
+				}
+				for (int k = 0; k < N; ++k) {
+					T vkp = V(k, p), vkq = V(k, q);
+					V(k, p) = c * vkp - s * vkq;
+					V(k, q) = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+	for (int i = 0; i < N; ++i) values[i] = A(i, i);
+	// selection sort, largest first
+	for (int i = 0; i < N; ++i) {
+		int largest = i;
+		for (int j = i + 1; j < N; ++j) {
+			if (values[j] > values[largest]) largest = j;
+		}
+		if (largest == i) continue;
+		std::swap(values[i], values[largest]);
+		for (int k = 0; k < N; ++k) std::swap(V(k, i), V(k, largest));
+	}
+}
+
+/**
+ * Singular value decomposition A = U diag(S) V^T of an R x C matrix with R >= C, by one-
+ * sided Jacobi rotations on the columns of A (Hestenes). The singular values are in
+ * decreasing order. Columns of U that belong to a zero singular value are zero.
+ */
+template<int R, int C, typename T>
+inline void SVD(const Mat<R, C, T> &A, Mat<R, C, T> &U, Vec<C, T> &S, Mat<C, C, T> &V) {
+	typedef char rows_at_least_columns[(R >= C) ? 1 : -1];
+	(void)sizeof(rows_at_least_columns);
+	U = A;
+	V = Mat<C, C, T>::Identity();
+	for (int sweep = 0; sweep < 30; ++sweep) {
+		bool rotated = false;
+		for (int p = 0; p < C; ++p) {
+			for (int q = p + 1; q < C; ++q) {
+				T alpha = 0, beta = 0, gamma = 0;
+				for (int k = 0; k < R; ++k) {
+					alpha += U(k, p) * U(k, p);
+					beta += U(k, q) * U(k, q);
+					gamma += U(k, p) * U(k, q);
+				}
+				if (std::fabs(gamma) <= T(1e-15) * std::sqrt(alpha * beta) || gamma == 0) continue;
+				rotated = true;
+				T zeta = (beta - alpha) / (2 * gamma);
+				T t = (zeta >= 0 ? 1 : -1) / (std::fabs(zeta) + std::sqrt(1 + zeta * zeta));
+				T c = 1 / std::sqrt(1 + t * t), s = c * t;
+				for (int k = 0; k < R; ++k) {
+					T up = U(k, p), uq = U(k, q);
+					U(k, p) = c * up - s * uq;
+					U(k, q) = s * up + c * uq;
+				}
+				for (int k = 0; k < C; ++k) {
+					T vp = V(k, p), vq = V(k, q);
+					V(k, p) = c * vp - s * vq;
+					V(k, q) = s * vp + c * vq;
+				}
+			}
+		}
+		if (!rotated) break;
+	}
+	for (int j = 0; j < C; ++j) {
+		T norm = 0;
+		for (int k = 0; k < R; ++k) norm += U(k, j) * U(k, j);
+		S[j] = std::sqrt(norm);
+	}
+	for (int i = 0; i < C; ++i) {
+		int largest = i;
+		for (int j = i + 1; j < C; ++j) {
+			if (S[j] > S[largest]) largest = j;
+		}
+		if (largest != i) {
+			std::swap(S[i], S[largest]);
+			for (int k = 0; k < R; ++k) std::swap(U(k, i), U(k, largest));
+			for (int k = 0; k < C; ++k) std::swap(V(k, i), V(k, largest));
+		}
+		for (int k = 0; k < R; ++k) U(k, i) = S[i] > 0 ? U(k, i) / S[i] : 0;
+	}
+}
+
+/* **************************************************************************************
+ * Rotations
+ * **************************************************************************************/
+
+//! Rotation matrix of a rotation vector (axis times angle), Rodrigues' formula
+template<typename T>
+inline Mat<3, 3, T> Exp(const Vec<3, T> &w) {
+	T theta = w.Norm();
+	if (theta < T(1e-12)) return Mat<3, 3, T>::Identity() + Skew(w);
+	Vec<3, T> k = w / theta;
+	Mat<3, 3, T> K = Skew(k);
+	return Mat<3, 3, T>::Identity() + K * std::sin(theta) + (K * K) * (1 - std::cos(theta));
+}
+
+//! Rotation vector of a rotation matrix, the inverse of Exp for angles below pi
+template<typename T>
+inline Vec<3, T> Log(const Mat<3, 3, T> &R) {
+	T c = std::max(T(-1), std::min(T(1), (R.Trace() - 1) / 2));
+	T theta = std::acos(c);
+	Vec<3, T> w = {{ R(2, 1) - R(1, 2), R(0, 2) - R(2, 0), R(1, 0) - R(0, 1) }};
+	if (theta < T(1e-6)) return w / 2;
+	T s = std::sin(theta);
+	if (s > T(1e-6)) return w * (theta / (2 * s));
+	// near pi: the axis from the largest diagonal element of (R + I) / 2
+	int i = 0;
+	if (R(1, 1) > R(i, i)) i = 1;
+	if (R(2, 2) > R(i, i)) i = 2;
+	Vec<3, T> axis;
+	for (int j = 0; j < 3; ++j) axis[j] = (R(j, i) + (i == j ? 1 : 0)) / 2;
+	return axis.Normalized() * theta;
+}
+
+/**
+ * Unit quaternion w + x i + y j + z k for rotations: cheaper to compose and to keep
+ * normalized than a rotation matrix.
+ */
+template<typename T = float>
+struct Quaternion {
+	T w, x, y, z;
+
+	static inline Quaternion Identity() {
+		Quaternion q = { 1, 0, 0, 0 };
+		return q;
+	}
+
+	static inline Quaternion FromRotationVector(const Vec<3, T> &v) {
+		T theta = v.Norm();
+		if (theta < T(1e-12)) {
+			Quaternion q = { 1, v[0] / 2, v[1] / 2, v[2] / 2 };
+			return q.Normalized();
+		}
+		T s = std::sin(theta / 2) / theta;
+		Quaternion q = { std::cos(theta / 2), v[0] * s, v[1] * s, v[2] * s };
+		return q;
+	}
+
+	//! From a rotation matrix, by the largest of the four possible square roots
+	static inline Quaternion FromMatrix(const Mat<3, 3, T> &R) {
+		Quaternion q;
+		T trace = R.Trace();
+		if (trace > 0) {
+			T s = std::sqrt(trace + 1) * 2;
+			q.w = s / 4;
+			q.x = (R(2, 1) - R(1, 2)) / s;
+			q.y = (R(0, 2) - R(2, 0)) / s;
+			q.z = (R(1, 0) - R(0, 1)) / s;
+		} else if (R(0, 0) > R(1, 1) && R(0, 0) > R(2, 2)) {
+			T s = std::sqrt(1 + R(0, 0) - R(1, 1) - R(2, 2)) * 2;
+			q.w = (R(2, 1) - R(1, 2)) / s;
+			q.x = s / 4;
+			q.y = (R(0, 1) + R(1, 0)) / s;
+			q.z = (R(0, 2) + R(2, 0)) / s;
+		} else if (R(1, 1) > R(2, 2)) {
+			T s = std::sqrt(1 + R(1, 1) - R(0, 0) - R(2, 2)) * 2;
+			q.w = (R(0, 2) - R(2, 0)) / s;
+			q.x = (R(0, 1) + R(1, 0)) / s;
+			q.y = s / 4;
+			q.z = (R(1, 2) + R(2, 1)) / s;
+		} else {
+			T s = std::sqrt(1 + R(2, 2) - R(0, 0) - R(1, 1)) * 2;
+			q.w = (R(1, 0) - R(0, 1)) / s;
+			q.x = (R(0, 2) + R(2, 0)) / s;
+			q.y = (R(1, 2) + R(2, 1)) / s;
+			q.z = s / 4;
+		}
+		return q.Normalized();
+	}
+
+	inline Mat<3, 3, T> ToMatrix() const {
+		Mat<3, 3, T> R = {{
+			1 - 2 * (y * y + z * z), 2 * (x * y - w * z), 2 * (x * z + w * y),
+			2 * (x * y + w * z), 1 - 2 * (x * x + z * z), 2 * (y * z - w * x),
+			2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y) }};
+		return R;
+	}
+
+	inline Vec<3, T> ToRotationVector() const {
+		T s = std::sqrt(x * x + y * y + z * z);
+		if (s < T(1e-12)) return MakeVec<T>(2 * x, 2 * y, 2 * z);
+		T theta = 2 * std::atan2(s, w);
+		return MakeVec<T>(x, y, z) * (theta / s);
+	}
+
+	//! The rotation of b followed by that of this quaternion
+	inline Quaternion operator*(const Quaternion &b) const {
+		Quaternion q = {
+			w * b.w - x * b.x - y * b.y - z * b.z,
+			w * b.x + x * b.w + y * b.z - z * b.y,
+			w * b.y - x * b.z + y * b.w + z * b.x,
+			w * b.z + x * b.y - y * b.x + z * b.w };
+		return q;
+	}
+
+	inline Quaternion Conjugate() const {
+		Quaternion q = { w, -x, -y, -z };
+		return q;
+	}
+
+	inline Quaternion Normalized() const {
+		T n = std::sqrt(w * w + x * x + y * y + z * z);
+		Quaternion q = { w / n, x / n, y / n, z / n };
+		return q;
+	}
+
+	//! Rotate a vector, v + 2 u x (u x v + w v) with u the vector part
+	inline Vec<3, T> Rotate(const Vec<3, T> &v) const {
+		Vec<3, T> u = MakeVec<T>(x, y, z);
+		Vec<3, T> t = Cross(u, v) * T(2);
+		return v + t * w + Cross(u, t);
+	}
+};
+
+#endif /* MATRIX_H_ */
@@ -23,28 +23,346 @@
 
 
 // General files
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Plugin files
 #include <Odometry.h>
 
+//! Default threshold of Odometry, for stereo points 5 percent of the depth
+#define ODOMETRY_THRESHOLD		0.05f
+
+//! Default deviation of the predicted motion, translations in units of the baseline
+#define ODOMETRY_DEVIATION_FORWARD	0.5f
+#define ODOMETRY_DEVIATION_LATERAL	0.2f
+#define ODOMETRY_DEVIATION_YAW		0.05f
+
+//! Default minimum of the learned deviation
+#define ODOMETRY_MIN_FORWARD		0.02f
+#define ODOMETRY_MIN_LATERAL		0.01f
+#define ODOMETRY_MIN_YAW			0.002f
+
+//! Weight of the error of the last prediction in the learned variance
+#define ODOMETRY_LEARNING_RATE		0.2f
+
+//! Search radius in standard deviations of the predicted position, and at least in pixels
+#define ODOMETRY_GATE				3.0f
+#define ODOMETRY_MIN_RADIUS			2.0f
+
+//! Default disparity of the nearest point, in pixels
+#define ODOMETRY_MAX_DISPARITY		64.0f
+
 /* **************************************************************************************
- * Implementation of Odometry
+ * Implementation of PlanarSolver and PlanarResidual
  * **************************************************************************************/
 
-Odometry::Odometry() {
+int PlanarSolver::operator()(const int *sample, PlanarMotion *models) const {
+	float x0[2], z0[2], x1[2], z1[2];
+	for (int i = 0; i < 2; ++i) {
+		x0[i] = px[sample[i]];
+		z0[i] = pz[sample[i]];
+		x1[i] = qx[sample[i]];
+		z1[i] = qz[sample[i]];
+	}
+	return Odometry::Estimate(x0, z0, x1, z1, NULL, 2, models[0]) ? 1 : 0;
+}
+
+/**
+ * The point p is expected at R (p - t), see Odometry::Estimate. Four points at a time.
+ */
+void PlanarResidual::operator()(const PlanarMotion &motion, int begin, int end,
+		float *errors) const {
+	const float c = cos(motion.yaw), s = sin(motion.yaw);
+	const float tx = motion.lateral, tz = motion.forward;
+	int i = begin;
+#ifdef __SSE2__
+	const __m128 vc = _mm_set1_ps(c), vs = _mm_set1_ps(s);
+	const __m128 vtx = _mm_set1_ps(tx), vtz = _mm_set1_ps(tz);
+	for (; i + 4 <= end; i += 4) {
+		__m128 x = _mm_sub_ps(_mm_loadu_ps(px + i), vtx);
+		__m128 z = _mm_sub_ps(_mm_loadu_ps(pz + i), vtz);
+		__m128 ex = _mm_sub_ps(_mm_loadu_ps(qx + i),
+				_mm_add_ps(_mm_mul_ps(vc, x), _mm_mul_ps(vs, z)));
+		__m128 ez = _mm_sub_ps(_mm_loadu_ps(qz + i),
+				_mm_sub_ps(_mm_mul_ps(vc, z), _mm_mul_ps(vs, x)));
+		__m128 e = _mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ez, ez));
+		_mm_storeu_ps(errors + i - begin, _mm_mul_ps(e, _mm_loadu_ps(weights + i)));
+	}
+#endif
+	for (; i < end; ++i) {
+		float x = px[i] - tx, z = pz[i] - tz;
+		float ex = qx[i] - (c * x + s * z);
+		float ez = qz[i] - (c * z - s * x);
+		errors[i - begin] = (ex * ex + ez * ez) * weights[i];
+	}
+}
+
+/* **************************************************************************************
+ * Implementation of Odometry
+ * **************************************************************************************/
 
+Odometry::Odometry(int capacity): capacity(capacity), count(0), robust(true), inlierCount(0),
+		ransac(ODOMETRY_THRESHOLD * ODOMETRY_THRESHOLD, 0.99f, 200), focal(0), baseline(0), cx(0),
+		cy(0), maxDisparity(ODOMETRY_MAX_DISPARITY), skipped(0), wheel(false) {
+	assert (capacity > 0);
+	px.resize(capacity);
+	pz.resize(capacity);
+	qx.resize(capacity);
+	qz.resize(capacity);
+	weights.resize(capacity);
+	inlierWeights.resize(capacity);
+	ransac.Reserve(capacity);
+	PlanarMotion initial, minimum;
+	initial.forward = ODOMETRY_DEVIATION_FORWARD;
+	initial.lateral = ODOMETRY_DEVIATION_LATERAL;
+	initial.yaw = ODOMETRY_DEVIATION_YAW;
+	minimum.forward = ODOMETRY_MIN_FORWARD;
+	minimum.lateral = ODOMETRY_MIN_LATERAL;
+	minimum.yaw = ODOMETRY_MIN_YAW;
+	SetDeviation(initial, minimum);
 }
 
 Odometry::~Odometry() {
 
 }
 
-//void Odometry::SetImage() {
-//
-//}
-//
-//void Odometry::Tick() {
-//
-//
-//}
-//
+void Odometry::SetCamera(float focal, float baseline, float cx, float cy) {
+	this->focal = focal;
+	this->baseline = baseline;
+	this->cx = cx;
+	this->cy = cy;
+	variance.forward = initialVariance.forward * baseline * baseline;
+	variance.lateral = initialVariance.lateral * baseline * baseline;
+}
+
+bool Odometry::Add(float px, float pz, float qx, float qz, float weight) {
+	if (count == capacity) return false;
+	this->px[count] = px;
+	this->pz[count] = pz;
+	this->qx[count] = qx;
+	this->qz[count] = qz;
+	weights[count] = weight;
+	count++;
+	return true;
+}
+
+/**
+ * With depth z = f b / d the point is at x = (u - cx) z / f. The error in the depth grows
+ * with the square of the depth, the weight is the inverse of the sum of the squared depths.
+ */
+bool Odometry::AddStereo(float u0, float d0, float u1, float d1) {
+	assert (focal > 0 && baseline > 0);
+	if (d0 <= 0 || d1 <= 0) return false;
+	float z0 = focal * baseline / d0;
+	float z1 = focal * baseline / d1;
+	return Add((u0 - cx) * baseline / d0, z0, (u1 - cx) * baseline / d1, z1,
+			1 / (z0 * z0 + z1 * z1));
+}
+
+bool Odometry::Estimate(PlanarMotion & motion) const {
+	return Estimate(&px[0], &pz[0], &qx[0], &qz[0], &weights[0], count, motion);
+}
+
+/**
+ * A static point p in the previous frame is seen at q = R (p - t) in the current frame, with
+ * t the translation of the camera and R the rotation over -yaw:
+ *   R = [ cos(yaw)  sin(yaw) ]
+ *       [ -sin(yaw) cos(yaw) ]
+ * Minimizing sum w |q - R (p - t)|^2 gives, with p' and q' relative to the weighted centroids,
+ *   yaw = atan2(sum w (q'x p'z - q'z p'x), sum w (q'x p'x + q'z p'z))
+ *   t = mean(p) - R^T mean(q)
+ * The sums are collected in one pass as raw moments, in double to not lose the small cross
+ * terms.
+ */
+bool Odometry::Estimate(const float *px, const float *pz, const float *qx, const float *qz,
+		const float *weights, int count, PlanarMotion & motion) {
+	if (count < 2) return false;
+	double sw = 0, spx = 0, spz = 0, sqx = 0, sqz = 0, sdot = 0, scross = 0;
+	for (int i = 0; i < count; ++i) {
+		double w = weights ? weights[i] : 1.0;
+		sw += w;
+		spx += w * px[i];
+		spz += w * pz[i];
+		sqx += w * qx[i];
+		sqz += w * qz[i];
+		sdot += w * (qx[i] * px[i] + qz[i] * pz[i]);
+		scross += w * (qx[i] * pz[i] - qz[i] * px[i]);
+	}
+	if (sw <= 0) return false;
+	double mpx = spx / sw, mpz = spz / sw, mqx = sqx / sw, mqz = sqz / sw;
+	double dot = sdot - sw * (mqx * mpx + mqz * mpz);
+	double cross = scross - sw * (mqx * mpz - mqz * mpx);
+
+	// all points in one spot, the rotation is undefined
+	if (dot * dot + cross * cross < 1e-12 * sw * sw) return false;
+
+	double yaw = atan2(cross, dot);
+	double c = cos(yaw), s = sin(yaw);
+	motion.yaw = yaw;
+	motion.lateral = mpx - (c * mqx - s * mqz);
+	motion.forward = mpz - (s * mqx + c * mqz);
+	return true;
+}
+
+bool Odometry::Update() {
+	PlanarMotion result;
+	if (robust) {
+		PlanarSolver solver = { &px[0], &pz[0], &qx[0], &qz[0] };
+		PlanarResidual residual = { &px[0], &pz[0], &qx[0], &qz[0], &weights[0] };
+		if (!ransac.Run(solver, residual, count, result)) return false;
+		const unsigned char *inliers = ransac.GetInliers();
+		for (int i = 0; i < count; ++i) {
+			inlierWeights[i] = inliers[i] ? weights[i] : 0;
+		}
+		inlierCount = ransac.GetInlierCount();
+		if (!Estimate(&px[0], &pz[0], &qx[0], &qz[0], &inlierWeights[0], count, result)) return false;
+	} else {
+		if (!Estimate(result)) return false;
+		inlierCount = count;
+	}
+	learn(result);
+	motion = result;
+	Accumulate(motion);
+	return true;
+}
+
+void Odometry::Update(const PlanarMotion & motion) {
+	learn(motion);
+	this->motion = motion;
+	Accumulate(motion);
+}
+
+void Odometry::Accumulate(const PlanarMotion & motion) {
+	float c = cos(pose.yaw), s = sin(pose.yaw);
+	pose.x += c * motion.lateral - s * motion.forward;
+	pose.z += s * motion.lateral + c * motion.forward;
+	pose.yaw += motion.yaw;
+	if (pose.yaw > M_PI) pose.yaw -= 2 * M_PI;
+	if (pose.yaw <= -M_PI) pose.yaw += 2 * M_PI;
+}
+
+void Odometry::SetDeviation(const PlanarMotion & initial, const PlanarMotion & minimum) {
+	initialVariance.forward = initial.forward * initial.forward;
+	initialVariance.lateral = initial.lateral * initial.lateral;
+	initialVariance.yaw = initial.yaw * initial.yaw;
+	minVariance.forward = minimum.forward * minimum.forward;
+	minVariance.lateral = minimum.lateral * minimum.lateral;
+	minVariance.yaw = minimum.yaw * minimum.yaw;
+	float b2 = (baseline > 0) ? baseline * baseline : 1;
+	variance.forward = initialVariance.forward * b2;
+	variance.lateral = initialVariance.lateral * b2;
+	variance.yaw = initialVariance.yaw;
+}
+
+void Odometry::SetWheelMotion(const PlanarMotion & motion, const PlanarMotion & deviation) {
+	wheel = true;
+	wheelMotion = motion;
+	wheelDeviation = deviation;
+}
+
+/**
+ * Over n frames without a measurement the constant velocity moves n times as far, and an
+ * error in the velocity grows just as much.
+ */
+void Odometry::Predict(PlanarMotion & motion, PlanarMotion & deviation) const {
+	if (wheel) {
+		motion = wheelMotion;
+		deviation = wheelDeviation;
+		return;
+	}
+	float n = skipped + 1;
+	motion.forward = velocity.forward * n;
+	motion.lateral = velocity.lateral * n;
+	motion.yaw = velocity.yaw * n;
+	deviation.forward = sqrt(variance.forward) * n;
+	deviation.lateral = sqrt(variance.lateral) * n;
+	deviation.yaw = sqrt(variance.yaw) * n;
+}
+
+/**
+ * The variance is a running average of the squared error of the prediction per frame, it
+ * does not drop below the minimum deviation. The wheels are not learned from, their
+ * deviation is given with their motion.
+ */
+void Odometry::learn(const PlanarMotion & motion) {
+	float n = skipped + 1;
+	if (!wheel) {
+		PlanarMotion predicted, deviation;
+		Predict(predicted, deviation);
+		float ef = (motion.forward - predicted.forward) / n;
+		float el = (motion.lateral - predicted.lateral) / n;
+		float ey = (motion.yaw - predicted.yaw) / n;
+		float b2 = (baseline > 0) ? baseline * baseline : 1;
+		const float a = ODOMETRY_LEARNING_RATE;
+		variance.forward = std::max((1 - a) * variance.forward + a * ef * ef, minVariance.forward * b2);
+		variance.lateral = std::max((1 - a) * variance.lateral + a * el * el, minVariance.lateral * b2);
+		variance.yaw = std::max((1 - a) * variance.yaw + a * ey * ey, minVariance.yaw);
+	}
+	velocity.forward = motion.forward / n;
+	velocity.lateral = motion.lateral / n;
+	velocity.yaw = motion.yaw / n;
+	skipped = 0;
+	wheel = false;
+}
+
+/**
+ * A point with normalized coordinates (x,y) and inverse depth r = d / (f b) is, multiplied
+ * by r, at p = (x, y, 1) in the previous frame. In the next frame it is at R (p - r t), see
+ * Estimate, so with c = cos(yaw) and s = sin(yaw)
+ *   A = c (x - r tx) + s (1 - r tz)
+ *   B = -s (x - r tx) + c (1 - r tz)
+ * and it is seen at x' = A / B, y' = y / B. The radius follows from the derivatives of the
+ * position in pixels with respect to the motion, weighted by its deviation. Points of
+ * unknown depth are taken halfway between zero (far away) and the maximum disparity, their
+ * radius grows by how far the other depths in that range would move them.
+ */
+void Odometry::Predict(const float *us, const float *vs, const float *disparities, int count,
+		float *guessUs, float *guessVs, float *radii) const {
+	assert (focal > 0 && baseline > 0);
+	PlanarMotion m, dev;
+	Predict(m, dev);
+	const float c = cos(m.yaw), s = sin(m.yaw);
+	const float tx = m.lateral, tz = m.forward;
+	const float halfRange = maxDisparity / (2 * focal * baseline);
+	for (int i = 0; i < count; ++i) {
+		float x = (us[i] - cx) / focal, y = (vs[i] - cy) / focal;
+		bool known = disparities && disparities[i] > 0;
+		float r = known ? disparities[i] / (focal * baseline) : halfRange;
+		float px = x - r * tx, pz = 1 - r * tz;
+		float A = c * px + s * pz;
+		float B = -s * px + c * pz;
+		if (B < 1e-3f) {
+			// too close to follow the motion, search everywhere around the old position
+			guessUs[i] = us[i];
+			guessVs[i] = vs[i];
+			radii[i] = focal;
+			continue;
+		}
+		float iB = 1 / B, fB2 = focal * iB * iB;
+		guessUs[i] = cx + focal * A * iB;
+		guessVs[i] = cy + focal * y * iB;
+
+		// derivatives of A and B to the forward and lateral translation, and to r
+		float dAz = -s * r, dBz = -c * r;
+		float dAx = -c * r, dBx = s * r;
+		float dAr = -c * tx - s * tz, dBr = s * tx - c * tz;
+		// the derivative of A to the yaw is B, that of B is -A
+		float uz = (dAz * B - A * dBz) * fB2, vz = -y * dBz * fB2;
+		float ux = (dAx * B - A * dBx) * fB2, vx = -y * dBx * fB2;
+		float uy = (B * B + A * A) * fB2, vy = y * A * fB2;
+		float var = (uz * uz + vz * vz) * dev.forward * dev.forward +
+				(ux * ux + vx * vx) * dev.lateral * dev.lateral +
+				(uy * uy + vy * vy) * dev.yaw * dev.yaw;
+		float radius = ODOMETRY_GATE * sqrtf(var);
+		if (!known) {
+			float ur = (dAr * B - A * dBr) * fB2, vr = -y * dBr * fB2;
+			radius += sqrtf(ur * ur + vr * vr) * halfRange;
+		}
+		radii[i] = std::max(radius, ODOMETRY_MIN_RADIUS);
+	}
+}
@@ -26,6 +26,53 @@
 #define ODOMETRY_H_
 
 // General files
+#include <vector>
+
+#include <Ransac.h>
+
+/**
+ * Motion of the robot between two frames, in the coordinates of the camera in the first of
+ * the two frames: x to the right and z forwards, along the optical axis. The yaw is in
+ * radians and positive when turning left.
+ */
+struct PlanarMotion {
+	PlanarMotion(): forward(0), lateral(0), yaw(0) {}
+	float forward;
+	float lateral;
+	float yaw;
+};
+
+/**
+ * Position and heading on the ground plane with respect to the first frame. The axes are the
+ * same as those of the camera in the first frame, x to the right and z forwards.
+ */
+struct PlanarPose {
+	PlanarPose(): x(0), z(0), yaw(0) {}
+	float x;
+	float z;
+	float yaw;
+};
+
+/**
+ * Minimal solver for Ransac: the motion from two correspondences. The correspondences are
+ * the arrays of Odometry.
+ */
+struct PlanarSolver {
+	typedef PlanarMotion Model;
+	static const int SAMPLE_SIZE = 2;
+	static const int MAX_MODELS = 1;
+	int operator()(const int *sample, PlanarMotion *models) const;
+	const float *px, *pz, *qx, *qz;
+};
+
+/**
+ * Weighted squared distance between a point in the current frame and where the motion puts
+ * it, for Ransac.
+ */
+struct PlanarResidual {
+	void operator()(const PlanarMotion &motion, int begin, int end, float *errors) const;
+	const float *px, *pz, *qx, *qz, *weights;
+};
 
 /* **************************************************************************************
  * Interface of Odometry
@@ -34,18 +81,171 @@
 /**
  * From two sets of features we want to derive how much we moved forwards and in how much
  * we turned left or right.
+ *
+ * The features are static points on the ground plane (x,z), seen from the previous and from
+ * the current camera position, for example from stereo depth. For a robot that drives over
+ * a flat floor the points move with a rotation over the yaw and a translation, which are
+ * found in closed form by weighted least squares: the yaw follows from the cross covariance
+ * of the two point sets around their centroids, the translation from the centroids. The
+ * motions of the frames are accumulated into a pose. All correspondences are stored in
+ * arrays of the capacity given at construction, nothing is allocated per frame.
+ *
+ * Moving objects and wrong matches do not follow the motion of the robot. Unless switched
+ * off, Update first finds the motion with most support by RANSAC over samples of two
+ * points and then fits the motion to the inliers only.
+ *
+ * The motion of the next frame is predicted to be that of the last one (constant velocity),
+ * or that of the wheels if it is given. The deviation of the prediction is learned from how
+ * far off it was in previous frames. Predict turns it into the positions where points of
+ * the previous image are expected in the next one, with a search radius, so trackers and
+ * matchers only have to search a small window around that position.
  */
 class Odometry {
 public:
 	//! Constructor Odometry
-	Odometry();
+	Odometry(int capacity = 1024);
 
 	//! Destructor ~Odometry
 	virtual ~Odometry();
-protected:
 
+	//! Focal length and principal point in pixels and the baseline, for AddStereo and Predict
+	void SetCamera(float focal, float baseline, float cx, float cy);
+
+	//! Remove the correspondences of the previous frame
+	inline void Clear() { count = 0; }
+
+	//! Add a point (px,pz) in the previous frame that is seen at (qx,qz), false if full
+	bool Add(float px, float pz, float qx, float qz, float weight = 1);
+
+	/**
+	 * Add a point from its column and (positive) disparity in pixels in the previous and the
+	 * current rectified left image. Far points are given less weight, their depth is less
+	 * certain. Returns false if a disparity is not positive or the arrays are full.
+	 */
+	bool AddStereo(float u0, float d0, float u1, float d1);
+
+	//! Number of correspondences
+	inline int GetCount() const { return count; }
+
+	//! Motion that fits the correspondences best, false if there are too few of them
+	bool Estimate(PlanarMotion & motion) const;
+
+	//! The same for correspondences in arrays, weights may be NULL
+	static bool Estimate(const float *px, const float *pz, const float *qx, const float *qz,
+			const float *weights, int count, PlanarMotion & motion);
+
+	//! Estimate the motion and add it to the pose, the pose is left alone if that fails
+	bool Update();
+
+	//! Take a motion that is found elsewhere, for example by PnPEstimator, as that of this frame
+	void Update(const PlanarMotion & motion);
+
+	//! Remove outliers with RANSAC in Update
+	inline void SetRobust(bool robust) { this->robust = robust; }
+
+	/**
+	 * Inliers have an error below this threshold times the inverse square root of their
+	 * weight, for AddStereo a fraction of the depth of the point.
+	 */
+	inline void SetThreshold(float threshold) { ransac.SetThreshold(threshold * threshold); }
+
+	//! Number of inliers of the last Update
+	inline int GetInlierCount() const { return inlierCount; }
+
+	inline Ransac<PlanarSolver, PlanarResidual> & GetRansac() { return ransac; }
+
+	//! Add a motion to the pose
+	void Accumulate(const PlanarMotion & motion);
+
+	//! The motion of the last successful Update
+	inline const PlanarMotion & GetMotion() const { return motion; }
+
+	inline const PlanarPose & GetPose() const { return pose; }
+
+	inline void SetPose(const PlanarPose & pose) { this->pose = pose; }
+
+	/**
+	 * Deviation of the prediction before any motion is measured, and the smallest that is
+	 * learned. The translations are in units of the baseline, the yaw in radians.
+	 */
+	void SetDeviation(const PlanarMotion & initial, const PlanarMotion & minimum);
+
+	//! No motion could be measured for a frame, the next prediction spans one more frame
+	inline void Skip() { skipped++; }
+
+	/**
+	 * Motion of the wheels since the last frame whose motion was measured, for example as
+	 * predicted by OdometryFilter, it replaces the constant velocity once
+	 */
+	void SetWheelMotion(const PlanarMotion & motion, const PlanarMotion & deviation);
+
+	//! Predicted motion from the previous to the next frame, and its standard deviation
+	void Predict(PlanarMotion & motion, PlanarMotion & deviation) const;
+
+	/**
+	 * Where points at (us,vs) in the previous image are expected in the next one, and the
+	 * radius in pixels within which they should be found. The disparities in pixels may be
+	 * NULL, points without one (zero or less) can be at any depth up to the maximum
+	 * disparity, which widens their radius by the translation.
+	 */
+	void Predict(const float *us, const float *vs, const float *disparities, int count,
+			float *guessUs, float *guessVs, float *radii) const;
+
+	//! Disparity of the nearest point that is expected, for points of unknown depth
+	inline void SetMaxDisparity(float maxDisparity) { this->maxDisparity = maxDisparity; }
+protected:
+	//! Learn the deviation of the prediction from the motion that is measured
+	void learn(const PlanarMotion & motion);
 private:
+	int capacity;
+
+	int count;
+
+	//! Correspondences, one array per coordinate
+	std::vector<float> px, pz, qx, qz, weights;
+
+	//! Weights with the outliers set to zero
+	std::vector<float> inlierWeights;
+
+	bool robust;
+
+	int inlierCount;
+
+	Ransac<PlanarSolver, PlanarResidual> ransac;
+
+	float focal;
+
+	float baseline;
+
+	float cx;
+
+	float cy;
+
+	float maxDisparity;
+
+	PlanarMotion motion;
+
+	//! Motion per frame for the constant velocity prediction
+	PlanarMotion velocity;
+
+	//! Variance of the prediction per frame, learned
+	PlanarMotion variance;
+
+	//! Variance before anything is learned and its minimum, in units of the baseline
+	PlanarMotion initialVariance;
+
+	PlanarMotion minVariance;
+
+	//! Frames since the last measured motion
+	int skipped;
+
+	bool wheel;
+
+	PlanarMotion wheelMotion;
+
+	PlanarMotion wheelDeviation;
 
+	PlanarPose pose;
 };
 
 #endif /* ODOMETRY_H_ */
@@ -0,0 +1,322 @@
+/**
+ * @brief
+ * @file OdometryFilter.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 23, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+// Plugin files
+#include <OdometryFilter.h>
+
+//! Default deviation of the random accelerations, in m/s^2 and rad/s^2
+#define ODOMETRY_FILTER_ACCELERATION	0.5f
+#define ODOMETRY_FILTER_ANGULAR			1.0f
+
+//! Default delay before inputs are taken in, in seconds
+#define ODOMETRY_FILTER_DELAY			0.1
+
+//! Default deviation of the motion since the last visual frame that needs a new one
+#define ODOMETRY_FILTER_MAX_TRANSLATION	0.02f
+#define ODOMETRY_FILTER_MAX_YAW			0.02f
+
+//! Deviation of the speed and yaw rate at the start, in m/s and rad/s
+#define ODOMETRY_FILTER_SPEED			1.0
+
+//! Squared Mahalanobis distance above which a measurement is an outlier, the 99.9% quantile
+//! of the chi-square distribution with two and three degrees of freedom
+#define ODOMETRY_FILTER_GATE_WHEEL		13.8
+#define ODOMETRY_FILTER_GATE_VISUAL		16.3
+
+//! Indices in the state
+enum { S_X, S_Z, S_YAW, S_SPEED, S_RATE, S_CLONE_X, S_CLONE_Z, S_CLONE_YAW };
+
+//! An angle in (-pi, pi]
+static inline double wrap(double angle) {
+	while (angle > M_PI) angle -= 2 * M_PI;
+	while (angle <= -M_PI) angle += 2 * M_PI;
+	return angle;
+}
+
+/* **************************************************************************************
+ * Implementation of OdometryFilter
+ * **************************************************************************************/
+
+OdometryFilter::OdometryFilter(int capacity): delay(ODOMETRY_FILTER_DELAY),
+		acceleration(ODOMETRY_FILTER_ACCELERATION), angular(ODOMETRY_FILTER_ANGULAR),
+		maxTranslation(ODOMETRY_FILTER_MAX_TRANSLATION), maxYaw(ODOMETRY_FILTER_MAX_YAW),
+		count(0), dropped(0), rejected(0) {
+	assert (capacity > 0);
+	queue.resize(capacity);
+	pthread_mutex_init(&mutex, NULL);
+	Reset(0);
+}
+
+OdometryFilter::~OdometryFilter() {
+	pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * The pose is known exactly, it is the origin of what follows. The speed is not known.
+ */
+void OdometryFilter::Reset(double time, const PlanarPose &pose) {
+	pthread_mutex_lock(&mutex);
+	state = State::Zero();
+	state[S_X] = pose.x;
+	state[S_Z] = pose.z;
+	state[S_YAW] = pose.yaw;
+	covariance = Covariance::Zero();
+	covariance(S_SPEED, S_SPEED) = ODOMETRY_FILTER_SPEED * ODOMETRY_FILTER_SPEED;
+	covariance(S_RATE, S_RATE) = ODOMETRY_FILTER_SPEED * ODOMETRY_FILTER_SPEED;
+	this->time = time;
+	cloneTime = -1;
+	wheelTime = -1;
+	count = 0;
+	pthread_mutex_unlock(&mutex);
+}
+
+void OdometryFilter::SetNoise(float acceleration, float angular) {
+	this->acceleration = acceleration;
+	this->angular = angular;
+}
+
+void OdometryFilter::SetMaxDeviation(float translation, float yaw) {
+	maxTranslation = translation;
+	maxYaw = yaw;
+}
+
+bool OdometryFilter::AddWheel(double time, const PlanarMotion &motion,
+		const PlanarMotion &deviation) {
+	Input input = { WHEEL, time, time, motion, deviation };
+	pthread_mutex_lock(&mutex);
+	bool result = push(input);
+	pthread_mutex_unlock(&mutex);
+	return result;
+}
+
+bool OdometryFilter::AddVisual(double from, double to, const PlanarMotion &motion,
+		const PlanarMotion &deviation) {
+	Input input = { VISUAL, from, to, motion, deviation };
+	pthread_mutex_lock(&mutex);
+	bool result = push(input);
+	pthread_mutex_unlock(&mutex);
+	return result;
+}
+
+//! Inputs mostly arrive in order, so the insertion starts at the back
+bool OdometryFilter::push(const Input &input) {
+	if (count == (int)queue.size()) return false;
+	int i = count++;
+	for (; i > 0 && queue[i-1].time > input.time; --i) queue[i] = queue[i-1];
+	queue[i] = input;
+	return true;
+}
+
+void OdometryFilter::process(double time) {
+	int i = 0;
+	for (; i < count && queue[i].time <= time; ++i) {
+		const Input &input = queue[i];
+		if (input.time < this->time) {
+			dropped++;
+			continue;
+		}
+		predict(state, covariance, input.time - this->time);
+		this->time = input.time;
+		if (input.type == WHEEL) wheel(input);
+		else visual(input);
+	}
+	std::copy(queue.begin() + i, queue.begin() + count, queue.begin());
+	count -= i;
+}
+
+/**
+ * The robot drives forwards along its heading at the middle of the interval:
+ *   x' = x - sin(yaw + rate dt/2) speed dt
+ *   z' = z + cos(yaw + rate dt/2) speed dt
+ * and the speed and yaw rate take a random walk. The clone stays where it is.
+ */
+void OdometryFilter::predict(State &state, Covariance &covariance, double dt) const {
+	if (dt <= 0) return;
+	const double speed = state[S_SPEED], rate = state[S_RATE];
+	const double yaw = state[S_YAW] + rate * dt / 2;
+	const double c = cos(yaw), s = sin(yaw);
+	state[S_X] -= s * speed * dt;
+	state[S_Z] += c * speed * dt;
+	state[S_YAW] = wrap(state[S_YAW] + rate * dt);
+
+	Covariance F = Covariance::Identity();
+	F(S_X, S_YAW) = -c * speed * dt;
+	F(S_X, S_SPEED) = -s * dt;
+	F(S_X, S_RATE) = -c * speed * dt * dt / 2;
+	F(S_Z, S_YAW) = -s * speed * dt;
+	F(S_Z, S_SPEED) = c * dt;
+	F(S_Z, S_RATE) = -s * speed * dt * dt / 2;
+	F(S_YAW, S_RATE) = dt;
+	covariance = F * covariance * F.Transpose();
+	covariance(S_SPEED, S_SPEED) += acceleration * acceleration * dt;
+	covariance(S_RATE, S_RATE) += angular * angular * dt;
+}
+
+/**
+ * The displacement since the clone, rotated into the frame of the clone, like
+ * Odometry::Accumulate in reverse:
+ *   lateral = cos(yaw_c) dx + sin(yaw_c) dz
+ *   forward = -sin(yaw_c) dx + cos(yaw_c) dz
+ */
+void OdometryFilter::relative(const State &state, PlanarMotion &motion,
+		Mat<3, ODOMETRY_FILTER_STATES, double> &H) const {
+	const double c = cos(state[S_CLONE_YAW]), s = sin(state[S_CLONE_YAW]);
+	const double dx = state[S_X] - state[S_CLONE_X], dz = state[S_Z] - state[S_CLONE_Z];
+	const double lateral = c * dx + s * dz, forward = -s * dx + c * dz;
+	motion.forward = forward;
+	motion.lateral = lateral;
+	motion.yaw = wrap(state[S_YAW] - state[S_CLONE_YAW]);
+
+	// rows in the order forward, lateral, yaw
+	H = Mat<3, ODOMETRY_FILTER_STATES, double>::Zero();
+	H(0, S_X) = -s; H(0, S_Z) = c;
+	H(0, S_CLONE_X) = s; H(0, S_CLONE_Z) = -c; H(0, S_CLONE_YAW) = -lateral;
+	H(1, S_X) = c; H(1, S_Z) = s;
+	H(1, S_CLONE_X) = -c; H(1, S_CLONE_Z) = -s; H(1, S_CLONE_YAW) = forward;
+	H(2, S_YAW) = 1; H(2, S_CLONE_YAW) = -1;
+}
+
+/**
+ * The covariance is updated in Joseph form, (I - K H) P (I - K H)^T + K R K^T, which keeps
+ * it symmetric and positive definite in spite of rounding.
+ */
+template<int M>
+bool OdometryFilter::update(const Vec<M, double> &y, const Mat<M, ODOMETRY_FILTER_STATES, double> &H,
+		const Mat<M, M, double> &R, double gate) {
+	const Mat<ODOMETRY_FILTER_STATES, M, double> PHt = covariance * H.Transpose();
+	Mat<M, M, double> S = H * PHt + R, Si;
+	if (!Inverse(S, Si)) return false;
+	if (Dot(y, Vec<M, double>(Si * y)) > gate) return false;
+	const Mat<ODOMETRY_FILTER_STATES, M, double> K = PHt * Si;
+	state += K * y;
+	state[S_YAW] = wrap(state[S_YAW]);
+	state[S_CLONE_YAW] = wrap(state[S_CLONE_YAW]);
+	const Covariance A = Covariance::Identity() - K * H;
+	covariance = A * covariance * A.Transpose() + K * R * K.Transpose();
+	return true;
+}
+
+//! The clone gets the pose, with the same covariance as the pose and fully correlated to it
+void OdometryFilter::clone() {
+	Covariance J = Covariance::Identity();
+	for (int i = 0; i < 3; ++i) {
+		J(S_CLONE_X + i, S_CLONE_X + i) = 0;
+		J(S_CLONE_X + i, S_X + i) = 1;
+	}
+	state[S_CLONE_X] = state[S_X];
+	state[S_CLONE_Z] = state[S_Z];
+	state[S_CLONE_YAW] = state[S_YAW];
+	covariance = J * covariance * J.Transpose();
+	cloneTime = time;
+}
+
+/**
+ * The wheels give the mean speed and yaw rate since their previous input, the first input
+ * only starts the interval.
+ */
+void OdometryFilter::wheel(const Input &input) {
+	double dt = input.time - wheelTime;
+	bool first = wheelTime < 0;
+	wheelTime = input.time;
+	if (first || dt <= 0) return;
+	Vec<2, double> y;
+	y[0] = input.motion.forward / dt - state[S_SPEED];
+	y[1] = input.motion.yaw / dt - state[S_RATE];
+	Mat<2, ODOMETRY_FILTER_STATES, double> H = Mat<2, ODOMETRY_FILTER_STATES, double>::Zero();
+	H(0, S_SPEED) = 1;
+	H(1, S_RATE) = 1;
+	Mat<2, 2, double> R = Mat<2, 2, double>::Zero();
+	R(0, 0) = input.deviation.forward * input.deviation.forward / (dt * dt);
+	R(1, 1) = input.deviation.yaw * input.deviation.yaw / (dt * dt);
+	if (!update(y, H, R, ODOMETRY_FILTER_GATE_WHEEL)) rejected++;
+}
+
+/**
+ * A visual motion that does not start at the clone can not be related to the state, it
+ * only makes its end the new clone.
+ */
+void OdometryFilter::visual(const Input &input) {
+	if (cloneTime >= 0 && fabs(input.from - cloneTime) < 1e-6) {
+		PlanarMotion h;
+		Mat<3, ODOMETRY_FILTER_STATES, double> H;
+		relative(state, h, H);
+		Vec<3, double> y;
+		y[0] = input.motion.forward - h.forward;
+		y[1] = input.motion.lateral - h.lateral;
+		y[2] = wrap(input.motion.yaw - h.yaw);
+		Mat<3, 3, double> R = Mat<3, 3, double>::Zero();
+		R(0, 0) = input.deviation.forward * input.deviation.forward;
+		R(1, 1) = input.deviation.lateral * input.deviation.lateral;
+		R(2, 2) = input.deviation.yaw * input.deviation.yaw;
+		if (!update(y, H, R, ODOMETRY_FILTER_GATE_VISUAL)) rejected++;
+	}
+	clone();
+}
+
+//! The filtered state is not changed by the extrapolation
+void OdometryFilter::GetPose(double time, PlanarPose &pose) {
+	pthread_mutex_lock(&mutex);
+	process(time - delay);
+	State s = state;
+	Covariance P = covariance;
+	predict(s, P, time - this->time);
+	pthread_mutex_unlock(&mutex);
+	pose.x = s[S_X];
+	pose.z = s[S_Z];
+	pose.yaw = s[S_YAW];
+}
+
+//! The predicted measurement of a visual frame at the given time, and its covariance
+bool OdometryFilter::PredictMotion(double time, PlanarMotion &motion, PlanarMotion &deviation) {
+	pthread_mutex_lock(&mutex);
+	process(time - delay);
+	if (cloneTime < 0) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	State s = state;
+	Covariance P = covariance;
+	predict(s, P, time - this->time);
+	pthread_mutex_unlock(&mutex);
+	Mat<3, ODOMETRY_FILTER_STATES, double> H;
+	relative(s, motion, H);
+	Mat<3, 3, double> S = H * P * H.Transpose();
+	deviation.forward = sqrt(S(0, 0));
+	deviation.lateral = sqrt(S(1, 1));
+	deviation.yaw = sqrt(S(2, 2));
+	return true;
+}
+
+bool OdometryFilter::NeedVisual(double time) {
+	PlanarMotion motion, deviation;
+	if (!PredictMotion(time, motion, deviation)) return true;
+	float translation = sqrt(deviation.forward * deviation.forward +
+			deviation.lateral * deviation.lateral);
+	return translation > maxTranslation || deviation.yaw > maxYaw;
+}
@@ -0,0 +1,183 @@
+/**
+ * @brief
+ * @file OdometryFilter.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 23, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef ODOMETRYFILTER_H_
+#define ODOMETRYFILTER_H_
+
+// General files
+#include <vector>
+#include <pthread.h>
+
+#include <Odometry.h>
+#include <Matrix.h>
+
+//! Size of the state: pose, forward speed and yaw rate, and the pose of the last visual frame
+#define ODOMETRY_FILTER_STATES	8
+
+/* **************************************************************************************
+ * Interface of OdometryFilter
+ * **************************************************************************************/
+
+/**
+ * Extended Kalman filter that fuses the motions measured by visual odometry with those of
+ * the wheel encoders, each at its own rate, into a pose on the ground plane.
+ *
+ * The state is the pose (x, z, yaw) in the coordinates of PlanarPose, the forward speed and
+ * the yaw rate, which are constant up to a random acceleration. The wheels measure the speed
+ * and yaw rate over the interval between two of their inputs. A visual motion is relative,
+ * between two frames, so the pose of the previous visual frame is kept in the state as a
+ * clone (stochastic cloning): the motion is a measurement of the pose with respect to the
+ * clone, and the correlation between the two keeps the uncertainty that both share out of
+ * the update. Measurements that are too far off for their covariance are rejected.
+ *
+ * Inputs are added from any thread into a queue that is kept in order of time, the filter
+ * only takes in those that are older than a delay, so a visual motion that arrives later
+ * than the wheel inputs of the same time is still in time. The pose can be asked for at any
+ * time and rate, it is the filtered pose extrapolated from there. All matrices are of fixed
+ * size and the queue has a fixed capacity, nothing is allocated after construction.
+ */
+class OdometryFilter {
+public:
+	//! Constructor OdometryFilter
+	OdometryFilter(int capacity = 256);
+
+	//! Destructor ~OdometryFilter
+	virtual ~OdometryFilter();
+
+	//! Start anew at a pose at the given time, the times of all inputs should be later
+	void Reset(double time, const PlanarPose &pose = PlanarPose());
+
+	//! Deviation of the random accelerations, in m/s^2 and rad/s^2, per square root second
+	void SetNoise(float acceleration, float angular);
+
+	//! Inputs are taken in once they are this number of seconds older than the time asked for
+	inline void SetDelay(double delay) { this->delay = delay; }
+
+	/**
+	 * The motion since the previous visual frame is needed once its deviation would be more
+	 * than this, in meters and radians, see NeedVisual
+	 */
+	void SetMaxDeviation(float translation, float yaw);
+
+	/**
+	 * Motion of the wheels since their previous input, with its standard deviation. False
+	 * if the queue is full.
+	 */
+	bool AddWheel(double time, const PlanarMotion &motion, const PlanarMotion &deviation);
+
+	/**
+	 * Motion measured by visual odometry from the frame at time "from" to that at "to",
+	 * with its standard deviation. It is only fused if "from" is the last visual frame that
+	 * was taken in. False if the queue is full.
+	 */
+	bool AddVisual(double from, double to, const PlanarMotion &motion,
+			const PlanarMotion &deviation);
+
+	//! The pose at a time, after taking in the inputs up to that time minus the delay
+	void GetPose(double time, PlanarPose &pose);
+
+	/**
+	 * The motion from the last visual frame to a time, with its deviation, predicted from the
+	 * inputs so far. False if there is no visual frame yet.
+	 */
+	bool PredictMotion(double time, PlanarMotion &motion, PlanarMotion &deviation);
+
+	//! Whether the motion since the last visual frame is too uncertain without a new one
+	bool NeedVisual(double time);
+
+	//! Whether wheel inputs have been taken in
+	inline bool HasWheels() const { return wheelTime >= 0; }
+
+	//! Number of inputs that came in too late or were rejected as outliers
+	inline int GetDropped() const { return dropped; }
+
+	inline int GetRejected() const { return rejected; }
+protected:
+	typedef Vec<ODOMETRY_FILTER_STATES, double> State;
+
+	typedef Mat<ODOMETRY_FILTER_STATES, ODOMETRY_FILTER_STATES, double> Covariance;
+
+	enum InputType { WHEEL, VISUAL };
+
+	struct Input {
+		InputType type;
+		double from, time;
+		PlanarMotion motion, deviation;
+	};
+
+	//! Insert an input in order of time, with the mutex locked
+	bool push(const Input &input);
+
+	//! Take in the queued inputs up to a time
+	void process(double time);
+
+	//! Let the state and its covariance move on over dt seconds
+	void predict(State &state, Covariance &covariance, double dt) const;
+
+	//! Pose with respect to the clone, as a motion, and its Jacobian to the state
+	void relative(const State &state, PlanarMotion &motion,
+			Mat<3, ODOMETRY_FILTER_STATES, double> &H) const;
+
+	/**
+	 * Update with the innovation y of a measurement with Jacobian H and covariance R, false
+	 * if the squared Mahalanobis distance of y is larger than gate
+	 */
+	template<int M>
+	bool update(const Vec<M, double> &y, const Mat<M, ODOMETRY_FILTER_STATES, double> &H,
+			const Mat<M, M, double> &R, double gate);
+
+	//! The pose of the last visual frame becomes the clone
+	void clone();
+
+	void wheel(const Input &input);
+
+	void visual(const Input &input);
+private:
+	State state;
+
+	Covariance covariance;
+
+	//! Time of the state
+	double time;
+
+	//! Time of the clone, negative if there is none, and of the last wheel input
+	double cloneTime, wheelTime;
+
+	double delay;
+
+	float acceleration, angular;
+
+	float maxTranslation, maxYaw;
+
+	//! Inputs in order of time, count of capacity are used
+	std::vector<Input> queue;
+
+	int count;
+
+	int dropped, rejected;
+
+	pthread_mutex_t mutex;
+};
+
+#endif /* ODOMETRYFILTER_H_ */
@@ -0,0 +1,245 @@
+/**
+ * @brief
+ * @file PatchDistance.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 15, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <PatchDistance.h>
+
+/* **************************************************************************************
+ * Implementation of PatchSet
+ * **************************************************************************************/
+
+PatchSet::PatchSet(int size): size(size), count(0), capacity(0), data(NULL) {
+	assert (size > 0);
+	bytes = (size * size + 15) & ~15;
+}
+
+PatchSet::~PatchSet() {
+	free(data);
+}
+
+void PatchSet::reserve(int count) {
+	this->count = count;
+	means.resize(count);
+	invNorms.resize(count);
+	if (count <= capacity) return;
+	free(data);
+	void *mem = NULL;
+	int result = posix_memalign(&mem, 16, count * bytes);
+	assert (result == 0);
+	data = (unsigned char*)mem;
+	capacity = count;
+}
+
+void PatchSet::Extract(const ImageView &img, const std::vector<Corner*> & corners) {
+	reserve(corners.size());
+	for (int i = 0; i < count; ++i) {
+		extract(img, corners[i]->x, corners[i]->y, data + i * bytes);
+	}
+	statistics();
+}
+
+void PatchSet::Extract(const ImageView &img, const int *xs, const int *ys, int count) {
+	reserve(count);
+	for (int i = 0; i < count; ++i) {
+		extract(img, xs[i], ys[i], data + i * bytes);
+	}
+	statistics();
+}
+
+void PatchSet::statistics() {
+	float n = size * size;
+	for (int i = 0; i < count; ++i) {
+		const unsigned char *p = GetPatch(i);
+		int sum = 0, sumSq = 0;
+		for (int k = 0; k < size * size; ++k) {
+			sum += p[k];
+			sumSq += p[k] * p[k];
+		}
+		means[i] = sum / n;
+		float var = sumSq - sum * means[i];
+		invNorms[i] = (var > 1e-3f) ? 1.0f / sqrt(var) : 0.0f;
+	}
+}
+
+void PatchSet::extract(const ImageView &img, int x, int y, unsigned char *patch) {
+	int x0 = x - size / 2;
+	int y0 = y - size / 2;
+	bool inside = (x0 >= 0 && y0 >= 0 && x0 + size <= img.width && y0 + size <= img.height);
+	for (int j = 0; j < size; ++j) {
+		unsigned char *out = patch + j * size;
+		if (inside) {
+			memcpy(out, img.row(y0 + j) + x0, size);
+			continue;
+		}
+		int r = y0 + j;
+		if (r < 0) r = 0;
+		if (r >= img.height) r = img.height - 1;
+		for (int i = 0; i < size; ++i) {
+			int c = x0 + i;
+			if (c < 0) c = 0;
+			if (c >= img.width) c = img.width - 1;
+			out[i] = img.at(c, r);
+		}
+	}
+	memset(patch + size * size, 0, bytes - size * size);
+}
+
+/* **************************************************************************************
+ * Implementation of PatchDistance
+ * **************************************************************************************/
+
+int PatchDistance::sad(const unsigned char *a, const unsigned char *b, int bytes) {
+#ifdef __SSE2__
+	__m128i acc = _mm_setzero_si128();
+	for (int k = 0; k < bytes; k += 16) {
+		__m128i va = _mm_load_si128((const __m128i*)(a + k));
+		__m128i vb = _mm_load_si128((const __m128i*)(b + k));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+	}
+	return _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#else
+	int sum = 0;
+	for (int k = 0; k < bytes; ++k) {
+		sum += abs(a[k] - b[k]);
+	}
+	return sum;
+#endif
+}
+
+#ifdef __SSE2__
+static inline int horizontalSum(__m128i v) {
+	v = _mm_add_epi32(v, _mm_srli_si128(v, 8));
+	v = _mm_add_epi32(v, _mm_srli_si128(v, 4));
+	return _mm_cvtsi128_si32(v);
+}
+#endif
+
+int PatchDistance::ssd(const unsigned char *a, const unsigned char *b, int bytes) {
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+	for (int k = 0; k < bytes; k += 16) {
+		__m128i va = _mm_load_si128((const __m128i*)(a + k));
+		__m128i vb = _mm_load_si128((const __m128i*)(b + k));
+		__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+		__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+	}
+	return horizontalSum(acc);
+#else
+	int sum = 0;
+	for (int k = 0; k < bytes; ++k) {
+		int d = a[k] - b[k];
+		sum += d * d;
+	}
+	return sum;
+#endif
+}
+
+int PatchDistance::dot(const unsigned char *a, const unsigned char *b, int bytes) {
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+	for (int k = 0; k < bytes; k += 16) {
+		__m128i va = _mm_load_si128((const __m128i*)(a + k));
+		__m128i vb = _mm_load_si128((const __m128i*)(b + k));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero)));
+	}
+	return horizontalSum(acc);
+#else
+	int sum = 0;
+	for (int k = 0; k < bytes; ++k) {
+		sum += a[k] * b[k];
+	}
+	return sum;
+#endif
+}
+
+int PatchDistance::SAD(const PatchSet &set0, int i, const PatchSet &set1, int j) {
+	assert (set0.GetSize() == set1.GetSize());
+	return sad(set0.GetPatch(i), set1.GetPatch(j), set0.GetBytes());
+}
+
+int PatchDistance::SSD(const PatchSet &set0, int i, const PatchSet &set1, int j) {
+	assert (set0.GetSize() == set1.GetSize());
+	return ssd(set0.GetPatch(i), set1.GetPatch(j), set0.GetBytes());
+}
+
+/**
+ * With the means and norms known, only the sum of products is left:
+ * sum (a - ma)(b - mb) = sum ab - n ma mb
+ */
+float PatchDistance::ZNCC(const PatchSet &set0, int i, const PatchSet &set1, int j) {
+	assert (set0.GetSize() == set1.GetSize());
+	float n = set0.GetSize() * set0.GetSize();
+	int ab = dot(set0.GetPatch(i), set1.GetPatch(j), set0.GetBytes());
+	return (ab - n * set0.GetMean(i) * set1.GetMean(j)) * set0.GetInvNorm(i) * set1.GetInvNorm(j);
+}
+
+void PatchDistance::SAD(const PatchSet &set0, int i, const PatchSet &set1, const int *candidates,
+		int n, int *costs) {
+	assert (set0.GetSize() == set1.GetSize());
+	const unsigned char *a = set0.GetPatch(i);
+	int bytes = set0.GetBytes();
+	for (int c = 0; c < n; ++c) {
+		costs[c] = sad(a, set1.GetPatch(candidates[c]), bytes);
+	}
+}
+
+void PatchDistance::SSD(const PatchSet &set0, int i, const PatchSet &set1, const int *candidates,
+		int n, int *costs) {
+	assert (set0.GetSize() == set1.GetSize());
+	const unsigned char *a = set0.GetPatch(i);
+	int bytes = set0.GetBytes();
+	for (int c = 0; c < n; ++c) {
+		costs[c] = ssd(a, set1.GetPatch(candidates[c]), bytes);
+	}
+}
+
+void PatchDistance::ZNCC(const PatchSet &set0, int i, const PatchSet &set1, const int *candidates,
+		int n, float *scores) {
+	assert (set0.GetSize() == set1.GetSize());
+	const unsigned char *a = set0.GetPatch(i);
+	int bytes = set0.GetBytes();
+	float size = set0.GetSize() * set0.GetSize();
+	float ma = size * set0.GetMean(i);
+	float na = set0.GetInvNorm(i);
+	for (int c = 0; c < n; ++c) {
+		int j = candidates[c];
+		int ab = dot(a, set1.GetPatch(j), bytes);
+		scores[c] = (ab - ma * set1.GetMean(j)) * na * set1.GetInvNorm(j);
+	}
+}
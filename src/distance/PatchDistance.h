@@ -0,0 +1,138 @@
+/**
+ * @brief
+ * @file PatchDistance.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 15, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef PATCHDISTANCE_H_
+#define PATCHDISTANCE_H_
+
+// General files
+#include <vector>
+
+#include <CornerDetector.h>
+#include <Pyramid.h>
+
+/* **************************************************************************************
+ * Interface of PatchSet
+ * **************************************************************************************/
+
+/**
+ * The patches around a set of corners, copied out of the image once so that comparing them
+ * does not need any index arithmetic. A patch of size x size pixels around (x,y) starts at
+ * (x - size/2, y - size/2), pixels outside of the image are replicated from the border. The
+ * pixels of a patch are stored row after row and padded with zeros to a multiple of 16
+ * bytes, so the distance functions can process a patch in 16-byte blocks. For ZNCC the mean
+ * and the inverse of the norm of the zero-mean patch are stored along.
+ */
+class PatchSet {
+public:
+	//! Constructor PatchSet
+	PatchSet(int size = 8);
+
+	//! Destructor ~PatchSet
+	virtual ~PatchSet();
+
+	//! Extract the patches around the corners, memory is reused
+	void Extract(const ImageView &img, const std::vector<Corner*> & corners);
+
+	//! Extract the patches around arbitrary points
+	void Extract(const ImageView &img, const int *xs, const int *ys, int count);
+
+	//! Number of patches
+	inline int GetCount() const { return count; }
+
+	//! Width and height of a patch
+	inline int GetSize() const { return size; }
+
+	//! Number of bytes per patch, including padding
+	inline int GetBytes() const { return bytes; }
+
+	//! Pixels of patch i
+	inline const unsigned char *GetPatch(int i) const { return data + i * bytes; }
+
+	inline float GetMean(int i) const { return means[i]; }
+
+	//! Inverse of the norm of patch i minus its mean, 0 for a flat patch
+	inline float GetInvNorm(int i) const { return invNorms[i]; }
+protected:
+	void reserve(int count);
+
+	void extract(const ImageView &img, int x, int y, unsigned char *patch);
+
+	//! Mean and inverse norm of every patch
+	void statistics();
+private:
+	int size;
+
+	int bytes;
+
+	int count;
+
+	int capacity;
+
+	unsigned char *data;
+
+	std::vector<float> means;
+
+	std::vector<float> invNorms;
+};
+
+/* **************************************************************************************
+ * Interface of PatchDistance
+ * **************************************************************************************/
+
+/**
+ * Distances between the patches of one or two PatchSets: sum of absolute differences (SAD),
+ * sum of squared differences (SSD) and zero-mean normalized cross-correlation (ZNCC). SAD
+ * uses psadbw, SSD and ZNCC use pmaddwd on 16-bit pixels when SSE2 is available. ZNCC is
+ * in [-1,1], 1 for patches that are the same up to gain and offset, so it is not affected
+ * by a difference in brightness between the images. The batch versions compare one patch
+ * against a list of candidates.
+ */
+class PatchDistance {
+public:
+	static int SAD(const PatchSet &set0, int i, const PatchSet &set1, int j);
+
+	static int SSD(const PatchSet &set0, int i, const PatchSet &set1, int j);
+
+	static float ZNCC(const PatchSet &set0, int i, const PatchSet &set1, int j);
+
+	//! Costs of patch i of set0 against the patches candidates[0..n-1] of set1
+	static void SAD(const PatchSet &set0, int i, const PatchSet &set1, const int *candidates,
+			int n, int *costs);
+
+	static void SSD(const PatchSet &set0, int i, const PatchSet &set1, const int *candidates,
+			int n, int *costs);
+
+	static void ZNCC(const PatchSet &set0, int i, const PatchSet &set1, const int *candidates,
+			int n, float *scores);
+
+	//! Raw kernels on two blocks of "bytes" pixels, bytes a multiple of 16
+	static int sad(const unsigned char *a, const unsigned char *b, int bytes);
+
+	static int ssd(const unsigned char *a, const unsigned char *b, int bytes);
+
+	//! Sum of a[i]*b[i]
+	static int dot(const unsigned char *a, const unsigned char *b, int bytes);
+};
+
+#endif /* PATCHDISTANCE_H_ */
@@ -0,0 +1,388 @@
+/**
+ * @brief 
+ * @file PnP.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common 
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from 
+ * thread pools and TCP/IP components to control architectures and learning algorithms. 
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory 
+ * farming, for animal experimentation, or anything that violates the Universal 
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 14, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <PnP.h>
+#include <Matrix.h>
+
+//! Default threshold of PnPEstimator in pixels
+#define PNP_THRESHOLD			2.0f
+
+/* **************************************************************************************
+ * Polynomials for the three-point solver
+ * **************************************************************************************/
+
+static inline double polyEvaluate(const double *p, int degree, double t) {
+	double r = p[degree];
+	for (int i = degree - 1; i >= 0; --i) r = r * t + p[i];
+	return r;
+}
+
+/**
+ * Real roots of a polynomial of low degree with coefficients p[0] + p[1] t + ..., in
+ * increasing order. Between two consecutive roots of the derivative the polynomial is
+ * monotonic, so each of those intervals, bounded by the Cauchy bound on the outside,
+ * holds at most one root, which is found by bisection.
+ */
+static int realRoots(const double *p, int degree, double *roots) {
+	while (degree > 0 && p[degree] == 0) degree--;
+	if (degree == 0) return 0;
+	if (degree == 1) {
+		roots[0] = -p[0] / p[1];
+		return 1;
+	}
+	double bound = 0;
+	for (int i = 0; i < degree; ++i) bound = std::max(bound, fabs(p[i] / p[degree]));
+	bound += 1;
+	double derivative[4], critical[4];
+	for (int i = 1; i <= degree; ++i) derivative[i-1] = i * p[i];
+	int nc = realRoots(derivative, degree - 1, critical);
+	double edges[6];
+	int ne = 0;
+	edges[ne++] = -bound;
+	for (int i = 0; i < nc; ++i) {
+		if (critical[i] > -bound && critical[i] < bound) edges[ne++] = critical[i];
+	}
+	edges[ne++] = bound;
+	int count = 0;
+	for (int k = 0; k + 1 < ne; ++k) {
+		double lo = edges[k], hi = edges[k+1];
+		double flo = polyEvaluate(p, degree, lo), fhi = polyEvaluate(p, degree, hi);
+		if (flo == 0) {
+			if (count == 0 || roots[count-1] != lo) roots[count++] = lo;
+			continue;
+		}
+		if ((flo < 0) == (fhi < 0)) continue;
+		for (int it = 0; it < 100 && hi - lo > 1e-14 * (fabs(lo) + fabs(hi)); ++it) {
+			double mid = (lo + hi) / 2, fmid = polyEvaluate(p, degree, mid);
+			if ((fmid < 0) == (flo < 0)) {
+				lo = mid;
+				flo = fmid;
+			} else {
+				hi = mid;
+			}
+		}
+		roots[count++] = (lo + hi) / 2;
+	}
+	return count;
+}
+
+/**
+ * Rotation and translation that move the triangle P onto the triangle C, C = R P + t, from
+ * the orthonormal frames of both triangles.
+ */
+static void align(const Vec3d *P, const Vec3d *C, Mat3d &R, Vec3d &t) {
+	Mat3d frames[2];
+	const Vec3d *points[2] = { P, C };
+	for (int k = 0; k < 2; ++k) {
+		Vec3d e1 = (points[k][1] - points[k][0]).Normalized();
+		Vec3d e3 = Cross(e1, points[k][2] - points[k][0]).Normalized();
+		frames[k].SetCol(0, e1);
+		frames[k].SetCol(1, Cross(e3, e1));
+		frames[k].SetCol(2, e3);
+	}
+	R = frames[1] * frames[0].Transpose();
+	t = (C[0] + C[1] + C[2] - R * (P[0] + P[1] + P[2])) / 3.0;
+}
+
+/* **************************************************************************************
+ * Implementation of P3PSolver and ReprojectionResidual
+ * **************************************************************************************/
+
+/**
+ * With the distances s1, s2, s3 of the points along their unit rays j1, j2, j3 the law of
+ * cosines gives three quadratic equations in those distances, for the sides a = |P2 - P3|,
+ * b = |P1 - P3| and c = |P1 - P2|. With s2 = u s1 and s3 = v s1 they become a quartic in v,
+ * after which u and s1 follow. The triangle of points along the rays is then aligned with
+ * the known triangle.
+ */
+int P3PSolver::operator()(const int *sample, RelativePose *models) const {
+	Vec3d P[3], j[3];
+	for (int i = 0; i < 3; ++i) {
+		int k = sample[i];
+		P[i] = MakeVec<double>(X[k], Y[k], Z[k]);
+		j[i] = MakeVec<double>(u[k], v[k], 1).Normalized();
+	}
+	double a2 = (P[1] - P[2]).SquaredNorm(), b2 = (P[0] - P[2]).SquaredNorm();
+	double c2 = (P[0] - P[1]).SquaredNorm();
+	if (a2 < 1e-12 || b2 < 1e-12 || c2 < 1e-12) return 0;
+	double ca = Dot(j[1], j[2]), cb = Dot(j[0], j[2]), cc = Dot(j[0], j[1]);
+
+	double amc = (a2 - c2) / b2, apc = (a2 + c2) / b2;
+	double bmc = (b2 - c2) / b2, bma = (b2 - a2) / b2;
+	double quartic[5];
+	quartic[4] = (amc - 1) * (amc - 1) - 4 * c2 / b2 * ca * ca;
+	quartic[3] = 4 * (amc * (1 - amc) * cb - (1 - apc) * ca * cc + 2 * c2 / b2 * ca * ca * cb);
+	quartic[2] = 2 * (amc * amc - 1 + 2 * amc * amc * cb * cb + 2 * bmc * ca * ca -
+			4 * apc * ca * cb * cc + 2 * bma * cc * cc);
+	quartic[1] = 4 * (-amc * (1 + amc) * cb + 2 * a2 / b2 * cc * cc * cb - (1 - apc) * ca * cc);
+	quartic[0] = (1 + amc) * (1 + amc) - 4 * a2 / b2 * cc * cc;
+
+	double roots[4];
+	int count = realRoots(quartic, 4, roots);
+	int models_found = 0;
+	for (int k = 0; k < count; ++k) {
+		double vv = roots[k];
+		if (vv <= 0) continue;
+		double denominator = 2 * (cc - vv * ca);
+		if (fabs(denominator) < 1e-12) continue;
+		double uu = ((amc - 1) * vv * vv - 2 * amc * cb * vv + 1 + amc) / denominator;
+		if (uu <= 0) continue;
+		double s = 1 + vv * vv - 2 * vv * cb;
+		if (s <= 0) continue;
+		double s1 = sqrt(b2 / s);
+		Vec3d C[3] = { j[0] * s1, j[1] * (uu * s1), j[2] * (vv * s1) };
+		Mat3d R;
+		Vec3d t;
+		align(P, C, R, t);
+		R.CopyTo(models[models_found].R);
+		t.CopyTo(models[models_found].t);
+		models_found++;
+	}
+	return models_found;
+}
+
+void ReprojectionResidual::operator()(const RelativePose &pose, int begin, int end,
+		float *errors) const {
+	const float *R = pose.R, *t = pose.t;
+	int i = begin;
+#ifdef __SSE2__
+	const __m128 r0 = _mm_set1_ps(R[0]), r1 = _mm_set1_ps(R[1]), r2 = _mm_set1_ps(R[2]);
+	const __m128 r3 = _mm_set1_ps(R[3]), r4 = _mm_set1_ps(R[4]), r5 = _mm_set1_ps(R[5]);
+	const __m128 r6 = _mm_set1_ps(R[6]), r7 = _mm_set1_ps(R[7]), r8 = _mm_set1_ps(R[8]);
+	const __m128 t0 = _mm_set1_ps(t[0]), t1 = _mm_set1_ps(t[1]), t2 = _mm_set1_ps(t[2]);
+	const __m128 tiny = _mm_set1_ps(1e-6f), huge = _mm_set1_ps(1e30f);
+	for (; i + 4 <= end; i += 4) {
+		__m128 x = _mm_loadu_ps(X + i), y = _mm_loadu_ps(Y + i), z = _mm_loadu_ps(Z + i);
+		__m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, x), _mm_mul_ps(r1, y)),
+				_mm_add_ps(_mm_mul_ps(r2, z), t0));
+		__m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r3, x), _mm_mul_ps(r4, y)),
+				_mm_add_ps(_mm_mul_ps(r5, z), t1));
+		__m128 cz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r6, x), _mm_mul_ps(r7, y)),
+				_mm_add_ps(_mm_mul_ps(r8, z), t2));
+		__m128 valid = _mm_cmpgt_ps(cz, tiny);
+		__m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), _mm_or_ps(_mm_and_ps(valid, cz),
+				_mm_andnot_ps(valid, _mm_set1_ps(1.0f))));
+		__m128 du = _mm_sub_ps(_mm_mul_ps(cx, inverse), _mm_loadu_ps(u + i));
+		__m128 dv = _mm_sub_ps(_mm_mul_ps(cy, inverse), _mm_loadu_ps(v + i));
+		__m128 error = _mm_add_ps(_mm_mul_ps(du, du), _mm_mul_ps(dv, dv));
+		error = _mm_or_ps(_mm_and_ps(valid, error), _mm_andnot_ps(valid, huge));
+		_mm_storeu_ps(errors + i - begin, error);
+	}
+#endif
+	for (; i < end; ++i) {
+		float cx = R[0] * X[i] + R[1] * Y[i] + R[2] * Z[i] + t[0];
+		float cy = R[3] * X[i] + R[4] * Y[i] + R[5] * Z[i] + t[1];
+		float cz = R[6] * X[i] + R[7] * Y[i] + R[8] * Z[i] + t[2];
+		if (cz <= 1e-6f) {
+			errors[i - begin] = 1e30f;
+			continue;
+		}
+		float du = cx / cz - u[i], dv = cy / cz - v[i];
+		errors[i - begin] = du * du + dv * dv;
+	}
+}
+
+/* **************************************************************************************
+ * Implementation of PnPEstimator
+ * **************************************************************************************/
+
+PnPEstimator::PnPEstimator(int capacity): capacity(capacity), count(0), focal(1), baseline(1),
+		cx(0), cy(0), threshold(PNP_THRESHOLD), inlierCount(0), prosac(false),
+		ransac(1, 0.99f, 200) {
+	assert (capacity > 0);
+	X.resize(capacity);
+	Y.resize(capacity);
+	Z.resize(capacity);
+	u.resize(capacity);
+	v.resize(capacity);
+	inliers.resize(capacity);
+	quality.resize(capacity);
+	ransac.Reserve(capacity);
+	SetThreshold(threshold);
+}
+
+PnPEstimator::~PnPEstimator() {
+
+}
+
+void PnPEstimator::SetCamera(float focal, float baseline, float cx, float cy) {
+	assert (focal > 0);
+	this->focal = focal;
+	this->baseline = baseline;
+	this->cx = cx;
+	this->cy = cy;
+	SetThreshold(threshold);
+}
+
+void PnPEstimator::SetThreshold(float threshold) {
+	this->threshold = threshold;
+	float normalized = threshold / focal;
+	ransac.SetThreshold(normalized * normalized);
+}
+
+void PnPEstimator::SetProsac(bool prosac) {
+	this->prosac = prosac;
+	ransac.SetProsac(prosac);
+	if (!prosac) return;
+	order.reserve(capacity);
+	rX.resize(capacity);
+	rY.resize(capacity);
+	rZ.resize(capacity);
+	ru.resize(capacity);
+	rv.resize(capacity);
+}
+
+bool PnPEstimator::Add(float X, float Y, float Z, float u, float v, float quality) {
+	if (count == capacity) return false;
+	this->quality[count] = quality;
+	this->X[count] = X;
+	this->Y[count] = Y;
+	this->Z[count] = Z;
+	this->u[count] = (u - cx) / focal;
+	this->v[count] = (v - cy) / focal;
+	count++;
+	return true;
+}
+
+//! For a rectified pair the depth is focal * baseline / disparity
+bool PnPEstimator::AddStereo(float u0, float v0, float d0, float u1, float v1) {
+	if (d0 <= 0) return false;
+	float z = focal * baseline / d0;
+	return Add((u0 - cx) * z / focal, (v0 - cy) * z / focal, z, u1, v1);
+}
+
+/**
+ * PROSAC runs on a copy of the correspondences in order of quality, the inliers it finds are
+ * put back in the order in which they were added.
+ */
+bool PnPEstimator::Estimate(RelativePose &pose) {
+	inlierCount = 0;
+	ReprojectionResidual residual = { &X[0], &Y[0], &Z[0], &u[0], &v[0] };
+	if (prosac) {
+		RankByQuality(&quality[0], count, order);
+		for (int k = 0; k < count; ++k) {
+			int i = order[k];
+			rX[k] = X[i]; rY[k] = Y[i]; rZ[k] = Z[i];
+			ru[k] = u[i]; rv[k] = v[i];
+		}
+		P3PSolver solver = { &rX[0], &rY[0], &rZ[0], &ru[0], &rv[0] };
+		ReprojectionResidual ranked = { &rX[0], &rY[0], &rZ[0], &ru[0], &rv[0] };
+		if (!ransac.Run(solver, ranked, count, pose)) return false;
+		const unsigned char *mask = ransac.GetInliers();
+		for (int k = 0; k < count; ++k) inliers[order[k]] = mask[k];
+	} else {
+		P3PSolver solver = { &X[0], &Y[0], &Z[0], &u[0], &v[0] };
+		if (!ransac.Run(solver, residual, count, pose)) return false;
+		const unsigned char *mask = ransac.GetInliers();
+		for (int i = 0; i < count; ++i) inliers[i] = mask[i];
+	}
+	Refine(&X[0], &Y[0], &Z[0], &u[0], &v[0], &inliers[0], count, pose);
+
+	// the inliers of the refined pose
+	float errors[RANSAC_BLOCK];
+	const float limit = (threshold / focal) * (threshold / focal);
+	for (int begin = 0; begin < count; begin += RANSAC_BLOCK) {
+		int end = std::min(begin + RANSAC_BLOCK, count);
+		residual(pose, begin, end, errors);
+		for (int i = begin; i < end; ++i) {
+			inliers[i] = errors[i - begin] < limit;
+			inlierCount += inliers[i];
+		}
+	}
+	return true;
+}
+
+/**
+ * The pose is updated by R' = exp(w) R and t' = t + dt. For a point at C = R P + t in the
+ * camera the projection (C0 / C2, C1 / C2) has the derivative [1 0 -C0/C2; 0 1 -C1/C2] / C2
+ * to C, and C has the derivative -[R P]x to w and the identity to dt. The pose is kept
+ * from before a step that does not lower the cost.
+ */
+int PnPEstimator::Refine(const float *X, const float *Y, const float *Z, const float *u,
+		const float *v, const unsigned char *mask, int count, RelativePose &pose,
+		int iterations) {
+	Mat3d R = Mat3d::From(pose.R);
+	Vec3d t = Vec3d::From(pose.t);
+	double previous = -1;
+	bool converged = false;
+	int it = 0;
+	while (true) {
+		Mat<6, 6, double> JtJ = Mat<6, 6, double>::Zero();
+		Vec<6, double> Jtr = Vec<6, double>::Zero();
+		double cost = 0;
+		for (int i = 0; i < count; ++i) {
+			if (mask && !mask[i]) continue;
+			Vec3d RP = R * MakeVec<double>(X[i], Y[i], Z[i]);
+			Vec3d C = RP + t;
+			if (C[2] <= 1e-6) continue;
+			double iz = 1 / C[2];
+			double pu = C[0] * iz, pv = C[1] * iz;
+			double ru = pu - u[i], rv = pv - v[i];
+			cost += ru * ru + rv * rv;
+			Mat<2, 3, double> projection = {{ iz, 0, -pu * iz, 0, iz, -pv * iz }};
+			Mat<3, 6, double> dC;
+			dC.SetBlock(0, 0, -Skew(RP));
+			dC.SetBlock(0, 3, Mat3d::Identity());
+			Mat<2, 6, double> J = projection * dC;
+			Vec<2, double> r = {{ ru, rv }};
+			JtJ += J.Transpose() * J;
+			Jtr += J.Transpose() * r;
+		}
+		if (previous >= 0 && cost >= previous) break;
+		previous = cost;
+		R.CopyTo(pose.R);
+		t.CopyTo(pose.t);
+		if (converged || it == iterations) break;
+		it++;
+		Vec<6, double> step = -Jtr;
+		if (!SolveCholesky(JtJ, step)) break;
+		R = Exp(step.Block<3, 1>(0, 0)) * R;
+		t += step.Block<3, 1>(3, 0);
+		converged = step.SquaredNorm() < 1e-20;
+	}
+	return it;
+}
+
+/**
+ * Odometry moves a point on the floor from p to R(yaw) (p - t), with t = (lateral,
+ * forward), which is the x-z part of R p + t' for t' = -R(yaw) t.
+ */
+void PnPEstimator::ToPlanar(const RelativePose &pose, PlanarMotion &motion) {
+	const float *R = pose.R;
+	float yaw = atan2(R[2] - R[6], R[0] + R[8]);
+	float c = cos(yaw), s = sin(yaw);
+	motion.yaw = yaw;
+	motion.lateral = -(c * pose.t[0] - s * pose.t[2]);
+	motion.forward = -(s * pose.t[0] + c * pose.t[2]);
+}
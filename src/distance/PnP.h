@@ -0,0 +1,167 @@
+/**
+ * @brief
+ * @file PnP.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Nov 14, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef PNP_H_
+#define PNP_H_
+
+// General files
+#include <vector>
+
+#include <Ransac.h>
+#include <Essential.h>
+#include <Odometry.h>
+
+/**
+ * Minimal solver for Ransac: the (up to four) poses of a camera that sees three known
+ * points in given directions, by the method of Grunert (1841) as reviewed by Haralick et
+ * al. (1994). The points are in the coordinates of the previous camera, the observations
+ * in normalized image coordinates of the current one.
+ */
+struct P3PSolver {
+	typedef RelativePose Model;
+	static const int SAMPLE_SIZE = 3;
+	static const int MAX_MODELS = 4;
+	int operator()(const int *sample, RelativePose *models) const;
+	const float *X, *Y, *Z, *u, *v;
+};
+
+/**
+ * Squared distance in normalized image coordinates between an observation and the
+ * projection of its point. Points behind the camera get a huge error.
+ */
+struct ReprojectionResidual {
+	void operator()(const RelativePose &pose, int begin, int end, float *errors) const;
+	const float *X, *Y, *Z, *u, *v;
+};
+
+/* **************************************************************************************
+ * Interface of PnPEstimator
+ * **************************************************************************************/
+
+/**
+ * The motion of the camera between two frames from points that are triangulated by the
+ * stereo pair in the previous frame and seen again in the left image of the current frame
+ * (perspective-n-point). In contrast to RelativePoseEstimator the translation has a scale,
+ * the unit of the baseline, and three points suffice for a minimal sample, so RANSAC needs
+ * far fewer iterations. The pose with most inliers is refined over all inliers by Gauss-
+ * Newton on the reprojection errors. All buffers have the capacity given at construction.
+ * With PROSAC the samples are drawn from the correspondences of the highest quality first,
+ * the order in which they are added does not matter.
+ */
+class PnPEstimator {
+public:
+	//! Constructor PnPEstimator
+	PnPEstimator(int capacity = 1024);
+
+	//! Destructor ~PnPEstimator
+	virtual ~PnPEstimator();
+
+	//! Focal length, principal point in pixels and the baseline of the rectified stereo pair
+	void SetCamera(float focal, float baseline, float cx, float cy);
+
+	//! Maximum reprojection error of an inlier in pixels
+	void SetThreshold(float threshold);
+
+	inline float GetFocal() const { return focal; }
+
+	inline float GetBaseline() const { return baseline; }
+
+	//! Draw samples from the correspondences in order of the quality given to Add
+	void SetProsac(bool prosac);
+
+	//! Remove the correspondences of the previous frame
+	inline void Clear() { count = 0; }
+
+	/**
+	 * Add a point (X,Y,Z) in the coordinates of the previous camera seen at pixel (u,v), the
+	 * quality is only used with PROSAC, higher is better
+	 */
+	bool Add(float X, float Y, float Z, float u, float v, float quality = 0);
+
+	/**
+	 * Add a point at pixel (u0,v0) with a (positive) disparity d0 in the previous rectified
+	 * left image, which is seen at (u1,v1) in the current one. False if the disparity is not
+	 * positive or the arrays are full.
+	 */
+	bool AddStereo(float u0, float v0, float d0, float u1, float v1);
+
+	//! Number of correspondences
+	inline int GetCount() const { return count; }
+
+	//! Point of correspondence i in the coordinates of the previous camera
+	inline void GetPoint(int i, float &X, float &Y, float &Z) const {
+		X = this->X[i];
+		Y = this->Y[i];
+		Z = this->Z[i];
+	}
+
+	//! Estimate the motion, t in the unit of the baseline
+	bool Estimate(RelativePose &pose);
+
+	/**
+	 * Minimize the reprojection errors of the correspondences with a nonzero mask value (all
+	 * if mask is NULL) by Gauss-Newton, starting at pose. Observations are in normalized
+	 * image coordinates. Returns the number of iterations.
+	 */
+	static int Refine(const float *X, const float *Y, const float *Z, const float *u,
+			const float *v, const unsigned char *mask, int count, RelativePose &pose,
+			int iterations = 10);
+
+	//! The motion on the floor of a pose, the rotation about the vertical axis only
+	static void ToPlanar(const RelativePose &pose, PlanarMotion &motion);
+
+	inline const unsigned char *GetInliers() const { return &inliers[0]; }
+
+	inline int GetInlierCount() const { return inlierCount; }
+
+	inline Ransac<P3PSolver, ReprojectionResidual> & GetRansac() { return ransac; }
+private:
+	int capacity;
+
+	int count;
+
+	float focal, baseline, cx, cy;
+
+	float threshold;
+
+	int inlierCount;
+
+	//! Points in the previous camera, observations in normalized image coordinates
+	std::vector<float> X, Y, Z, u, v;
+
+	std::vector<unsigned char> inliers;
+
+	bool prosac;
+
+	std::vector<float> quality;
+
+	//! The correspondences from best to worst, for PROSAC
+	std::vector<int> order;
+
+	std::vector<float> rX, rY, rZ, ru, rv;
+
+	Ransac<P3PSolver, ReprojectionResidual> ransac;
+};
+
+#endif /* PNP_H_ */
@@ -0,0 +1,221 @@
+/**
+ * @brief
+ * @file Pyramid.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 11, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <Pyramid.h>
+
+// Rows are aligned at this number of bytes
+#define PYRAMID_ALIGNMENT		16
+
+// Levels smaller than this in either dimension are not built
+#define PYRAMID_MIN_SIZE		8
+
+/* **************************************************************************************
+ * Implementation of Pyramid
+ * **************************************************************************************/
+
+Pyramid::Pyramid(): pool(NULL), capacity(0), rowBuffer(NULL), rowBufferSize(0), levels(0) {
+
+}
+
+Pyramid::~Pyramid() {
+	free(pool);
+	delete [] rowBuffer;
+}
+
+void Pyramid::Build(CRawImage *img, int levels) {
+	assert (img->isMonochrome());
+	Build(img->data, img->getwidth(), img->getheight(), levels);
+}
+
+void Pyramid::Build(const unsigned char *data, int width, int height, int levels) {
+	assert (data != NULL);
+	allocate(width, height, levels);
+
+	ImageView &base = views[0];
+	for (int y = 0; y < height; ++y) {
+		memcpy(base.row(y), data + y * width, width);
+	}
+	for (int l = 1; l < this->levels; ++l) {
+		downsample(views[l-1], views[l]);
+	}
+}
+
+void Pyramid::Swap(Pyramid &other) {
+	for (int l = 0; l < MAX_PYRAMID_LEVELS; ++l) {
+		std::swap(views[l], other.views[l]);
+	}
+	std::swap(pool, other.pool);
+	std::swap(capacity, other.capacity);
+	std::swap(rowBuffer, other.rowBuffer);
+	std::swap(rowBufferSize, other.rowBufferSize);
+	std::swap(levels, other.levels);
+}
+
+/**
+ * The views are laid out one after the other in the pool. Memory is only requested again
+ * if the total size grows.
+ */
+void Pyramid::allocate(int width, int height, int levels) {
+	if (levels > MAX_PYRAMID_LEVELS) levels = MAX_PYRAMID_LEVELS;
+	if (levels < 1) levels = 1;
+
+	if (this->levels == levels && views[0].width == width && views[0].height == height) {
+		return;
+	}
+
+	int offsets[MAX_PYRAMID_LEVELS];
+	int total = 0;
+	int w = width, h = height, l = 0;
+	for (; l < levels; ++l) {
+		if (l > 0 && (w < PYRAMID_MIN_SIZE || h < PYRAMID_MIN_SIZE)) break;
+		views[l].width = w;
+		views[l].height = h;
+		views[l].stride = (w + PYRAMID_ALIGNMENT - 1) & ~(PYRAMID_ALIGNMENT - 1);
+		offsets[l] = total;
+		total += views[l].stride * h;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	this->levels = l;
+
+	// some slack at the end, so SIMD loads beyond the last row remain within the pool
+	total += PYRAMID_ALIGNMENT;
+	if (total > capacity) {
+		free(pool);
+		void *mem = NULL;
+		int result = posix_memalign(&mem, PYRAMID_ALIGNMENT, total);
+		assert (result == 0);
+		pool = (unsigned char*)mem;
+		capacity = total;
+	}
+	for (l = 0; l < this->levels; ++l) {
+		views[l].data = pool + offsets[l];
+	}
+
+	// two border pixels at both sides and room for the last SIMD block
+	int size = views[0].stride + 4 + PYRAMID_ALIGNMENT;
+	if (size > rowBufferSize) {
+		delete [] rowBuffer;
+		rowBuffer = new unsigned short[size];
+		rowBufferSize = size;
+	}
+}
+
+/**
+ * First the vertical pass over five source rows into a 16-bit row buffer (at most 16*255),
+ * then the horizontal pass over that buffer, of which only the even positions are kept.
+ * The border is replicated. The result is (sum + 128) / 256, which fits 16 bits until the
+ * very end: 16*16*255 + 128 < 65536.
+ */
+void Pyramid::downsample(const ImageView &src, const ImageView &dst) {
+	unsigned short *buf = rowBuffer + 2;
+	const int w = src.width;
+	for (int y = 0; y < dst.height; ++y) {
+		const unsigned char *rows[5];
+		for (int k = 0; k < 5; ++k) {
+			int r = 2*y - 2 + k;
+			if (r < 0) r = 0;
+			if (r >= src.height) r = src.height - 1;
+			rows[k] = src.row(r);
+		}
+
+		// vertical pass
+		int x = 0;
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 16 <= w; x += 16) {
+			__m128i r0 = _mm_loadu_si128((const __m128i*)(rows[0] + x));
+			__m128i r1 = _mm_loadu_si128((const __m128i*)(rows[1] + x));
+			__m128i r2 = _mm_loadu_si128((const __m128i*)(rows[2] + x));
+			__m128i r3 = _mm_loadu_si128((const __m128i*)(rows[3] + x));
+			__m128i r4 = _mm_loadu_si128((const __m128i*)(rows[4] + x));
+			// low and high halves in 16 bits
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(r0, zero), _mm_unpacklo_epi8(r4, zero));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(r0, zero), _mm_unpackhi_epi8(r4, zero));
+			__m128i lo13 = _mm_add_epi16(_mm_unpacklo_epi8(r1, zero), _mm_unpacklo_epi8(r3, zero));
+			__m128i hi13 = _mm_add_epi16(_mm_unpackhi_epi8(r1, zero), _mm_unpackhi_epi8(r3, zero));
+			__m128i lo2 = _mm_unpacklo_epi8(r2, zero);
+			__m128i hi2 = _mm_unpackhi_epi8(r2, zero);
+			// r0 + r4 + 4 (r1 + r3) + 6 r2
+			lo = _mm_add_epi16(lo, _mm_slli_epi16(lo13, 2));
+			hi = _mm_add_epi16(hi, _mm_slli_epi16(hi13, 2));
+			lo = _mm_add_epi16(lo, _mm_add_epi16(_mm_slli_epi16(lo2, 2), _mm_slli_epi16(lo2, 1)));
+			hi = _mm_add_epi16(hi, _mm_add_epi16(_mm_slli_epi16(hi2, 2), _mm_slli_epi16(hi2, 1)));
+			_mm_storeu_si128((__m128i*)(buf + x), lo);
+			_mm_storeu_si128((__m128i*)(buf + x + 8), hi);
+		}
+#endif
+		for (; x < w; ++x) {
+			buf[x] = rows[0][x] + rows[4][x] + 4 * (rows[1][x] + rows[3][x]) + 6 * rows[2][x];
+		}
+		buf[-2] = buf[-1] = buf[0];
+		buf[w] = buf[w+1] = buf[w-1];
+
+		// horizontal pass, only the even positions are used
+		unsigned char *out = dst.row(y);
+		int i = 0;
+#ifdef __SSE2__
+		const __m128i round = _mm_set1_epi16(128);
+		const __m128i even = _mm_set1_epi32(0xFFFF);
+		for (; 2*i + 16 + 2 <= w; i += 8) {
+			const unsigned short *b = buf + 2*i;
+			// 16 filtered values at positions 2i .. 2i+15, for two registers
+			__m128i sum[2];
+			for (int h = 0; h < 2; ++h) {
+				const unsigned short *c = b + 8*h;
+				__m128i m2 = _mm_loadu_si128((const __m128i*)(c - 2));
+				__m128i m1 = _mm_loadu_si128((const __m128i*)(c - 1));
+				__m128i c0 = _mm_loadu_si128((const __m128i*)(c));
+				__m128i p1 = _mm_loadu_si128((const __m128i*)(c + 1));
+				__m128i p2 = _mm_loadu_si128((const __m128i*)(c + 2));
+				__m128i s = _mm_add_epi16(m2, p2);
+				s = _mm_add_epi16(s, _mm_slli_epi16(_mm_add_epi16(m1, p1), 2));
+				s = _mm_add_epi16(s, _mm_add_epi16(_mm_slli_epi16(c0, 2), _mm_slli_epi16(c0, 1)));
+				s = _mm_srli_epi16(_mm_add_epi16(s, round), 8);
+				sum[h] = _mm_and_si128(s, even);
+			}
+			// keep the even 16-bit lanes, then pack to bytes
+			__m128i packed = _mm_packs_epi32(sum[0], sum[1]);
+			packed = _mm_packus_epi16(packed, packed);
+			_mm_storel_epi64((__m128i*)(out + i), packed);
+		}
+#endif
+		for (; i < dst.width; ++i) {
+			const unsigned short *c = buf + 2*i;
+			unsigned int s = c[-2] + c[2] + 4 * (c[-1] + c[1]) + 6 * c[0];
+			out[i] = (unsigned char)((s + 128) >> 8);
+		}
+	}
+}
@@ -0,0 +1,107 @@
+/**
+ * @brief
+ * @file Pyramid.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 11, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef PYRAMID_H_
+#define PYRAMID_H_
+
+// General files
+#include <CRawImage.h>
+
+//! Maximum number of levels in a pyramid, level 0 included
+#define MAX_PYRAMID_LEVELS		8
+
+/**
+ * A grayscale image that does not own its data. Rows are "stride" bytes apart, which can be
+ * more than the width, so rows are aligned for SIMD instructions.
+ */
+struct ImageView {
+	ImageView(): data(NULL), width(0), height(0), stride(0) {}
+	explicit ImageView(CRawImage *img): data(img->data), width(img->getwidth()),
+			height(img->getheight()), stride(img->getwidth()) {}
+	unsigned char *data;
+	int width;
+	int height;
+	int stride;
+
+	inline unsigned char *row(int y) const { return data + y * stride; }
+	inline unsigned char at(int x, int y) const { return data[y * stride + x]; }
+};
+
+/* **************************************************************************************
+ * Interface of Pyramid
+ * **************************************************************************************/
+
+/**
+ * Gaussian image pyramid. Level 0 is a copy of the original image, every next level is
+ * smoothed with the 5-tap binomial kernel [1 4 6 4 1]/16 in both directions and subsampled
+ * by a factor of two. All levels live in one allocation that is kept as long as the image
+ * dimensions and the number of levels stay the same, so building the pyramid for a new
+ * frame does not allocate. Use Swap to keep the pyramid of the previous frame around.
+ */
+class Pyramid {
+public:
+	//! Constructor Pyramid
+	Pyramid();
+
+	//! Destructor ~Pyramid
+	virtual ~Pyramid();
+
+	//! Build the pyramid for a grayscale image, fewer levels are built if the image is small
+	void Build(CRawImage *img, int levels);
+
+	//! Build the pyramid from a grayscale image in memory
+	void Build(const unsigned char *data, int width, int height, int levels);
+
+	//! Number of levels that are built
+	inline int GetLevels() const { return levels; }
+
+	//! Get a level, 0 is the original resolution
+	inline const ImageView & GetLevel(int level) const { return views[level]; }
+
+	//! Exchange the contents with another pyramid, without copying the images
+	void Swap(Pyramid &other);
+protected:
+	//! Allocate the levels, if that is not already done for these dimensions
+	void allocate(int width, int height, int levels);
+
+	//! Smooth and subsample src into dst
+	void downsample(const ImageView &src, const ImageView &dst);
+private:
+	//! One allocation for all levels
+	unsigned char *pool;
+
+	//! Size of pool in bytes
+	int capacity;
+
+	//! Row buffer for the vertical pass, 16 bits per pixel
+	unsigned short *rowBuffer;
+
+	int rowBufferSize;
+
+	ImageView views[MAX_PYRAMID_LEVELS];
+
+	int levels;
+};
+
+#endif /* PYRAMID_H_ */
@@ -0,0 +1,347 @@
+/**
+ * @brief
+ * @file Ransac.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 29, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef RANSAC_H_
+#define RANSAC_H_
+
+// General files
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+//! Number of points of which the residuals are calculated in one call, a multiple of 4
+#define RANSAC_BLOCK			64
+
+//! Maximum number of samples drawn by PROSAC before it equals uniform sampling
+#define PROSAC_MAX_SAMPLES		200000
+
+/* **************************************************************************************
+ * Interface of Ransac
+ * **************************************************************************************/
+
+/**
+ * Random sample consensus: models are fitted to random minimal samples of the
+ * correspondences, the model that agrees with most of them wins. The model itself comes
+ * from two functors, so the same loop serves every kind of model:
+ *
+ *   struct Solver {
+ *     typedef ... Model;
+ *     static const int SAMPLE_SIZE;     // points in a minimal sample
+ *     static const int MAX_MODELS;      // models a minimal sample can give
+ *     // fit models to the points with the given indices, return the number of models
+ *     int operator()(const int *sample, Model *models) const;
+ *   };
+ *   struct Residual {
+ *     // squared errors of the points begin to end-1 into errors[0] to errors[end-begin-1]
+ *     void operator()(const Model &model, int begin, int end, float *errors) const;
+ *   };
+ *
+ * The residual functor works on a block of RANSAC_BLOCK consecutive points, so it can keep
+ * the correspondences in one array per coordinate and use SIMD instructions. A point is an
+ * inlier if its squared error is below the threshold; ties are broken by the sum of the
+ * truncated squared errors (MSAC).
+ *
+ * Three things make it fast:
+ *  - PROSAC: if the correspondences are sorted by quality, best first, samples are drawn
+ *    from the best ones first and from gradually more of them, so a good model shows up
+ *    much earlier than with uniform sampling (Chum and Matas, 2005).
+ *  - SPRT: a model is verified point after point and rejected as soon as the sequential
+ *    probability ratio test decides it is bad, most bad models after a few points. The
+ *    probabilities of a point agreeing with a good and with a bad model are estimated on
+ *    the way (Chum and Matas, 2008). A model that can no longer beat the best one, even if
+ *    all remaining points agree with it, is given up as well.
+ *  - The number of iterations is adapted to the inlier ratio of the best model so far.
+ *
+ * Memory is kept between runs, use Reserve to allocate it in advance.
+ */
+template<typename Solver, typename Residual>
+class Ransac {
+public:
+	typedef typename Solver::Model Model;
+
+	//! Constructor Ransac, the threshold is on the squared error
+	Ransac(float threshold = 1.0f, float confidence = 0.99f, int maxIterations = 1000):
+		threshold(threshold), confidence(confidence), maxIterations(maxIterations),
+		prosac(false), sprt(true), modelCost(200), seed(0x9E3779B9), iterations(0),
+		inlierCount(0), rejected(0) {}
+
+	//! Destructor ~Ransac
+	virtual ~Ransac() {}
+
+	//! Points with a squared error below the threshold are inliers
+	inline void SetThreshold(float threshold) { this->threshold = threshold; }
+
+	//! Probability that at least one sample is free of outliers, to stop early
+	inline void SetConfidence(float confidence) { this->confidence = confidence; }
+
+	inline void SetMaxIterations(int maxIterations) { this->maxIterations = maxIterations; }
+
+	//! Use PROSAC sampling, the correspondences should be sorted from best to worst
+	inline void SetProsac(bool prosac) { this->prosac = prosac; }
+
+	//! Use the sequential probability ratio test to reject bad models early
+	inline void SetSprt(bool sprt) { this->sprt = sprt; }
+
+	//! Time to fit the models of a sample, in units of the time to verify a point
+	inline void SetModelCost(float modelCost) { this->modelCost = modelCost; }
+
+	inline void SetSeed(unsigned int seed) { this->seed = seed ? seed : 1; }
+
+	//! Allocate the buffers for this number of correspondences
+	void Reserve(int count) {
+		mask.reserve(count);
+		bestMask.reserve(count);
+	}
+
+	/**
+	 * Find the model with the most inliers among count correspondences. Returns false if
+	 * there are fewer correspondences than a minimal sample, or no sample gave a model.
+	 */
+	bool Run(const Solver &solver, const Residual &residual, int count, Model &model) {
+		iterations = 0;
+		inlierCount = 0;
+		rejected = 0;
+		if (count < Solver::SAMPLE_SIZE) return false;
+		mask.resize(count);
+		bestMask.resize(count);
+
+		// prior guesses: few inliers and bad models agree with few points
+		epsilon = 0.1f;
+		delta = 0.01f;
+		updateSprt();
+		float bestScore = 0;
+		bool found = false;
+
+		initProsac(count);
+		int needed = maxIterations;
+		int sample[Solver::SAMPLE_SIZE];
+		Model models[Solver::MAX_MODELS];
+		while (iterations < needed) {
+			iterations++;
+			drawSample(count, sample);
+			int n = solver(sample, models);
+			for (int k = 0; k < n; ++k) {
+				int inliers;
+				float score;
+				if (!verify(residual, models[k], count, inlierCount, inliers, score)) {
+					rejected++;
+					continue;
+				}
+				if (inliers > inlierCount || (inliers == inlierCount && score < bestScore)) {
+					inlierCount = inliers;
+					bestScore = score;
+					model = models[k];
+					bestMask.swap(mask);
+					found = true;
+					// the best model so far tells how many of the points are inliers
+					epsilon = std::max(epsilon, (float)inliers / count);
+					updateSprt();
+					needed = std::min(needed, iterationsNeeded((float)inliers / count));
+				}
+			}
+		}
+		return found;
+	}
+
+	//! The inliers of the best model, one flag per correspondence
+	inline const unsigned char *GetInliers() const { return &bestMask[0]; }
+
+	inline int GetInlierCount() const { return inlierCount; }
+
+	//! Number of samples drawn by the last run
+	inline int GetIterations() const { return iterations; }
+
+	//! Number of models that were given up before all points were verified
+	inline int GetRejected() const { return rejected; }
+protected:
+	//! Random number by xorshift, fast and the same sequence for the same seed
+	inline unsigned int random() {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		return seed;
+	}
+
+	/**
+	 * PROSAC draws from the first n points, where n grows such that the first T'(n) samples
+	 * are drawn from the best n points, as uniform sampling would do in expectation with
+	 * PROSAC_MAX_SAMPLES samples. A sample from the first n points always contains point n,
+	 * the others are drawn from the first n-1.
+	 */
+	void initProsac(int count) {
+		const int m = Solver::SAMPLE_SIZE;
+		subset = prosac ? m : count;
+		tn = PROSAC_MAX_SAMPLES;
+		for (int i = 0; i < m; ++i) tn *= (double)(m - i) / (count - i);
+		tnPrime = 1;
+	}
+
+	void drawSample(int count, int *sample) {
+		const int m = Solver::SAMPLE_SIZE;
+		bool last = false;
+		if (prosac && subset < count) {
+			if (iterations > tnPrime) {
+				subset++;
+				double next = tn * subset / (subset - m);
+				tnPrime += (int)std::ceil(next - tn);
+				tn = next;
+			}
+			last = (iterations <= tnPrime);
+		}
+		int from = last ? subset - 1 : subset;
+		int k = 0;
+		if (last) sample[k++] = subset - 1;
+		while (k < m) {
+			int index = random() % from;
+			bool duplicate = false;
+			for (int j = 0; j < k; ++j) duplicate |= (sample[j] == index);
+			if (!duplicate) sample[k++] = index;
+		}
+	}
+
+	/**
+	 * Verify a model on all points in blocks. The likelihood ratio of the model being bad
+	 * versus good is updated per point; above the decision threshold A the model is
+	 * rejected, and the fraction of points that agreed with it updates the estimate of delta.
+	 */
+	bool verify(const Residual &residual, const Model &model, int count, int best,
+			int &inliers, float &score) {
+		float errors[RANSAC_BLOCK];
+		const float inlierRatio = delta / epsilon;
+		const float outlierRatio = (1 - delta) / (1 - epsilon);
+		double lambda = 1;
+		inliers = 0;
+		score = 0;
+		for (int begin = 0; begin < count; begin += RANSAC_BLOCK) {
+			int end = std::min(begin + RANSAC_BLOCK, count);
+			residual(model, begin, end, errors);
+			for (int i = 0; i < end - begin; ++i) {
+				bool inlier = errors[i] < threshold;
+				mask[begin + i] = inlier;
+				inliers += inlier;
+				score += inlier ? errors[i] : threshold;
+				if (testing) lambda *= inlier ? inlierRatio : outlierRatio;
+			}
+			if (testing && lambda > decision) {
+				float agreed = (float)inliers / end;
+				delta = 0.95f * delta + 0.05f * agreed;
+				updateSprt();
+				return false;
+			}
+			if (inliers + count - end < best) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * The decision threshold A follows from A = K + log(A), with K the cost of fitting a model
+	 * relative to the expected number of points to verify a bad model: K = modelCost * C + 1,
+	 * C = (1 - delta) log((1 - delta)/(1 - epsilon)) + delta log(delta/epsilon). The test is
+	 * switched off while good and bad models can not be told apart.
+	 */
+	void updateSprt() {
+		if (delta < 0.0001f) delta = 0.0001f;
+		testing = sprt && epsilon > 1.5f * delta;
+		if (!testing) return;
+		double c = (1 - delta) * std::log((1 - delta) / (1 - epsilon)) +
+				delta * std::log(delta / epsilon);
+		double k = modelCost * c + 1;
+		double a = k;
+		for (int i = 0; i < 10; ++i) a = k + std::log(a);
+		decision = a;
+	}
+
+	/**
+	 * Samples needed to find an all-inlier sample with the given confidence. With SPRT a good
+	 * model is rejected with probability 1/A, which makes the chance per sample a bit lower.
+	 */
+	int iterationsNeeded(float inlierRatio) const {
+		double good = std::pow((double)inlierRatio, Solver::SAMPLE_SIZE);
+		if (testing) good *= 1 - 1 / decision;
+		if (good >= 1) return 1;
+		if (good <= 0) return maxIterations;
+		double k = std::log(1 - confidence) / std::log(1 - good);
+		return k < maxIterations ? (int)std::ceil(k) : maxIterations;
+	}
+private:
+	float threshold;
+
+	float confidence;
+
+	int maxIterations;
+
+	bool prosac;
+
+	bool sprt;
+
+	float modelCost;
+
+	unsigned int seed;
+
+	int iterations;
+
+	int inlierCount;
+
+	int rejected;
+
+	//! Probability that a point agrees with a good model
+	float epsilon;
+
+	//! Probability that a point agrees with a bad model
+	float delta;
+
+	//! Whether the SPRT is in use with the current epsilon and delta
+	bool testing;
+
+	//! Decision threshold A of the SPRT
+	double decision;
+
+	//! PROSAC: the size of the subset of best points that is drawn from
+	int subset;
+
+	//! PROSAC: expected number of samples from the subset, and the integer version of it
+	double tn;
+	int tnPrime;
+
+	//! Inlier flags of the model being verified and of the best model
+	std::vector<unsigned char> mask, bestMask;
+};
+
+//! Orders indices by a quality, highest first, ties by index so the order is deterministic
+struct QualityOrder {
+	const float *quality;
+	inline bool operator()(int a, int b) const {
+		return quality[a] > quality[b] || (quality[a] == quality[b] && a < b);
+	}
+};
+
+//! The indices of count correspondences from best to worst quality, for PROSAC
+inline void RankByQuality(const float *quality, int count, std::vector<int> &order) {
+	order.resize(count);
+	for (int i = 0; i < count; ++i) order[i] = i;
+	QualityOrder less = { quality };
+	std::sort(order.begin(), order.end(), less);
+}
+
+#endif /* RANSAC_H_ */
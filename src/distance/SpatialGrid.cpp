@@ -0,0 +1,142 @@
+/**
+ * @brief
+ * @file SpatialGrid.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 12, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+
+// Plugin files
+#include <SpatialGrid.h>
+
+/* **************************************************************************************
+ * Implementation of SpatialGrid
+ * **************************************************************************************/
+
+SpatialGrid::SpatialGrid(): cellSize(1), cols(0), rows(0) {
+
+}
+
+SpatialGrid::~SpatialGrid() {
+
+}
+
+/**
+ * Points outside of the image are put in the nearest border cell.
+ */
+inline int SpatialGrid::cell(int x, int y) const {
+	int cx = x / cellSize;
+	int cy = y / cellSize;
+	if (cx < 0) cx = 0;
+	if (cx >= cols) cx = cols - 1;
+	if (cy < 0) cy = 0;
+	if (cy >= rows) cy = rows - 1;
+	return cy * cols + cx;
+}
+
+void SpatialGrid::Build(const std::vector<Corner*> & corners, int width, int height, int cellSize) {
+	xs.resize(corners.size());
+	ys.resize(corners.size());
+	for (unsigned int i = 0; i < corners.size(); ++i) {
+		xs[i] = corners[i]->x;
+		ys[i] = corners[i]->y;
+	}
+	build(width, height, cellSize);
+}
+
+void SpatialGrid::Build(const float *xs, const float *ys, int count, int width, int height,
+		int cellSize) {
+	this->xs.resize(count);
+	this->ys.resize(count);
+	for (int i = 0; i < count; ++i) {
+		this->xs[i] = (int)xs[i];
+		this->ys[i] = (int)ys[i];
+	}
+	build(width, height, cellSize);
+}
+
+void SpatialGrid::build(int width, int height, int cellSize) {
+	assert (cellSize > 0);
+	this->cellSize = cellSize;
+	cols = (width + cellSize - 1) / cellSize;
+	rows = (height + cellSize - 1) / cellSize;
+	if (cols < 1) cols = 1;
+	if (rows < 1) rows = 1;
+
+	// count the points per cell, start[c+1] is the count of cell c
+	const int count = xs.size();
+	start.assign(cols * rows + 1, 0);
+	for (int i = 0; i < count; ++i) {
+		start[cell(xs[i], ys[i]) + 1]++;
+	}
+	// prefix sum gives the start of every cell
+	for (int c = 0; c < cols * rows; ++c) {
+		start[c+1] += start[c];
+	}
+	// scatter the indices, fill is the next free position in every cell
+	fill.assign(start.begin(), start.end() - 1);
+	indices.resize(count);
+	for (int i = 0; i < count; ++i) {
+		indices[fill[cell(xs[i], ys[i])]++] = i;
+	}
+}
+
+void SpatialGrid::Query(int x, int y, int radius, std::vector<int> & result) const {
+	query(x, y, radius, false, result);
+}
+
+void SpatialGrid::QueryBox(int x, int y, int radius, std::vector<int> & result) const {
+	query(x, y, radius, true, result);
+}
+
+void SpatialGrid::query(int x, int y, int radius, bool box, std::vector<int> & result) const {
+	result.clear();
+	if (start.empty()) return;
+	int cx0 = (x - radius) / cellSize, cx1 = (x + radius) / cellSize;
+	int cy0 = (y - radius) / cellSize, cy1 = (y + radius) / cellSize;
+	if (x - radius < 0) cx0 = 0;
+	if (y - radius < 0) cy0 = 0;
+	if (cx1 >= cols) cx1 = cols - 1;
+	if (cy1 >= rows) cy1 = rows - 1;
+	// points outside of the image were clamped into the border cells
+	if (cx0 >= cols) cx0 = cols - 1;
+	if (cy0 >= rows) cy0 = rows - 1;
+	if (cx1 < 0) cx1 = 0;
+	if (cy1 < 0) cy1 = 0;
+
+	int r2 = radius * radius;
+	for (int cy = cy0; cy <= cy1; ++cy) {
+		for (int cx = cx0; cx <= cx1; ++cx) {
+			int id = cy * cols + cx;
+			for (int k = start[id]; k < start[id+1]; ++k) {
+				int dx = xs[indices[k]] - x;
+				int dy = ys[indices[k]] - y;
+				if (box) {
+					if (dx > radius || dx < -radius || dy > radius || dy < -radius) continue;
+				} else {
+					if (dx * dx + dy * dy > r2) continue;
+				}
+				result.push_back(indices[k]);
+			}
+		}
+	}
+}
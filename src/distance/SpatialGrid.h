@@ -0,0 +1,105 @@
+/**
+ * @brief
+ * @file SpatialGrid.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 12, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef SPATIALGRID_H_
+#define SPATIALGRID_H_
+
+// General files
+#include <vector>
+
+#include <CornerDetector.h>
+
+/* **************************************************************************************
+ * Interface of SpatialGrid
+ * **************************************************************************************/
+
+/**
+ * Uniform grid over a set of points, to find the points in the neighbourhood of a point
+ * without going over all of them. The cell size should be about the search radius, then a
+ * query only visits the 3x3 cells around the point. The grid is built with a counting sort
+ * in O(N): the indices of the points are stored cell after cell in one array. The number of
+ * points per cell tells which parts of the image are empty. Memory is reused when the grid
+ * is built again for the next frame.
+ */
+class SpatialGrid {
+public:
+	//! Constructor SpatialGrid
+	SpatialGrid();
+
+	//! Destructor ~SpatialGrid
+	virtual ~SpatialGrid();
+
+	//! Build the grid over corners in an image of width x height pixels
+	void Build(const std::vector<Corner*> & corners, int width, int height, int cellSize);
+
+	//! Build the grid over count points (xs[i],ys[i])
+	void Build(const float *xs, const float *ys, int count, int width, int height, int cellSize);
+
+	/**
+	 * Get the indices (in the order given to Build) of all points within radius of (x,y),
+	 * the result is cleared first.
+	 */
+	void Query(int x, int y, int radius, std::vector<int> & result) const;
+
+	//! Same, but within a square of radius pixels around (x,y), so |dx| <= radius and |dy| <= radius
+	void QueryBox(int x, int y, int radius, std::vector<int> & result) const;
+
+	inline int GetCols() const { return cols; }
+
+	inline int GetRows() const { return rows; }
+
+	//! Number of points in cell (cx,cy), points outside of the image are in the nearest cell
+	inline int GetCount(int cx, int cy) const {
+		int c = cy * cols + cx;
+		return start[c+1] - start[c];
+	}
+protected:
+	//! Sort the positions in xs and ys into the cells
+	void build(int width, int height, int cellSize);
+
+	void query(int x, int y, int radius, bool box, std::vector<int> & result) const;
+
+	inline int cell(int x, int y) const;
+private:
+	//! Positions of the points, in pixels
+	std::vector<int> xs;
+
+	std::vector<int> ys;
+
+	int cellSize;
+
+	int cols;
+
+	int rows;
+
+	//! Corner indices of cell c are in indices[start[c]] to indices[start[c+1]-1]
+	std::vector<int> start;
+
+	std::vector<int> indices;
+
+	//! Temporary, used while building
+	std::vector<int> fill;
+};
+
+#endif /* SPATIALGRID_H_ */
@@ -0,0 +1,186 @@
+/**
+ * @brief
+ * @file StereoMatcher.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 19, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <cstdlib>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Plugin files
+#include <StereoMatcher.h>
+
+/* **************************************************************************************
+ * Implementation of StereoMatcher
+ * **************************************************************************************/
+
+StereoMatcher::StereoMatcher(int minDisparity, int maxDisparity, int window): costType(SC_SAD),
+		minCorrelation(0.8), uniqueness(0.9), focal(0), baseline(0), leftPatch(NULL),
+		rightPatches(NULL) {
+	SetDisparityRange(minDisparity, maxDisparity);
+	SetWindow(window);
+}
+
+StereoMatcher::~StereoMatcher() {
+	delete leftPatch;
+	delete rightPatches;
+}
+
+void StereoMatcher::SetDisparityRange(int minDisparity, int maxDisparity) {
+	assert (minDisparity >= 0 && maxDisparity >= minDisparity);
+	this->minDisparity = minDisparity;
+	this->maxDisparity = maxDisparity;
+	cost.resize(maxDisparity + 1);
+	xs.resize(maxDisparity + 1);
+	ys.resize(maxDisparity + 1);
+	candidates.resize(maxDisparity + 1);
+	scores.resize(maxDisparity + 1);
+	for (int d = 0; d <= maxDisparity; ++d) candidates[d] = d;
+}
+
+void StereoMatcher::SetWindow(int window) {
+	assert (window > 0 && window <= STEREO_MAX_WINDOW && (window % 2) == 1);
+	this->window = window;
+	delete leftPatch;
+	delete rightPatches;
+	leftPatch = new PatchSet(window);
+	rightPatches = new PatchSet(window);
+}
+
+/**
+ * The rows of the left window are loaded once, the window in the right image moves one pixel
+ * per disparity, so its loads are unaligned.
+ */
+void StereoMatcher::costs(const ImageView &left, const ImageView &right, int x, int y,
+		int dMin, int dMax) {
+	const int half = window / 2;
+	const int x0 = x - STEREO_WINDOW_WIDTH / 2;
+#ifdef __SSE2__
+	__m128i rows[STEREO_MAX_WINDOW];
+	for (int r = 0; r < window; ++r) {
+		rows[r] = _mm_loadu_si128((const __m128i*)(left.row(y - half + r) + x0));
+	}
+	for (int d = dMin; d <= dMax; ++d) {
+		__m128i sum = _mm_setzero_si128();
+		for (int r = 0; r < window; ++r) {
+			__m128i b = _mm_loadu_si128((const __m128i*)(right.row(y - half + r) + x0 - d));
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(rows[r], b));
+		}
+		int c = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+		cost[d] = c;
+	}
+#else
+	for (int d = dMin; d <= dMax; ++d) {
+		int c = 0;
+		for (int r = 0; r < window; ++r) {
+			const unsigned char *a = left.row(y - half + r) + x0;
+			const unsigned char *b = right.row(y - half + r) + x0 - d;
+			for (int i = 0; i < STEREO_WINDOW_WIDTH; ++i) c += abs(a[i] - b[i]);
+		}
+		cost[d] = c;
+	}
+#endif
+}
+
+/**
+ * The candidate windows in the right image are copied into one PatchSet, with their means
+ * and norms, and scored against the left window in a single batch.
+ */
+void StereoMatcher::correlations(const ImageView &left, const ImageView &right, int x, int y,
+		int dMin, int dMax) {
+	leftPatch->Extract(left, &x, &y, 1);
+	int n = dMax - dMin + 1;
+	for (int d = dMin; d <= dMax; ++d) {
+		xs[d - dMin] = x - d;
+		ys[d - dMin] = y;
+	}
+	rightPatches->Extract(right, &xs[0], &ys[0], n);
+	PatchDistance::ZNCC(*leftPatch, 0, *rightPatches, &candidates[0], n, &scores[0]);
+	for (int d = dMin; d <= dMax; ++d) {
+		cost[d] = 1 - scores[d - dMin];
+	}
+}
+
+/**
+ * The disparity range is clipped so the window stays inside the right image. The parabola
+ * through the costs at d-1, d and d+1 has its minimum at d + (c[d-1] - c[d+1]) / (2 (c[d-1] -
+ * 2 c[d] + c[d+1])), which is within half a pixel of d because c[d] is the smallest.
+ */
+StereoMatch StereoMatcher::Match(const ImageView &left, const ImageView &right, int x, int y) {
+	StereoMatch m;
+	m.valid = false;
+	m.disparity = 0;
+	m.depth = 0;
+	m.cost = 0;
+
+	const int half = window / 2;
+	const int width = (costType == SC_ZNCC) ? window : STEREO_WINDOW_WIDTH;
+	const int x0 = x - width / 2;
+	if (y - half < 0 || y + half >= left.height || y + half >= right.height) return m;
+	if (x0 < 0 || x0 + width > left.width) return m;
+	int dMin = minDisparity;
+	int dMax = std::min(maxDisparity, x0);
+	// the right window must be inside the right image as well
+	if (x0 - dMin + width > right.width) dMin = x0 + width - right.width;
+	if (dMin > dMax) return m;
+
+	if (costType == SC_ZNCC) {
+		correlations(left, right, x, y, dMin, dMax);
+	} else {
+		costs(left, right, x, y, dMin, dMax);
+	}
+
+	int best = dMin;
+	for (int d = dMin + 1; d <= dMax; ++d) {
+		if (cost[d] < cost[best]) best = d;
+	}
+	for (int d = dMin; d <= dMax; ++d) {
+		if (abs(d - best) <= 1) continue;
+		if (cost[best] >= uniqueness * cost[d]) return m;
+	}
+	if (costType == SC_ZNCC && 1 - cost[best] < minCorrelation) return m;
+
+	float disparity = best;
+	if (best > dMin && best < dMax) {
+		float denominator = cost[best-1] - 2 * cost[best] + cost[best+1];
+		if (denominator > 0) {
+			disparity += (cost[best-1] - cost[best+1]) / (2 * denominator);
+		}
+	}
+	m.valid = true;
+	m.disparity = disparity;
+	m.cost = cost[best];
+	if (disparity > 0 && focal > 0) m.depth = focal * baseline / disparity;
+	return m;
+}
+
+void StereoMatcher::Match(const ImageView &left, const ImageView &right,
+		const std::vector<Corner*> & corners, std::vector<StereoMatch> & result) {
+	result.resize(corners.size());
+	for (unsigned int i = 0; i < corners.size(); ++i) {
+		result[i] = Match(left, right, corners[i]->x, corners[i]->y);
+	}
+}
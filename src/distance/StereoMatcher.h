@@ -0,0 +1,142 @@
+/**
+ * @brief
+ * @file StereoMatcher.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 19, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef STEREOMATCHER_H_
+#define STEREOMATCHER_H_
+
+// General files
+#include <vector>
+
+#include <CornerDetector.h>
+#include <PatchDistance.h>
+#include <Pyramid.h>
+
+//! Width of the matching window, the number of pixels in an SSE2 register
+#define STEREO_WINDOW_WIDTH		16
+
+//! Maximum number of rows of the matching window
+#define STEREO_MAX_WINDOW		31
+
+enum StereoCost {
+	SC_SAD,                    //! Sum of absolute differences of a 16 pixels wide window
+	SC_ZNCC,                   //! Zero-mean normalized cross-correlation of a square window
+};
+
+struct StereoMatch {
+	//! False if no unique match is found within the disparity range
+	bool valid;
+	//! Disparity in pixels, with subpixel precision: x in the right image is x - disparity
+	float disparity;
+	//! Distance along the optical axis, in the unit of the baseline, 0 if unknown
+	float depth;
+	//! Cost at the best integer disparity, the SAD or 1 - ZNCC
+	float cost;
+};
+
+/* **************************************************************************************
+ * Interface of StereoMatcher
+ * **************************************************************************************/
+
+/**
+ * Finds the corners of the left image in the right image of a rectified stereo pair. After
+ * rectification a point can only be found on the same row, to the left, so the search is
+ * one-dimensional over the disparity range. The cost is the sum of absolute differences over
+ * a window of 16 pixels wide, one psadbw per row, and "window" rows high. The disparity with
+ * the lowest cost is refined to subpixel precision by fitting a parabola through it and its
+ * neighbours. A match is rejected if another disparity, not next to it, has almost the same
+ * cost (uniqueness ratio), which happens on repetitive texture and edges along the row.
+ *
+ * The SAD assumes both cameras see the same brightness. When their gain or exposure differ,
+ * the ZNCC cost compares square windows of "window" pixels with PatchDistance instead, and
+ * the correlation at the best disparity must reach a minimum.
+ */
+class StereoMatcher {
+public:
+	//! Constructor StereoMatcher
+	StereoMatcher(int minDisparity = 0, int maxDisparity = 64, int window = 7);
+
+	//! Destructor ~StereoMatcher
+	virtual ~StereoMatcher();
+
+	void SetDisparityRange(int minDisparity, int maxDisparity);
+
+	//! Number of rows of the window, odd and at most STEREO_MAX_WINDOW
+	void SetWindow(int window);
+
+	//! Compare the windows by their SAD (default) or by their ZNCC
+	inline void SetCost(StereoCost cost) { this->costType = cost; }
+
+	//! Minimum ZNCC of a match, in [-1,1]
+	inline void SetMinCorrelation(float correlation) { this->minCorrelation = correlation; }
+
+	//! The best cost must be below this ratio times the best cost at other disparities
+	inline void SetUniqueness(float uniqueness) { this->uniqueness = uniqueness; }
+
+	//! Focal length in pixels and baseline, to calculate the depth
+	inline void SetCamera(float focal, float baseline) { this->focal = focal; this->baseline = baseline; }
+
+	//! Match the corners of the left image, the result has the same order
+	void Match(const ImageView &left, const ImageView &right, const std::vector<Corner*> & corners,
+			std::vector<StereoMatch> & result);
+
+	//! Match a single point
+	StereoMatch Match(const ImageView &left, const ImageView &right, int x, int y);
+protected:
+	//! Costs of the window at (x,y) in left, for the disparities from dMin to dMax
+	void costs(const ImageView &left, const ImageView &right, int x, int y, int dMin, int dMax);
+
+	//! Costs as 1 - ZNCC, in [0,2]
+	void correlations(const ImageView &left, const ImageView &right, int x, int y, int dMin,
+			int dMax);
+private:
+	int minDisparity;
+
+	int maxDisparity;
+
+	int window;
+
+	StereoCost costType;
+
+	float minCorrelation;
+
+	float uniqueness;
+
+	float focal;
+
+	float baseline;
+
+	//! Costs of the current point, per disparity
+	std::vector<float> cost;
+
+	//! Window around the current point and around its candidates in the right image, for ZNCC
+	PatchSet *leftPatch;
+
+	PatchSet *rightPatches;
+
+	std::vector<int> xs, ys, candidates;
+
+	std::vector<float> scores;
+};
+
+#endif /* STEREOMATCHER_H_ */
@@ -0,0 +1,164 @@
+/**
+ * @brief
+ * @file TrackManager.cpp
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 18, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+// General files
+#include <cassert>
+#include <algorithm>
+
+// Plugin files
+#include <TrackManager.h>
+
+//! Number of pyramid levels used for tracking
+#define TRACK_PYRAMID_LEVELS		4
+
+/* **************************************************************************************
+ * Implementation of TrackManager
+ * **************************************************************************************/
+
+TrackManager::TrackManager(int maxTracks, int history, int cellSize): maxTracks(maxTracks),
+		history(history), cellSize(cellSize), minTracks(maxTracks / 2), maxEmpty(0.5),
+		frame(0), count(0), nextId(0), detector(NULL) {
+	assert (maxTracks > 0 && history > 0 && cellSize > 0);
+	xs.resize(maxTracks * history);
+	ys.resize(maxTracks * history);
+	ids.resize(maxTracks);
+	births.resize(maxTracks);
+	retired.reserve(maxTracks);
+}
+
+TrackManager::~TrackManager() {
+	for (unsigned int i = 0; i < corners.size(); ++i) delete corners[i];
+}
+
+void TrackManager::move(int from, int to) {
+	for (int k = 0; k < history; ++k) {
+		int r = k * maxTracks;
+		xs[r + to] = xs[r + from];
+		ys[r + to] = ys[r + from];
+	}
+	ids[to] = ids[from];
+	births[to] = births[from];
+}
+
+/**
+ * The tracks are followed from the previous row into the next one, which overwrites the
+ * oldest positions. Lost tracks are removed in a single pass, so the order of the remaining
+ * tracks changes, but their IDs do not.
+ */
+void TrackManager::Update(CRawImage *img, const float *guessXs, const float *guessYs,
+		const float *radii) {
+	assert (detector != NULL);
+	pyramid.Build(img, TRACK_PYRAMID_LEVELS);
+	gradients.Clear();
+	retired.clear();
+	++frame;
+
+	if (count > 0) {
+		tracker.Track(prevPyramid, prevGradients, pyramid, gradients, GetXs(1), GetYs(1), count,
+				tracked, guessXs, guessYs, radii);
+		float *x = &xs[row(0)], *y = &ys[row(0)];
+		for (int i = 0; i < count; ++i) {
+			x[i] = tracked[i].x;
+			y[i] = tracked[i].y;
+		}
+		for (int i = 0; i < count; ) {
+			if (tracked[i].status == TS_OK) {
+				++i;
+				continue;
+			}
+			retired.push_back(ids[i]);
+			--count;
+			if (i < count) {
+				move(count, i);
+				tracked[i] = tracked[count];
+			}
+		}
+	}
+
+	detect(img);
+	prevPyramid.Swap(pyramid);
+	prevGradients.Swap(gradients);
+}
+
+/**
+ * Runs of empty cells in a row of the grid are merged into one patch, which saves the
+ * overhead of running the detector on many small patches.
+ */
+void TrackManager::detect(CRawImage *img) {
+	const int width = img->getwidth(), height = img->getheight();
+	grid.Build(GetXs(), GetYs(), count, width, height, cellSize);
+	const int cols = grid.GetCols(), rows = grid.GetRows();
+	occupied.resize(cols * rows);
+	int empty = 0;
+	for (int cy = 0; cy < rows; ++cy) {
+		for (int cx = 0; cx < cols; ++cx) {
+			occupied[cy * cols + cx] = grid.GetCount(cx, cy) > 0;
+			if (!occupied[cy * cols + cx]) empty++;
+		}
+	}
+	if (count >= maxTracks) return;
+	if (count >= minTracks && empty <= maxEmpty * cols * rows) return;
+
+	patches.clear();
+	for (int cy = 0; cy < rows; ++cy) {
+		for (int cx = 0; cx < cols; ) {
+			if (occupied[cy * cols + cx]) {
+				++cx;
+				continue;
+			}
+			int start = cx;
+			while (cx < cols && !occupied[cy * cols + cx]) ++cx;
+			Patch patch;
+			patch.x = start * cellSize;
+			patch.y = cy * cellSize;
+			patch.width = std::min(cx * cellSize, width) - patch.x;
+			patch.height = std::min((cy + 1) * cellSize, height) - patch.y;
+			patches.push_back(patch);
+		}
+	}
+
+	for (unsigned int i = 0; i < corners.size(); ++i) delete corners[i];
+	corners.clear();
+	detector->SetImage(img);
+	detector->GetCorners(patches, corners);
+
+	// one corner per empty cell, only those are refined to subpixel precision
+	selected.clear();
+	for (unsigned int c = 0; c < corners.size() && count + (int)selected.size() < maxTracks; ++c) {
+		int cell = (corners[c]->y / cellSize) * cols + corners[c]->x / cellSize;
+		if (occupied[cell]) continue;
+		occupied[cell] = 1;
+		selected.push_back(corners[c]);
+	}
+	detector->RefineCorners(selected);
+
+	float *nx = &xs[row(0)], *ny = &ys[row(0)];
+	for (unsigned int c = 0; c < selected.size(); ++c) {
+		nx[count] = selected[c]->sx;
+		ny[count] = selected[c]->sy;
+		ids[count] = nextId++;
+		births[count] = frame - 1;
+		count++;
+	}
+}
@@ -0,0 +1,171 @@
+/**
+ * @brief
+ * @file TrackManager.h
+ *
+ * This file is created at Almende B.V. It is open-source software and part of the Common
+ * Hybrid Agent Platform (CHAP). A toolbox with a lot of open-source tools, ranging from
+ * thread pools and TCP/IP components to control architectures and learning algorithms.
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless,
+ * we personally strongly object to this software being used by the military, in factory
+ * farming, for animal experimentation, or anything that violates the Universal
+ * Declaration of Human Rights.
+ *
+ * Copyright © 2012 Anne van Rossum <anne@almende.com>
+ *
+ * @author  Anne C. van Rossum
+ * @date    Oct 18, 2012
+ * @project Replicator FP7
+ * @company Almende B.V.
+ * @case    modular robotics / sensor fusion
+ */
+
+
+#ifndef TRACKMANAGER_H_
+#define TRACKMANAGER_H_
+
+// General files
+#include <vector>
+#include <algorithm>
+
+#include <CornerDetector.h>
+#include <KLTTracker.h>
+#include <Pyramid.h>
+#include <SpatialGrid.h>
+
+/* **************************************************************************************
+ * Interface of TrackManager
+ * **************************************************************************************/
+
+/**
+ * Follows features over frames. Every track gets an ID that stays the same as long as the
+ * feature is tracked, and keeps its last "history" positions. The positions are stored in a
+ * ring buffer of frames, one row of maxTracks x and y values per frame, and the active tracks
+ * are kept at the front of every row. So the current positions of all tracks are contiguous
+ * and can be handed to the KLTTracker without copying. A track that is lost is retired by
+ * moving the last track in its place. New corners are only detected in the cells of a grid
+ * over the image that have no track, and only when the number of tracks drops below a
+ * minimum or too large a part of the image is empty.
+ */
+class TrackManager {
+public:
+	//! Constructor TrackManager
+	TrackManager(int maxTracks = 512, int history = 16, int cellSize = 32);
+
+	//! Destructor ~TrackManager
+	virtual ~TrackManager();
+
+	//! Detector used for new tracks (not deallocated by the manager)
+	inline void SetDetector(CornerDetector *detector) { this->detector = detector; }
+
+	//! The tracker, to change its settings
+	inline KLTTracker & GetTracker() { return tracker; }
+
+	//! Detect new corners if there are fewer tracks than this
+	inline void SetMinTracks(int minTracks) { this->minTracks = minTracks; }
+
+	//! Detect new corners if more than this fraction of the grid cells is empty
+	inline void SetMaxEmpty(float maxEmpty) { this->maxEmpty = maxEmpty; }
+
+	/**
+	 * Track all features into a new grayscale frame, and start new tracks where needed. The
+	 * positions where the tracks are expected in the new frame and the radii to search them
+	 * in can be given, see KLTTracker, one for every track before the update.
+	 */
+	void Update(CRawImage *img, const float *guessXs = NULL, const float *guessYs = NULL,
+			const float *radii = NULL);
+
+	//! Number of frames handed to Update
+	inline int GetFrame() const { return frame; }
+
+	//! Number of active tracks, they have index 0 to GetCount()-1
+	inline int GetCount() const { return count; }
+
+	inline int GetId(int i) const { return ids[i]; }
+
+	//! Number of frames track i has been followed, including the one it started in
+	inline int GetAge(int i) const { return frame - births[i]; }
+
+	//! Number of positions stored for track i, at most the history
+	inline int GetLength(int i) const { return std::min(GetAge(i), history); }
+
+	//! Position of track i, k frames ago, k smaller than GetLength(i)
+	inline float GetX(int i, int k = 0) const { return xs[row(k) + i]; }
+
+	inline float GetY(int i, int k = 0) const { return ys[row(k) + i]; }
+
+	//! Current positions of all tracks, GetCount() values
+	inline const float *GetXs(int k = 0) const { return &xs[row(k)]; }
+
+	inline const float *GetYs(int k = 0) const { return &ys[row(k)]; }
+
+	//! IDs of the tracks that were lost in the last Update
+	inline const std::vector<int> & GetRetired() const { return retired; }
+protected:
+	//! Offset of the row of k frames ago in the ring buffer
+	inline int row(int k) const { return ((frame - 1 - k + history) % history) * maxTracks; }
+
+	//! Move track "from" to index "to", in all rows
+	void move(int from, int to);
+
+	//! Find corners in the empty cells, and start a track for at most one corner per cell
+	void detect(CRawImage *img);
+private:
+	int maxTracks;
+
+	int history;
+
+	int cellSize;
+
+	int minTracks;
+
+	float maxEmpty;
+
+	int frame;
+
+	int count;
+
+	int nextId;
+
+	//! Ring buffer of history rows of maxTracks positions
+	std::vector<float> xs;
+
+	std::vector<float> ys;
+
+	std::vector<int> ids;
+
+	//! Frame in which a track started
+	std::vector<int> births;
+
+	std::vector<int> retired;
+
+	//! The tracks in cells of cellSize, and which cells are occupied
+	SpatialGrid grid;
+
+	std::vector<unsigned char> occupied;
+
+	std::vector<Patch> patches;
+
+	std::vector<Corner*> corners;
+
+	//! The corners that start a new track (not owned)
+	std::vector<Corner*> selected;
+
+	std::vector<TrackedPoint> tracked;
+
+	CornerDetector *detector;
+
+	KLTTracker tracker;
+
+	Pyramid pyramid;
+
+	Pyramid prevPyramid;
+
+	//! Gradients of the pyramids, those of a frame are kept until it is tracked from
+	KLTTracker::Gradients gradients;
+
+	KLTTracker::Gradients prevGradients;
+};
+
+#endif /* TRACKMANAGER_H_ */
@@ -8,11 +8,25 @@
 #include <sstream>
 #include <iostream>
 #include <semaphore.h>
+#include <sys/time.h>
+#include <pthread.h>
 #include <vector>
 #include <cassert>
+#include <cmath>
 #include <CornerDetector.h>
+#include <ThreadPool.h>
+#include <StereoMatcher.h>
+#include <TrackManager.h>
+#include <CameraModel.h>
+#include <DenseStereo.h>
+#include <Odometry.h>
+#include <Homography.h>
+#include <Essential.h>
+#include <LocalMap.h>
+#include <OdometryFilter.h>
 
 #include <iomanip>
+#include <algorithm>
 
 char port[] = "10002"; 
 
@@ -28,8 +42,69 @@ sem_t imageSem;
 
 #define ENABLE_CAM
 
+#define ENABLE_WHEELS
+
+// Mounting of the left camera above the floor, in the unit of the stereo baseline
+#define CAMERA_HEIGHT		0.25
+#define CAMERA_PITCH		0.1
+
+// Deviation of the motion between two frames by visual odometry, in meters and radians
+#define VISUAL_DEVIATION_TRANSLATION	0.005
+#define VISUAL_DEVIATION_YAW			0.005
+
+// Distance between the wheels of the differential drive in meters, the deviation of the
+// distance a wheel travels as a fraction of it, and the smallest deviation in meters
+#define WHEEL_BASE				0.1
+#define WHEEL_DEVIATION			0.02
+#define WHEEL_MIN_DEVIATION		0.001
+
 using namespace std;
 
+//! Wall-clock time in seconds
+static double seconds() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+#ifdef ENABLE_WHEELS
+struct WheelReader {
+	FILE *file;
+	OdometryFilter *filter;
+};
+
+/**
+ * Reads the wheel encoders from a file or pipe, one line per reading with the distances in
+ * meters that the left and the right wheel travelled since the previous line, and adds them
+ * to the filter at the time they come in. Runs until the end of the file, or until it is
+ * cancelled while it waits for the next line; it can't be cancelled while it holds the lock
+ * of the filter.
+ */
+static void *read_wheels(void *arg) {
+	WheelReader *reader = (WheelReader*)arg;
+	double left, right;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	while (true) {
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		int read = fscanf(reader->file, "%lf %lf", &left, &right);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		if (read != 2) break;
+		double dl = std::max(WHEEL_DEVIATION * fabs(left), WHEEL_MIN_DEVIATION);
+		double dr = std::max(WHEEL_DEVIATION * fabs(right), WHEEL_MIN_DEVIATION);
+		PlanarMotion motion, deviation;
+		motion.forward = (left + right) / 2;
+		motion.lateral = 0;
+		motion.yaw = (right - left) / WHEEL_BASE;
+		deviation.forward = sqrt(dl * dl + dr * dr) / 2;
+		deviation.lateral = WHEEL_MIN_DEVIATION;
+		deviation.yaw = sqrt(dl * dl + dr * dr) / WHEEL_BASE;
+		if (!reader->filter->AddWheel(seconds(), motion, deviation)) {
+			cerr << "Wheel input dropped, the queue of the filter is full" << endl;
+		}
+	}
+	return NULL;
+}
+#endif
 
 // http://www.cise.ufl.edu/class/cap5416fa09/Assignments/Right.bmp
 void specific_image() {
@@ -53,23 +128,6 @@ void specific_image() {
 	detector.GetCorners(corners);
 }
 
-/**
- * The most primitive way of matching two points. Just check all values in a neighbourhood and
- * if the total distance between the values at the specific locations around the two corners is
- * small, it is considered the same point. This doesn't work at all... It is not rotation or
- * translation invariant, or able to capture light difference etc.
- */
-bool match(Corner *c0, Corner *c1, CRawImage *img0, CRawImage *img1) {
-	int region = 4;
-	int dist = 0;
-	for (int i = -region; i < region; ++i) {
-		for (int j = -region; j < region; ++j) {
-			dist += abs(img0->data[(j+c0->y)*img0->getwidth() + (i+c0->x)] - img1->data[(j+c1->y)*img1->getwidth() + (i+c1->x)]);
-		}
-	}
-	return (dist < region*region*20); // 320
-}
-
 /**
  * This starts a separate binary forever, calling renewImage indefinitely.
  */
@@ -77,9 +135,13 @@ int main(int argc,char *argv[])
 {
 	if (argc < 2) {
 		fprintf(stderr, "You need the camera file descriptor as argument\n");
+		fprintf(stderr, "Optionally followed by the stereo calibration file (see data/stereo.cfg)\n");
+		fprintf(stderr, "and by a file or pipe with the distances the left and right wheel travel\n");
 		return EXIT_FAILURE;
 	}
 	char *devName = argv[1];
+	char *calibrationFile = (argc > 2) ? argv[2] : NULL;
+	char *wheelFile = (argc > 3) ? argv[3] : NULL;
 
 	sem_init(&imageSem,0,1);
 
@@ -118,9 +180,60 @@ int main(int argc,char *argv[])
 	string extension = ".bmp";
 	int imageIndex = 0;
 
+	ThreadPool pool;
 	CornerDetector detector;
+	detector.SetThreadPool(&pool);
 	std::vector<Corner*> corners0; corners0.clear();
-	std::vector<Corner*> corners1; corners1.clear();
+	StereoMatcher stereo(0, 64, 7);
+	stereo.SetCost(SC_ZNCC);
+	std::vector<StereoMatch> disparities;
+	DenseStereo dense(32, 9);
+	dense.SetThreadPool(&pool);
+	dense.SetCost(DC_CENSUS5);
+	Pyramid dense_left, dense_right;
+	std::vector<short> disparity_map;
+	std::vector<float> track_disparities, prev_disparities;
+	std::vector<float> guess_x, guess_y, guess_radii;
+	Odometry odometry;
+	LocalMap local_map;
+	OdometryFilter filter;
+	PlanarMotion visual_deviation;
+	visual_deviation.forward = visual_deviation.lateral = VISUAL_DEVIATION_TRANSLATION;
+	visual_deviation.yaw = VISUAL_DEVIATION_YAW;
+	double last_visual = -1;
+	GroundPlane ground;
+	PlaneSegmentation segmentation;
+	RelativePoseEstimator relative;
+	RelativePose relative_pose;
+	std::vector<float> plane_x0, plane_y0, plane_x1, plane_y1, plane_age;
+
+	// without calibration the images are assumed to be rectified already
+	StereoCamera calibration;
+	bool rectify = (calibrationFile != NULL) && calibration.Load(calibrationFile);
+	CRawImage *rectified = new CRawImage(640,480,1);
+	if (rectify) {
+		calibration.BuildMaps(640,480);
+		stereo.SetCamera(calibration.GetFocal(), calibration.GetBaseline());
+		const CameraIntrinsics &camera = calibration.GetRectified();
+		odometry.SetCamera(camera.fx, calibration.GetBaseline(), camera.cx, camera.cy);
+		local_map.SetCamera(camera.fx, calibration.GetBaseline(), camera.cx, camera.cy);
+		ground.SetCamera(camera.fx, camera.fy, camera.cx, camera.cy);
+		ground.SetMounting(CAMERA_HEIGHT, CAMERA_PITCH);
+		segmentation.SetGroundPlane(&ground);
+		relative.SetCamera(camera.fx, camera.cx, camera.cy);
+	}
+	TrackManager tracks;
+	tracks.SetDetector(&detector);
+	filter.Reset(seconds());
+#ifdef ENABLE_WHEELS
+	// without wheels every frame is used, with them only those that keep the pose certain
+	WheelReader wheels = { wheelFile ? fopen(wheelFile, "r") : NULL, &filter };
+	pthread_t wheel_thread;
+	if (wheelFile && !wheels.file) cerr << "Couldn't open wheel file: \"" << wheelFile << '"' << endl;
+	bool wheel_reading = wheels.file && pthread_create(&wheel_thread, NULL, read_wheels, &wheels) == 0;
+#else
+	(void)wheelFile;
+#endif
 	while (true) {
 #ifdef ENABLE_CAM
 		cout << "Grab new image" << endl;
@@ -135,9 +248,40 @@ int main(int argc,char *argv[])
 		}
 #endif
 		cam->renewImage(image1);
+		double frame_time = seconds();
+
+		// when the wheels report to the filter, frames are only needed to keep the pose certain
+		if (rectify && filter.HasWheels() && !filter.NeedVisual(frame_time)) {
+			odometry.Skip();
+			continue;
+		}
 
 //		image0->saveNumberedBmp("left");
 		image0->makeMonochrome(image0gray);
+		if (rectify) {
+			calibration.Rectify(CS_LEFT, image0gray, rectified);
+			std::swap(image0gray, rectified);
+		}
+
+		// follow the features of the left image over frames, only searching around where the
+		// predicted motion puts them, from the wheels if they report to the filter
+		if (rectify && tracks.GetCount() > 0) {
+			const int n = tracks.GetCount();
+			PlanarMotion wheel_motion, wheel_deviation;
+			if (filter.HasWheels() && filter.PredictMotion(frame_time, wheel_motion, wheel_deviation)) {
+				odometry.SetWheelMotion(wheel_motion, wheel_deviation);
+			}
+			track_disparities.resize(n);
+			guess_x.resize(n); guess_y.resize(n); guess_radii.resize(n);
+			local_map.GetDisparities(tracks, &track_disparities[0]);
+			odometry.Predict(tracks.GetXs(), tracks.GetYs(), &track_disparities[0], n,
+					&guess_x[0], &guess_y[0], &guess_radii[0]);
+			tracks.Update(image0gray, &guess_x[0], &guess_y[0], &guess_radii[0]);
+		} else {
+			tracks.Update(image0gray);
+		}
+		cout << "Tracks: " << tracks.GetCount() << ", lost " << tracks.GetRetired().size() << endl;
+
 		detector.SetImage(image0gray);
 		for (unsigned int i = 0; i < corners0.size(); ++i) delete corners0[i];
 		corners0.clear();
@@ -146,43 +290,120 @@ int main(int argc,char *argv[])
 
 //		image1->saveNumberedBmp("right",false);
 		image1->makeMonochrome(image1gray);
-		image1->makeMonochrome();
-		detector.SetImage(image1);
-		for (unsigned int i = 0; i < corners1.size(); ++i) delete corners1[i];
-		corners1.clear();
-		detector.GetCorners(corners1);
+		if (rectify) {
+			calibration.Rectify(CS_RIGHT, image1gray, rectified);
+			std::swap(image1gray, rectified);
+		}
+
+		// search the corners of the left image along the same row in the right image
+		stereo.Match(ImageView(image0gray), ImageView(image1gray), corners0, disparities);
+
+		// the pose of this frame from the tracks that follow landmarks of the map
+		bool mapped = rectify && local_map.Track(tracks, image0gray);
+
+		// only keyframes need the disparities of all pixels, at half the resolution (QVGA),
+		// for the landmarks of new tracks; a frame that could not be tracked is one too
+		bool keyframe = rectify && local_map.NeedKeyframe();
+		if (keyframe) {
+			dense_left.Build(image0gray, 2);
+			dense_right.Build(image1gray, 2);
+			dense.Compute(dense_left.GetLevel(1), dense_right.GetLevel(1), disparity_map);
+			const int w = dense_left.GetLevel(1).width, h = dense_left.GetLevel(1).height;
+			const float scale = 2.0f / (1 << DISPARITY_SHIFT);
+			track_disparities.resize(tracks.GetCount());
+			for (int i = 0; i < tracks.GetCount(); ++i) {
+				int x = (int)(tracks.GetX(i) / 2), y = (int)(tracks.GetY(i) / 2);
+				short d = (x < 0 || y < 0 || x >= w || y >= h) ? DISPARITY_INVALID : disparity_map[y * w + x];
+				track_disparities[i] = (d == DISPARITY_INVALID) ? -1 : d * scale;
+			}
+		}
+
+		bool moved = false;
+		if (mapped) {
+			RelativePose step;
+			PlanarMotion motion;
+			local_map.GetMotion(step);
+			PnPEstimator::ToPlanar(step, motion);
+			odometry.Update(motion);
+			moved = true;
+		} else if (keyframe && tracks.GetCount() > 0) {
+			// without the map the tracks with a disparity in the previous and in this frame give
+			// the motion on the floor, those of the previous frame from their landmarks, as the
+			// map is still at the pose of the previous frame
+			prev_disparities.resize(tracks.GetCount());
+			local_map.GetDisparities(tracks, &prev_disparities[0]);
+			odometry.Clear();
+			for (int i = 0; i < tracks.GetCount(); ++i) {
+				if (tracks.GetLength(i) < 2) continue;
+				odometry.AddStereo(tracks.GetX(i, 1), prev_disparities[i], tracks.GetX(i),
+						track_disparities[i]);
+			}
+			moved = odometry.Update();
+		}
+		if (moved) {
+			if (last_visual >= 0) {
+				filter.AddVisual(last_visual, frame_time, odometry.GetMotion(), visual_deviation);
+			}
+			last_visual = frame_time;
+			const PlanarPose &pose = odometry.GetPose();
+			cout << "Moved " << odometry.GetMotion().forward << " forward, turned " <<
+					odometry.GetMotion().yaw << " rad, pose " << pose.x << " " << pose.z << " " <<
+					pose.yaw << endl;
+		} else {
+			// the frame was processed, so the next prediction still spans a single frame, but the
+			// next motion does not start at the last measured one and can't be fused
+			last_visual = -1;
+		}
+		if (rectify) {
+			PlanarPose fused;
+			filter.GetPose(frame_time, fused);
+			cout << "Fused pose " << fused.x << " " << fused.z << " " << fused.yaw << endl;
+		}
+
+		if (keyframe) {
+			local_map.AddKeyframe(tracks, track_disparities.empty() ? NULL : &track_disparities[0],
+					image0gray);
+			cout << "Keyframe " << local_map.GetKeyframeCount() << endl;
+		}
 
-		// stupid exhaustive enumeration over all corners (should've been organized in a spatial sense)
 		std::vector<Corner*> matches;
 		matches.clear(); // individual corners do not need to be deleted
-		for (unsigned int i = 0; i < corners0.size(); ++i) {
-			Corner *c0 = corners0[i];
-			for (unsigned int j = 0; j < corners1.size(); ++j) {
-				Corner *c1 = corners0[j];
-
-				if (abs(c0->x - c1->x) > 10) continue;
-				if (abs(c0->y - c1->y) > 10) continue;
-
-				// match corners
-				if (match(c0, c1, image0, image1)) {
-					matches.push_back(c0);
-				}
-			}
+		for (unsigned int i = 0; i < disparities.size(); ++i) {
+			if (disparities[i].valid) matches.push_back(corners0[i]);
 		}
 
 		CRawImage *match_img(image0gray);
 		detector.DrawCorners(matches, match_img);
 		match_img->saveNumberedBmp("stereo");
 
-		// now calculate features around corners to find matches...
-
-		// use corners close to each other to calculate the homography (projective mapping), there are only four
-		// correspondences required for this
+		// group the tracks into planes by the homography between the previous and this frame, the floor first
+		plane_x0.clear(); plane_y0.clear(); plane_x1.clear(); plane_y1.clear(); plane_age.clear();
+		for (int i = 0; i < tracks.GetCount(); ++i) {
+			if (tracks.GetLength(i) < 2) continue;
+			plane_x0.push_back(tracks.GetX(i, 1));
+			plane_y0.push_back(tracks.GetY(i, 1));
+			plane_x1.push_back(tracks.GetX(i));
+			plane_y1.push_back(tracks.GetY(i));
+			plane_age.push_back(tracks.GetAge(i));
+		}
+		if (!plane_x0.empty()) {
+			int planes = segmentation.Segment(&plane_x0[0], &plane_y0[0], &plane_x1[0], &plane_y1[0],
+					plane_x0.size());
+			cout << "Planes: " << planes << (segmentation.HasGround() ? " (floor found)" : "") << endl;
+
+			// without the floor the motion is not planar, use the rotation from the essential matrix,
+			// older tracks are sampled first
+			if (rectify && !segmentation.HasGround() && relative.Estimate(&plane_x0[0], &plane_y0[0],
+					&plane_x1[0], &plane_y1[0], plane_x0.size(), relative_pose, &plane_age[0])) {
+				const float *R = relative_pose.R;
+				float angle = acos(std::max(-1.0f, std::min(1.0f, (R[0] + R[4] + R[8] - 1) / 2)));
+				cout << "Rotated " << angle << " rad, moving towards " << relative_pose.t[0] << " " <<
+						relative_pose.t[1] << " " << relative_pose.t[2] << endl;
+			}
+		}
 
 		// depict this by coloring the points if they are on the same plane with the same color
 
-		// remove outliers with ransac
-
 		// ? plane expansion, use a type of region growing to expand the plane over an area as large as possible
 
 		// ? can we somehow use normal image based segmentation for this?
@@ -204,9 +425,18 @@ int main(int argc,char *argv[])
 
 	}
 
+#ifdef ENABLE_WHEELS
+	// the reader adds to the filter, so it has to stop before the filter goes out of scope
+	if (wheel_reading) {
+		pthread_cancel(wheel_thread);
+		pthread_join(wheel_thread, NULL);
+	}
+	if (wheels.file) fclose(wheels.file);
+#endif
 #ifdef ENABLE_CAM
 	delete cam;
 #endif
+	delete rectified;
 	delete image1;
 	sleep (1);
 }